@@ -0,0 +1,102 @@
+//===- AliasAnalysis.h - Polygeist alias and memory effect analysis -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Alias and memory effect queries shared by the Polygeist passes. Pointers are
+// resolved to their base object through subindex, memref2pointer,
+// pointer2memref, casts and GEPs; base objects are allocations, globals,
+// function arguments or unknown values. Results are cached until the analysis
+// is invalidated.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef POLYGEIST_ALIASANALYSIS_H
+#define POLYGEIST_ALIASANALYSIS_H
+
+#include "mlir/IR/Operation.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "mlir/Pass/AnalysisManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include <memory>
+#include <set>
+#include <string>
+
+namespace mlir {
+namespace polygeist {
+
+/// Functions which do not capture their pointer arguments.
+extern const std::set<std::string> NonCapturingFunctions;
+
+/// Memory a call may access, in terms of the call operands.
+struct CallSummary {
+  /// The callee may access memory not derived from its pointer arguments,
+  /// such as globals or memory reachable through loaded pointers.
+  bool otherMemory = false;
+  /// Whether the callee may read or write memory derived from each argument.
+  /// Arguments past the end, as passed to variadic functions, use
+  /// `variadicReads` and `variadicWrites` instead.
+  llvm::SmallVector<bool> reads, writes;
+  bool variadicReads = false, variadicWrites = false;
+
+  bool mayRead(unsigned idx) const {
+    return idx < reads.size() ? reads[idx] : variadicReads;
+  }
+  bool mayWrite(unsigned idx) const {
+    return idx < writes.size() ? writes[idx] : variadicWrites;
+  }
+};
+
+class AliasAnalysis {
+public:
+  /// Queries are answered for operations nested in `root`. Calls to functions
+  /// nested in `root` are summarized from the callee body; other calls only
+  /// use what is known about library functions, as reading the body of a
+  /// function outside of `root` would race with passes running on it.
+  explicit AliasAnalysis(Operation *root = nullptr) : root(root) {}
+
+  /// Returns the object `v` points into.
+  Value getBase(Value v);
+  /// Returns true if `v` is a stack or heap allocation.
+  bool isStackAlloca(Value v);
+  /// Returns true if the pointer `v` may escape, through a store or a call
+  /// that may capture it. If `potentialUser` is given, `seenUse` is set when
+  /// it uses `v` or a pointer derived from it.
+  bool isCaptured(Value v, Operation *potentialUser = nullptr,
+                  bool *seenUse = nullptr);
+
+  bool mayAlias(Value a, Value b);
+  bool mayAlias(MemoryEffects::EffectInstance a,
+                MemoryEffects::EffectInstance b);
+  bool mayAlias(MemoryEffects::EffectInstance a, Value b);
+
+  bool mayReadFrom(Operation *op, Value val);
+  bool mayWriteTo(Operation *op, Value val, bool ignoreBarrier = false);
+
+  /// Returns what the call `call` may access, or null if unknown.
+  const CallSummary *getCallSummary(Operation *call);
+
+  /// Drops all cached results, to be called after the IR changed.
+  void invalidate();
+
+  bool isInvalidated(const AnalysisManager::PreservedAnalyses &pa) {
+    return !pa.isPreserved<AliasAnalysis>();
+  }
+
+private:
+  const CallSummary *summarize(Operation *callee);
+
+  Operation *root;
+  llvm::DenseMap<Value, Value> bases;
+  llvm::DenseMap<Value, bool> captured;
+  llvm::DenseMap<Operation *, std::unique_ptr<CallSummary>> summaries;
+};
+
+} // namespace polygeist
+} // namespace mlir
+
+#endif // POLYGEIST_ALIASANALYSIS_H
@@ -41,6 +41,10 @@ emitIterationCounts(mlir::OpBuilder &rewriter, mlir::scf::ParallelOp op) {
   return iterationCounts;
 }
 
+/// Emit a call to `malloc` and `free` respectively, declaring them in `module`
+/// if they are missing. Declaring a symbol mutates the module, which is only
+/// safe from passes anchored on the module: function passes run concurrently
+/// and must find these declarations already in place.
 mlir::Value callMalloc(mlir::OpBuilder &builder, mlir::ModuleOp module,
                        mlir::Location loc, mlir::Value arg);
 mlir::LLVM::LLVMFuncOp GetOrCreateFreeFunction(mlir::ModuleOp module);
@@ -114,6 +118,8 @@ mlir::Value allocateTemporaryBuffer<mlir::LLVM::CallOp>(
                                            value.getLoc(), sz.getType(), iter));
   }
   auto m = val->getParentOfType<ModuleOp>();
+  // This runs from function passes, which may not add module symbols.
+  assert(m.lookupSymbol("malloc") && "malloc must be declared up front");
   return callMalloc(rewriter, m, value.getLoc(), sz);
 }
 
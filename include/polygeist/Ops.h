@@ -49,6 +49,11 @@ bool getEffectsAfter(
 bool isReadOnly(mlir::Operation *);
 bool isReadNone(mlir::Operation *);
 
+mlir::Value getBase(mlir::Value v);
+bool isStackAlloca(mlir::Value v);
+bool isCaptured(mlir::Value v, mlir::Operation *potentialUser = nullptr,
+                bool *seenuse = nullptr);
+
 bool mayReadFrom(mlir::Operation *, mlir::Value);
 bool mayWriteTo(mlir::Operation *, mlir::Value, bool ignoreBarrier = false);
 
@@ -18,11 +18,28 @@ std::unique_ptr<Pass> replaceAffineCFGPass();
 std::unique_ptr<Pass> createOpenMPOptPass();
 std::unique_ptr<Pass> createCanonicalizeForPass();
 std::unique_ptr<Pass> createRaiseSCFToAffinePass();
-std::unique_ptr<Pass> createCPUifyPass(StringRef method = "");
+std::unique_ptr<Pass> createLoopInterchangePass(unsigned cacheLineSize = 64);
+std::unique_ptr<Pass> createLoopUnswitchPass(unsigned growthBudget = 256);
+std::unique_ptr<Pass> createLoopIdiomPass();
+std::unique_ptr<Pass> createPredictiveCommoningPass(unsigned maxDistance = 4);
+std::unique_ptr<Pass>
+createNonTemporalStoresPass(unsigned llcSize = 16777216,
+                            unsigned cacheLineSize = 64);
+std::unique_ptr<Pass> createLowerComplexPass();
+std::unique_ptr<Pass> createCPUifyPass(StringRef method = "",
+                                       int64_t cacheBudget = 0,
+                                       StringRef report = "",
+                                       bool remarks = false);
 std::unique_ptr<Pass> createBarrierRemovalContinuation();
 std::unique_ptr<Pass> detectReductionPass();
+std::unique_ptr<Pass>
+createKernelRecognitionPass(StringRef library = "polygeist",
+                            unsigned minWork = 4096);
+std::unique_ptr<Pass> createSharedStagingElisionPass();
+std::unique_ptr<Pass> createCollectiveRecognitionPass();
 std::unique_ptr<Pass> createRemoveTrivialUsePass();
-std::unique_ptr<Pass> createParallelLowerPass(bool wrapParallelOps = false);
+std::unique_ptr<Pass> createParallelLowerPass(bool wrapParallelOps = false,
+                                              bool inlineAll = false);
 std::unique_ptr<Pass> createCudaRTLowerPass();
 std::unique_ptr<Pass>
 createConvertPolygeistToLLVMPass(const LowerToLLVMOptions &options,
@@ -68,6 +85,10 @@ namespace func {
 class FuncDialect;
 }
 
+namespace math {
+class MathDialect;
+}
+
 class AffineDialect;
 namespace LLVM {
 class LLVMDialect;
@@ -0,0 +1,498 @@
+//===- AliasAnalysis.cpp - Polygeist alias and memory effect analysis -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "polygeist/AliasAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/IR/FunctionInterfaces.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Interfaces/CallInterfaces.h"
+#include "polygeist/Ops.h"
+#include "llvm/ADT/StringMap.h"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace mlir {
+namespace polygeist {
+const std::set<std::string> NonCapturingFunctions = {
+    "free",           "printf",       "fprintf",       "scanf",
+    "fscanf",         "gettimeofday", "clock_gettime", "getenv",
+    "strrchr",        "strlen",       "sprintf",       "sscanf",
+    "mkdir",          "fwrite",       "fread",         "memcpy",
+    "cudaMemcpy",     "memset",       "cudaMemset",    "__isoc99_scanf",
+    "__isoc99_fscanf"};
+} // namespace polygeist
+} // namespace mlir
+
+static bool isPointerLike(Type type) {
+  return type.isa<MemRefType, LLVM::LLVMPointerType>();
+}
+
+/// Returns the memory accessed by known library functions, or null.
+static const CallSummary *getLibrarySummary(StringRef name) {
+  static const llvm::StringMap<CallSummary> summaries = [] {
+    llvm::StringMap<CallSummary> summaries;
+    auto add = [&](ArrayRef<StringRef> names, ArrayRef<bool> reads,
+                   ArrayRef<bool> writes, bool otherMemory = false) {
+      CallSummary summary;
+      summary.otherMemory = otherMemory;
+      summary.reads.assign(reads.begin(), reads.end());
+      summary.writes.assign(writes.begin(), writes.end());
+      for (StringRef name : names)
+        summaries[name] = summary;
+    };
+    add({"memcpy", "memmove", "cudaMemcpy"}, {false, true, false},
+        {true, false, false});
+    add({"memset", "cudaMemset"}, {false, false, false}, {true, false, false});
+    add({"free"}, {false}, {true});
+    add({"strlen"}, {true}, {false});
+    add({"__polygeist_simd"}, {false, false}, {false, false});
+    add({"tanh", "tanhf", "fabs", "fabsf", "floor", "floorf", "ceil",
+         "ceilf"},
+        {}, {});
+    // These may set errno on failure, or for domain and range errors, which
+    // is memory none of their arguments point to.
+    add({"gettimeofday"}, {false, false}, {true, true}, /*otherMemory*/ true);
+    add({"clock_gettime"}, {false, false}, {false, true},
+        /*otherMemory*/ true);
+    add({"sqrt", "sqrtf", "exp", "expf", "log", "logf", "sin", "sinf", "cos",
+         "cosf", "pow", "powf"},
+        {}, {}, /*otherMemory*/ true);
+    return summaries;
+  }();
+  auto found = summaries.find(name);
+  if (found == summaries.end())
+    return nullptr;
+  return &found->second;
+}
+
+Value AliasAnalysis::getBase(Value v) {
+  auto found = bases.find(v);
+  if (found != bases.end())
+    return found->second;
+  Value orig = v;
+  while (true) {
+    if (auto s = v.getDefiningOp<SubIndexOp>()) {
+      v = s.getSource();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<Memref2PointerOp>()) {
+      v = s.getSource();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<Pointer2MemrefOp>()) {
+      v = s.getSource();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<LLVM::GEPOp>()) {
+      v = s.getBase();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<LLVM::BitcastOp>()) {
+      v = s.getArg();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<LLVM::AddrSpaceCastOp>()) {
+      v = s.getArg();
+      continue;
+    }
+    if (auto s = v.getDefiningOp<memref::CastOp>()) {
+      v = s.getSource();
+      continue;
+    }
+    break;
+  }
+  bases[orig] = v;
+  return v;
+}
+
+bool AliasAnalysis::isStackAlloca(Value v) {
+  return v.getDefiningOp<memref::AllocaOp>() ||
+         v.getDefiningOp<memref::AllocOp>() ||
+         v.getDefiningOp<LLVM::AllocaOp>();
+}
+
+bool AliasAnalysis::isCaptured(Value v, Operation *potentialUser,
+                               bool *seenUse) {
+  if (!seenUse) {
+    auto found = captured.find(v);
+    if (found != captured.end())
+      return found->second;
+  }
+  Value orig = v;
+  bool result = false;
+  SmallVector<Value> todo = {v};
+  while (todo.size() && !result) {
+    Value v = todo.pop_back_val();
+    for (auto u : v.getUsers()) {
+      if (seenUse && u == potentialUser)
+        *seenUse = true;
+      if (isa<memref::LoadOp, LLVM::LoadOp, AffineLoadOp, polygeist::CacheLoad>(
+              u))
+        continue;
+      if (auto s = dyn_cast<memref::StoreOp>(u)) {
+        if (s.getValue() == v) {
+          result = true;
+          break;
+        }
+        continue;
+      }
+      if (auto s = dyn_cast<AffineStoreOp>(u)) {
+        if (s.getValue() == v) {
+          result = true;
+          break;
+        }
+        continue;
+      }
+      if (auto s = dyn_cast<LLVM::StoreOp>(u)) {
+        if (s.getValue() == v) {
+          result = true;
+          break;
+        }
+        continue;
+      }
+      if (isa<LLVM::GEPOp, LLVM::BitcastOp, LLVM::AddrSpaceCastOp,
+              memref::CastOp, polygeist::SubIndexOp,
+              polygeist::Memref2PointerOp, polygeist::Pointer2MemrefOp>(u)) {
+        todo.push_back(u->getResult(0));
+        continue;
+      }
+      if (isa<func::ReturnOp, LLVM::MemsetOp, LLVM::MemcpyOp, LLVM::MemmoveOp,
+              memref::DeallocOp>(u))
+        continue;
+      if (auto cop = dyn_cast<LLVM::CallOp>(u)) {
+        if (auto callee = cop.getCallee()) {
+          if (NonCapturingFunctions.count(callee->str()))
+            continue;
+        }
+      }
+      if (auto cop = dyn_cast<func::CallOp>(u)) {
+        if (NonCapturingFunctions.count(cop.getCallee().str()))
+          continue;
+      }
+      result = true;
+      break;
+    }
+  }
+  // A partial walk may have missed the use by potentialUser.
+  if (!seenUse)
+    captured[orig] = result;
+  return result;
+}
+
+bool AliasAnalysis::mayAlias(Value v, Value v2) {
+  v = getBase(v);
+  v2 = getBase(v2);
+  if (v == v2)
+    return true;
+
+  // We may now assume neither v1 nor v2 are subindices
+
+  if (auto glob = v.getDefiningOp<memref::GetGlobalOp>()) {
+    if (auto Aglob = v2.getDefiningOp<memref::GetGlobalOp>()) {
+      return glob.getName() == Aglob.getName();
+    }
+  }
+
+  if (auto glob = v.getDefiningOp<LLVM::AddressOfOp>()) {
+    if (auto Aglob = v2.getDefiningOp<LLVM::AddressOfOp>()) {
+      return glob.getGlobalName() == Aglob.getGlobalName();
+    }
+  }
+
+  bool isAlloca[2];
+  bool isGlobal[2];
+
+  isAlloca[0] = isStackAlloca(v);
+  isGlobal[0] = v.getDefiningOp<memref::GetGlobalOp>() ||
+                v.getDefiningOp<LLVM::AddressOfOp>();
+
+  isAlloca[1] = isStackAlloca(v2);
+
+  isGlobal[1] = v2.getDefiningOp<memref::GetGlobalOp>() ||
+                v2.getDefiningOp<LLVM::AddressOfOp>();
+
+  // Non-equivalent allocas/global's cannot conflict with each other
+  if ((isAlloca[0] || isGlobal[0]) && (isAlloca[1] || isGlobal[1]))
+    return false;
+
+  bool isArg[2];
+  isArg[0] = v.isa<BlockArgument>() &&
+             isa<FunctionOpInterface>(
+                 v.cast<BlockArgument>().getOwner()->getParentOp());
+
+  isArg[1] = v2.isa<BlockArgument>() &&
+             isa<FunctionOpInterface>(
+                 v2.cast<BlockArgument>().getOwner()->getParentOp());
+
+  // Stack allocations cannot have been passed as an argument.
+  if ((isAlloca[0] && isArg[1]) || (isAlloca[1] && isArg[0]))
+    return false;
+
+  // Non captured base allocas cannot conflict with another base value.
+  if (isAlloca[0] && !isCaptured(v))
+    return false;
+
+  if (isAlloca[1] && !isCaptured(v2))
+    return false;
+
+  return true;
+}
+
+bool AliasAnalysis::mayAlias(MemoryEffects::EffectInstance a,
+                             MemoryEffects::EffectInstance b) {
+  if (Value v2 = b.getValue()) {
+    return mayAlias(a, v2);
+  } else if (Value v = a.getValue()) {
+    return mayAlias(b, v);
+  }
+  return true;
+}
+
+bool AliasAnalysis::mayAlias(MemoryEffects::EffectInstance a, Value v2) {
+  if (Value v = a.getValue()) {
+    return mayAlias(v, v2);
+  }
+  return true;
+}
+
+const CallSummary *AliasAnalysis::getCallSummary(Operation *call) {
+  auto callOp = dyn_cast<CallOpInterface>(call);
+  if (!callOp)
+    return nullptr;
+  auto symRef = callOp.getCallableForCallee().dyn_cast<SymbolRefAttr>();
+  if (!symRef)
+    return nullptr;
+  if (const CallSummary *summary =
+          getLibrarySummary(symRef.getLeafReference().getValue()))
+    return summary;
+  if (!root)
+    return nullptr;
+  Operation *callee = SymbolTable::lookupNearestSymbolFrom(call, symRef);
+  if (!callee || !root->isProperAncestor(callee))
+    return nullptr;
+  return summarize(callee);
+}
+
+const CallSummary *AliasAnalysis::summarize(Operation *callee) {
+  auto found = summaries.find(callee);
+  if (found != summaries.end())
+    return found->second.get();
+
+  auto F = dyn_cast<FunctionOpInterface>(callee);
+  if (!F || F.isExternal()) {
+    summaries[callee] = nullptr;
+    return nullptr;
+  }
+
+  // Recursive calls see a summary that may access anything until this one is
+  // complete.
+  auto inProgress = std::make_unique<CallSummary>();
+  inProgress->otherMemory = true;
+  CallSummary *summary = inProgress.get();
+  summaries[callee] = std::move(inProgress);
+
+  CallSummary result;
+  result.reads.resize(F.getNumArguments());
+  result.writes.resize(F.getNumArguments());
+  Block *entry = &F.getFunctionBody().front();
+  auto record = [&](Value ptr, bool read, bool write) {
+    Value base = getBase(ptr);
+    if (auto arg = base.dyn_cast<BlockArgument>()) {
+      if (arg.getOwner() == entry) {
+        result.reads[arg.getArgNumber()] |= read;
+        result.writes[arg.getArgNumber()] |= write;
+        return;
+      }
+    }
+    // Allocations of the callee are not visible to the caller.
+    if (isStackAlloca(base) && callee->isProperAncestor(base.getDefiningOp()))
+      return;
+    result.otherMemory = true;
+  };
+
+  F->walk([&](Operation *op) {
+    if (op == callee || result.otherMemory ||
+        op->hasTrait<OpTrait::HasRecursiveMemoryEffects>())
+      return;
+    if (auto call = dyn_cast<CallOpInterface>(op)) {
+      const CallSummary *inner = getCallSummary(op);
+      if (!inner || inner->otherMemory) {
+        result.otherMemory = true;
+        return;
+      }
+      for (auto en : llvm::enumerate(call.getArgOperands())) {
+        bool read = inner->mayRead(en.index());
+        bool write = inner->mayWrite(en.index());
+        if ((read || write) && isPointerLike(en.value().getType()))
+          record(en.value(), read, write);
+      }
+      return;
+    }
+    auto effectInterface = dyn_cast<MemoryEffectOpInterface>(op);
+    if (!effectInterface) {
+      result.otherMemory = true;
+      return;
+    }
+    SmallVector<MemoryEffects::EffectInstance> effects;
+    effectInterface.getEffects(effects);
+    for (auto it : effects) {
+      bool read = isa<MemoryEffects::Read>(it.getEffect());
+      bool write = isa<MemoryEffects::Write, MemoryEffects::Free>(
+          it.getEffect());
+      if (!read && !write)
+        continue;
+      if (Value v = it.getValue())
+        record(v, read, write);
+      else
+        result.otherMemory = true;
+    }
+  });
+
+  *summary = std::move(result);
+  return summary;
+}
+
+bool AliasAnalysis::mayReadFrom(Operation *op, Value val) {
+  bool hasRecursiveEffects = op->hasTrait<OpTrait::HasRecursiveMemoryEffects>();
+  if (hasRecursiveEffects) {
+    for (Region &region : op->getRegions()) {
+      for (auto &block : region) {
+        for (auto &nestedOp : block)
+          if (mayReadFrom(&nestedOp, val))
+            return true;
+      }
+    }
+    return false;
+  }
+
+  // If the op has memory effects, try to characterize them to see if the op
+  // is trivially dead here.
+  if (auto effectInterface = dyn_cast<MemoryEffectOpInterface>(op)) {
+    // Check to see if this op either has no effects, or only allocates/reads
+    // memory.
+    SmallVector<MemoryEffects::EffectInstance, 1> effects;
+    effectInterface.getEffects(effects);
+    for (auto it : effects) {
+      if (!isa<MemoryEffects::Read>(it.getEffect()))
+        continue;
+      if (mayAlias(it, val))
+        return true;
+    }
+    return false;
+  }
+  if (isa<LLVM::CallOp, func::CallOp>(op)) {
+    auto base = getBase(val);
+    bool seenuse = false;
+    if (isStackAlloca(base) && !isCaptured(base, op, &seenuse) && !seenuse) {
+      return false;
+    }
+    if (const CallSummary *summary = getCallSummary(op)) {
+      if (summary->otherMemory)
+        return true;
+      for (auto en :
+           llvm::enumerate(cast<CallOpInterface>(op).getArgOperands()))
+        if (summary->mayRead(en.index()) &&
+            isPointerLike(en.value().getType()) && mayAlias(en.value(), val))
+          return true;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AliasAnalysis::mayWriteTo(Operation *op, Value val, bool ignoreBarrier) {
+  bool hasRecursiveEffects = op->hasTrait<OpTrait::HasRecursiveMemoryEffects>();
+  if (hasRecursiveEffects) {
+    for (Region &region : op->getRegions()) {
+      for (auto &block : region) {
+        for (auto &nestedOp : block)
+          if (mayWriteTo(&nestedOp, val, ignoreBarrier))
+            return true;
+      }
+    }
+    return false;
+  }
+
+  if (ignoreBarrier && isa<polygeist::BarrierOp>(op))
+    return false;
+
+  // If the op has memory effects, try to characterize them to see if the op
+  // is trivially dead here.
+  if (auto effectInterface = dyn_cast<MemoryEffectOpInterface>(op)) {
+    // Check to see if this op either has no effects, or only allocates/reads
+    // memory.
+    SmallVector<MemoryEffects::EffectInstance, 1> effects;
+    effectInterface.getEffects(effects);
+    for (auto it : effects) {
+      if (!isa<MemoryEffects::Write>(it.getEffect()))
+        continue;
+      if (mayAlias(it, val))
+        return true;
+    }
+    return false;
+  }
+
+  // Calls which do not use a derived pointer of a known alloca, which is not
+  // captured can not write to said memory.
+  if (isa<LLVM::CallOp, func::CallOp>(op)) {
+    auto base = getBase(val);
+    bool seenuse = false;
+    if (isStackAlloca(base) && !isCaptured(base, op, &seenuse) && !seenuse) {
+      return false;
+    }
+    if (const CallSummary *summary = getCallSummary(op)) {
+      if (summary->otherMemory)
+        return true;
+      for (auto en :
+           llvm::enumerate(cast<CallOpInterface>(op).getArgOperands()))
+        if (summary->mayWrite(en.index()) &&
+            isPointerLike(en.value().getType()) && mayAlias(en.value(), val))
+          return true;
+      return false;
+    }
+  }
+  return true;
+}
+
+void AliasAnalysis::invalidate() {
+  bases.clear();
+  captured.clear();
+  summaries.clear();
+}
+
+// Uncached entry points, for canonicalization patterns which cannot keep an
+// analysis across rewrites.
+
+Value getBase(Value v) { return AliasAnalysis().getBase(v); }
+
+bool isStackAlloca(Value v) { return AliasAnalysis().isStackAlloca(v); }
+
+bool isCaptured(Value v, Operation *potentialUser, bool *seenuse) {
+  return AliasAnalysis().isCaptured(v, potentialUser, seenuse);
+}
+
+bool mayAlias(MemoryEffects::EffectInstance a,
+              MemoryEffects::EffectInstance b) {
+  return AliasAnalysis().mayAlias(a, b);
+}
+
+bool mayAlias(MemoryEffects::EffectInstance a, Value v2) {
+  return AliasAnalysis().mayAlias(a, v2);
+}
+
+bool mayReadFrom(Operation *op, Value val) {
+  return AliasAnalysis().mayReadFrom(op, val);
+}
+
+bool mayWriteTo(Operation *op, Value val, bool ignoreBarrier) {
+  return AliasAnalysis().mayWriteTo(op, val, ignoreBarrier);
+}
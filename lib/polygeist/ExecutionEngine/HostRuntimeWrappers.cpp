@@ -0,0 +1,187 @@
+//===- HostRuntimeWrappers.cpp - GPU runtime stub for hosts without GPUs --===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Implements the mgpu* functions that the GPU lowering of cgeist calls without
+// a GPU, so that the host side of CUDA programs, in particular the ordering of
+// streams and events, can be run and checked anywhere:
+//
+//  * kernels are not run, their launches are only recorded on the stream,
+//  * memory is allocated on the host,
+//  * waiting for an event which was never recorded, and any use of a destroyed
+//    stream or event, is reported and aborts.
+//
+// With POLYGEIST_HOST_RUNTIME_TRACE set, every call is printed to stderr.
+//
+//===----------------------------------------------------------------------===//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define POLYGEIST_HOST_RUNTIME_EXPORT __declspec(dllexport)
+#else
+#define POLYGEIST_HOST_RUNTIME_EXPORT
+#endif // _WIN32
+
+namespace {
+/// A stream, which counts the operations enqueued on it.
+struct Stream {
+  int id;
+  int64_t queued;
+  bool destroyed;
+};
+
+/// An event, which remembers the position in the stream it was recorded at.
+struct Event {
+  int id;
+  Stream *stream;
+  int64_t position;
+  bool destroyed;
+};
+
+int numStreams = 0;
+int numEvents = 0;
+} // namespace
+
+static bool isTracing() {
+  static bool tracing = getenv("POLYGEIST_HOST_RUNTIME_TRACE") != nullptr;
+  return tracing;
+}
+
+static void fail(const char *what, const char *name, int id) {
+  fprintf(stderr, "polygeist host runtime: %s %s %d\n", what, name, id);
+  abort();
+}
+
+static Stream *checkStream(void *ptr, const char *what) {
+  Stream *stream = (Stream *)ptr;
+  if (stream && stream->destroyed)
+    fail(what, "destroyed stream", stream->id);
+  return stream;
+}
+
+static Event *checkEvent(void *ptr, const char *what) {
+  Event *event = (Event *)ptr;
+  if (!event)
+    fail(what, "null event", -1);
+  if (event->destroyed)
+    fail(what, "destroyed event", event->id);
+  return event;
+}
+
+/// Returns the id to print for `stream`, where the null stream is 0.
+static int getId(Stream *stream) { return stream ? stream->id : 0; }
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void *mgpuStreamCreate() {
+  Stream *stream = new Stream{++numStreams, 0, false};
+  if (isTracing())
+    fprintf(stderr, "stream create %d\n", stream->id);
+  return stream;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuStreamDestroy(void *ptr) {
+  Stream *stream = checkStream(ptr, "destroy of");
+  if (isTracing())
+    fprintf(stderr, "stream destroy %d\n", getId(stream));
+  // Streams are kept to report uses after their destruction.
+  if (stream)
+    stream->destroyed = true;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void
+mgpuStreamSynchronize(void *ptr) {
+  Stream *stream = checkStream(ptr, "synchronize of");
+  if (isTracing())
+    fprintf(stderr, "stream synchronize %d\n", getId(stream));
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuStreamWaitEvent(void *ptr,
+                                                                  void *e) {
+  Stream *stream = checkStream(ptr, "wait on");
+  Event *event = checkEvent(e, "wait for");
+  if (event->position < 0)
+    fail("wait for", "unrecorded event", event->id);
+  if (isTracing())
+    fprintf(stderr, "stream %d wait event %d\n", getId(stream), event->id);
+  if (stream)
+    stream->queued++;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void *mgpuEventCreate() {
+  Event *event = new Event{++numEvents, nullptr, -1, false};
+  if (isTracing())
+    fprintf(stderr, "event create %d\n", event->id);
+  return event;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuEventDestroy(void *e) {
+  Event *event = checkEvent(e, "destroy of");
+  if (isTracing())
+    fprintf(stderr, "event destroy %d\n", event->id);
+  event->destroyed = true;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuEventRecord(void *e,
+                                                              void *ptr) {
+  Event *event = checkEvent(e, "record of");
+  Stream *stream = checkStream(ptr, "record on");
+  event->stream = stream;
+  event->position = stream ? stream->queued : 0;
+  if (isTracing())
+    fprintf(stderr, "event record %d stream %d\n", event->id, getId(stream));
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuEventSynchronize(void *e) {
+  Event *event = checkEvent(e, "synchronize of");
+  if (isTracing())
+    fprintf(stderr, "event synchronize %d\n", event->id);
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void *mgpuModuleLoad(void *data) {
+  return data;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuModuleUnload(void *module) {}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void *
+mgpuModuleGetFunction(void *module, const char *name) {
+  return (void *)name;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT int32_t mgpuLaunchKernelErr(
+    void *function, intptr_t gridX, intptr_t gridY, intptr_t gridZ,
+    intptr_t blockX, intptr_t blockY, intptr_t blockZ, int32_t smem,
+    void *ptr, void **params, void **extra) {
+  Stream *stream = checkStream(ptr, "launch on");
+  if (isTracing())
+    fprintf(stderr, "launch %s stream %d\n", (const char *)function,
+            getId(stream));
+  if (stream)
+    stream->queued++;
+  return 0;
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void
+mgpuLaunchKernel(void *function, intptr_t gridX, intptr_t gridY,
+                 intptr_t gridZ, intptr_t blockX, intptr_t blockY,
+                 intptr_t blockZ, int32_t smem, void *ptr, void **params,
+                 void **extra) {
+  mgpuLaunchKernelErr(function, gridX, gridY, gridZ, blockX, blockY, blockZ,
+                      smem, ptr, params, extra);
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void *mgpuMemAlloc(uint64_t size,
+                                                           void *ptr) {
+  return malloc(size);
+}
+
+extern "C" POLYGEIST_HOST_RUNTIME_EXPORT void mgpuMemFree(void *mem,
+                                                         void *ptr) {
+  free(mem);
+}
@@ -0,0 +1,326 @@
+//===- PolygeistAllocator.cpp - Huge page allocator for cgeist programs ---===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Implements the allocator that programs built with -polygeist-allocator=
+// hugepage call instead of malloc, calloc, aligned_alloc, realloc and free:
+//
+//  * every allocation is aligned to a 64 byte cache line,
+//  * allocations of at least a huge page are rounded up to whole huge pages
+//    and mapped with explicit huge pages when the system reserved some, or
+//    aligned to a huge page and advised to use transparent huge pages,
+//  * freed huge page mappings are kept, up to POLYGEIST_ALLOCATOR_CACHE bytes
+//    (1 GiB by default), and handed out again to allocations of the same
+//    rounded size, as repeated kernel launches allocate the same buffers.
+//
+// Smaller allocations come from the C library, so pointers allocated by code
+// built without the allocator, e.g. by strdup, can still be freed through it.
+// The converse does not hold: huge page allocations are not known to the C
+// library and must not be passed to its free or realloc, e.g. by a library
+// which takes ownership of a buffer.
+//
+// The library only depends on the C runtime so that cgeist can link it into
+// C programs.
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <sys/mman.h>
+#endif // _WIN32
+
+#ifdef _WIN32
+#define POLYGEIST_ALLOCATOR_EXPORT __declspec(dllexport)
+#else
+#define POLYGEIST_ALLOCATOR_EXPORT
+#endif // _WIN32
+
+namespace {
+constexpr size_t alignment = 64;
+constexpr size_t hugePageSize = 2 << 20;
+constexpr size_t defaultCacheBytes = size_t(1) << 30;
+constexpr unsigned spinsBeforeYield = 64;
+
+/// A huge page mapping, either live or kept for reuse.
+struct Mapping {
+  void *ptr;
+  size_t size;
+  Mapping *next;
+};
+
+std::atomic_flag lock = ATOMIC_FLAG_INIT;
+Mapping *live = nullptr;
+Mapping *cached = nullptr;
+size_t cachedBytes = 0;
+
+/// Tells the core that the thread is spinning, so that a sibling hyperthread
+/// holding the lock is not starved.
+inline void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+struct Guard {
+  Guard() {
+    // The lock is only held for a few list operations, so spin briefly and
+    // then give up the core to a holder that may have been preempted.
+    for (unsigned spins = 0; lock.test_and_set(std::memory_order_acquire);
+         ++spins) {
+      if (spins < spinsBeforeYield) {
+        pause();
+        continue;
+      }
+#ifndef _WIN32
+      sched_yield();
+#endif // _WIN32
+    }
+  }
+  ~Guard() { lock.clear(std::memory_order_release); }
+};
+} // namespace
+
+/// Returns the bytes of mappings to keep for reuse. Called with the lock held.
+static size_t getCacheLimit() {
+  static bool initialized = false;
+  static size_t limit;
+  if (!initialized) {
+    const char *env = getenv("POLYGEIST_ALLOCATOR_CACHE");
+    limit = env ? (size_t)strtoull(env, nullptr, 10) : defaultCacheBytes;
+    initialized = true;
+  }
+  return limit;
+}
+
+/// Removes the mapping of `ptr` from `list` and returns it, or null if there
+/// is none.
+static Mapping *take(Mapping *&list, void *ptr) {
+  for (Mapping **cur = &list; *cur; cur = &(*cur)->next) {
+    if ((*cur)->ptr != ptr)
+      continue;
+    Mapping *found = *cur;
+    *cur = found->next;
+    return found;
+  }
+  return nullptr;
+}
+
+/// Removes a mapping of `size` bytes from `list` and returns it, or null if
+/// there is none.
+static Mapping *takeSize(Mapping *&list, size_t size) {
+  for (Mapping **cur = &list; *cur; cur = &(*cur)->next) {
+    if ((*cur)->size != size)
+      continue;
+    Mapping *found = *cur;
+    *cur = found->next;
+    return found;
+  }
+  return nullptr;
+}
+
+#ifndef _WIN32
+/// Maps `size` bytes, a multiple of the huge page size, with huge pages.
+static void *mapHugePages(size_t size) {
+#ifdef MAP_HUGETLB
+  void *explicitPages =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (explicitPages != MAP_FAILED)
+    return explicitPages;
+#endif // MAP_HUGETLB
+
+  // Without reserved huge pages, align the mapping to a huge page so that
+  // the kernel can back all of it with transparent huge pages.
+  size_t length = size + hugePageSize;
+  void *raw = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED)
+    return nullptr;
+  uintptr_t begin = (uintptr_t)raw;
+  uintptr_t aligned = (begin + hugePageSize - 1) & ~(hugePageSize - 1);
+  if (aligned != begin)
+    munmap(raw, aligned - begin);
+  if (begin + length != aligned + size)
+    munmap((void *)(aligned + size), begin + length - (aligned + size));
+#ifdef MADV_HUGEPAGE
+  madvise((void *)aligned, size, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+  return (void *)aligned;
+}
+#endif // _WIN32
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_malloc(size_t size);
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_calloc(size_t count,
+                                                             size_t size);
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *
+polygeist_aligned_alloc(size_t align, size_t size);
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void polygeist_free(void *ptr);
+
+#ifdef _WIN32
+// Memory from _aligned_malloc cannot be released with free, so only the C
+// library allocator is used.
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_malloc(size_t size) {
+  return malloc(size);
+}
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_calloc(size_t count,
+                                                             size_t size) {
+  return calloc(count, size);
+}
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *
+polygeist_aligned_alloc(size_t align, size_t size) {
+  // Only the alignment malloc guarantees can be released with free.
+  return align <= alignof(max_align_t) ? malloc(size) : nullptr;
+}
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void polygeist_free(void *ptr) {
+  free(ptr);
+}
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_realloc(void *ptr,
+                                                              size_t size) {
+  return realloc(ptr, size);
+}
+#else
+/// Allocates a mapping of at least `size` bytes, a huge page or more, and sets
+/// `fresh` if it was newly mapped rather than reused, i.e. zero filled.
+static void *allocateMapping(size_t size, bool &fresh) {
+  size = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+  {
+    Guard guard;
+    if (Mapping *reused = takeSize(cached, size)) {
+      cachedBytes -= size;
+      reused->next = live;
+      live = reused;
+      fresh = false;
+      return reused->ptr;
+    }
+  }
+
+  Mapping *mapping = (Mapping *)malloc(sizeof(Mapping));
+  if (!mapping)
+    return nullptr;
+  mapping->ptr = mapHugePages(size);
+  if (!mapping->ptr) {
+    free(mapping);
+    return nullptr;
+  }
+  mapping->size = size;
+  fresh = true;
+  Guard guard;
+  mapping->next = live;
+  live = mapping;
+  return mapping->ptr;
+}
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_malloc(size_t size) {
+  if (size < hugePageSize) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size ? size : 1))
+      return nullptr;
+    return ptr;
+  }
+  bool fresh;
+  return allocateMapping(size, fresh);
+}
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_calloc(size_t count,
+                                                             size_t size) {
+  if (size && count > SIZE_MAX / size)
+    return nullptr;
+  size *= count;
+  if (size < hugePageSize) {
+    void *ptr = polygeist_malloc(size);
+    if (ptr)
+      memset(ptr, 0, size);
+    return ptr;
+  }
+  // Fresh mappings are already zero, so only reused ones are cleared and the
+  // pages of large buffers are not touched ahead of their first use.
+  bool fresh;
+  void *ptr = allocateMapping(size, fresh);
+  if (ptr && !fresh)
+    memset(ptr, 0, size);
+  return ptr;
+}
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *
+polygeist_aligned_alloc(size_t align, size_t size) {
+  // Every allocation is cache line aligned and mappings are huge page
+  // aligned, so only larger alignments need the C library.
+  if (align <= alignment || (size >= hugePageSize && align <= hugePageSize))
+    return polygeist_malloc(size);
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, align, size ? size : 1))
+    return nullptr;
+  return ptr;
+}
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void polygeist_free(void *ptr) {
+  if (!ptr)
+    return;
+  Mapping *mapping;
+  {
+    Guard guard;
+    mapping = take(live, ptr);
+    if (mapping && cachedBytes + mapping->size <= getCacheLimit()) {
+      cachedBytes += mapping->size;
+      mapping->next = cached;
+      cached = mapping;
+      return;
+    }
+  }
+  if (!mapping) {
+    free(ptr);
+    return;
+  }
+  munmap(mapping->ptr, mapping->size);
+  free(mapping);
+}
+
+extern "C" POLYGEIST_ALLOCATOR_EXPORT void *polygeist_realloc(void *ptr,
+                                                              size_t size) {
+  if (!ptr)
+    return polygeist_malloc(size);
+
+  size_t oldSize = 0;
+  {
+    Guard guard;
+    for (Mapping *cur = live; cur; cur = cur->next)
+      if (cur->ptr == ptr)
+        oldSize = cur->size;
+  }
+
+  if (!oldSize) {
+    // The C library keeps the contents but not the alignment, and small
+    // allocations may grow past a huge page.
+    void *moved = realloc(ptr, size);
+    if (!moved || (size < hugePageSize && (uintptr_t)moved % alignment == 0))
+      return moved;
+    void *copy = polygeist_malloc(size);
+    if (!copy)
+      return moved;
+    memcpy(copy, moved, size);
+    free(moved);
+    return copy;
+  }
+
+  if (size <= oldSize && size > oldSize - hugePageSize)
+    return ptr;
+  void *copy = polygeist_malloc(size);
+  if (!copy)
+    return nullptr;
+  memcpy(copy, ptr, size < oldSize ? size : oldSize);
+  polygeist_free(ptr);
+  return copy;
+}
+#endif // _WIN32
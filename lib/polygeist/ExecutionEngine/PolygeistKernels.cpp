@@ -0,0 +1,248 @@
+//===- PolygeistKernels.cpp - Kernels for the recognize-kernels pass ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Implements the kernels that the recognize-kernels pass dispatches dense
+// loop nests to. All matrices are row-major with an explicit leading
+// dimension.
+//
+// Matrix multiplication follows the usual BLIS structure: blocks of the
+// operands are packed into contiguous panels sized for the caches, and an
+// MR x NR register-blocked microkernel, written so that the compiler
+// vectorizes it, computes each tile of C.
+//
+// The library only depends on the C runtime so that cgeist can link it into
+// C programs.
+//
+//===----------------------------------------------------------------------===//
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define POLYGEIST_KERNELS_EXPORT __declspec(dllexport)
+#else
+#define POLYGEIST_KERNELS_EXPORT
+#endif // _WIN32
+
+namespace {
+template <typename T> struct Blocking;
+
+// The MR x NR accumulator tile fits in eight 256-bit registers, KC x NR panels
+// of B stay in L1, MC x KC blocks of A in L2 and KC x NC blocks of B in L3.
+template <> struct Blocking<double> {
+  static constexpr int64_t MR = 4, NR = 8, MC = 96, KC = 256, NC = 2048;
+};
+template <> struct Blocking<float> {
+  static constexpr int64_t MR = 8, NR = 8, MC = 128, KC = 256, NC = 2048;
+};
+} // namespace
+
+static inline int64_t min(int64_t a, int64_t b) { return a < b ? a : b; }
+
+/// C = beta * C, without reading C when beta is zero.
+template <typename T>
+static void scale(int64_t M, int64_t N, T beta, T *C, int64_t ldc) {
+  if (beta == T(1))
+    return;
+  for (int64_t i = 0; i < M; i++)
+    for (int64_t j = 0; j < N; j++)
+      C[i * ldc + j] = beta == T(0) ? T(0) : beta * C[i * ldc + j];
+}
+
+/// Pack the mc x kc block of op(A) at (ic, pc) into row panels of MR rows,
+/// each stored column by column and padded with zeros.
+template <typename T>
+static void packA(bool trans, const T *A, int64_t lda, int64_t ic, int64_t pc,
+                  int64_t mc, int64_t kc, T *Ap) {
+  constexpr int64_t MR = Blocking<T>::MR;
+  for (int64_t ir = 0; ir < mc; ir += MR) {
+    int64_t mr = min(MR, mc - ir);
+    for (int64_t p = 0; p < kc; p++) {
+      for (int64_t i = 0; i < mr; i++) {
+        int64_t row = ic + ir + i, col = pc + p;
+        *Ap++ = trans ? A[col * lda + row] : A[row * lda + col];
+      }
+      for (int64_t i = mr; i < MR; i++)
+        *Ap++ = T(0);
+    }
+  }
+}
+
+/// Pack the kc x nc block of op(B) at (pc, jc) into column panels of NR
+/// columns, each stored row by row and padded with zeros.
+template <typename T>
+static void packB(bool trans, const T *B, int64_t ldb, int64_t pc, int64_t jc,
+                  int64_t kc, int64_t nc, T *Bp) {
+  constexpr int64_t NR = Blocking<T>::NR;
+  for (int64_t jr = 0; jr < nc; jr += NR) {
+    int64_t nr = min(NR, nc - jr);
+    for (int64_t p = 0; p < kc; p++) {
+      for (int64_t j = 0; j < nr; j++) {
+        int64_t row = pc + p, col = jc + jr + j;
+        *Bp++ = trans ? B[col * ldb + row] : B[row * ldb + col];
+      }
+      for (int64_t j = nr; j < NR; j++)
+        *Bp++ = T(0);
+    }
+  }
+}
+
+/// C[0:mr, 0:nr] = beta * C + alpha * a * b for one MR x kc panel of A and one
+/// kc x NR panel of B.
+template <typename T>
+static void microkernel(int64_t kc, const T *__restrict a,
+                        const T *__restrict b, T alpha, T beta, T *C,
+                        int64_t ldc, int64_t mr, int64_t nr) {
+  constexpr int64_t MR = Blocking<T>::MR, NR = Blocking<T>::NR;
+  T ab[MR][NR] = {};
+  for (int64_t p = 0; p < kc; p++)
+    for (int64_t i = 0; i < MR; i++)
+      for (int64_t j = 0; j < NR; j++)
+        ab[i][j] += a[p * MR + i] * b[p * NR + j];
+  for (int64_t i = 0; i < mr; i++)
+    for (int64_t j = 0; j < nr; j++) {
+      T &c = C[i * ldc + j];
+      c = (beta == T(0) ? T(0) : beta * c) + alpha * ab[i][j];
+    }
+}
+
+/// C = alpha * op(A) * op(B) + beta * C, with op(A) M x K and op(B) K x N.
+template <typename T>
+static void gemm(bool transA, bool transB, int64_t M, int64_t N, int64_t K,
+                 T alpha, const T *A, int64_t lda, const T *B, int64_t ldb,
+                 T beta, T *C, int64_t ldc) {
+  using B_ = Blocking<T>;
+  if (M <= 0 || N <= 0)
+    return;
+  if (K <= 0 || alpha == T(0)) {
+    scale(M, N, beta, C, ldc);
+    return;
+  }
+
+  int64_t kcMax = min(B_::KC, K);
+  int64_t ncMax = (min(B_::NC, N) + B_::NR - 1) / B_::NR * B_::NR;
+  int64_t mcMax = (min(B_::MC, M) + B_::MR - 1) / B_::MR * B_::MR;
+  T *Ap = (T *)malloc(sizeof(T) * mcMax * kcMax);
+  T *Bp = (T *)malloc(sizeof(T) * kcMax * ncMax);
+
+  for (int64_t jc = 0; jc < N; jc += B_::NC) {
+    int64_t nc = min(B_::NC, N - jc);
+    for (int64_t pc = 0; pc < K; pc += B_::KC) {
+      int64_t kc = min(B_::KC, K - pc);
+      packB(transB, B, ldb, pc, jc, kc, nc, Bp);
+      // Only the first block of the reduction applies beta.
+      T b = pc == 0 ? beta : T(1);
+      for (int64_t ic = 0; ic < M; ic += B_::MC) {
+        int64_t mc = min(B_::MC, M - ic);
+        packA(transA, A, lda, ic, pc, mc, kc, Ap);
+        for (int64_t jr = 0; jr < nc; jr += B_::NR)
+          for (int64_t ir = 0; ir < mc; ir += B_::MR)
+            microkernel(kc, Ap + ir * kc, Bp + jr * kc, alpha, b,
+                        C + (ic + ir) * ldc + jc + jr, ldc,
+                        min(B_::MR, mc - ir), min(B_::NR, nc - jr));
+      }
+    }
+  }
+
+  free(Ap);
+  free(Bp);
+}
+
+/// y = alpha * op(A) * x + beta * y, where A is rows x cols as stored.
+template <typename T>
+static void gemv(bool trans, int64_t rows, int64_t cols, T alpha, const T *A,
+                 int64_t lda, const T *x, T beta, T *y) {
+  if (rows < 0)
+    rows = 0;
+  if (cols < 0)
+    cols = 0;
+  if (!trans) {
+    for (int64_t i = 0; i < rows; i++) {
+      T dot = T(0);
+      for (int64_t j = 0; j < cols; j++)
+        dot += A[i * lda + j] * x[j];
+      y[i] = (beta == T(0) ? T(0) : beta * y[i]) + alpha * dot;
+    }
+    return;
+  }
+  // Walk A by rows to keep the accesses contiguous.
+  scale(1, cols, beta, y, cols);
+  for (int64_t i = 0; i < rows; i++) {
+    T t = alpha * x[i];
+    for (int64_t j = 0; j < cols; j++)
+      y[j] += t * A[i * lda + j];
+  }
+}
+
+/// out[i][j] = beta * out[i][j] + alpha * sum(w[p][q] * in[i + p][j + q]) for
+/// an H x W output and a KH x KW filter.
+template <typename T>
+static void conv2d(int64_t H, int64_t W, int64_t KH, int64_t KW, T alpha,
+                   const T *in, int64_t ldin, const T *w, int64_t ldw, T beta,
+                   T *out, int64_t ldout) {
+  if (H <= 0 || W <= 0)
+    return;
+  scale(H, W, beta, out, ldout);
+  for (int64_t i = 0; i < H; i++) {
+    T *__restrict row = out + i * ldout;
+    for (int64_t p = 0; p < KH; p++) {
+      const T *__restrict src = in + (i + p) * ldin;
+      for (int64_t q = 0; q < KW; q++) {
+        T c = alpha * w[p * ldw + q];
+        for (int64_t j = 0; j < W; j++)
+          row[j] += c * src[j + q];
+      }
+    }
+  }
+}
+
+/// B[j][i] = A[i][j] for an M x N matrix A, in tiles that stay in L1.
+template <typename T>
+static void transpose(int64_t M, int64_t N, const T *A, int64_t lda, T *B,
+                      int64_t ldb) {
+  constexpr int64_t Tile = 32;
+  for (int64_t ii = 0; ii < M; ii += Tile)
+    for (int64_t jj = 0; jj < N; jj += Tile)
+      for (int64_t i = ii; i < min(ii + Tile, M); i++)
+        for (int64_t j = jj; j < min(jj + Tile, N); j++)
+          B[j * ldb + i] = A[i * lda + j];
+}
+
+#define DEFINE_KERNELS(PREFIX, T)                                              \
+  extern "C" POLYGEIST_KERNELS_EXPORT void polygeist_##PREFIX##gemm(           \
+      int32_t transA, int32_t transB, int64_t M, int64_t N, int64_t K,         \
+      T alpha, const T *A, int64_t lda, const T *B, int64_t ldb, T beta,       \
+      T *C, int64_t ldc) {                                                     \
+    gemm<T>(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);     \
+  }                                                                            \
+  extern "C" POLYGEIST_KERNELS_EXPORT void polygeist_##PREFIX##gemm_batched(   \
+      int32_t transA, int32_t transB, int64_t batch, int64_t M, int64_t N,     \
+      int64_t K, T alpha, const T *A, int64_t lda, int64_t strideA,            \
+      const T *B, int64_t ldb, int64_t strideB, T beta, T *C, int64_t ldc,     \
+      int64_t strideC) {                                                       \
+    for (int64_t b = 0; b < batch; b++)                                        \
+      gemm<T>(transA, transB, M, N, K, alpha, A + b * strideA, lda,            \
+              B + b * strideB, ldb, beta, C + b * strideC, ldc);               \
+  }                                                                            \
+  extern "C" POLYGEIST_KERNELS_EXPORT void polygeist_##PREFIX##gemv(           \
+      int32_t trans, int64_t rows, int64_t cols, T alpha, const T *A,          \
+      int64_t lda, const T *x, T beta, T *y) {                                 \
+    gemv<T>(trans, rows, cols, alpha, A, lda, x, beta, y);                     \
+  }                                                                            \
+  extern "C" POLYGEIST_KERNELS_EXPORT void polygeist_##PREFIX##conv2d(         \
+      int64_t H, int64_t W, int64_t KH, int64_t KW, T alpha, const T *in,      \
+      int64_t ldin, const T *w, int64_t ldw, T beta, T *out, int64_t ldout) {  \
+    conv2d<T>(H, W, KH, KW, alpha, in, ldin, w, ldw, beta, out, ldout);        \
+  }                                                                            \
+  extern "C" POLYGEIST_KERNELS_EXPORT void polygeist_##PREFIX##transpose(      \
+      int64_t M, int64_t N, const T *A, int64_t lda, T *B, int64_t ldb) {      \
+    transpose<T>(M, N, A, lda, B, ldb);                                        \
+  }
+
+DEFINE_KERNELS(s, float)
+DEFINE_KERNELS(d, double)
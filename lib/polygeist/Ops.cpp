@@ -169,6 +169,10 @@ bool collectEffects(Operation *op,
         }
         return true;
       }
+      // The marker of `#pragma omp simd` loops only carries their hints to
+      // the translation to LLVM IR.
+      if (*callee == "__polygeist_simd")
+        return true;
       if (*callee == "strlen") {
         for (auto arg : cop.getArgOperands()) {
           effects.emplace_back(::mlir::MemoryEffects::Read::get(), arg,
@@ -419,203 +423,6 @@ public:
   }
 };
 
-extern std::set<std::string> NonCapturingFunctions;
-
-bool isCaptured(Value v, Operation *potentialUser = nullptr,
-                bool *seenuse = nullptr) {
-  SmallVector<Value> todo = {v};
-  while (todo.size()) {
-    Value v = todo.pop_back_val();
-    for (auto u : v.getUsers()) {
-      if (seenuse && u == potentialUser)
-        *seenuse = true;
-      if (isa<memref::LoadOp, LLVM::LoadOp, AffineLoadOp, polygeist::CacheLoad>(
-              u))
-        continue;
-      if (auto s = dyn_cast<memref::StoreOp>(u)) {
-        if (s.getValue() == v)
-          return true;
-        continue;
-      }
-      if (auto s = dyn_cast<AffineStoreOp>(u)) {
-        if (s.getValue() == v)
-          return true;
-        continue;
-      }
-      if (auto s = dyn_cast<LLVM::StoreOp>(u)) {
-        if (s.getValue() == v)
-          return true;
-        continue;
-      }
-      if (auto sub = dyn_cast<LLVM::GEPOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<LLVM::BitcastOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<LLVM::AddrSpaceCastOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<func::ReturnOp>(u)) {
-        continue;
-      }
-      if (auto sub = dyn_cast<LLVM::MemsetOp>(u)) {
-        continue;
-      }
-      if (auto sub = dyn_cast<LLVM::MemcpyOp>(u)) {
-        continue;
-      }
-      if (auto sub = dyn_cast<LLVM::MemmoveOp>(u)) {
-        continue;
-      }
-      if (auto sub = dyn_cast<memref::CastOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<memref::DeallocOp>(u)) {
-        continue;
-      }
-      if (auto sub = dyn_cast<polygeist::SubIndexOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<polygeist::Memref2PointerOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto sub = dyn_cast<polygeist::Pointer2MemrefOp>(u)) {
-        todo.push_back(sub);
-      }
-      if (auto cop = dyn_cast<LLVM::CallOp>(u)) {
-        if (auto callee = cop.getCallee()) {
-          if (NonCapturingFunctions.count(callee->str()))
-            continue;
-        }
-      }
-      if (auto cop = dyn_cast<func::CallOp>(u)) {
-        if (NonCapturingFunctions.count(cop.getCallee().str()))
-          continue;
-      }
-      return true;
-    }
-  }
-
-  return false;
-}
-
-Value getBase(Value v) {
-  while (true) {
-    if (auto s = v.getDefiningOp<SubIndexOp>()) {
-      v = s.getSource();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<Memref2PointerOp>()) {
-      v = s.getSource();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<Pointer2MemrefOp>()) {
-      v = s.getSource();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<LLVM::GEPOp>()) {
-      v = s.getBase();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<LLVM::BitcastOp>()) {
-      v = s.getArg();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<LLVM::AddrSpaceCastOp>()) {
-      v = s.getArg();
-      continue;
-    }
-    if (auto s = v.getDefiningOp<memref::CastOp>()) {
-      v = s.getSource();
-      continue;
-    }
-    break;
-  }
-  return v;
-}
-
-bool isStackAlloca(Value v) {
-  return v.getDefiningOp<memref::AllocaOp>() ||
-         v.getDefiningOp<memref::AllocOp>() ||
-         v.getDefiningOp<LLVM::AllocaOp>();
-}
-static bool mayAlias(Value v, Value v2) {
-  v = getBase(v);
-  v2 = getBase(v2);
-  if (v == v2)
-    return true;
-
-  // We may now assume neither v1 nor v2 are subindices
-
-  if (auto glob = v.getDefiningOp<memref::GetGlobalOp>()) {
-    if (auto Aglob = v2.getDefiningOp<memref::GetGlobalOp>()) {
-      return glob.getName() == Aglob.getName();
-    }
-  }
-
-  if (auto glob = v.getDefiningOp<LLVM::AddressOfOp>()) {
-    if (auto Aglob = v2.getDefiningOp<LLVM::AddressOfOp>()) {
-      return glob.getGlobalName() == Aglob.getGlobalName();
-    }
-  }
-
-  bool isAlloca[2];
-  bool isGlobal[2];
-
-  isAlloca[0] = isStackAlloca(v);
-  isGlobal[0] = v.getDefiningOp<memref::GetGlobalOp>() ||
-                v.getDefiningOp<LLVM::AddressOfOp>();
-
-  isAlloca[1] = isStackAlloca(v2);
-
-  isGlobal[1] = v2.getDefiningOp<memref::GetGlobalOp>() ||
-                v2.getDefiningOp<LLVM::AddressOfOp>();
-
-  // Non-equivalent allocas/global's cannot conflict with each other
-  if ((isAlloca[0] || isGlobal[0]) && (isAlloca[1] || isGlobal[1]))
-    return false;
-
-  bool isArg[2];
-  isArg[0] = v.isa<BlockArgument>() &&
-             isa<FunctionOpInterface>(
-                 v.cast<BlockArgument>().getOwner()->getParentOp());
-
-  isArg[1] = v.isa<BlockArgument>() &&
-             isa<FunctionOpInterface>(
-                 v.cast<BlockArgument>().getOwner()->getParentOp());
-
-  // Stack allocations cannot have been passed as an argument.
-  if ((isAlloca[0] && isArg[1]) || (isAlloca[1] && isArg[0]))
-    return false;
-
-  // Non captured base allocas cannot conflict with another base value.
-  if (isAlloca[0] && !isCaptured(v))
-    return false;
-
-  if (isAlloca[1] && !isCaptured(v2))
-    return false;
-
-  return true;
-}
-
-bool mayAlias(MemoryEffects::EffectInstance a,
-              MemoryEffects::EffectInstance b) {
-  if (Value v2 = b.getValue()) {
-    return mayAlias(a, v2);
-  } else if (Value v = a.getValue()) {
-    return mayAlias(b, v);
-  }
-  return true;
-}
-
-bool mayAlias(MemoryEffects::EffectInstance a, Value v2) {
-  if (Value v = a.getValue()) {
-    return mayAlias(v, v2);
-  }
-  return true;
-}
-
 void BarrierOp::getCanonicalizationPatterns(RewritePatternSet &results,
                                             MLIRContext *context) {
   results.insert<BarrierHoist, BarrierElim</*TopLevelOnly*/ false>>(context);
@@ -1345,6 +1152,9 @@ public:
 
   LogicalResult matchAndRewrite(T op,
                                 PatternRewriter &rewriter) const override {
+    // Created by the loop idiom pass from the loops this would produce.
+    if (op->hasAttr("polygeist.loop_idiom"))
+      return failure();
 
     Value dstv = op.getDst();
     auto dst = dstv.getDefiningOp<polygeist::Memref2PointerOp>();
@@ -1456,6 +1266,9 @@ public:
 
   LogicalResult matchAndRewrite(T op,
                                 PatternRewriter &rewriter) const override {
+    // Created by the loop idiom pass from the loops this would produce.
+    if (op->hasAttr("polygeist.loop_idiom"))
+      return failure();
 
     Value dstv = op.getDst();
     auto dst = dstv.getDefiningOp<polygeist::Memref2PointerOp>();
@@ -0,0 +1,585 @@
+//===- CollectiveRecognition.cpp - Serialize block-wide collectives -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Recognizes the shared-memory reductions and scans of CUDA kernels lowered to
+// the CPU: loops executed by every thread of a block whose trip count does not
+// depend on the thread, with polygeist.barrier ops at the top level of their
+// body, e.g.
+//
+//   for (s = blockDim.x / 2; s > 0; s >>= 1) {
+//     if (tid < s)
+//       sh[tid] += sh[tid + s];
+//     __syncthreads();
+//   }
+//
+// Distributing the barriers of such a loop costs a fork/join of the whole
+// block per step. Instead, the loop is run by the first thread of the block
+// alone, with each barrier-separated phase of its body turned into a
+// sequential loop over the threads:
+//
+//   barrier
+//   if (tid == 0)
+//     for (s = blockDim.x / 2; s > 0; s >>= 1)
+//       for (t = 0; t < blockDim.x; t++)
+//         if (t < s)
+//           sh[t] += sh[t + s];
+//   barrier
+//
+// Running the phases in thread order is one of the interleavings the barriers
+// permit, so the result is exact, and the resulting inner loops are plain
+// strided loops that the vectorizer handles. Values a thread computes before
+// the loop are recomputed from the thread index, and values it carries from
+// one phase to the next (the running partial sum of a Hillis-Steele scan) are
+// kept in a buffer indexed by thread.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/Matchers.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "recognize-collectives"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct CollectiveRecognition
+    : public CollectiveRecognitionBase<CollectiveRecognition> {
+  void runOnOperation() override;
+};
+
+/// Whether values computed in a thread-parallel loop differ between threads
+/// of the block, i.e. depend on the induction variables the barriers name.
+/// Values carried by `loop` itself are assumed uniform; callers check that
+/// what flows into them is.
+class ThreadDependence {
+public:
+  ThreadDependence(Operation *par, Operation *loop, ArrayRef<Value> tids)
+      : par(par), loop(loop), tids(tids.begin(), tids.end()) {}
+
+  bool dependsOnThread(Value v) {
+    if (tids.contains(v))
+      return true;
+    auto found = cache.find(v);
+    if (found != cache.end())
+      return found->second;
+    bool result;
+    if (auto arg = v.dyn_cast<BlockArgument>()) {
+      Operation *owner = arg.getOwner()->getParentOp();
+      result = owner != loop && loop->isProperAncestor(owner) &&
+               dependsOnThread(owner);
+    } else {
+      result = dependsOnThread(v.getDefiningOp());
+    }
+    cache[v] = result;
+    return result;
+  }
+
+  bool dependsOnThread(Operation *op) {
+    // Memory allocated inside the parallel loop is private to each thread.
+    if (par->isProperAncestor(op)) {
+      if (isa<LLVM::AllocaOp>(op))
+        return true;
+      if (auto mem = dyn_cast<MemoryEffectOpInterface>(op))
+        if (mem.hasEffect<MemoryEffects::Allocate>())
+          return true;
+    }
+    for (Value operand : op->getOperands())
+      if (dependsOnThread(operand))
+        return true;
+    // Values captured by the regions of the op; loads from uniform addresses
+    // are uniform in a race-free kernel.
+    return op
+        ->walk([&](Operation *nested) {
+          if (nested == op)
+            return WalkResult::advance();
+          for (Value operand : nested->getOperands())
+            if (!op->isAncestor(operand.getParentRegion()->getParentOp()) &&
+                dependsOnThread(operand))
+              return WalkResult::interrupt();
+          return WalkResult::advance();
+        })
+        .wasInterrupted();
+  }
+
+private:
+  Operation *par;
+  Operation *loop;
+  SmallPtrSet<Value, 4> tids;
+  DenseMap<Value, bool> cache;
+};
+} // namespace
+
+static Block *getLoopBody(Operation *loop) {
+  if (auto whileOp = dyn_cast<scf::WhileOp>(loop))
+    return whileOp.getAfterBody();
+  if (auto forOp = dyn_cast<scf::ForOp>(loop))
+    return forOp.getBody();
+  return cast<AffineForOp>(loop).getBody();
+}
+
+static bool onlyReadsMemory(Operation *op) {
+  if (isMemoryEffectFree(op))
+    return true;
+  auto mem = dyn_cast<MemoryEffectOpInterface>(op);
+  if (!mem)
+    return false;
+  SmallVector<MemoryEffects::EffectInstance> effects;
+  mem.getEffects(effects);
+  return llvm::all_of(effects, [](const MemoryEffects::EffectInstance &e) {
+    return isa<MemoryEffects::Read>(e.getEffect());
+  });
+}
+
+/// The lower bound of dimension `pos` of the parallel loop `par`, or null if
+/// it is the maximum of several expressions.
+static Value getLowerBound(OpBuilder &builder, Location loc, Operation *par,
+                           unsigned pos) {
+  if (auto scfPar = dyn_cast<scf::ParallelOp>(par))
+    return scfPar.getLowerBound()[pos];
+  auto affinePar = cast<AffineParallelOp>(par);
+  AffineMap map = affinePar.getLowerBoundMap(pos);
+  if (map.getNumResults() != 1)
+    return nullptr;
+  return builder.create<AffineApplyOp>(loc, map,
+                                       affinePar.getLowerBoundsOperands());
+}
+
+/// Whether dimension `pos` of `par` starts at zero with unit step and a single
+/// upper bound, so that its induction variable can index a buffer.
+static bool isNormalized(Operation *par, unsigned pos) {
+  if (auto scfPar = dyn_cast<scf::ParallelOp>(par))
+    return matchPattern(scfPar.getLowerBound()[pos], m_Zero()) &&
+           matchPattern(scfPar.getStep()[pos], m_One());
+  auto affinePar = cast<AffineParallelOp>(par);
+  AffineMap lb = affinePar.getLowerBoundMap(pos);
+  return lb.isSingleConstant() && lb.getSingleConstantResult() == 0 &&
+         affinePar.getSteps()[pos] == 1 &&
+         affinePar.getUpperBoundMap(pos).getNumResults() == 1;
+}
+
+/// The trip count of a normalized dimension `pos` of `par`.
+static Value getExtent(OpBuilder &builder, Location loc, Operation *par,
+                       unsigned pos) {
+  if (auto scfPar = dyn_cast<scf::ParallelOp>(par))
+    return scfPar.getUpperBound()[pos];
+  auto affinePar = cast<AffineParallelOp>(par);
+  return builder.create<AffineApplyOp>(loc, affinePar.getUpperBoundMap(pos),
+                                       affinePar.getUpperBoundsOperands());
+}
+
+/// Creates a sequential loop over dimension `pos` of `par`, an affine.for if
+/// `par` is affine so that affine accesses of the thread index stay valid, and
+/// leaves `builder` in its body.
+static Value createThreadLoop(OpBuilder &builder, Location loc, Operation *par,
+                              unsigned pos) {
+  if (auto scfPar = dyn_cast<scf::ParallelOp>(par)) {
+    auto forOp = builder.create<scf::ForOp>(loc, scfPar.getLowerBound()[pos],
+                                            scfPar.getUpperBound()[pos],
+                                            scfPar.getStep()[pos]);
+    builder.setInsertionPoint(forOp.getBody()->getTerminator());
+    return forOp.getInductionVar();
+  }
+  auto affinePar = cast<AffineParallelOp>(par);
+  auto forOp = builder.create<AffineForOp>(
+      loc, affinePar.getLowerBoundsOperands(),
+      affinePar.getLowerBoundMap(pos), affinePar.getUpperBoundsOperands(),
+      affinePar.getUpperBoundMap(pos), affinePar.getSteps()[pos]);
+  builder.setInsertionPoint(forOp.getBody()->getTerminator());
+  return forOp.getInductionVar();
+}
+
+namespace {
+/// A synchronizing loop of a thread-parallel loop and how to run it on a
+/// single thread.
+class Collective {
+public:
+  Collective(Operation *par, Operation *loop, polygeist::BarrierOp barrier)
+      : par(par), loop(loop), barrier(barrier) {
+    for (Value index : barrier.getOperands())
+      for (auto en : llvm::enumerate(par->getRegion(0).getArguments()))
+        if (index == en.value() && !llvm::is_contained(dims, en.index())) {
+          dims.push_back(en.index());
+          tids.push_back(en.value());
+        }
+  }
+
+  /// Checks that the loop can be serialized and plans how, without changing
+  /// the IR.
+  bool match();
+  void rewrite();
+
+private:
+  bool matchPhases();
+  bool canRematerialize(Value v);
+  bool canHoist(Value v, unsigned phase);
+  Value hoist(OpBuilder &builder, Value v);
+  Value rematerialize(OpBuilder &builder, Value v, BlockAndValueMapping &map);
+  unsigned getPhase(Operation *op);
+
+  Operation *par;
+  Operation *loop;
+  polygeist::BarrierOp barrier;
+  /// The parallel dimensions that index threads, and their induction
+  /// variables.
+  SmallVector<unsigned> dims;
+  SmallVector<Value> tids;
+  Optional<ThreadDependence> deps;
+
+  /// The ops of the loop body between consecutive barriers.
+  SmallVector<SmallVector<Operation *>> phases;
+  DenseMap<Operation *, unsigned> phaseOf;
+  /// Thread-invariant values used after their phase, computed once before
+  /// the phase instead.
+  SetVector<Value> hoisted;
+  BlockAndValueMapping hoistMap;
+  /// Per-thread values used after their phase, stored in a buffer.
+  SetVector<Value> buffered;
+  DenseMap<Value, Value> buffers;
+  /// Memoized legality of recomputing values from before the loop in the
+  /// thread loops, and of hoisting values out of them.
+  DenseMap<Value, bool> rematerializable;
+  DenseMap<std::pair<Value, unsigned>, bool> hoistable;
+};
+} // namespace
+
+unsigned Collective::getPhase(Operation *op) {
+  Operation *ancestor = getLoopBody(loop)->findAncestorOpInBlock(*op);
+  auto found = phaseOf.find(ancestor);
+  return found == phaseOf.end() ? phases.size() : found->second;
+}
+
+bool Collective::canRematerialize(Value v) {
+  if (llvm::is_contained(tids, v) || !deps->dependsOnThread(v))
+    return true;
+  auto found = rematerializable.find(v);
+  if (found != rematerializable.end())
+    return found->second;
+  Operation *def = v.getDefiningOp();
+  bool result = def && def->getBlock() == loop->getBlock() &&
+                def->getNumRegions() == 0 && isMemoryEffectFree(def) &&
+                llvm::all_of(def->getOperands(),
+                             [&](Value operand) {
+                               return canRematerialize(operand);
+                             });
+  rematerializable[v] = result;
+  return result;
+}
+
+bool Collective::canHoist(Value v, unsigned phase) {
+  // Values from outside the loop body, or carried by the loop, are available
+  // before every phase.
+  Operation *def = v.getDefiningOp();
+  if (!def || !getLoopBody(loop)->findAncestorOpInBlock(*def))
+    return true;
+  if (getPhase(def) != phase)
+    return hoisted.contains(v);
+  auto key = std::make_pair(v, phase);
+  auto found = hoistable.find(key);
+  if (found != hoistable.end())
+    return found->second;
+  bool result =
+      !deps->dependsOnThread(v) && def->getNumRegions() == 0 &&
+      onlyReadsMemory(def) &&
+      llvm::all_of(def->getOperands(),
+                   [&](Value operand) { return canHoist(operand, phase); });
+  hoistable[key] = result;
+  return result;
+}
+
+bool Collective::matchPhases() {
+  Block *body = getLoopBody(loop);
+  phases.emplace_back();
+  for (Operation &op : body->without_terminator()) {
+    if (isa<polygeist::BarrierOp>(op)) {
+      phases.emplace_back();
+      continue;
+    }
+    phaseOf[&op] = phases.size() - 1;
+    phases.back().push_back(&op);
+  }
+
+  for (auto en : llvm::enumerate(phases)) {
+    unsigned phase = en.index();
+    for (Operation *op : en.value()) {
+      // Uses of per-thread values are remapped to the thread loops, which
+      // only enclose the phases.
+      WalkResult walk = op->walk([&](Operation *nested) {
+        for (Value operand : nested->getOperands()) {
+          if (loop->isAncestor(operand.getParentRegion()->getParentOp()))
+            continue;
+          if (!canRematerialize(operand))
+            return WalkResult::interrupt();
+        }
+        return WalkResult::advance();
+      });
+      if (walk.wasInterrupted())
+        return false;
+
+      for (Value result : op->getResults()) {
+        bool escapes = false, reachesControl = false;
+        for (Operation *user : result.getUsers()) {
+          unsigned userPhase = getPhase(user);
+          escapes |= userPhase != phase;
+          reachesControl |= userPhase == phases.size();
+        }
+        if (!escapes)
+          continue;
+        if (canHoist(result, phase)) {
+          hoisted.insert(result);
+          continue;
+        }
+        if (reachesControl || !MemRefType::isValidElementType(result.getType()))
+          return false;
+        buffered.insert(result);
+      }
+    }
+  }
+  return true;
+}
+
+bool Collective::match() {
+  if (dims.empty() || !loop->use_empty())
+    return false;
+  if (auto affinePar = dyn_cast<AffineParallelOp>(par))
+    for (unsigned dim : dims)
+      if (affinePar.getLowerBoundMap(dim).getNumResults() != 1)
+        return false;
+  deps.emplace(par, loop, tids);
+
+  // Every thread has to run the same iterations.
+  for (Value operand : loop->getOperands())
+    if (deps->dependsOnThread(operand))
+      return false;
+  for (Region &region : loop->getRegions())
+    for (Value operand : region.front().getTerminator()->getOperands())
+      if (deps->dependsOnThread(operand))
+        return false;
+
+  // Thread indices may only be used in the phases, which run in thread
+  // loops, not in the loop condition.
+  if (auto whileOp = dyn_cast<scf::WhileOp>(loop)) {
+    WalkResult walk = whileOp.getBefore().walk([&](Operation *op) {
+      for (Value operand : op->getOperands())
+        if (!whileOp.getBefore().isAncestor(operand.getParentRegion()) &&
+            deps->dependsOnThread(operand))
+          return WalkResult::interrupt();
+      return WalkResult::advance();
+    });
+    if (walk.wasInterrupted())
+      return false;
+  }
+
+  if (!matchPhases())
+    return false;
+
+  // The barriers inserted around the loop reuse the barrier operands.
+  for (Value index : barrier.getOperands())
+    if (loop->isAncestor(index.getParentRegion()->getParentOp()))
+      return false;
+
+  return buffered.empty() ||
+         llvm::all_of(dims, [&](unsigned dim) { return isNormalized(par, dim); });
+}
+
+Value Collective::hoist(OpBuilder &builder, Value v) {
+  if (Value mapped = hoistMap.lookupOrNull(v))
+    return mapped;
+  Operation *def = v.getDefiningOp();
+  if (!def || !getLoopBody(loop)->findAncestorOpInBlock(*def) ||
+      !phaseOf.count(def))
+    return v;
+  for (Value operand : def->getOperands())
+    hoist(builder, operand);
+  builder.clone(*def, hoistMap);
+  return hoistMap.lookup(v);
+}
+
+Value Collective::rematerialize(OpBuilder &builder, Value v,
+                                BlockAndValueMapping &map) {
+  if (Value mapped = map.lookupOrNull(v))
+    return mapped;
+  if (!deps->dependsOnThread(v))
+    return v;
+  Operation *def = v.getDefiningOp();
+  for (Value operand : def->getOperands())
+    rematerialize(builder, operand, map);
+  builder.clone(*def, map);
+  return map.lookup(v);
+}
+
+void Collective::rewrite() {
+  Location loc = loop->getLoc();
+  OpBuilder builder(loop);
+  builder.create<polygeist::BarrierOp>(loc, barrier.getOperands());
+
+  Value first;
+  for (auto en : llvm::zip(dims, tids)) {
+    Value lb = getLowerBound(builder, loc, par, std::get<0>(en));
+    Value isFirst = builder.create<arith::CmpIOp>(loc, arith::CmpIPredicate::eq,
+                                                  std::get<1>(en), lb);
+    first = first ? builder.create<arith::AndIOp>(loc, first, isFirst)
+                  : isFirst;
+  }
+  auto ifOp = builder.create<scf::IfOp>(loc, first, /*hasElse*/ false);
+  builder.create<polygeist::BarrierOp>(loc, barrier.getOperands());
+
+  builder.setInsertionPoint(ifOp.thenYield());
+  auto scope = builder.create<memref::AllocaScopeOp>(loc, TypeRange());
+  builder.createBlock(&scope.getRegion());
+  auto scopeReturn = builder.create<memref::AllocaScopeReturnOp>(loc);
+  builder.setInsertionPoint(scopeReturn);
+
+  if (!buffered.empty()) {
+    SmallVector<Value> extents;
+    for (unsigned dim : dims)
+      extents.push_back(getExtent(builder, loc, par, dim));
+    for (Value v : buffered) {
+      SmallVector<int64_t> shape(extents.size(), ShapedType::kDynamicSize);
+      buffers[v] = builder.create<memref::AllocaOp>(
+          loc, MemRefType::get(shape, v.getType()), extents);
+    }
+  }
+  loop->moveBefore(scopeReturn);
+
+  for (auto en : llvm::enumerate(phases)) {
+    ArrayRef<Operation *> phase = en.value();
+    if (phase.empty())
+      continue;
+    builder.setInsertionPoint(phase.front());
+
+    // Thread-invariant values needed later are computed once, before the
+    // threads of this phase run.
+    for (Value v : hoisted) {
+      if (getPhase(v.getDefiningOp()) != en.index())
+        continue;
+      Value clone = hoist(builder, v);
+      unsigned phaseIdx = en.index();
+      v.replaceUsesWithIf(clone, [&](OpOperand &use) {
+        return getPhase(use.getOwner()) != phaseIdx;
+      });
+    }
+
+    // The first barrier operand is the x dimension, whose thread loop goes
+    // innermost for contiguous shared-memory accesses.
+    Operation *outer = nullptr;
+    BlockAndValueMapping threadMap;
+    for (unsigned i = dims.size(); i-- > 0;) {
+      Value iv = createThreadLoop(builder, loc, par, dims[i]);
+      if (!outer)
+        outer = iv.getParentRegion()->getParentOp();
+      threadMap.map(tids[i], iv);
+    }
+    SmallVector<Value> ivs;
+    for (Value tid : tids)
+      ivs.push_back(threadMap.lookup(tid));
+    Operation *innerTerminator = builder.getInsertionBlock()->getTerminator();
+    for (Operation *op : phase)
+      op->moveBefore(innerTerminator);
+
+    for (Value tid : tids)
+      tid.replaceUsesWithIf(threadMap.lookup(tid), [&](OpOperand &use) {
+        return outer->isProperAncestor(use.getOwner());
+      });
+
+    // Per-thread values from before the loop or from earlier phases.
+    builder.setInsertionPointToStart(builder.getInsertionBlock());
+    SmallVector<OpOperand *> uses;
+    outer->walk([&](Operation *op) {
+      for (OpOperand &use : op->getOpOperands()) {
+        Value v = use.get();
+        if ((buffers.count(v) && !outer->isAncestor(v.getDefiningOp())) ||
+            (!loop->isAncestor(v.getParentRegion()->getParentOp()) &&
+             deps->dependsOnThread(v)))
+          uses.push_back(&use);
+      }
+    });
+    for (OpOperand *use : uses) {
+      Value v = use->get();
+      Value replacement = threadMap.lookupOrNull(v);
+      if (!replacement) {
+        auto buffer = buffers.find(v);
+        replacement =
+            buffer != buffers.end()
+                ? builder.create<memref::LoadOp>(loc, buffer->second, ivs)
+                : rematerialize(builder, v, threadMap);
+        threadMap.map(v, replacement);
+      }
+      use->set(replacement);
+    }
+
+    for (Operation *op : phase)
+      for (Value result : op->getResults())
+        if (buffered.contains(result)) {
+          OpBuilder after(op->getBlock(), std::next(op->getIterator()));
+          after.create<memref::StoreOp>(loc, result, buffers[result], ivs);
+        }
+  }
+
+  for (Operation &op : llvm::make_early_inc_range(*getLoopBody(loop)))
+    if (isa<polygeist::BarrierOp>(op))
+      op.erase();
+}
+
+/// The barrier shared by the top-level barriers of the body of `loop`, or
+/// null if the loop does not synchronize or also synchronizes elsewhere.
+static polygeist::BarrierOp getPhaseBarrier(Operation *loop) {
+  polygeist::BarrierOp first;
+  Block *body = getLoopBody(loop);
+  WalkResult walk = loop->walk([&](polygeist::BarrierOp barrier) {
+    if (barrier->getBlock() != body ||
+        (first && !llvm::equal(barrier.getOperands(), first.getOperands())))
+      return WalkResult::interrupt();
+    if (!first)
+      first = barrier;
+    return WalkResult::advance();
+  });
+  if (walk.wasInterrupted())
+    return nullptr;
+  return first;
+}
+
+void CollectiveRecognition::runOnOperation() {
+  SmallVector<Operation *> loops;
+  getOperation()->walk([&](Operation *op) {
+    if (isa<scf::WhileOp, scf::ForOp, AffineForOp>(op) &&
+        isa_and_nonnull<scf::ParallelOp, AffineParallelOp>(op->getParentOp()))
+      loops.push_back(op);
+  });
+
+  for (Operation *loop : loops) {
+    polygeist::BarrierOp barrier = getPhaseBarrier(loop);
+    if (!barrier)
+      continue;
+    Collective collective(loop->getParentOp(), loop, barrier);
+    if (!collective.match())
+      continue;
+    LLVM_DEBUG(llvm::dbgs() << "serializing block collective at "
+                            << loop->getLoc() << "\n");
+    collective.rewrite();
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createCollectiveRecognitionPass() {
+  return std::make_unique<CollectiveRecognition>();
+}
+} // namespace polygeist
+} // namespace mlir
@@ -14,6 +14,7 @@
 #include "mlir/../../lib/Conversion/MemRefToLLVM/MemRefToLLVM.cpp"
 #include "mlir/Analysis/DataLayoutAnalysis.h"
 #include "mlir/Conversion/ArithToLLVM/ArithToLLVM.h"
+#include "mlir/Conversion/ComplexToLLVM/ComplexToLLVM.h"
 #include "mlir/Conversion/ControlFlowToLLVM/ControlFlowToLLVM.h"
 #include "mlir/Conversion/FuncToLLVM/ConvertFuncToLLVM.h"
 #include "mlir/Conversion/GPUCommon/GPUCommonPass.h"
@@ -44,6 +45,7 @@
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "mlir/Transforms/RegionUtils.h"
 #include "polygeist/Ops.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Support/FormatVariadic.h"
 #define DEBUG_TYPE "convert-polygeist-to-llvm"
 
@@ -564,13 +566,16 @@ struct AsyncOpLowering : public ConvertOpToLLVMPattern<async::ExecuteOp> {
     {
       OpBuilder::InsertionGuard guard(rewriter);
       rewriter.setInsertionPointToEnd(module.getBody());
-      static int off = 0;
-      off++;
-      func = rewriter.create<LLVM::LLVMFuncOp>(
-          execute.getLoc(),
-          "kernelbody." + std::to_string((long long int)&execute) + "." +
-              std::to_string(off),
-          funcType);
+      // Number the outlined bodies from the symbols already in the module
+      // rather than from global state, so that the names are deterministic
+      // and concurrent compilations do not race.
+      unsigned off = 0;
+      std::string name;
+      do {
+        name = "kernelbody." + std::to_string(off++);
+      } while (module.lookupSymbol(name));
+      func = rewriter.create<LLVM::LLVMFuncOp>(execute.getLoc(), name,
+                                               funcType);
     }
 
     rewriter.setInsertionPointToStart(func.addEntryBlock());
@@ -1106,8 +1111,10 @@ public:
     if (!address)
       return failure();
 
-    rewriter.replaceOpWithNewOp<LLVM::StoreOp>(storeOp, adaptor.getValue(),
-                                               address);
+    auto newStore = rewriter.replaceOpWithNewOp<LLVM::StoreOp>(
+        storeOp, adaptor.getValue(), address);
+    if (storeOp->hasAttr("polygeist.nontemporal"))
+      newStore.setNontemporalAttr(rewriter.getUnitAttr());
     return success();
   }
 };
@@ -1293,6 +1300,42 @@ LLVM::CallOp FunctionCallBuilder::create(Location loc, OpBuilder &builder,
   return builder.create<LLVM::CallOp>(loc, function, arguments);
 }
 
+/// Returns true if `token` is the only token left which stands for its
+/// stream. The token of an async operation stands for the stream of one of
+/// its dependencies, so none of the tokens back to the `gpu.wait async`
+/// which created the stream may have another use.
+static bool isLastTokenOfStream(Value token) {
+  SmallVector<Value> worklist = {token};
+  while (!worklist.empty()) {
+    Value value = worklist.pop_back_val();
+    if (!value.hasOneUse())
+      return false;
+    auto asyncOp = value.getDefiningOp<gpu::AsyncOpInterface>();
+    if (!asyncOp)
+      return false;
+    if (!isa<gpu::WaitOp>(asyncOp))
+      llvm::append_range(worklist, asyncOp.getAsyncDependencies());
+  }
+  return true;
+}
+
+/// Returns the number of asynchronous GPU operations that `token` waits for,
+/// counted in the dependence graph at compile time. This is only a proxy for
+/// the work queued on its stream: it knows neither the cost of the operations
+/// nor how many of them are still pending when the program gets there.
+static unsigned getAsyncDependenceCount(Value token) {
+  SmallPtrSet<Operation *, 8> queued;
+  SmallVector<Value> worklist = {token};
+  while (!worklist.empty()) {
+    Operation *op = worklist.pop_back_val().getDefiningOp();
+    if (!op || !queued.insert(op).second)
+      continue;
+    if (auto asyncOp = dyn_cast<gpu::AsyncOpInterface>(op))
+      llvm::append_range(worklist, asyncOp.getAsyncDependencies());
+  }
+  return queued.size();
+}
+
 template <typename OpTy>
 class ConvertOpToGpuRuntimeCallPattern : public ConvertOpToLLVMPattern<OpTy> {
 public:
@@ -1312,6 +1355,41 @@ protected:
                                               desc.size(rewriter, loc, 0));
   }
 
+  // Returns a stream on which work runs after the work on the streams of all
+  // `dependencies`, the async tokens of an op, which were converted to
+  // `streams`. The stream whose token has the fewest operations before it,
+  // see getAsyncDependenceCount, waits for events recorded on the others.
+  // Once the wait is enqueued, the other streams are destroyed unless
+  // another token still stands for them.
+  Value joinAsyncDependencies(ConversionPatternRewriter &rewriter, Location loc,
+                              ValueRange dependencies,
+                              ValueRange streams) const {
+    unsigned best = 0;
+    unsigned bestCount = getAsyncDependenceCount(dependencies[0]);
+    for (unsigned i = 1, e = dependencies.size(); i < e; i++) {
+      unsigned count = getAsyncDependenceCount(dependencies[i]);
+      if (count < bestCount) {
+        best = i;
+        bestCount = count;
+      }
+    }
+
+    Value stream = streams[best];
+    SmallPtrSet<Value, 4> joined = {stream};
+    for (auto en : llvm::enumerate(streams)) {
+      if (!joined.insert(en.value()).second)
+        continue;
+      Value event =
+          eventCreateCallBuilder.create(loc, rewriter, {}).getResult();
+      eventRecordCallBuilder.create(loc, rewriter, {event, en.value()});
+      streamWaitEventCallBuilder.create(loc, rewriter, {stream, event});
+      eventDestroyCallBuilder.create(loc, rewriter, {event});
+      if (isLastTokenOfStream(dependencies[en.index()]))
+        streamDestroyCallBuilder.create(loc, rewriter, {en.value()});
+    }
+    return stream;
+  }
+
   MLIRContext *context = &this->getTypeConverter()->getContext();
 
   Type llvmVoidType = LLVM::LLVMVoidType::get(context);
@@ -1382,6 +1460,18 @@ protected:
       "mgpuStreamSynchronize",
       llvmVoidType,
       {llvmPointerType /* void *stream */}};
+  FunctionCallBuilder streamWaitEventCallBuilder = {
+      "mgpuStreamWaitEvent",
+      llvmVoidType,
+      {llvmPointerType /* void *stream */, llvmPointerType /* void *event */}};
+  FunctionCallBuilder eventCreateCallBuilder = {
+      "mgpuEventCreate", llvmPointerType /* void *event */, {}};
+  FunctionCallBuilder eventDestroyCallBuilder = {
+      "mgpuEventDestroy", llvmVoidType, {llvmPointerType /* void *event */}};
+  FunctionCallBuilder eventRecordCallBuilder = {
+      "mgpuEventRecord",
+      llvmVoidType,
+      {llvmPointerType /* void *event */, llvmPointerType /* void *stream */}};
 };
 
 static constexpr const char *kGpuBinaryStorageSuffix = "_gpubin_cst";
@@ -1507,18 +1597,15 @@ static LogicalResult areAllLLVMTypes(Operation *op, ValueRange operands,
 // call %streamDestroy(%4)
 // call %moduleUnload(%1)
 //
-// If the op is async, the stream corresponds to the (single) async dependency
-// as well as the async token the op produces.
+// If the op is async, the stream corresponds to its async dependency as well
+// as the async token the op produces. Several dependencies are joined on one
+// of their streams, see joinAsyncDependencies.
 LogicalResult ConvertLaunchFuncOpToGpuRuntimeCallPattern::matchAndRewrite(
     gpu::LaunchFuncOp launchOp, OpAdaptor adaptor,
     ConversionPatternRewriter &rewriter) const {
   if (failed(areAllLLVMTypes(launchOp, adaptor.getOperands(), rewriter)))
     return failure();
 
-  if (launchOp.getAsyncDependencies().size() > 1)
-    return rewriter.notifyMatchFailure(
-        launchOp, "Cannot convert with more than one async dependency.");
-
   // Fail when the synchronous version of the op has async dependencies. The
   // lowering destroys the stream, and we do not want to check that there is no
   // use of the stream after this op.
@@ -1652,7 +1739,9 @@ LogicalResult ConvertLaunchFuncOpToGpuRuntimeCallPattern::matchAndRewrite(
   auto nullpointer = rewriter.create<LLVM::NullOp>(loc, llvmPointerType);
   Value stream = adaptor.getAsyncDependencies().empty()
                      ? nullpointer
-                     : adaptor.getAsyncDependencies().front();
+                     : joinAsyncDependencies(rewriter, loc,
+                                             launchOp.getAsyncDependencies(),
+                                             adaptor.getAsyncDependencies());
   // Create array of pointers to kernel arguments.
   auto kernelParams = generateParamsArray(launchOp, adaptor, rewriter);
   auto nullpointerpointer =
@@ -1843,11 +1932,11 @@ isAsyncWithZeroDependencies(ConversionPatternRewriter &rewriter,
   return success();
 }
 static LogicalResult
-isAsyncWithOneDependency(ConversionPatternRewriter &rewriter,
-                         gpu::AsyncOpInterface op) {
-  if (op.getAsyncDependencies().size() != 1)
+isAsyncWithDependencies(ConversionPatternRewriter &rewriter,
+                        gpu::AsyncOpInterface op) {
+  if (op.getAsyncDependencies().empty())
     return rewriter.notifyMatchFailure(
-        op, "Can only convert with exactly one async dependency.");
+        op, "Can only convert with at least one async dependency.");
 
   if (!op.getAsyncToken())
     return rewriter.notifyMatchFailure(op, "Can convert only async version.");
@@ -1875,8 +1964,6 @@ private:
         !isConvertibleAndHasIdentityMaps(memRefType))
       return failure();
 
-    // TODO handle async
-
     auto loc = allocOp.getLoc();
 
     // Get shape of the memref as values: static sizes are constant
@@ -1899,8 +1986,19 @@ private:
     allocatedPtr =
         rewriter.create<LLVM::BitcastOp>(loc, elementPtrType, allocatedPtr);
 
-    rewriter.replaceOp(allocOp, {allocatedPtr});
+    if (!allocOp.getAsyncToken()) {
+      rewriter.replaceOp(allocOp, {allocatedPtr});
+      return success();
+    }
 
+    // The allocation is synchronous, the token only orders the ops after it.
+    Value asyncStream =
+        adaptor.getAsyncDependencies().empty()
+            ? streamCreateCallBuilder.create(loc, rewriter, {}).getResult()
+            : joinAsyncDependencies(rewriter, loc,
+                                    allocOp.getAsyncDependencies(),
+                                    adaptor.getAsyncDependencies());
+    rewriter.replaceOp(allocOp, {allocatedPtr, asyncStream});
     return success();
   }
 };
@@ -2180,6 +2278,7 @@ struct ConvertPolygeistToLLVMPass
         populateGpuToNVVMConversionPatterns(converter, patterns);
       }
       populateMathToLLVMConversionPatterns(converter, patterns);
+      populateComplexToLLVMConversionPatterns(converter, patterns);
       populateOpenMPToLLVMConversionPatterns(converter, patterns);
       arith::populateArithToLLVMConversionPatterns(converter, patterns);
 
@@ -2227,7 +2326,8 @@ struct ConvertPolygeistToLLVMPass
                             LLVM::PowOp, LLVM::SinOp, LLVM::SqrtOp>();
         target.addLegalOp<gpu::YieldOp, gpu::GPUModuleOp, gpu::ModuleEndOp>();
       }
-      target.addDynamicallyLegalOp<omp::ParallelOp, omp::WsLoopOp>(
+      target.addDynamicallyLegalOp<omp::ParallelOp, omp::WsLoopOp,
+                                   omp::TaskOp, omp::TaskGroupOp>(
           [&](Operation *op) { return converter.isLegal(&op->getRegion(0)); });
       target.addIllegalOp<scf::ForOp, scf::IfOp, scf::ParallelOp, scf::WhileOp,
                           scf::ExecuteRegionOp, func::FuncOp>();
@@ -0,0 +1,856 @@
+//===- KernelRecognition.cpp - Dispatch dense kernels to libraries --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Recognizes matrix multiplication, matrix-vector products, batched matrix
+// multiplication, 2-D convolution and transposition written as affine.for
+// nests and replaces them with calls to a kernel library: the packed,
+// cache-blocked microkernels of the polygeist_kernels runtime, or a CBLAS
+// implementation where it provides the kernel.
+//
+// A contraction nest is a band of zero-based, unit-step loops whose innermost
+// body is a single update
+//
+//   out[...] = out[...] + (x[...] * y[...] * alpha...)
+//
+// where every index is a band induction variable (or, for convolutions, the
+// sum of two) and the alpha factors are loop invariant. Operand transposes are
+// read off the index order. An initialization of the output, either
+// `out[...] = 0` or `out[...] = out[...] * beta`, may precede the reduction
+// loops, directly or in a loop of its own (as in PolyBench gemm); it becomes
+// the beta of the call.
+//
+// Nests whose trip counts are known to be too small to amortize the call are
+// left alone. When the trip counts are only known at run time, or when the
+// output may overlap an input (which the library kernels do not allow but the
+// loops do), the call is guarded by a run-time check and the original loops
+// are kept as the fallback.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/Matchers.h"
+#include "polygeist/AliasAnalysis.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "recognize-kernels"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct KernelRecognition : public KernelRecognitionBase<KernelRecognition> {
+  KernelRecognition() = default;
+  KernelRecognition(StringRef library, unsigned minWork) {
+    this->library.setValue(library.str());
+    this->minWork.setValue(minWork);
+  }
+  void runOnOperation() override;
+};
+
+/// The band loops whose induction variables are summed to form one index of
+/// an access, as positions in the band (outermost first).
+using IndexTerms = SmallVector<unsigned, 2>;
+
+struct Access {
+  Value memref;
+  SmallVector<IndexTerms> indices;
+
+  /// The band position of index `i` if it is a single induction variable.
+  Optional<unsigned> single(unsigned i) const {
+    if (indices[i].size() != 1)
+      return llvm::None;
+    return indices[i][0];
+  }
+};
+
+enum class KernelKind { Gemv, Gemm, BatchedGemm, Conv2D, Transpose };
+
+struct Kernel {
+  KernelKind kind;
+  /// The loops of the nest, outermost first. band[0] is what gets replaced.
+  SmallVector<AffineForOp> band;
+  Value out, lhs, rhs;
+  bool transLhs = false, transRhs = false;
+  SmallVector<Value> alpha;
+  /// The beta of the call: null for 1, or the scaling factor, unless the
+  /// output is zero-initialized.
+  Value beta;
+  bool betaZero = false;
+  /// The band positions giving the extents of the kernel arguments, in the
+  /// order the library expects them.
+  SmallVector<unsigned> extents;
+  /// The access of the output followed by those of the inputs.
+  SmallVector<Access> accesses;
+};
+} // namespace
+
+static bool isInvariant(Value v, Operation *root) {
+  return !root->isAncestor(v.getParentRegion()->getParentOp());
+}
+
+static bool collectTerms(AffineExpr expr, ValueRange operands,
+                         unsigned numDims, ArrayRef<AffineForOp> band,
+                         IndexTerms &terms) {
+  if (auto bin = expr.dyn_cast<AffineBinaryOpExpr>()) {
+    if (bin.getKind() != AffineExprKind::Add)
+      return false;
+    return collectTerms(bin.getLHS(), operands, numDims, band, terms) &&
+           collectTerms(bin.getRHS(), operands, numDims, band, terms);
+  }
+  Value operand;
+  if (auto dim = expr.dyn_cast<AffineDimExpr>())
+    operand = operands[dim.getPosition()];
+  else if (auto sym = expr.dyn_cast<AffineSymbolExpr>())
+    operand = operands[numDims + sym.getPosition()];
+  else
+    return false;
+  for (auto en : llvm::enumerate(band))
+    if (en.value().getInductionVar() == operand) {
+      terms.push_back(en.index());
+      return true;
+    }
+  return false;
+}
+
+template <typename T>
+static Optional<Access> getAccess(T op, ArrayRef<AffineForOp> band) {
+  Access access;
+  access.memref = op.getMemRef();
+  AffineMap map = op.getAffineMap();
+  for (AffineExpr expr : map.getResults()) {
+    access.indices.emplace_back();
+    if (!collectTerms(expr, op.getMapOperands(), map.getNumDims(), band,
+                      access.indices.back()))
+      return llvm::None;
+  }
+  return access;
+}
+
+/// Whether `op` accesses `memref` through `map` applied to `operands`.
+template <typename T>
+static bool accessesSame(T op, Value memref, AffineMap map,
+                         ArrayRef<Value> operands) {
+  return op.getMemRef() == memref && op.getAffineMap() == map &&
+         llvm::equal(op.getMapOperands(), operands);
+}
+
+static bool sameBounds(AffineForOp a, AffineForOp b) {
+  return a.getLowerBoundMap() == b.getLowerBoundMap() &&
+         llvm::equal(a.getLowerBoundOperands(), b.getLowerBoundOperands()) &&
+         a.getUpperBoundMap() == b.getUpperBoundMap() &&
+         llvm::equal(a.getUpperBoundOperands(), b.getUpperBoundOperands()) &&
+         a.getStep() == b.getStep();
+}
+
+/// Flatten a tree of multiplications into the loads it multiplies and its
+/// loop-invariant factors.
+static bool flattenProduct(Value v, Operation *root,
+                           SmallVectorImpl<Value> &factors,
+                           SmallVectorImpl<AffineLoadOp> &loads,
+                           SmallPtrSetImpl<Operation *> &ops) {
+  if (isInvariant(v, root)) {
+    factors.push_back(v);
+    return true;
+  }
+  Operation *def = v.getDefiningOp();
+  if (!def)
+    return false;
+  if (matchPattern(v, m_Constant())) {
+    factors.push_back(v);
+    ops.insert(def);
+    return true;
+  }
+  if (auto mul = dyn_cast<arith::MulFOp>(def)) {
+    ops.insert(def);
+    return flattenProduct(mul.getLhs(), root, factors, loads, ops) &&
+           flattenProduct(mul.getRhs(), root, factors, loads, ops);
+  }
+  if (auto load = dyn_cast<AffineLoadOp>(def)) {
+    ops.insert(def);
+    loads.push_back(load);
+    return true;
+  }
+  return false;
+}
+
+/// Match the initialization `out[idx] = 0` or `out[idx] = out[idx] * beta`
+/// made of exactly the operations in `ops`, where idx is `map` applied to
+/// `operands`.
+static bool matchInit(ArrayRef<Operation *> ops, Value out, AffineMap map,
+                      ArrayRef<Value> operands, Operation *root, Kernel &k) {
+  AffineStoreOp store;
+  for (Operation *op : ops)
+    if (auto s = dyn_cast<AffineStoreOp>(op)) {
+      if (store)
+        return false;
+      store = s;
+    }
+  if (!store || !accessesSame(store, out, map, operands))
+    return false;
+
+  SmallPtrSet<Operation *, 4> matched = {store};
+  Value value = store.getValueToStore();
+  if (matchPattern(value, m_AnyZeroFloat())) {
+    k.betaZero = true;
+    if (!isInvariant(value, root))
+      matched.insert(value.getDefiningOp());
+  } else if (auto mul = value.getDefiningOp<arith::MulFOp>()) {
+    matched.insert(mul);
+    Value lhs = mul.getLhs(), rhs = mul.getRhs();
+    auto load = lhs.getDefiningOp<AffineLoadOp>();
+    if (!load || !accessesSame(load, out, map, operands)) {
+      std::swap(lhs, rhs);
+      load = lhs.getDefiningOp<AffineLoadOp>();
+    }
+    if (!load || !accessesSame(load, out, map, operands))
+      return false;
+    matched.insert(load);
+    if (!isInvariant(rhs, root)) {
+      if (!matchPattern(rhs, m_Constant()))
+        return false;
+      matched.insert(rhs.getDefiningOp());
+    }
+    k.beta = rhs;
+  } else {
+    return false;
+  }
+  return llvm::all_of(ops, [&](Operation *op) { return matched.count(op); });
+}
+
+/// Check the structure of the band around the update statement: every loop
+/// holds only the next one and parts of the product hoisted out of it, except
+/// that one level may also initialize the output before the reduction loops.
+static bool matchBandStructure(Kernel &k, AffineStoreOp update,
+                               ArrayRef<unsigned> outDims,
+                               ArrayRef<unsigned> redDims,
+                               const SmallPtrSetImpl<Operation *> &productOps) {
+  Operation *root = k.band[0];
+  unsigned firstRed = *llvm::min_element(redDims);
+  bool seenInit = false;
+  for (unsigned m = 0; m + 1 < k.band.size(); m++) {
+    SmallVector<Operation *> before;
+    bool seenNext = false;
+    for (Operation &op : k.band[m].getBody()->without_terminator()) {
+      if (&op == k.band[m + 1])
+        seenNext = true;
+      else if (seenNext)
+        return false;
+      else if (!productOps.count(&op))
+        before.push_back(&op);
+    }
+    if (before.empty())
+      continue;
+    if (seenInit || m >= firstRed)
+      return false;
+    seenInit = true;
+
+    SmallVector<Value> operands(update.getMapOperands());
+    SmallVector<unsigned> inner;
+    for (unsigned d : outDims)
+      if (d > m)
+        inner.push_back(d);
+    if (inner.empty()) {
+      // The initialization is in the same loop as the reduction.
+      if (!matchInit(before, k.out, update.getAffineMap(), operands, root, k))
+        return false;
+      continue;
+    }
+
+    // The initialization has its own loop over the one output dimension that
+    // is iterated inside the reduction.
+    AffineForOp init;
+    if (inner.size() != 1 || before.size() != 1 ||
+        !(init = dyn_cast<AffineForOp>(before[0])) ||
+        init.getNumResults() != 0 || !sameBounds(init, k.band[inner[0]]))
+      return false;
+    for (Value &v : operands)
+      if (v == k.band[inner[0]].getInductionVar())
+        v = init.getInductionVar();
+    SmallVector<Operation *> initOps;
+    for (Operation &op : init.getBody()->without_terminator())
+      initOps.push_back(&op);
+    if (!matchInit(initOps, k.out, update.getAffineMap(), operands, root, k))
+      return false;
+  }
+  return true;
+}
+
+static bool isSupportedMemRef(Value memref, unsigned rank, Type elementType) {
+  auto MT = memref.getType().dyn_cast<MemRefType>();
+  return MT && MT.getRank() == rank && MT.getLayout().isIdentity() &&
+         MT.getMemorySpaceAsInt() == 0 && MT.getElementType() == elementType;
+}
+
+/// Classify a contraction from the accesses of its update statement.
+static bool classify(Kernel &k, const Access &out, const Access &x,
+                     const Access &y, ArrayRef<unsigned> outDims,
+                     ArrayRef<unsigned> redDims) {
+  auto hasDims = [](const Access &a, unsigned from, unsigned d0, unsigned d1,
+                    bool &transposed) {
+    auto i0 = a.single(from), i1 = a.single(from + 1);
+    if (!i0 || !i1)
+      return false;
+    transposed = *i0 == d1 && *i1 == d0;
+    return (*i0 == d0 && *i1 == d1) || transposed;
+  };
+
+  Type elementType = out.memref.getType().cast<MemRefType>().getElementType();
+  unsigned rank = out.indices.size();
+  if (outDims.size() == 1 && redDims.size() == 1 && rank == 1) {
+    // y[i] += A[i][j] * x[j]
+    const Access *A = &x, *v = &y;
+    if (A->indices.size() != 2)
+      std::swap(A, v);
+    if (A->indices.size() != 2 || v->indices.size() != 1 ||
+        v->single(0) != redDims[0] ||
+        !hasDims(*A, 0, outDims[0], redDims[0], k.transLhs))
+      return false;
+    k.kind = KernelKind::Gemv;
+    k.lhs = A->memref;
+    k.rhs = v->memref;
+    // The extents of A as it is stored.
+    if (k.transLhs)
+      k.extents = {redDims[0], outDims[0]};
+    else
+      k.extents = {outDims[0], redDims[0]};
+    return isSupportedMemRef(k.lhs, 2, elementType) &&
+           isSupportedMemRef(k.rhs, 1, elementType);
+  }
+
+  if (outDims.size() == 2 && redDims.size() == 1 && rank == 2) {
+    // C[i][j] += A[i][k] * B[k][j]
+    const Access *A = &x, *B = &y;
+    if (!llvm::is_contained(A->indices, IndexTerms{outDims[0]}))
+      std::swap(A, B);
+    if (A->indices.size() != 2 || B->indices.size() != 2 ||
+        !hasDims(*A, 0, outDims[0], redDims[0], k.transLhs) ||
+        !hasDims(*B, 0, redDims[0], outDims[1], k.transRhs))
+      return false;
+    k.kind = KernelKind::Gemm;
+    k.lhs = A->memref;
+    k.rhs = B->memref;
+    k.extents = {outDims[0], outDims[1], redDims[0]};
+    return isSupportedMemRef(k.lhs, 2, elementType) &&
+           isSupportedMemRef(k.rhs, 2, elementType);
+  }
+
+  if (outDims.size() == 3 && redDims.size() == 1 && rank == 3) {
+    // C[b][i][j] += A[b][i][k] * B[b][k][j]
+    const Access *A = &x, *B = &y;
+    if (A->indices.size() != 3 || B->indices.size() != 3 ||
+        A->single(0) != outDims[0] || B->single(0) != outDims[0])
+      return false;
+    if (!llvm::is_contained(A->indices, IndexTerms{outDims[1]}))
+      std::swap(A, B);
+    if (!hasDims(*A, 1, outDims[1], redDims[0], k.transLhs) ||
+        !hasDims(*B, 1, redDims[0], outDims[2], k.transRhs))
+      return false;
+    k.kind = KernelKind::BatchedGemm;
+    k.lhs = A->memref;
+    k.rhs = B->memref;
+    k.extents = {outDims[0], outDims[1], outDims[2], redDims[0]};
+    return isSupportedMemRef(k.lhs, 3, elementType) &&
+           isSupportedMemRef(k.rhs, 3, elementType);
+  }
+
+  if (outDims.size() == 2 && redDims.size() == 2 && rank == 2) {
+    // out[i][j] += w[p][q] * in[i + p][j + q]
+    const Access *in = &x, *w = &y;
+    if (!w->single(0) || !w->single(1))
+      std::swap(in, w);
+    if (in->indices.size() != 2 || w->indices.size() != 2)
+      return false;
+    auto p = w->single(0), q = w->single(1);
+    if (!p || !q || *p == *q || !llvm::is_contained(redDims, *p) ||
+        !llvm::is_contained(redDims, *q))
+      return false;
+    auto isSum = [](IndexTerms terms, unsigned a, unsigned b) {
+      llvm::sort(terms);
+      return terms == IndexTerms{std::min(a, b), std::max(a, b)};
+    };
+    if (!isSum(in->indices[0], outDims[0], *p) ||
+        !isSum(in->indices[1], outDims[1], *q))
+      return false;
+    k.kind = KernelKind::Conv2D;
+    k.lhs = in->memref;
+    k.rhs = w->memref;
+    k.extents = {outDims[0], outDims[1], *p, *q};
+    return isSupportedMemRef(k.lhs, 2, elementType) &&
+           isSupportedMemRef(k.rhs, 2, elementType);
+  }
+  return false;
+}
+
+static bool hasSimpleBounds(ArrayRef<AffineForOp> band) {
+  Operation *root = band[0];
+  for (AffineForOp loop : band) {
+    if (loop.getNumResults() != 0 || loop.getStep() != 1 ||
+        !loop.hasConstantLowerBound() || loop.getConstantLowerBound() != 0 ||
+        loop.getUpperBoundMap().getNumResults() != 1)
+      return false;
+    if (!llvm::all_of(loop.getUpperBoundOperands(),
+                      [&](Value v) { return isInvariant(v, root); }))
+      return false;
+  }
+  return true;
+}
+
+/// The perfectly enclosing affine.for loops of `op`, outermost first.
+static SmallVector<AffineForOp> getEnclosingLoops(Operation *op) {
+  SmallVector<AffineForOp> chain;
+  for (Operation *parent = op->getParentOp(); isa<AffineForOp>(parent);
+       parent = parent->getParentOp())
+    chain.push_back(cast<AffineForOp>(parent));
+  std::reverse(chain.begin(), chain.end());
+  return chain;
+}
+
+/// The innermost enclosing loops of `op` up to the outermost one whose
+/// induction variable is used by `accessOps`, outermost first.
+static SmallVector<AffineForOp> getBand(Operation *op,
+                                        ArrayRef<Operation *> accessOps) {
+  SmallVector<AffineForOp> chain = getEnclosingLoops(op);
+  unsigned first = chain.size();
+  for (Operation *accessOp : accessOps)
+    for (Value v : accessOp->getOperands())
+      for (auto en : llvm::enumerate(chain))
+        if (en.value().getInductionVar() == v)
+          first = std::min(first, (unsigned)en.index());
+  return SmallVector<AffineForOp>(chain.begin() + first, chain.end());
+}
+
+static Optional<Kernel> matchContraction(AffineStoreOp update) {
+  auto add = update.getValueToStore().getDefiningOp<arith::AddFOp>();
+  if (!add || add->getBlock() != update->getBlock())
+    return llvm::None;
+  Value acc = add.getLhs(), product = add.getRhs();
+  auto accLoad = acc.getDefiningOp<AffineLoadOp>();
+  if (!accLoad || !accessesSame(accLoad, update.getMemRef(),
+                                update.getAffineMap(),
+                                llvm::to_vector(update.getMapOperands()))) {
+    std::swap(acc, product);
+    accLoad = acc.getDefiningOp<AffineLoadOp>();
+  }
+  if (!accLoad || !accessesSame(accLoad, update.getMemRef(),
+                                update.getAffineMap(),
+                                llvm::to_vector(update.getMapOperands())))
+    return llvm::None;
+
+  // Loop-invariant code motion may have hoisted parts of the product out of
+  // the inner loops, so the band is found from the operand loads rather than
+  // from the innermost body alone.
+  SmallVector<AffineForOp> enclosing = getEnclosingLoops(update);
+  if (enclosing.empty())
+    return llvm::None;
+  Kernel k;
+  SmallVector<AffineLoadOp> loads;
+  SmallPtrSet<Operation *, 8> productOps;
+  if (!flattenProduct(product, enclosing[0], k.alpha, loads, productOps) ||
+      loads.size() != 2)
+    return llvm::None;
+  k.band = getBand(update, {update, loads[0], loads[1]});
+  if (k.band.size() < 2 || update->getParentOp() != k.band.back() ||
+      !hasSimpleBounds(k.band))
+    return llvm::None;
+  for (Operation *op : productOps)
+    if (!op->hasTrait<OpTrait::ConstantLike>() && !k.band[0]->isAncestor(op))
+      return llvm::None;
+  for (Operation &op : k.band.back().getBody()->without_terminator())
+    if (&op != update && &op != add && &op != accLoad &&
+        !productOps.count(&op))
+      return llvm::None;
+
+  auto out = getAccess(update, k.band);
+  auto x = getAccess(loads[0], k.band);
+  auto y = getAccess(loads[1], k.band);
+  if (!out || !x || !y || x->memref == out->memref ||
+      y->memref == out->memref)
+    return llvm::None;
+
+  // The output is indexed by distinct induction variables; the remaining
+  // band loops are the reduction.
+  SmallVector<unsigned> outDims, redDims;
+  for (unsigned i = 0; i < out->indices.size(); i++) {
+    auto d = out->single(i);
+    if (!d || llvm::is_contained(outDims, *d))
+      return llvm::None;
+    outDims.push_back(*d);
+  }
+  for (unsigned d = 0; d < k.band.size(); d++)
+    if (!llvm::is_contained(outDims, d))
+      redDims.push_back(d);
+  if (redDims.empty())
+    return llvm::None;
+
+  k.out = out->memref;
+  Type elementType = k.out.getType().cast<MemRefType>().getElementType();
+  if (!elementType.isF32() && !elementType.isF64())
+    return llvm::None;
+  if (!isSupportedMemRef(k.out, out->indices.size(), elementType) ||
+      !classify(k, *out, *x, *y, outDims, redDims) ||
+      !matchBandStructure(k, update, outDims, redDims, productOps))
+    return llvm::None;
+  k.accesses = {*out, *x, *y};
+  return k;
+}
+
+static Optional<Kernel> matchTranspose(AffineStoreOp store) {
+  auto load = store.getValueToStore().getDefiningOp<AffineLoadOp>();
+  if (!load || load->getBlock() != store->getBlock())
+    return llvm::None;
+  Kernel k;
+  k.kind = KernelKind::Transpose;
+  k.band = getBand(store, {store, load});
+  if (k.band.size() != 2 || store->getParentOp() != k.band[1] ||
+      !hasSimpleBounds(k.band) ||
+      k.band[1].getBody()->getOperations().size() != 3 ||
+      k.band[0].getBody()->getOperations().size() != 2)
+    return llvm::None;
+  auto src = getAccess(load, k.band);
+  auto dst = getAccess(store, k.band);
+  if (!src || !dst || src->indices.size() != 2 || dst->indices.size() != 2 ||
+      src->memref == dst->memref)
+    return llvm::None;
+  auto a = src->single(0), b = src->single(1);
+  if (!a || !b || *a == *b || dst->single(0) != *b || dst->single(1) != *a)
+    return llvm::None;
+  k.lhs = src->memref;
+  k.out = dst->memref;
+  k.extents = {*a, *b};
+  Type elementType = k.out.getType().cast<MemRefType>().getElementType();
+  if ((!elementType.isF32() && !elementType.isF64()) ||
+      !isSupportedMemRef(k.lhs, 2, elementType) ||
+      !isSupportedMemRef(k.out, 2, elementType))
+    return llvm::None;
+  k.accesses = {*dst, *src};
+  return k;
+}
+
+static func::FuncOp getOrCreateFunction(ModuleOp module, StringRef name,
+                                        FunctionType type) {
+  if (auto fn = module.lookupSymbol<func::FuncOp>(name))
+    return fn.getFunctionType() == type ? fn : nullptr;
+  if (module.lookupSymbol(name))
+    return nullptr;
+  OpBuilder builder(module.getContext());
+  builder.setInsertionPointToStart(module.getBody());
+  auto fn = builder.create<func::FuncOp>(module.getLoc(), name, type);
+  fn.setPrivate();
+  return fn;
+}
+
+namespace {
+/// Builds the arguments of a kernel library call in front of the nest.
+struct CallBuilder {
+  OpBuilder &builder;
+  Location loc;
+  Kernel &k;
+  Type elementType;
+  bool cblas;
+  SmallVector<Value> args;
+
+  Type intType() { return builder.getIntegerType(cblas ? 32 : 64); }
+
+  Value toInt(Value index) {
+    return builder.create<arith::IndexCastOp>(loc, intType(), index);
+  }
+
+  /// The trip count of band loop `d`, clamped at zero.
+  Value extent(unsigned d) {
+    AffineForOp loop = k.band[d];
+    Value ub = builder.create<AffineApplyOp>(loc, loop.getUpperBoundMap(),
+                                             loop.getUpperBoundOperands());
+    Value zero = builder.create<arith::ConstantIndexOp>(loc, 0);
+    return builder.create<arith::MaxSIOp>(loc, ub, zero);
+  }
+
+  /// The distance between consecutive indices of dimension `dim` of a
+  /// row-major memref.
+  Value stride(Value memref, unsigned dim) {
+    auto MT = memref.getType().cast<MemRefType>();
+    Value s = builder.create<arith::ConstantIndexOp>(loc, 1);
+    for (unsigned i = dim + 1; i < MT.getRank(); i++) {
+      Value size;
+      if (MT.isDynamicDim(i))
+        size = builder.create<memref::DimOp>(loc, memref, i);
+      else
+        size = builder.create<arith::ConstantIndexOp>(loc, MT.getDimSize(i));
+      s = builder.create<arith::MulIOp>(loc, s, size);
+    }
+    return s;
+  }
+
+  Value pointer(Value memref) {
+    return builder.create<polygeist::Memref2PointerOp>(
+        loc, LLVM::LLVMPointerType::get(elementType), memref);
+  }
+
+  /// The addresses of the first element `access` reaches in the nest and of
+  /// the byte past the last one, as integers.
+  std::pair<Value, Value> footprint(const Access &access) {
+    Type i64 = builder.getI64Type();
+    Value begin =
+        builder.create<LLVM::PtrToIntOp>(loc, i64, pointer(access.memref));
+    Value one = builder.create<arith::ConstantIndexOp>(loc, 1);
+    Value last = builder.create<arith::ConstantIndexOp>(loc, 0);
+    for (auto en : llvm::enumerate(access.indices)) {
+      Value index = builder.create<arith::ConstantIndexOp>(loc, 0);
+      for (unsigned d : en.value())
+        index = builder.create<arith::AddIOp>(
+            loc, index, builder.create<arith::SubIOp>(loc, extent(d), one));
+      last = builder.create<arith::AddIOp>(
+          loc, last,
+          builder.create<arith::MulIOp>(loc, index,
+                                        stride(access.memref, en.index())));
+    }
+    Value count = builder.create<arith::IndexCastOp>(
+        loc, i64, builder.create<arith::AddIOp>(loc, last, one));
+    Value size = builder.create<arith::ConstantIntOp>(
+        loc, elementType.getIntOrFloatBitWidth() / 8, 64);
+    Value end = builder.create<arith::AddIOp>(
+        loc, begin, builder.create<arith::MulIOp>(loc, count, size));
+    return {begin, end};
+  }
+
+  /// Whether the elements reached through `a` and `b` do not overlap.
+  Value disjoint(const Access &a, const Access &b) {
+    auto [beginA, endA] = footprint(a);
+    auto [beginB, endB] = footprint(b);
+    Value before = builder.create<arith::CmpIOp>(
+        loc, arith::CmpIPredicate::ule, endA, beginB);
+    Value after = builder.create<arith::CmpIOp>(
+        loc, arith::CmpIPredicate::ule, endB, beginA);
+    return builder.create<arith::OrIOp>(loc, before, after);
+  }
+
+  Value scalar(double v) {
+    return builder.create<arith::ConstantOp>(
+        loc, builder.getFloatAttr(elementType, v));
+  }
+
+  Value materialize(Value v) {
+    if (isInvariant(v, k.band[0]))
+      return v;
+    return builder.clone(*v.getDefiningOp())->getResult(0);
+  }
+
+  Value alpha() {
+    Value a;
+    for (Value f : k.alpha) {
+      f = materialize(f);
+      a = a ? builder.create<arith::MulFOp>(loc, a, f) : f;
+    }
+    return a ? a : scalar(1.0);
+  }
+
+  Value beta() {
+    if (k.betaZero)
+      return scalar(0.0);
+    if (k.beta)
+      return materialize(k.beta);
+    return scalar(1.0);
+  }
+
+  Value flag(bool transposed) {
+    // CBLAS_TRANSPOSE: CblasNoTrans = 111, CblasTrans = 112.
+    int64_t v = cblas ? (transposed ? 112 : 111) : transposed;
+    return builder.create<arith::ConstantIntOp>(loc, v, 32);
+  }
+
+  void add(Value v) { args.push_back(v); }
+  void addExtent(unsigned d) { add(toInt(extent(d))); }
+  void addMatrix(Value memref, unsigned dim = 0) {
+    add(pointer(memref));
+    add(toInt(stride(memref, dim)));
+  }
+};
+} // namespace
+
+/// Replace the nest of `k` by a library call. Returns false if the nest is
+/// too small to be worth it or the library does not provide the kernel.
+static bool dispatch(Kernel &k, StringRef library, unsigned minWork,
+                     polygeist::AliasAnalysis &aa) {
+  AffineForOp root = k.band[0];
+  ModuleOp module = root->getParentOfType<ModuleOp>();
+  bool cblas = library == "cblas" &&
+               (k.kind == KernelKind::Gemm || k.kind == KernelKind::Gemv);
+
+  // The nest performs one multiply-add (or one copy for transposes) per
+  // iteration.
+  uint64_t work = 1;
+  bool isStatic = true;
+  for (AffineForOp loop : k.band) {
+    if (!loop.hasConstantUpperBound()) {
+      isStatic = false;
+      break;
+    }
+    work *= std::max<int64_t>(loop.getConstantUpperBound(), 0);
+  }
+  if (isStatic && work < minWork)
+    return false;
+
+  OpBuilder builder(root);
+  Location loc = root.getLoc();
+  Operation *beforeArgs = root->getPrevNode();
+  Type elementType = k.out.getType().cast<MemRefType>().getElementType();
+  CallBuilder call{builder, loc, k, elementType, cblas, {}};
+  std::string name = cblas ? "cblas_" : "polygeist_";
+  name += elementType.isF32() ? "s" : "d";
+
+  switch (k.kind) {
+  case KernelKind::Gemv:
+    name += "gemv";
+    if (cblas)
+      call.add(builder.create<arith::ConstantIntOp>(loc, 101, 32));
+    call.add(call.flag(k.transLhs));
+    call.addExtent(k.extents[0]);
+    call.addExtent(k.extents[1]);
+    call.add(call.alpha());
+    call.addMatrix(k.lhs);
+    call.add(call.pointer(k.rhs));
+    if (cblas)
+      call.add(builder.create<arith::ConstantIntOp>(loc, 1, 32));
+    call.add(call.beta());
+    call.add(call.pointer(k.out));
+    if (cblas)
+      call.add(builder.create<arith::ConstantIntOp>(loc, 1, 32));
+    break;
+  case KernelKind::Gemm:
+    name += "gemm";
+    if (cblas)
+      // CblasRowMajor
+      call.add(builder.create<arith::ConstantIntOp>(loc, 101, 32));
+    call.add(call.flag(k.transLhs));
+    call.add(call.flag(k.transRhs));
+    for (unsigned d : k.extents)
+      call.addExtent(d);
+    call.add(call.alpha());
+    call.addMatrix(k.lhs);
+    call.addMatrix(k.rhs);
+    call.add(call.beta());
+    call.addMatrix(k.out);
+    break;
+  case KernelKind::BatchedGemm:
+    name += "gemm_batched";
+    call.add(call.flag(k.transLhs));
+    call.add(call.flag(k.transRhs));
+    for (unsigned d : k.extents)
+      call.addExtent(d);
+    call.add(call.alpha());
+    call.addMatrix(k.lhs, 1);
+    call.add(call.toInt(call.stride(k.lhs, 0)));
+    call.addMatrix(k.rhs, 1);
+    call.add(call.toInt(call.stride(k.rhs, 0)));
+    call.add(call.beta());
+    call.addMatrix(k.out, 1);
+    call.add(call.toInt(call.stride(k.out, 0)));
+    break;
+  case KernelKind::Conv2D:
+    name += "conv2d";
+    for (unsigned d : k.extents)
+      call.addExtent(d);
+    call.add(call.alpha());
+    call.addMatrix(k.lhs);
+    call.addMatrix(k.rhs);
+    call.add(call.beta());
+    call.addMatrix(k.out);
+    break;
+  case KernelKind::Transpose:
+    name += "transpose";
+    for (unsigned d : k.extents)
+      call.addExtent(d);
+    call.addMatrix(k.lhs);
+    call.addMatrix(k.out);
+    break;
+  }
+
+  auto fn = getOrCreateFunction(
+      module, name,
+      builder.getFunctionType(ValueRange(call.args).getTypes(), {}));
+  if (!fn) {
+    // The symbol is taken by something else; drop the argument computations
+    // and leave the loops alone.
+    while (root->getPrevNode() != beforeArgs)
+      root->getPrevNode()->erase();
+    return false;
+  }
+
+  Value guard;
+  auto addGuard = [&](Value cond) {
+    guard = guard ? builder.create<arith::AndIOp>(loc, guard, cond) : cond;
+  };
+  if (!isStatic) {
+    Value total = builder.create<arith::ConstantIndexOp>(loc, 1);
+    for (unsigned d = 0; d < k.band.size(); d++)
+      total = builder.create<arith::MulIOp>(loc, total, call.extent(d));
+    addGuard(builder.create<arith::CmpIOp>(
+        loc, arith::CmpIPredicate::sge, total,
+        builder.create<arith::ConstantIndexOp>(loc, minWork)));
+  }
+  const Access &out = k.accesses[0];
+  for (const Access &input : llvm::drop_begin(k.accesses))
+    if (aa.mayAlias(out.memref, input.memref))
+      addGuard(call.disjoint(out, input));
+
+  if (!guard) {
+    builder.create<func::CallOp>(loc, fn, call.args);
+    root->erase();
+    return true;
+  }
+
+  auto ifOp = builder.create<scf::IfOp>(loc, guard, /*hasElse*/ true);
+  OpBuilder thenBuilder = ifOp.getThenBodyBuilder();
+  thenBuilder.create<func::CallOp>(loc, fn, call.args);
+  root->moveBefore(ifOp.elseBlock()->getTerminator());
+  return true;
+}
+
+void KernelRecognition::runOnOperation() {
+  if (library != "polygeist" && library != "cblas") {
+    getOperation()->emitError() << "unknown kernel library '" << library
+                                << "', expected 'polygeist' or 'cblas'";
+    signalPassFailure();
+    return;
+  }
+
+  auto &aa = getAnalysis<polygeist::AliasAnalysis>();
+  SmallVector<Kernel> kernels;
+  SmallPtrSet<Operation *, 4> roots;
+  getOperation()->walk([&](AffineStoreOp store) {
+    Optional<Kernel> k = matchContraction(store);
+    if (!k)
+      k = matchTranspose(store);
+    if (k && roots.insert(k->band[0]).second)
+      kernels.push_back(std::move(*k));
+  });
+
+  for (Kernel &k : kernels)
+    if (dispatch(k, library, minWork, aa)) {
+      LLVM_DEBUG(llvm::dbgs() << "dispatched kernel nest at "
+                              << k.band[0].getLoc() << "\n");
+      aa.invalidate();
+    }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createKernelRecognitionPass(StringRef library,
+                                                  unsigned minWork) {
+  return std::make_unique<KernelRecognition>(library, minWork);
+}
+} // namespace polygeist
+} // namespace mlir
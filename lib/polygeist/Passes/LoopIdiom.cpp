@@ -0,0 +1,398 @@
+//===- LoopIdiom.cpp - Replace copy and fill loops with memcpy and memset -===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Recognizes perfect nests of affine.for and scf.for whose innermost body
+// copies one memref into another or fills a memref with a constant, and
+// replaces them with a single llvm.memcpy or llvm.memset:
+//
+//    for (i = lb; i < ub; i++)
+//      for (j = 0; j < 64; j++)
+//        A[k][i][j] = B[i][j];
+//      =>  memcpy(&A[k][lb][0], &B[lb][0], (ub - lb) * 64 * sizeof(*A))
+//
+// The induction variables must index the trailing dimensions of identity
+// layout memrefs in nest order, and all loops but the outermost must cover
+// their dimension from zero with unit step, so that the nest walks one
+// contiguous range. Only the leading dimensions of a nest may be dropped when
+// they do not qualify. Fills must store a constant whose bytes are all equal
+// and copies must be between memrefs that do not alias.
+//
+// The canonicalization patterns of memref2pointer expand memcpy and memset on
+// memrefs back into loops, so the calls created here are marked with the
+// `polygeist.loop_idiom` attribute to be left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "mlir/IR/Matchers.h"
+#include "polygeist/AliasAnalysis.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "loop-idiom"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct LoopIdiom : public LoopIdiomBase<LoopIdiom> {
+  void runOnOperation() override;
+};
+
+/// A load or store of the innermost body: `memref` indexed by the results of
+/// `map` applied to `operands`.
+struct Access {
+  Value memref;
+  AffineMap map;
+  SmallVector<Value> operands;
+};
+} // namespace
+
+static bool isInvariant(Value v, Operation *loop) {
+  return !loop->isAncestor(v.getParentRegion()->getParentOp());
+}
+
+/// Returns true if `op` is a loop the pass can replace: an affine.for or
+/// scf.for without loop-carried values.
+static bool isForLoop(Operation *op) {
+  if (auto forOp = dyn_cast<AffineForOp>(op))
+    return forOp.getNumIterOperands() == 0;
+  if (auto forOp = dyn_cast<scf::ForOp>(op))
+    return forOp.getNumIterOperands() == 0;
+  return false;
+}
+
+static Block &getBody(Operation *loop) { return loop->getRegion(0).front(); }
+
+static Value getIV(Operation *loop) { return getBody(loop).getArgument(0); }
+
+static Optional<int64_t> getConstantBound(Operation *loop, bool upper) {
+  if (auto forOp = dyn_cast<AffineForOp>(loop)) {
+    if (upper ? !forOp.hasConstantUpperBound()
+              : !forOp.hasConstantLowerBound())
+      return llvm::None;
+    return upper ? forOp.getConstantUpperBound()
+                 : forOp.getConstantLowerBound();
+  }
+  auto forOp = cast<scf::ForOp>(loop);
+  return getConstantIntValue(upper ? forOp.getUpperBound()
+                                   : forOp.getLowerBound());
+}
+
+static bool hasUnitStep(Operation *loop) {
+  if (auto forOp = dyn_cast<AffineForOp>(loop))
+    return forOp.getStep() == 1;
+  Optional<int64_t> step =
+      getConstantIntValue(cast<scf::ForOp>(loop).getStep());
+  return step && *step == 1;
+}
+
+/// Returns true if the bounds of `loop` are single values, without the min
+/// or max of several affine expressions.
+static bool hasSimpleBounds(Operation *loop) {
+  if (auto forOp = dyn_cast<AffineForOp>(loop))
+    return forOp.getLowerBoundMap().getNumResults() == 1 &&
+           forOp.getUpperBoundMap().getNumResults() == 1;
+  return true;
+}
+
+static Value getBound(OpBuilder &builder, Operation *loop, bool upper) {
+  if (auto forOp = dyn_cast<AffineForOp>(loop)) {
+    if (upper)
+      return builder.create<AffineApplyOp>(loop->getLoc(),
+                                           forOp.getUpperBoundMap(),
+                                           forOp.getUpperBoundOperands());
+    return builder.create<AffineApplyOp>(loop->getLoc(),
+                                         forOp.getLowerBoundMap(),
+                                         forOp.getLowerBoundOperands());
+  }
+  auto forOp = cast<scf::ForOp>(loop);
+  return upper ? forOp.getUpperBound() : forOp.getLowerBound();
+}
+
+static Optional<Access> getAccess(Operation *op) {
+  if (auto load = dyn_cast<AffineLoadOp>(op))
+    return Access{load.getMemRef(), load.getAffineMap(),
+                  llvm::to_vector(load.getMapOperands())};
+  if (auto store = dyn_cast<AffineStoreOp>(op))
+    return Access{store.getMemRef(), store.getAffineMap(),
+                  llvm::to_vector(store.getMapOperands())};
+  Value memref;
+  SmallVector<Value> indices;
+  if (auto load = dyn_cast<memref::LoadOp>(op)) {
+    memref = load.getMemref();
+    indices = llvm::to_vector(load.getIndices());
+  } else if (auto store = dyn_cast<memref::StoreOp>(op)) {
+    memref = store.getMemref();
+    indices = llvm::to_vector(store.getIndices());
+  } else {
+    return llvm::None;
+  }
+  return Access{memref,
+                AffineMap::getMultiDimIdentityMap(indices.size(),
+                                                  op->getContext()),
+                indices};
+}
+
+/// Returns the operand `expr` refers to if it is a single dimension or
+/// symbol of the map of `access`.
+static Value getOperand(const Access &access, AffineExpr expr) {
+  if (auto dim = expr.dyn_cast<AffineDimExpr>())
+    return access.operands[dim.getPosition()];
+  if (auto sym = expr.dyn_cast<AffineSymbolExpr>())
+    return access.operands[access.map.getNumDims() + sym.getPosition()];
+  return nullptr;
+}
+
+/// Returns the number of bytes of the elements of `memref`, if the pass can
+/// address them.
+static Optional<unsigned> getElementBytes(MemRefType memref) {
+  Type elTy = memref.getElementType();
+  if (!elTy.isIntOrFloat() || elTy.getIntOrFloatBitWidth() % 8 != 0)
+    return llvm::None;
+  return elTy.getIntOrFloatBitWidth() / 8;
+}
+
+/// Returns true if the iterations of `nest`, outermost first, visit one
+/// contiguous range of elements of `access`.
+static bool isContiguous(const Access &access, ArrayRef<Operation *> nest) {
+  auto mt = access.memref.getType().cast<MemRefType>();
+  if (!mt.getLayout().isIdentity() || !getElementBytes(mt) ||
+      mt.getRank() < (int64_t)nest.size())
+    return false;
+  for (int64_t size : mt.getShape().drop_front())
+    if (size == ShapedType::kDynamicSize)
+      return false;
+
+  unsigned rank = mt.getRank();
+  unsigned dim = rank - nest.size();
+  for (unsigned i = 0; i < rank; ++i) {
+    AffineExpr expr = access.map.getResult(i);
+    if (i >= dim) {
+      if (getOperand(access, expr) != getIV(nest[i - dim]))
+        return false;
+      continue;
+    }
+    // The leading indices are computed once, before the nest.
+    for (auto en : llvm::enumerate(access.operands)) {
+      bool used = en.index() < access.map.getNumDims()
+                      ? expr.isFunctionOfDim(en.index())
+                      : expr.isFunctionOfSymbol(en.index() -
+                                                access.map.getNumDims());
+      if (used && !isInvariant(en.value(), nest.front()))
+        return false;
+    }
+  }
+
+  for (unsigned i = 1; i < nest.size(); ++i) {
+    Optional<int64_t> lb = getConstantBound(nest[i], /*upper*/ false);
+    Optional<int64_t> ub = getConstantBound(nest[i], /*upper*/ true);
+    if (!lb || *lb != 0 || !ub || *ub != mt.getDimSize(dim + i) ||
+        !hasUnitStep(nest[i]))
+      return false;
+  }
+  return hasUnitStep(nest.front()) && hasSimpleBounds(nest.front());
+}
+
+/// Returns the number of elements between consecutive indices of dimension
+/// `dim` of `memref`.
+static int64_t getStride(MemRefType memref, unsigned dim) {
+  int64_t stride = 1;
+  for (int64_t size : memref.getShape().drop_front(dim + 1))
+    stride *= size;
+  return stride;
+}
+
+/// Returns a pointer to the first element the nest of `numLoops` loops
+/// starting at `lb` visits through `access`.
+static Value getStartPointer(OpBuilder &builder, Location loc,
+                             const Access &access, unsigned numLoops,
+                             Value lb) {
+  auto mt = access.memref.getType().cast<MemRefType>();
+  unsigned dim = mt.getRank() - numLoops;
+  Value offset = builder.create<arith::MulIOp>(
+      loc, lb,
+      builder.create<arith::ConstantIndexOp>(loc, getStride(mt, dim)));
+  for (unsigned i = 0; i < dim; ++i) {
+    AffineExpr expr = access.map.getResult(i);
+    Value idx = getOperand(access, expr);
+    if (!idx) {
+      // Only keep the operands the index uses: the others may be induction
+      // variables of the nest, which is about to be erased.
+      AffineMap map = access.map.getSubMap({i});
+      SmallVector<Value> operands(access.operands);
+      canonicalizeMapAndOperands(&map, &operands);
+      idx = builder.create<AffineApplyOp>(loc, map, operands);
+    }
+    offset = builder.create<arith::AddIOp>(
+        loc, offset,
+        builder.create<arith::MulIOp>(
+            loc, idx,
+            builder.create<arith::ConstantIndexOp>(loc, getStride(mt, i))));
+  }
+
+  Value ptr = builder.create<polygeist::Memref2PointerOp>(
+      loc,
+      LLVM::LLVMPointerType::get(mt.getElementType(),
+                                 mt.getMemorySpaceAsInt()),
+      access.memref);
+  Value idxs[] = {
+      builder.create<arith::IndexCastOp>(loc, builder.getI64Type(), offset)};
+  return builder.create<LLVM::GEPOp>(loc, ptr.getType(), ptr, idxs);
+}
+
+/// Returns the byte all bytes of the constant `attr` are equal to.
+static Optional<uint8_t> getSplatByte(Attribute attr) {
+  APInt bits;
+  if (auto intAttr = attr.dyn_cast<IntegerAttr>())
+    bits = intAttr.getValue();
+  else if (auto floatAttr = attr.dyn_cast<FloatAttr>())
+    bits = floatAttr.getValue().bitcastToAPInt();
+  else
+    return llvm::None;
+  if (bits.getBitWidth() % 8 != 0)
+    return llvm::None;
+  APInt byte = bits.extractBits(8, 0);
+  for (unsigned i = 8; i < bits.getBitWidth(); i += 8)
+    if (bits.extractBits(8, i) != byte)
+      return llvm::None;
+  return byte.getZExtValue();
+}
+
+/// Returns the store of the body of the innermost loop `loop`, and in `load`
+/// the load it copies, if the body does nothing else.
+static Operation *getStore(Operation *loop, Operation *&load) {
+  Operation *store = nullptr;
+  load = nullptr;
+  for (Operation &op : getBody(loop).without_terminator()) {
+    if (op.hasTrait<OpTrait::ConstantLike>())
+      continue;
+    if (isa<AffineLoadOp, memref::LoadOp>(op) && !load) {
+      load = &op;
+      continue;
+    }
+    if (isa<AffineStoreOp, memref::StoreOp>(op) && !store) {
+      store = &op;
+      continue;
+    }
+    return nullptr;
+  }
+  if (!store)
+    return nullptr;
+  Value stored = store->getOperand(0);
+  if (load)
+    return stored == load->getResult(0) && load->getResult(0).hasOneUse()
+               ? store
+               : nullptr;
+  return matchPattern(stored, m_Constant()) ? store : nullptr;
+}
+
+/// Replaces `nest`, outermost first, whose innermost body is `store` and
+/// optionally `load`, with one memcpy or memset. Returns false if the nest
+/// does not walk contiguous memory.
+static bool replaceNest(ArrayRef<Operation *> nest, Operation *store,
+                        Operation *load, polygeist::AliasAnalysis &aa) {
+  Access dst = *getAccess(store);
+  if (!isContiguous(dst, nest))
+    return false;
+  Optional<Access> src;
+  Optional<uint8_t> byte;
+  if (load) {
+    src = getAccess(load);
+    if (!isContiguous(*src, nest) || aa.mayAlias(src->memref, dst.memref))
+      return false;
+  } else {
+    Attribute value;
+    matchPattern(store->getOperand(0), m_Constant(&value));
+    byte = getSplatByte(value);
+    if (!byte)
+      return false;
+  }
+
+  Operation *outer = nest.front();
+  Location loc = outer->getLoc();
+  OpBuilder builder(outer);
+  auto mt = dst.memref.getType().cast<MemRefType>();
+  unsigned dim = mt.getRank() - nest.size();
+  Value lb = getBound(builder, outer, /*upper*/ false);
+  Value ub = getBound(builder, outer, /*upper*/ true);
+  Value trips = builder.create<arith::MaxSIOp>(
+      loc, builder.create<arith::SubIOp>(loc, ub, lb),
+      builder.create<arith::ConstantIndexOp>(loc, 0));
+  Value len = builder.create<arith::MulIOp>(
+      loc, trips,
+      builder.create<arith::ConstantIndexOp>(
+          loc, getStride(mt, dim) * *getElementBytes(mt)));
+  len = builder.create<arith::IndexCastOp>(loc, builder.getI64Type(), len);
+  Value falsev = builder.create<arith::ConstantIntOp>(loc, false, 1);
+
+  Value dstPtr = getStartPointer(builder, loc, dst, nest.size(), lb);
+  Operation *call;
+  if (src) {
+    Value srcPtr = getStartPointer(builder, loc, *src, nest.size(), lb);
+    call = builder.create<LLVM::MemcpyOp>(loc, dstPtr, srcPtr, len,
+                                          /*isVolatile*/ falsev);
+  } else {
+    Value val = builder.create<arith::ConstantIntOp>(loc, *byte, 8);
+    call = builder.create<LLVM::MemsetOp>(loc, dstPtr, val, len,
+                                          /*isVolatile*/ falsev);
+  }
+  call->setAttr("polygeist.loop_idiom", builder.getUnitAttr());
+  outer->erase();
+  return true;
+}
+
+void LoopIdiom::runOnOperation() {
+  auto &aa = getAnalysis<polygeist::AliasAnalysis>();
+
+  SmallVector<Operation *> leaves;
+  getOperation()->walk([&](Operation *op) {
+    Operation *load;
+    if (isForLoop(op) && getStore(op, load))
+      leaves.push_back(op);
+  });
+
+  for (Operation *leaf : leaves) {
+    Operation *load;
+    Operation *store = getStore(leaf, load);
+    Location loc = leaf->getLoc();
+
+    // The perfect nest around the leaf, outermost first.
+    SmallVector<Operation *> nest = {leaf};
+    while (isForLoop(nest.front()->getParentOp()) &&
+           getBody(nest.front()->getParentOp()).getOperations().size() == 2)
+      nest.insert(nest.begin(), nest.front()->getParentOp());
+
+    // Prefer the deepest nest that walks contiguous memory.
+    for (unsigned i = 0; i < nest.size(); ++i) {
+      if (!replaceNest(ArrayRef<Operation *>(nest).drop_front(i), store, load,
+                       aa))
+        continue;
+      LLVM_DEBUG(llvm::dbgs() << "replaced " << nest.size() - i
+                              << " loops at " << loc << "\n");
+      aa.invalidate();
+      break;
+    }
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createLoopIdiomPass() {
+  return std::make_unique<LoopIdiom>();
+}
+} // namespace polygeist
+} // namespace mlir
@@ -0,0 +1,475 @@
+//===- LoopInterchange.cpp - Reorder affine loops for locality ------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Permutes perfectly nested bands of affine.for loops, and the dimensions of
+// affine.parallel loops, so that the innermost loop walks memory with the
+// smallest stride. A loop such as
+//
+//   for (j = 0; j < M; j++)
+//     for (i = 0; i < N; i++)
+//       s[j] += A[i][j];
+//
+// touches a new cache line of A on every iteration, while with i outermost
+// consecutive iterations share a line.
+//
+// Every loop of a band is given the number of cache lines the accesses of the
+// band touch when it runs innermost: one for an access invariant in the loop,
+// trip count * stride / line size for an access whose consecutive iterations
+// share a line, and the trip count otherwise. The band is then reordered by
+// decreasing cost, outermost first. affine.for bands keep the cheapest order
+// the dependences allow; the dimensions of affine.parallel are independent
+// and are always reordered.
+//
+// The affine dependence analysis assumes that distinct memrefs do not
+// overlap. When a band writes a memref that may alias another one it
+// accesses, such as two pointer arguments, the accesses to both are also
+// analyzed as accesses to one array: aliasing memrefs of the same type are
+// assumed to be either the same array or disjoint, not offset views of each
+// other. Bands accessing aliasing memrefs of different types, or containing
+// memory operations other than affine loads and stores, are left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/Analysis/AffineAnalysis.h"
+#include "mlir/Dialect/Affine/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/Analysis/Utils.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Affine/LoopUtils.h"
+#include "polygeist/AliasAnalysis.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/Support/Debug.h"
+#include <numeric>
+
+#define DEBUG_TYPE "loop-interchange"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct LoopInterchange : public LoopInterchangeBase<LoopInterchange> {
+  LoopInterchange() = default;
+  LoopInterchange(unsigned cacheLineSize) {
+    this->cacheLineSize.setValue(cacheLineSize);
+  }
+  void runOnOperation() override;
+};
+
+/// A loop of a band as seen by the cost model.
+struct BandLoop {
+  Value iv;
+  /// The trip count, or an estimate when it is not constant.
+  double tripCount;
+};
+
+/// An affine load or store nested in a band.
+struct Access {
+  Operation *op;
+  Value memref;
+  AffineMap map;
+  SmallVector<Value> operands;
+  bool isWrite;
+};
+} // namespace
+
+/// Trip count assumed for loops whose bounds are not constant.
+static constexpr double unknownTripCount = 128;
+
+/// Bands longer than this only try the order of the cost model rather than
+/// every permutation.
+static constexpr unsigned maxExhaustiveBand = 6;
+
+static bool isInvariant(Value v, Operation *root) {
+  return !root->isAncestor(v.getParentRegion()->getParentOp());
+}
+
+/// Returns the coefficient of `iv`, a dim or symbol, in `expr`, or None if
+/// `expr` is not linear in it.
+static Optional<int64_t> getCoefficient(AffineExpr expr, AffineExpr iv) {
+  if (expr == iv)
+    return 1;
+  auto bin = expr.dyn_cast<AffineBinaryOpExpr>();
+  if (!bin)
+    return 0;
+  Optional<int64_t> lhs = getCoefficient(bin.getLHS(), iv);
+  Optional<int64_t> rhs = getCoefficient(bin.getRHS(), iv);
+  if (!lhs || !rhs)
+    return llvm::None;
+  if (bin.getKind() == AffineExprKind::Add)
+    return *lhs + *rhs;
+  if (bin.getKind() == AffineExprKind::Mul) {
+    if (auto cst = bin.getRHS().dyn_cast<AffineConstantExpr>())
+      return *lhs * cst.getValue();
+    if (auto cst = bin.getLHS().dyn_cast<AffineConstantExpr>())
+      return *rhs * cst.getValue();
+  }
+  // Products of symbols, divisions and modulos are only linear in `iv` when
+  // they do not involve it.
+  if (*lhs == 0 && *rhs == 0)
+    return 0;
+  return llvm::None;
+}
+
+static unsigned getElementBytes(MemRefType type) {
+  Type elt = type.getElementType();
+  if (elt.isIntOrFloat())
+    return std::max(1u, elt.getIntOrFloatBitWidth() / 8);
+  return 8;
+}
+
+/// Returns the cache lines `access` touches over the iterations of `loop`
+/// when it runs innermost.
+static double getAccessCost(const Access &access, const BandLoop &loop,
+                            unsigned lineSize) {
+  MLIRContext *ctx = access.map.getContext();
+  unsigned numDims = access.map.getNumDims();
+  SmallVector<int64_t> coeffs;
+  for (AffineExpr expr : access.map.getResults()) {
+    int64_t coeff = 0;
+    for (auto en : llvm::enumerate(access.operands)) {
+      if (en.value() != loop.iv)
+        continue;
+      AffineExpr iv = en.index() < numDims
+                          ? getAffineDimExpr(en.index(), ctx)
+                          : getAffineSymbolExpr(en.index() - numDims, ctx);
+      Optional<int64_t> c = getCoefficient(expr, iv);
+      if (!c)
+        return loop.tripCount;
+      coeff += *c;
+    }
+    coeffs.push_back(coeff);
+  }
+  if (llvm::all_of(coeffs, [](int64_t c) { return c == 0; }))
+    return 1;
+
+  auto type = access.memref.getType().cast<MemRefType>();
+  if (!type.getLayout().isIdentity())
+    return loop.tripCount;
+
+  // The stride in elements, in row-major order. A dynamic extent makes the
+  // stride of every outer dimension unknown, and assumed large.
+  ArrayRef<int64_t> shape = type.getShape();
+  int64_t stride = 0, size = 1;
+  bool sizeKnown = true;
+  for (unsigned i = coeffs.size(); i-- > 0;) {
+    if (coeffs[i] != 0) {
+      if (!sizeKnown)
+        return loop.tripCount;
+      stride += coeffs[i] * size;
+    }
+    if (ShapedType::isDynamic(shape[i]))
+      sizeKnown = false;
+    else
+      size *= shape[i];
+  }
+  double bytes = std::abs(stride) * getElementBytes(type);
+  if (bytes >= lineSize)
+    return loop.tripCount;
+  return std::max(1.0, loop.tripCount * bytes / lineSize);
+}
+
+/// Returns, for each loop, the cache lines the whole band touches when that
+/// loop runs innermost.
+static SmallVector<double> getLoopCosts(ArrayRef<BandLoop> loops,
+                                        ArrayRef<Access> accesses,
+                                        unsigned lineSize) {
+  double iterations = 1;
+  for (const BandLoop &loop : loops)
+    iterations *= loop.tripCount;
+  SmallVector<double> costs;
+  for (const BandLoop &loop : loops) {
+    double cost = 0;
+    for (const Access &access : accesses)
+      cost += getAccessCost(access, loop, lineSize);
+    costs.push_back(cost * (iterations / loop.tripCount));
+  }
+  return costs;
+}
+
+/// Collects the affine accesses nested in `root`. Returns false if `root`
+/// contains a barrier or another operation touching memory, whose
+/// dependences the affine analysis does not see.
+static bool collectAccesses(Operation *root,
+                            SmallVectorImpl<Access> &accesses) {
+  WalkResult result = root->walk([&](Operation *op) {
+    if (auto load = dyn_cast<AffineReadOpInterface>(op)) {
+      accesses.push_back({op, load.getMemRef(), load.getAffineMap(),
+                          llvm::to_vector(load.getMapOperands()), false});
+      return WalkResult::advance();
+    }
+    if (auto store = dyn_cast<AffineWriteOpInterface>(op)) {
+      accesses.push_back({op, store.getMemRef(), store.getAffineMap(),
+                          llvm::to_vector(store.getMapOperands()), true});
+      return WalkResult::advance();
+    }
+    if (isa<polygeist::BarrierOp>(op))
+      return WalkResult::interrupt();
+    if (isMemoryEffectFree(op) ||
+        op->hasTrait<OpTrait::HasRecursiveMemoryEffects>())
+      return WalkResult::advance();
+    return WalkResult::interrupt();
+  });
+  return !result.wasInterrupted();
+}
+
+/// Computes the dependences of `band` between a write and another access to
+/// distinct memrefs that may alias, a dependence the affine analysis misses,
+/// as if both accessed the same array. Returns false if two such memrefs have
+/// different types, so that their accesses cannot be compared.
+static bool
+getAliasingDependences(ArrayRef<AffineForOp> band, ArrayRef<Access> accesses,
+                       polygeist::AliasAnalysis &aa,
+                       SmallVectorImpl<SmallVector<DependenceComponent, 2>>
+                           &dependences) {
+  unsigned outerDepth = getNestingDepth(band.front());
+  for (const Access &src : accesses) {
+    for (const Access &dst : accesses) {
+      if (!src.isWrite && !dst.isWrite)
+        continue;
+      if (src.memref == dst.memref || !aa.mayAlias(src.memref, dst.memref))
+        continue;
+      auto srcType = src.memref.getType().cast<MemRefType>();
+      if (srcType != dst.memref.getType() || !srcType.getLayout().isIdentity())
+        return false;
+      MemRefAccess srcAccess(src.op), dstAccess(dst.op);
+      dstAccess.memref = srcAccess.memref;
+      for (unsigned d = 1; d <= band.size(); ++d) {
+        SmallVector<DependenceComponent, 2> components;
+        DependenceResult result = checkMemrefAccessDependence(
+            srcAccess, dstAccess, outerDepth + d,
+            /*dependenceConstraints=*/nullptr, &components);
+        if (result.value == DependenceResult::Failure)
+          return false;
+        if (hasDependence(result))
+          dependences.emplace_back(components.begin() + outerDepth,
+                                   components.end());
+      }
+    }
+  }
+  return true;
+}
+
+/// Returns true if each of `dependences`, with components for the loops of a
+/// band, still goes forward when the band is permuted with `permMap`.
+static bool
+isLegalPermutation(ArrayRef<SmallVector<DependenceComponent, 2>> dependences,
+                   ArrayRef<unsigned> permMap) {
+  SmallVector<unsigned> inverse(permMap.size());
+  for (unsigned i = 0; i < permMap.size(); ++i)
+    inverse[permMap[i]] = i;
+  for (const auto &components : dependences) {
+    for (unsigned p = 0; p < inverse.size(); ++p) {
+      const DependenceComponent &component = components[inverse[p]];
+      if (!component.lb)
+        return false;
+      if (*component.lb > 0)
+        break;
+      if (*component.lb < 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Returns the band of perfectly nested loops rooted at `root` that can be
+/// permuted: loops without iteration arguments whose bounds do not depend on
+/// the band.
+static void getBand(AffineForOp root, SmallVectorImpl<AffineForOp> &band) {
+  SmallVector<AffineForOp> nest;
+  getPerfectlyNestedLoops(nest, root);
+  for (AffineForOp loop : nest) {
+    if (loop.getNumIterOperands() != 0)
+      break;
+    auto dependsOnBand = [&](Value v) { return !isInvariant(v, root); };
+    if (llvm::any_of(loop.getLowerBoundOperands(), dependsOnBand) ||
+        llvm::any_of(loop.getUpperBoundOperands(), dependsOnBand))
+      break;
+    band.push_back(loop);
+  }
+}
+
+/// Returns true if `a`, a band order listing the loops outermost first, has a
+/// cheaper innermost loop than `b`, comparing outwards on ties.
+static bool isCheaper(ArrayRef<unsigned> a, ArrayRef<unsigned> b,
+                      ArrayRef<double> costs) {
+  for (unsigned p = a.size(); p-- > 0;)
+    if (costs[a[p]] != costs[b[p]])
+      return costs[a[p]] < costs[b[p]];
+  return false;
+}
+
+static bool interchangeBand(MutableArrayRef<AffineForOp> band,
+                            polygeist::AliasAnalysis &aa, unsigned lineSize) {
+  SmallVector<Access> accesses;
+  SmallVector<SmallVector<DependenceComponent, 2>> aliasingDependences;
+  if (!collectAccesses(band.front(), accesses) || accesses.empty() ||
+      !getAliasingDependences(band, accesses, aa, aliasingDependences))
+    return false;
+
+  SmallVector<BandLoop> loops;
+  for (AffineForOp loop : band) {
+    Optional<uint64_t> trip = getConstantTripCount(loop);
+    loops.push_back({loop.getInductionVar(),
+                     trip ? std::max<double>(*trip, 1) : unknownTripCount});
+  }
+  SmallVector<double> costs = getLoopCosts(loops, accesses, lineSize);
+
+  // order[p] is the band loop placed at depth p.
+  SmallVector<unsigned> order(band.size());
+  std::iota(order.begin(), order.end(), 0);
+  SmallVector<unsigned> best = order;
+  SmallVector<unsigned> permMap(band.size());
+  auto isLegal = [&](ArrayRef<unsigned> candidate) {
+    for (unsigned p = 0; p < candidate.size(); ++p)
+      permMap[candidate[p]] = p;
+    return isValidLoopInterchangePermutation(band, permMap) &&
+           isLegalPermutation(aliasingDependences, permMap);
+  };
+
+  if (band.size() <= maxExhaustiveBand) {
+    while (std::next_permutation(order.begin(), order.end()))
+      if (isCheaper(order, best, costs) && isLegal(order))
+        best = order;
+  } else {
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return costs[a] > costs[b];
+    });
+    if (isCheaper(order, best, costs) && isLegal(order))
+      best = order;
+  }
+  if (llvm::is_sorted(best))
+    return false;
+
+  for (unsigned p = 0; p < best.size(); ++p)
+    permMap[best[p]] = p;
+  LLVM_DEBUG(llvm::dbgs() << "interchanging band at " << band.front().getLoc()
+                          << " into order";
+             for (unsigned l : best) llvm::dbgs() << " " << l;
+             llvm::dbgs() << "\n");
+  permuteLoops(band, permMap);
+  return true;
+}
+
+static bool interchangeParallel(AffineParallelOp op, unsigned lineSize) {
+  unsigned numDims = op.getNumDims();
+  SmallVector<Access> accesses;
+  if (numDims < 2 || !collectAccesses(op, accesses) || accesses.empty())
+    return false;
+
+  Optional<SmallVector<int64_t, 8>> ranges = op.getConstantRanges();
+  SmallVector<int64_t> steps = op.getSteps();
+  SmallVector<BandLoop> loops;
+  for (unsigned i = 0; i < numDims; ++i) {
+    double trip = unknownTripCount;
+    if (ranges)
+      trip = std::max<double>((*ranges)[i] / steps[i], 1);
+    loops.push_back({op.getIVs()[i], trip});
+  }
+  SmallVector<double> costs = getLoopCosts(loops, accesses, lineSize);
+
+  SmallVector<unsigned> order(numDims);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](unsigned a, unsigned b) { return costs[a] > costs[b]; });
+  if (llvm::is_sorted(order))
+    return false;
+
+  LLVM_DEBUG(llvm::dbgs() << "reordering parallel dims at " << op.getLoc()
+                          << " into order";
+             for (unsigned d : order) llvm::dbgs() << " " << d;
+             llvm::dbgs() << "\n");
+
+  MLIRContext *ctx = op.getContext();
+  SmallVector<AffineExpr> lbExprs, ubExprs;
+  SmallVector<int32_t> lbGroups, ubGroups;
+  SmallVector<int64_t> newSteps;
+  for (unsigned d : order) {
+    AffineMap lb = op.getLowerBoundMap(d), ub = op.getUpperBoundMap(d);
+    llvm::append_range(lbExprs, lb.getResults());
+    llvm::append_range(ubExprs, ub.getResults());
+    lbGroups.push_back(lb.getNumResults());
+    ubGroups.push_back(ub.getNumResults());
+    newSteps.push_back(steps[d]);
+  }
+  AffineMap lbMap = op.getLowerBoundsMap(), ubMap = op.getUpperBoundsMap();
+
+  OpBuilder builder(op);
+  auto newOp = builder.create<AffineParallelOp>(
+      op.getLoc(), op.getResultTypes(), op.getReductions(),
+      AffineMapAttr::get(AffineMap::get(lbMap.getNumDims(),
+                                        lbMap.getNumSymbols(), lbExprs, ctx)),
+      builder.getI32TensorAttr(lbGroups),
+      AffineMapAttr::get(AffineMap::get(ubMap.getNumDims(),
+                                        ubMap.getNumSymbols(), ubExprs, ctx)),
+      builder.getI32TensorAttr(ubGroups), builder.getI64ArrayAttr(newSteps),
+      op.getMapOperands());
+  newOp.getRegion().takeBody(op.getRegion());
+
+  Block *body = newOp.getBody();
+  SmallVector<BlockArgument> oldIVs(body->getArguments().begin(),
+                                    body->getArguments().end());
+  for (unsigned d : order)
+    body->addArgument(oldIVs[d].getType(), oldIVs[d].getLoc());
+  for (unsigned p = 0; p < numDims; ++p)
+    oldIVs[order[p]].replaceAllUsesWith(body->getArgument(numDims + p));
+  for (unsigned p = 0; p < numDims; ++p)
+    body->eraseArgument(0);
+
+  op->replaceAllUsesWith(newOp->getResults());
+  op->erase();
+  return true;
+}
+
+void LoopInterchange::runOnOperation() {
+  auto &aa = getAnalysis<polygeist::AliasAnalysis>();
+
+  SmallVector<SmallVector<AffineForOp>> bands;
+  SmallVector<AffineParallelOp> parallels;
+  DenseSet<Operation *> inBand;
+  getOperation()->walk<WalkOrder::PreOrder>([&](Operation *op) {
+    if (auto par = dyn_cast<AffineParallelOp>(op)) {
+      parallels.push_back(par);
+      return;
+    }
+    auto loop = dyn_cast<AffineForOp>(op);
+    if (!loop || inBand.count(loop))
+      return;
+    SmallVector<AffineForOp> band;
+    getBand(loop, band);
+    for (AffineForOp l : band)
+      inBand.insert(l);
+    if (band.size() > 1)
+      bands.push_back(std::move(band));
+  });
+
+  bool changed = false;
+  for (auto &band : llvm::reverse(bands)) {
+    if (interchangeBand(band, aa, cacheLineSize)) {
+      aa.invalidate();
+      changed = true;
+    }
+  }
+  for (AffineParallelOp par : llvm::reverse(parallels)) {
+    if (interchangeParallel(par, cacheLineSize)) {
+      aa.invalidate();
+      changed = true;
+    }
+  }
+  if (!changed)
+    markAllAnalysesPreserved();
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createLoopInterchangePass(unsigned cacheLineSize) {
+  return std::make_unique<LoopInterchange>(cacheLineSize);
+}
+} // namespace polygeist
+} // namespace mlir
@@ -270,6 +270,40 @@ bool attemptToFoldIntoPredecessor(Block *target) {
   return false;
 }
 
+/// Recreate a cf.switch with every edge to `from` redirected to `to`. The
+/// operands forwarded along a redirected edge are computed by `remapArgs` from
+/// the operands of the original edge. Returns the new terminator.
+static Operation *
+retargetSwitch(OpBuilder &builder, cf::SwitchOp op, Block *from, Block *to,
+               llvm::function_ref<SmallVector<Value>(ValueRange)> remapArgs) {
+  SmallVector<Value> defaultOps(op.getDefaultOperands().begin(),
+                                op.getDefaultOperands().end());
+  if (op.getDefaultDestination() == from)
+    defaultOps = remapArgs(op.getDefaultOperands());
+
+  SmallVector<Block *> dests;
+  SmallVector<SmallVector<Value>> cases;
+  for (auto pair : llvm::enumerate(op.getCaseDestinations())) {
+    if (pair.value() == from) {
+      dests.push_back(to);
+      cases.push_back(remapArgs(op.getCaseOperands(pair.index())));
+    } else {
+      dests.push_back(pair.value());
+      cases.emplace_back(op.getCaseOperands(pair.index()).begin(),
+                         op.getCaseOperands(pair.index()).end());
+    }
+  }
+  SmallVector<ValueRange> vrange;
+  for (auto &c : cases)
+    vrange.push_back(c);
+  auto newop = builder.create<cf::SwitchOp>(
+      op.getLoc(), op.getFlag(),
+      op.getDefaultDestination() == from ? to : op.getDefaultDestination(),
+      defaultOps, op.getCaseValuesAttr(), dests, vrange);
+  op.erase();
+  return newop;
+}
+
 bool LoopRestructure::removeIfFromRegion(DominanceInfo &domInfo, Region &region,
                                          Block *pseudoExit) {
   SmallVector<Block *, 4> Preds;
@@ -534,6 +568,14 @@ void LoopRestructure::runOnRegion(DominanceInfo &domInfo, Region &region) {
                   falseargs);
               op.erase();
             }
+            if (auto op = dyn_cast<cf::SwitchOp>(terminator)) {
+              retargetSwitch(builder, op, target, pseudoExit,
+                             [&](ValueRange operands) {
+                               SmallVector<Value> newArgs(args);
+                               newArgs.append(operands.begin(), operands.end());
+                               return newArgs;
+                             });
+            }
             break;
           }
         }
@@ -601,6 +643,19 @@ void LoopRestructure::runOnRegion(DominanceInfo &domInfo, Region &region) {
                   op.getFalseDest() == header ? pseudoExit : op.getFalseDest(),
                   falseargs);
               op.erase();
+            } else if (auto op = dyn_cast<cf::SwitchOp>(terminator)) {
+              terminator = retargetSwitch(
+                  builder, op, header, pseudoExit, [&](ValueRange operands) {
+                    SmallVector<Value> newArgs = {vtrue};
+                    newArgs.append(operands.begin(), operands.end());
+                    for (auto pair : preservedVals)
+                      newArgs.push_back(pair.first);
+                    for (auto tup : llvm::zip(returns, returnLocs)) {
+                      newArgs.push_back(builder.create<mlir::LLVM::UndefOp>(
+                          std::get<1>(tup), std::get<0>(tup)));
+                    }
+                    return newArgs;
+                  });
             }
           }
         }
@@ -0,0 +1,482 @@
+//===- LoopUnswitch.cpp - Hoist conditions out of loops -------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Removes conditionals from loop bodies by versioning the loop:
+//
+//  * Unswitching. A scf.if or affine.if in the body of a loop whose condition
+//    is loop invariant is hoisted around the loop, with one copy of the loop
+//    per branch:
+//
+//      for (i...) { if (flag) A; B; }
+//        =>  if (flag) { for (i...) { A; B; } } else { for (i...) { B; } }
+//
+//  * Index-set splitting. An affine.if in the body of an affine.for or
+//    affine.parallel that bounds the induction variable, such as the
+//    boundary conditions of stencils or the `idx < n` guard of lowered CUDA
+//    kernels, splits the iteration space into the ranges where it holds and
+//    where it does not:
+//
+//      for (i = 0; i < n; i++) { if (i >= 1 && i <= n - 2) A; B; }
+//        =>  for (i = 0; i < 1; i++) B;
+//            for (i = 1; i < n - 1; i++) { A; B; }
+//            for (i = n - 1; i < n; i++) B;
+//
+//    Conditions with a single lower and a single upper bound on the induction
+//    variable, or an equality which peels one iteration, are split. The loop
+//    must have unit step.
+//
+// Both duplicate the loop, so each transformation is charged the operations it
+// copies against a per-function growth budget. Innermost loops are visited
+// first. Loops containing barriers are left alone, as their copies would no
+// longer synchronize with each other.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "loop-unswitch"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct LoopUnswitch : public LoopUnswitchBase<LoopUnswitch> {
+  LoopUnswitch() = default;
+  LoopUnswitch(unsigned growthBudget) {
+    this->growthBudget.setValue(growthBudget);
+  }
+  void runOnOperation() override;
+};
+
+/// A bound on the induction variable: `map` applied to `operands`.
+struct IVBound {
+  AffineMap map;
+  SmallVector<Value> operands;
+};
+
+/// The range lo <= iv < hi of the induction variable of dimension `dim` on
+/// which an affine.if holds. A missing bound does not restrict that side.
+struct SplitRange {
+  unsigned dim;
+  Optional<IVBound> lo, hi;
+};
+
+/// The bounds of one side of an affine loop: `map` applied to `operands`,
+/// with the results of each dimension contiguous and counted in `groups`.
+struct LoopBounds {
+  AffineMap map;
+  SmallVector<Value> operands;
+  SmallVector<int32_t> groups;
+
+  /// Adds `bound` to the bounds of dimension `dim`.
+  void add(unsigned dim, const IVBound &bound);
+};
+} // namespace
+
+void LoopBounds::add(unsigned dim, const IVBound &bound) {
+  unsigned numDims = map.getNumDims(), numSymbols = map.getNumSymbols();
+  unsigned extraDims = bound.map.getNumDims();
+  AffineMap extra = bound.map.shiftDims(numDims).shiftSymbols(numSymbols);
+
+  SmallVector<AffineExpr> exprs;
+  unsigned pos = 0;
+  for (unsigned d = 0; d < groups.size(); ++d) {
+    llvm::append_range(exprs, map.getResults().slice(pos, groups[d]));
+    pos += groups[d];
+    if (d == dim)
+      llvm::append_range(exprs, extra.getResults());
+  }
+  groups[dim] += extra.getNumResults();
+
+  SmallVector<Value> newOperands(operands.begin(), operands.begin() + numDims);
+  newOperands.append(bound.operands.begin(),
+                     bound.operands.begin() + extraDims);
+  newOperands.append(operands.begin() + numDims, operands.end());
+  newOperands.append(bound.operands.begin() + extraDims, bound.operands.end());
+  map = AffineMap::get(numDims + extraDims,
+                       numSymbols + bound.map.getNumSymbols(), exprs,
+                       map.getContext());
+  operands = std::move(newOperands);
+}
+
+static bool isInvariant(Value v, Operation *loop) {
+  return !loop->isAncestor(v.getParentRegion()->getParentOp());
+}
+
+static bool isLoop(Operation *op) {
+  return isa<scf::ForOp, scf::ParallelOp, AffineForOp, AffineParallelOp>(op);
+}
+
+static Block &getBody(Operation *loop) { return loop->getRegion(0).front(); }
+
+static unsigned getSize(Operation *op) {
+  unsigned size = 0;
+  op->walk([&](Operation *) { ++size; });
+  return size;
+}
+
+/// Replaces the scf.if or affine.if `ifOp` with the body of one of its
+/// branches.
+static void inlineBranch(Operation *ifOp, bool thenBranch) {
+  Region &region = ifOp->getRegion(thenBranch ? 0 : 1);
+  if (region.empty()) {
+    ifOp->erase();
+    return;
+  }
+  Block &block = region.front();
+  Operation *yield = block.getTerminator();
+  ifOp->replaceAllUsesWith(yield->getOperands());
+  yield->erase();
+  ifOp->getBlock()->getOperations().splice(Block::iterator(ifOp),
+                                           block.getOperations());
+  ifOp->erase();
+}
+
+/// Returns the position of `ifOp` in its block, to find it again in copies of
+/// the loop.
+static unsigned getPosition(Operation *ifOp) {
+  return std::distance(ifOp->getBlock()->begin(), ifOp->getIterator());
+}
+
+static Operation *getOpAt(Operation *loop, unsigned pos) {
+  return &*std::next(getBody(loop).begin(), pos);
+}
+
+//===----------------------------------------------------------------------===//
+// Unswitching
+//===----------------------------------------------------------------------===//
+
+/// Returns a conditional in the body of `loop` whose condition is loop
+/// invariant.
+static Operation *getInvariantIf(Operation *loop) {
+  for (Operation &op : getBody(loop)) {
+    if (auto ifOp = dyn_cast<scf::IfOp>(op))
+      if (isInvariant(ifOp.getCondition(), loop))
+        return ifOp;
+    if (auto ifOp = dyn_cast<AffineIfOp>(op))
+      if (llvm::all_of(ifOp.getOperands(),
+                       [&](Value v) { return isInvariant(v, loop); }))
+        return ifOp;
+  }
+  return nullptr;
+}
+
+static void unswitch(Operation *loop, Operation *ifOp) {
+  unsigned pos = getPosition(ifOp);
+  Location loc = loop->getLoc();
+  OpBuilder builder(loop);
+  Operation *guard;
+  if (auto scfIf = dyn_cast<scf::IfOp>(ifOp)) {
+    guard = builder.create<scf::IfOp>(loc, loop->getResultTypes(),
+                                      scfIf.getCondition(),
+                                      /*withElseRegion*/ true);
+  } else {
+    auto affineIf = cast<AffineIfOp>(ifOp);
+    guard = builder.create<AffineIfOp>(loc, loop->getResultTypes(),
+                                       affineIf.getIntegerSet(),
+                                       affineIf.getOperands(),
+                                       /*withElseRegion*/ true);
+  }
+
+  for (unsigned r = 0; r < 2; ++r) {
+    Block &block = guard->getRegion(r).front();
+    if (block.empty())
+      builder.setInsertionPointToEnd(&block);
+    else
+      builder.setInsertionPoint(block.getTerminator());
+    Operation *copy = builder.clone(*loop);
+    inlineBranch(getOpAt(copy, pos), /*thenBranch*/ r == 0);
+    if (loop->getNumResults() == 0)
+      continue;
+    if (isa<scf::IfOp>(guard))
+      builder.create<scf::YieldOp>(loc, copy->getResults());
+    else
+      builder.create<AffineYieldOp>(loc, copy->getResults());
+  }
+  loop->replaceAllUsesWith(guard->getResults());
+  loop->erase();
+}
+
+//===----------------------------------------------------------------------===//
+// Index-set splitting
+//===----------------------------------------------------------------------===//
+
+/// Returns c if `expr` is c * iv + rest with c = 1 or -1 and rest independent
+/// of `iv`.
+static Optional<int64_t> getUnitCoefficient(AffineExpr expr, AffineExpr iv) {
+  SmallVector<AffineExpr> terms = {expr};
+  int64_t coeff = 0;
+  while (!terms.empty()) {
+    AffineExpr term = terms.pop_back_val();
+    if (term.getKind() == AffineExprKind::Add) {
+      auto add = term.cast<AffineBinaryOpExpr>();
+      terms.push_back(add.getLHS());
+      terms.push_back(add.getRHS());
+      continue;
+    }
+    if (term == iv) {
+      coeff += 1;
+      continue;
+    }
+    if (term == iv * -1) {
+      coeff -= 1;
+      continue;
+    }
+    bool usesIV = false;
+    term.walk([&](AffineExpr e) { usesIV |= e == iv; });
+    if (usesIV)
+      return llvm::None;
+  }
+  if (coeff != 1 && coeff != -1)
+    return llvm::None;
+  return coeff;
+}
+
+static IVBound getBound(IntegerSet set, AffineExpr expr, ValueRange operands) {
+  IVBound bound{AffineMap::get(set.getNumDims(), set.getNumSymbols(), expr),
+                llvm::to_vector(operands)};
+  // Drops the induction variable, which the bound no longer uses.
+  canonicalizeMapAndOperands(&bound.map, &bound.operands);
+  return bound;
+}
+
+/// Returns the range of one of `ivs`, the induction variables of `loop`, on
+/// which `ifOp` holds.
+static Optional<SplitRange> getSplitRange(AffineIfOp ifOp, Operation *loop,
+                                          ValueRange ivs) {
+  IntegerSet set = ifOp.getIntegerSet();
+  MLIRContext *ctx = set.getContext();
+  Optional<unsigned> dim;
+  AffineExpr iv;
+  for (auto en : llvm::enumerate(ifOp.getOperands())) {
+    auto it = llvm::find(ivs, en.value());
+    if (it == ivs.end()) {
+      if (!isInvariant(en.value(), loop))
+        return llvm::None;
+      continue;
+    }
+    // Conditions on several induction variables, or on one passed twice,
+    // are not split.
+    if (dim)
+      return llvm::None;
+    dim = it - ivs.begin();
+    iv = en.index() < set.getNumDims()
+             ? getAffineDimExpr(en.index(), ctx)
+             : getAffineSymbolExpr(en.index() - set.getNumDims(), ctx);
+  }
+  if (!dim || set.getNumConstraints() == 0)
+    return llvm::None;
+
+  SplitRange range{*dim, llvm::None, llvm::None};
+  for (unsigned i = 0, e = set.getNumConstraints(); i < e; ++i) {
+    AffineExpr expr = set.getConstraint(i);
+    Optional<int64_t> coeff = getUnitCoefficient(expr, iv);
+    if (!coeff)
+      return llvm::None;
+    // expr = coeff * iv + rest, which is >= 0 or == 0.
+    AffineExpr rest = expr.replace(iv, getAffineConstantExpr(0, ctx));
+    AffineExpr lo, hi;
+    if (set.isEq(i)) {
+      lo = *coeff == 1 ? -rest : rest;
+      hi = lo + 1;
+    } else if (*coeff == 1) {
+      lo = -rest;
+    } else {
+      hi = rest + 1;
+    }
+    if (lo) {
+      if (range.lo)
+        return llvm::None;
+      range.lo = getBound(set, lo, ifOp.getOperands());
+    }
+    if (hi) {
+      if (range.hi)
+        return llvm::None;
+      range.hi = getBound(set, hi, ifOp.getOperands());
+    }
+  }
+  return range;
+}
+
+/// A copy of the loop running the part of the iteration space bounded by
+/// `lbs` and `ubs`, with the then or else branch of the split conditional.
+struct Piece {
+  SmallVector<IVBound, 2> lbs, ubs;
+  bool thenBranch;
+};
+
+static SmallVector<Piece, 3> getPieces(const SplitRange &range) {
+  SmallVector<Piece, 3> pieces;
+  if (range.lo)
+    pieces.push_back({{}, {*range.lo}, false});
+  pieces.push_back({{}, {}, true});
+  if (range.lo)
+    pieces.back().lbs.push_back(*range.lo);
+  if (range.hi)
+    pieces.back().ubs.push_back(*range.hi);
+  if (range.hi) {
+    // Also starts after lo, in case the range is empty.
+    pieces.push_back({{}, {}, false});
+    if (range.lo)
+      pieces.back().lbs.push_back(*range.lo);
+    pieces.back().lbs.push_back(*range.hi);
+  }
+  return pieces;
+}
+
+static void splitFor(AffineForOp loop, AffineIfOp ifOp,
+                     const SplitRange &range) {
+  unsigned pos = getPosition(ifOp);
+  OpBuilder builder(loop);
+  ValueRange inits = loop.getIterOperands();
+  SmallVector<Value> results(inits.begin(), inits.end());
+  for (const Piece &piece : getPieces(range)) {
+    auto copy = cast<AffineForOp>(builder.clone(*loop));
+    LoopBounds lb{copy.getLowerBoundMap(),
+                  llvm::to_vector(copy.getLowerBoundOperands()),
+                  {(int32_t)copy.getLowerBoundMap().getNumResults()}};
+    LoopBounds ub{copy.getUpperBoundMap(),
+                  llvm::to_vector(copy.getUpperBoundOperands()),
+                  {(int32_t)copy.getUpperBoundMap().getNumResults()}};
+    for (const IVBound &bound : piece.lbs)
+      lb.add(0, bound);
+    for (const IVBound &bound : piece.ubs)
+      ub.add(0, bound);
+    canonicalizeMapAndOperands(&lb.map, &lb.operands);
+    canonicalizeMapAndOperands(&ub.map, &ub.operands);
+    copy.setLowerBound(lb.operands, lb.map);
+    copy.setUpperBound(ub.operands, ub.map);
+    for (auto en : llvm::enumerate(results))
+      copy->setOperand(copy.getNumControlOperands() + en.index(), en.value());
+    inlineBranch(getOpAt(copy, pos), piece.thenBranch);
+    results.assign(copy->result_begin(), copy->result_end());
+  }
+  loop->replaceAllUsesWith(results);
+  loop->erase();
+}
+
+static void splitParallel(AffineParallelOp loop, AffineIfOp ifOp,
+                          const SplitRange &range) {
+  unsigned pos = getPosition(ifOp);
+  OpBuilder builder(loop);
+  auto getGroups = [](DenseIntElementsAttr attr) {
+    SmallVector<int32_t> groups;
+    for (const APInt &g : attr)
+      groups.push_back(g.getZExtValue());
+    return groups;
+  };
+  for (const Piece &piece : getPieces(range)) {
+    LoopBounds lb{loop.getLowerBoundsMap(),
+                  llvm::to_vector(loop.getLowerBoundsOperands()),
+                  getGroups(loop.getLowerBoundsGroups())};
+    LoopBounds ub{loop.getUpperBoundsMap(),
+                  llvm::to_vector(loop.getUpperBoundsOperands()),
+                  getGroups(loop.getUpperBoundsGroups())};
+    for (const IVBound &bound : piece.lbs)
+      lb.add(range.dim, bound);
+    for (const IVBound &bound : piece.ubs)
+      ub.add(range.dim, bound);
+    SmallVector<Value> operands = lb.operands;
+    operands.append(ub.operands);
+    auto copy = builder.create<AffineParallelOp>(
+        loop.getLoc(), TypeRange(), builder.getArrayAttr({}),
+        AffineMapAttr::get(lb.map), builder.getI32TensorAttr(lb.groups),
+        AffineMapAttr::get(ub.map), builder.getI32TensorAttr(ub.groups),
+        loop.getStepsAttr(), operands);
+    Operation *body = builder.clone(*loop);
+    copy.getRegion().takeBody(body->getRegion(0));
+    body->erase();
+    inlineBranch(getOpAt(copy, pos), piece.thenBranch);
+  }
+  loop->erase();
+}
+
+/// Returns the affine.if in the body of `loop` whose condition restricts one
+/// of its unit-step induction variables to a range.
+static Optional<std::pair<AffineIfOp, SplitRange>> getSplit(Operation *loop) {
+  SmallVector<Value> ivs;
+  SmallVector<int64_t> steps;
+  if (auto forOp = dyn_cast<AffineForOp>(loop)) {
+    ivs.push_back(forOp.getInductionVar());
+    steps.push_back(forOp.getStep());
+  } else if (auto parOp = dyn_cast<AffineParallelOp>(loop)) {
+    // Splitting the reductions would need their partial results combined.
+    if (parOp.getNumResults() != 0)
+      return llvm::None;
+    llvm::append_range(ivs, parOp.getIVs());
+    steps = parOp.getSteps();
+  } else {
+    return llvm::None;
+  }
+  for (Operation &op : getBody(loop)) {
+    auto ifOp = dyn_cast<AffineIfOp>(op);
+    if (!ifOp)
+      continue;
+    Optional<SplitRange> range = getSplitRange(ifOp, loop, ivs);
+    if (range && steps[range->dim] == 1)
+      return std::make_pair(ifOp, *range);
+  }
+  return llvm::None;
+}
+
+void LoopUnswitch::runOnOperation() {
+  int64_t budget = growthBudget;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // Restart from the innermost loops after every change, as the copies
+    // may hold further conditionals.
+    getOperation()->walk([&](Operation *loop) {
+      if (!isLoop(loop) || getSize(loop) > budget)
+        return WalkResult::advance();
+      bool hasBarrier = false;
+      loop->walk([&](polygeist::BarrierOp) { hasBarrier = true; });
+      if (hasBarrier)
+        return WalkResult::advance();
+
+      if (Operation *ifOp = getInvariantIf(loop)) {
+        LLVM_DEBUG(llvm::dbgs() << "unswitching " << ifOp->getLoc() << "\n");
+        budget -= getSize(loop);
+        unswitch(loop, ifOp);
+        changed = true;
+        return WalkResult::interrupt();
+      }
+      if (auto split = getSplit(loop)) {
+        int64_t growth =
+            (getPieces(split->second).size() - 1) * (int64_t)getSize(loop);
+        if (growth > budget)
+          return WalkResult::advance();
+        LLVM_DEBUG(llvm::dbgs()
+                   << "splitting on " << split->first.getLoc() << "\n");
+        budget -= growth;
+        if (auto forOp = dyn_cast<AffineForOp>(loop))
+          splitFor(forOp, split->first, split->second);
+        else
+          splitParallel(cast<AffineParallelOp>(loop), split->first,
+                        split->second);
+        changed = true;
+        return WalkResult::interrupt();
+      }
+      return WalkResult::advance();
+    });
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createLoopUnswitchPass(unsigned growthBudget) {
+  return std::make_unique<LoopUnswitch>(growthBudget);
+}
+} // namespace polygeist
+} // namespace mlir
@@ -0,0 +1,134 @@
+//===- LowerComplex.cpp - Lower complex arithmetic to real arithmetic -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Lowers the complex dialect operations the frontend emits for C complex
+// arithmetic to arith and math operations on the real and imaginary parts.
+//
+// Multiplications and divisions marked `polygeist.limited_range`, which the
+// frontend emits under -ffast-math, use the textbook formulas:
+//
+//    (a + bi)(c + di) = (ac - bd) + (ad + bc)i
+//    (a + bi)/(c + di) = ((ac + bd) + (bc - ad)i) / (c^2 + d^2)
+//
+// Others follow C99 Annex G: multiplications recover infinities from NaN
+// results and divisions scale the operands to avoid overflow. Both only use
+// selects, never branches or libcalls, so that loops over arrays of complex
+// numbers remain vectorizable: the real and imaginary parts of an array of
+// complex numbers are accessed as an interleaved group.
+//
+// The parts of values created and taken apart in the same function fold
+// away, so that complex values only remain where they cross blocks.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Conversion/ComplexToStandard/ComplexToStandard.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Complex/IR/Complex.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Transforms/DialectConversion.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct LowerComplex : public LowerComplexBase<LowerComplex> {
+  void runOnOperation() override;
+};
+
+/// Multiplies with the textbook formula, which may return NaN parts where
+/// C99 expects an infinity.
+struct LimitedRangeMul : public OpConversionPattern<complex::MulOp> {
+  LimitedRangeMul(MLIRContext *ctx)
+      : OpConversionPattern<complex::MulOp>(ctx, /*benefit*/ 2) {}
+
+  LogicalResult
+  matchAndRewrite(complex::MulOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    if (!op->hasAttr("polygeist.limited_range"))
+      return failure();
+    Location loc = op.getLoc();
+    auto elTy = op.getType().cast<ComplexType>().getElementType();
+    Value a = rewriter.create<complex::ReOp>(loc, elTy, adaptor.getLhs());
+    Value b = rewriter.create<complex::ImOp>(loc, elTy, adaptor.getLhs());
+    Value c = rewriter.create<complex::ReOp>(loc, elTy, adaptor.getRhs());
+    Value d = rewriter.create<complex::ImOp>(loc, elTy, adaptor.getRhs());
+    Value re = rewriter.create<arith::SubFOp>(
+        loc, rewriter.create<arith::MulFOp>(loc, a, c),
+        rewriter.create<arith::MulFOp>(loc, b, d));
+    Value im = rewriter.create<arith::AddFOp>(
+        loc, rewriter.create<arith::MulFOp>(loc, a, d),
+        rewriter.create<arith::MulFOp>(loc, b, c));
+    rewriter.replaceOpWithNewOp<complex::CreateOp>(op, op.getType(), re, im);
+    return success();
+  }
+};
+
+/// Divides with the textbook formula, which overflows when the squared
+/// magnitude of the divisor does.
+struct LimitedRangeDiv : public OpConversionPattern<complex::DivOp> {
+  LimitedRangeDiv(MLIRContext *ctx)
+      : OpConversionPattern<complex::DivOp>(ctx, /*benefit*/ 2) {}
+
+  LogicalResult
+  matchAndRewrite(complex::DivOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    if (!op->hasAttr("polygeist.limited_range"))
+      return failure();
+    Location loc = op.getLoc();
+    auto elTy = op.getType().cast<ComplexType>().getElementType();
+    Value a = rewriter.create<complex::ReOp>(loc, elTy, adaptor.getLhs());
+    Value b = rewriter.create<complex::ImOp>(loc, elTy, adaptor.getLhs());
+    Value c = rewriter.create<complex::ReOp>(loc, elTy, adaptor.getRhs());
+    Value d = rewriter.create<complex::ImOp>(loc, elTy, adaptor.getRhs());
+    Value denom = rewriter.create<arith::AddFOp>(
+        loc, rewriter.create<arith::MulFOp>(loc, c, c),
+        rewriter.create<arith::MulFOp>(loc, d, d));
+    Value re = rewriter.create<arith::AddFOp>(
+        loc, rewriter.create<arith::MulFOp>(loc, a, c),
+        rewriter.create<arith::MulFOp>(loc, b, d));
+    Value im = rewriter.create<arith::SubFOp>(
+        loc, rewriter.create<arith::MulFOp>(loc, b, c),
+        rewriter.create<arith::MulFOp>(loc, a, d));
+    re = rewriter.create<arith::DivFOp>(loc, re, denom);
+    im = rewriter.create<arith::DivFOp>(loc, im, denom);
+    rewriter.replaceOpWithNewOp<complex::CreateOp>(op, op.getType(), re, im);
+    return success();
+  }
+};
+} // namespace
+
+void LowerComplex::runOnOperation() {
+  MLIRContext *ctx = &getContext();
+  RewritePatternSet patterns(ctx);
+  patterns.add<LimitedRangeMul, LimitedRangeDiv>(ctx);
+  populateComplexToStandardConversionPatterns(patterns);
+
+  ConversionTarget target(*ctx);
+  target.addLegalDialect<arith::ArithDialect, math::MathDialect>();
+  target.addIllegalOp<complex::AddOp, complex::SubOp, complex::MulOp,
+                      complex::DivOp, complex::NegOp>();
+  if (failed(applyPartialConversion(getOperation(), target,
+                                    std::move(patterns)))) {
+    signalPassFailure();
+    return;
+  }
+
+  // Fold the parts of the complex values created above.
+  (void)applyPatternsAndFoldGreedily(getOperation(), RewritePatternSet(ctx));
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createLowerComplexPass() {
+  return std::make_unique<LowerComplex>();
+}
+} // namespace polygeist
+} // namespace mlir
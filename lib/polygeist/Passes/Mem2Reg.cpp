@@ -33,6 +33,7 @@
 #include <iostream>
 #include <set>
 
+#include "polygeist/AliasAnalysis.h"
 #include "polygeist/Ops.h"
 #include "polygeist/Passes/Utils.h"
 
@@ -208,7 +209,8 @@ struct Mem2Reg : public Mem2RegBase<Mem2Reg> {
   bool forwardStoreToLoad(
       mlir::Value AI, std::vector<Offset> idx,
       SmallVectorImpl<Operation *> &loadOpsToErase,
-      DenseMap<Operation *, SmallVector<Operation *>> &capturedAliasing);
+      DenseMap<Operation *, SmallVector<Operation *>> &capturedAliasing,
+      polygeist::AliasAnalysis &aa);
 };
 
 } // end anonymous namespace
@@ -1066,21 +1068,15 @@ void removeRedundantBlockArgs(
   }
 }
 
-std::set<std::string> NonCapturingFunctions = {
-    "free",           "printf",       "fprintf",       "scanf",
-    "fscanf",         "gettimeofday", "clock_gettime", "getenv",
-    "strrchr",        "strlen",       "sprintf",       "sscanf",
-    "mkdir",          "fwrite",       "fread",         "memcpy",
-    "cudaMemcpy",     "memset",       "cudaMemset",    "__isoc99_scanf",
-    "__isoc99_fscanf"};
 // fopen, fclose
-std::set<std::string> NoWriteFunctions = {"exit", "__errno_location"};
+const std::set<std::string> NoWriteFunctions = {"exit", "__errno_location"};
 // This is a straightforward implementation not optimized for speed. Optimize
 // if needed.
 bool Mem2Reg::forwardStoreToLoad(
     mlir::Value AI, std::vector<Offset> idx,
     SmallVectorImpl<Operation *> &loadOpsToErase,
-    DenseMap<Operation *, SmallVector<Operation *>> &capturedAliasing) {
+    DenseMap<Operation *, SmallVector<Operation *>> &capturedAliasing,
+    polygeist::AliasAnalysis &aa) {
   bool changed = false;
   std::set<mlir::Operation *> loadOps;
   mlir::Type subType = nullptr;
@@ -1311,7 +1307,7 @@ bool Mem2Reg::forwardStoreToLoad(
           // If op causes EffectType on a potentially aliasing location for
           // memOp, mark as having the effect.
           if (isa<MemoryEffects::Write>(effect.getEffect())) {
-            if (!mayAlias(effect.getEffect(), AI)) {
+            if (!aa.mayAlias(effect, AI)) {
               continue;
             }
             opMayHaveEffect = true;
@@ -1911,9 +1907,13 @@ void Mem2Reg::runOnOperation() {
   // and or been deleted. Because there can be memrefs of
   // memrefs etc, we may need to do multiple passes (first
   // to eliminate the outermost one, then inner ones)
+  polygeist::AliasAnalysis &aa = getAnalysis<polygeist::AliasAnalysis>();
+
   bool changed;
   do {
     changed = false;
+    // The previous iteration erased loads and memrefs.
+    aa.invalidate();
 
     // A list of memref's that are potentially dead / could be eliminated.
     SmallPtrSet<Value, 4> memrefsToErase;
@@ -1955,8 +1955,13 @@ void Mem2Reg::runOnOperation() {
                    llvm::dbgs() << "} of " << AI << "\n");
         // llvm::errs() << " PRE " << AI << "\n";
         // f.dump();
-        changed |=
-            forwardStoreToLoad(AI, vec, loadOpsToErase, capturedAliasing);
+        // The alias analysis caches results per value and operation, which
+        // forwarding may have created or replaced.
+        if (forwardStoreToLoad(AI, vec, loadOpsToErase, capturedAliasing,
+                               aa)) {
+          changed = true;
+          aa.invalidate();
+        }
         // llvm::errs() << " POST " << AI << "\n";
         // f.dump();
       }
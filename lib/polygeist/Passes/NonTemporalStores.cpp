@@ -0,0 +1,188 @@
+//===- NonTemporalStores.cpp - Stream write-only arrays past the cache ----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Marks affine stores which stream through an array too large for the last
+// level cache as non-temporal, so that they bypass the cache instead of first
+// reading every line they overwrite:
+//
+//  * the innermost loop walks the last dimension of an identity layout memref
+//    with unit stride, over enough elements to overwrite whole cache lines,
+//  * the enclosing loops indexing the stores have constant trip counts, and
+//    together they address more bytes than the last level cache holds,
+//  * nothing in the function may read the memory being written.
+//
+// The stores are rewritten to memref.store with the `polygeist.nontemporal`
+// attribute, which the C-style LLVM lowering turns into `!nontemporal`
+// metadata. Non-temporal stores are weakly ordered with respect to other
+// stores, so a sequentially consistent fence is placed after the outermost
+// sequential loop around them, inside any parallel loop.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Affine/Utils.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "polygeist/AliasAnalysis.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "nontemporal-stores"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct NonTemporalStores : public NonTemporalStoresBase<NonTemporalStores> {
+  NonTemporalStores() = default;
+  NonTemporalStores(unsigned llcSize, unsigned cacheLineSize) {
+    this->llcSize.setValue(llcSize);
+    this->cacheLineSize.setValue(cacheLineSize);
+  }
+  void runOnOperation() override;
+};
+} // namespace
+
+/// Cache lines the innermost loop must write in a row, as the lines at either
+/// end may be shared with memory it does not write.
+static constexpr int64_t minStreamLines = 4;
+
+/// Returns true if `expr` is `iv` plus terms which do not depend on it.
+static bool isUnitStride(AffineExpr expr, AffineExpr iv) {
+  if (expr == iv)
+    return true;
+  auto bin = expr.dyn_cast<AffineBinaryOpExpr>();
+  if (!bin || bin.getKind() != AffineExprKind::Add)
+    return false;
+  unsigned pos = iv.cast<AffineDimExpr>().getPosition();
+  return (isUnitStride(bin.getLHS(), iv) &&
+          !bin.getRHS().isFunctionOfDim(pos)) ||
+         (isUnitStride(bin.getRHS(), iv) && !bin.getLHS().isFunctionOfDim(pos));
+}
+
+/// Returns the number of bytes the loops around `store` write through it if
+/// the innermost loop streams through whole cache lines, and 0 otherwise.
+/// Loops which do not index the store write the same bytes again and do not
+/// add to it.
+static int64_t getStreamFootprint(AffineStoreOp store, unsigned lineSize) {
+  auto mt = store.getMemRefType();
+  Type elTy = mt.getElementType();
+  if (!mt.getLayout().isIdentity() || !elTy.isIntOrFloat() ||
+      elTy.getIntOrFloatBitWidth() % 8 != 0)
+    return 0;
+  int64_t bytes = elTy.getIntOrFloatBitWidth() / 8;
+
+  auto inner = dyn_cast<AffineForOp>(store->getParentOp());
+  if (!inner || inner.getStep() != 1)
+    return 0;
+  AffineMap map = store.getAffineMap();
+  auto operands = store.getMapOperands();
+  unsigned pos = std::distance(
+      operands.begin(), llvm::find(operands, inner.getInductionVar()));
+  if (pos >= map.getNumDims())
+    return 0;
+  AffineExpr iv = getAffineDimExpr(pos, store.getContext());
+  if (!isUnitStride(map.getResults().back(), iv))
+    return 0;
+  for (AffineExpr expr : map.getResults().drop_back())
+    if (expr.isFunctionOfDim(pos))
+      return 0;
+
+  Optional<uint64_t> innerTrips = getConstantTripCount(inner);
+  if (!innerTrips || (int64_t)*innerTrips * bytes < minStreamLines * lineSize)
+    return 0;
+
+  auto isIndex = [&](Value iv) { return llvm::is_contained(operands, iv); };
+  int64_t footprint = bytes;
+  for (Operation *op = inner; !isa<FunctionOpInterface>(op);
+       op = op->getParentOp()) {
+    if (auto forOp = dyn_cast<AffineForOp>(op)) {
+      if (!isIndex(forOp.getInductionVar()))
+        continue;
+      Optional<uint64_t> trips = getConstantTripCount(forOp);
+      if (!trips)
+        return 0;
+      footprint *= *trips;
+    } else if (auto parOp = dyn_cast<AffineParallelOp>(op)) {
+      Optional<SmallVector<int64_t, 8>> ranges = parOp.getConstantRanges();
+      if (!ranges)
+        return 0;
+      for (auto en : llvm::enumerate(*ranges))
+        if (isIndex(parOp.getIVs()[en.index()]))
+          footprint *=
+              llvm::divideCeil(en.value(), parOp.getSteps()[en.index()]);
+    } else if (!isa<AffineIfOp>(op)) {
+      return 0;
+    }
+  }
+  return footprint;
+}
+
+/// Returns true if anything in the body of `root` may read from `memref`.
+static bool isRead(Operation *root, Value memref,
+                   polygeist::AliasAnalysis &aa) {
+  for (Region &region : root->getRegions())
+    for (Block &block : region)
+      for (Operation &op : block)
+        if (aa.mayReadFrom(&op, memref))
+          return true;
+  return false;
+}
+
+void NonTemporalStores::runOnOperation() {
+  auto &aa = getAnalysis<polygeist::AliasAnalysis>();
+
+  SmallVector<AffineStoreOp> stores;
+  getOperation()->walk([&](AffineStoreOp store) {
+    int64_t footprint = getStreamFootprint(store, cacheLineSize);
+    if (footprint <= (int64_t)llcSize)
+      return;
+    if (!isRead(getOperation(), store.getMemRef(), aa))
+      stores.push_back(store);
+  });
+
+  // The outermost sequential loops around the stores, to be fenced.
+  llvm::SetVector<Operation *> streams;
+  for (AffineStoreOp store : stores) {
+    LLVM_DEBUG(llvm::dbgs() << "non-temporal " << store.getLoc() << "\n");
+    Operation *outer = store->getParentOp();
+    while (isa<AffineForOp, AffineIfOp>(outer->getParentOp()))
+      outer = outer->getParentOp();
+    streams.insert(outer);
+
+    OpBuilder builder(store);
+    auto indices = expandAffineMap(builder, store.getLoc(),
+                                   store.getAffineMap(),
+                                   store.getMapOperands());
+    auto newStore = builder.create<memref::StoreOp>(
+        store.getLoc(), store.getValueToStore(), store.getMemRef(), *indices);
+    newStore->setAttr("polygeist.nontemporal", builder.getUnitAttr());
+    store.erase();
+  }
+
+  for (Operation *outer : streams) {
+    OpBuilder builder(outer->getContext());
+    builder.setInsertionPointAfter(outer);
+    builder.create<LLVM::FenceOp>(outer->getLoc(),
+                                  LLVM::AtomicOrdering::seq_cst, StringRef());
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createNonTemporalStoresPass(unsigned llcSize,
+                                                  unsigned cacheLineSize) {
+  return std::make_unique<NonTemporalStores>(llcSize, cacheLineSize);
+}
+} // namespace polygeist
+} // namespace mlir
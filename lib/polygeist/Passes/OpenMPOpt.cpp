@@ -1,11 +1,13 @@
 #include "PassDetails.h"
 
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/OpenMP/OpenMPDialect.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/Dialect/SCF/Transforms/Passes.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
 #include "mlir/IR/BlockAndValueMapping.h"
 #include "mlir/IR/Dominance.h"
 #include "mlir/IR/Matchers.h"
@@ -40,93 +42,6 @@ struct OpenMPOpt : public OpenMPOptPassBase<OpenMPOpt> {
 ///       omp.barrier
 ///       codeB();
 ///    }
-Value getBase(Value v);
-bool isStackAlloca(Value v);
-bool isCaptured(Value v, Operation *potentialUser = nullptr,
-                bool *seenuse = nullptr);
-
-bool mayReadFrom(Operation *op, Value val) {
-  bool hasRecursiveEffects = op->hasTrait<OpTrait::HasRecursiveMemoryEffects>();
-  if (hasRecursiveEffects) {
-    for (Region &region : op->getRegions()) {
-      for (auto &block : region) {
-        for (auto &nestedOp : block)
-          if (mayReadFrom(&nestedOp, val))
-            return true;
-      }
-    }
-    return false;
-  }
-
-  // If the op has memory effects, try to characterize them to see if the op
-  // is trivially dead here.
-  if (auto effectInterface = dyn_cast<MemoryEffectOpInterface>(op)) {
-    // Check to see if this op either has no effects, or only allocates/reads
-    // memory.
-    SmallVector<MemoryEffects::EffectInstance, 1> effects;
-    effectInterface.getEffects(effects);
-    for (auto it : effects) {
-      if (!isa<MemoryEffects::Read>(it.getEffect()))
-        continue;
-      if (mayAlias(it, val))
-        return true;
-    }
-    return false;
-  }
-  if (isa<LLVM::CallOp, func::CallOp>(op)) {
-    auto base = getBase(val);
-    bool seenuse = false;
-    if (isStackAlloca(base) && !isCaptured(base, op, &seenuse) && !seenuse) {
-      return false;
-    }
-  }
-  return true;
-}
-
-bool mayWriteTo(Operation *op, Value val, bool ignoreBarrier) {
-  bool hasRecursiveEffects = op->hasTrait<OpTrait::HasRecursiveMemoryEffects>();
-  if (hasRecursiveEffects) {
-    for (Region &region : op->getRegions()) {
-      for (auto &block : region) {
-        for (auto &nestedOp : block)
-          if (mayWriteTo(&nestedOp, val, ignoreBarrier))
-            return true;
-      }
-    }
-    return false;
-  }
-
-  if (ignoreBarrier && isa<polygeist::BarrierOp>(op))
-    return false;
-
-  // If the op has memory effects, try to characterize them to see if the op
-  // is trivially dead here.
-  if (auto effectInterface = dyn_cast<MemoryEffectOpInterface>(op)) {
-    // Check to see if this op either has no effects, or only allocates/reads
-    // memory.
-    SmallVector<MemoryEffects::EffectInstance, 1> effects;
-    effectInterface.getEffects(effects);
-    for (auto it : effects) {
-      if (!isa<MemoryEffects::Write>(it.getEffect()))
-        continue;
-      if (mayAlias(it, val))
-        return true;
-    }
-    return false;
-  }
-
-  // Calls which do not use a derived pointer of a known alloca, which is not
-  // captured can not write to said memory.
-  if (isa<LLVM::CallOp, func::CallOp>(op)) {
-    auto base = getBase(val);
-    bool seenuse = false;
-    if (isStackAlloca(base) && !isCaptured(base, op, &seenuse) && !seenuse) {
-      return false;
-    }
-  }
-  return true;
-}
-
 struct CombineParallel : public OpRewritePattern<omp::ParallelOp> {
   using OpRewritePattern<omp::ParallelOp>::OpRewritePattern;
 
@@ -290,10 +205,190 @@ struct ParallelIfInterchange : public OpRewritePattern<scf::IfOp> {
   }
 };
 
+/// How the work done by an iteration of a worksharing loop varies with its
+/// induction variables.
+enum class WorkShape {
+  /// Every iteration runs the same inner loops.
+  Uniform,
+  /// Inner trip counts are affine in the induction variables, as in the
+  /// triangular nests of a Cholesky or LU factorization.
+  Affine,
+  /// Inner trip counts depend on the induction variables in any other way,
+  /// e.g. through the row offsets of a sparse matrix.
+  Irregular
+};
+
+/// Returns true if `v` depends on an induction variable of `loop`.
+static bool dependsOnIV(Value v, omp::WsLoopOp loop,
+                        DenseMap<Value, bool> &cache) {
+  if (llvm::is_contained(loop.getRegion().front().getArguments(), v))
+    return true;
+  Operation *def = v.getDefiningOp();
+  if (!def || !loop->isProperAncestor(def))
+    return false;
+  auto found = cache.find(v);
+  if (found != cache.end())
+    return found->second;
+  // Values yielded from nested regions are not tracked.
+  bool depends = def->getNumRegions() != 0 ||
+                 llvm::any_of(def->getOperands(), [&](Value operand) {
+                   return dependsOnIV(operand, loop, cache);
+                 });
+  cache[v] = depends;
+  return depends;
+}
+
+/// Returns the coefficient of each induction variable of `loop` in `v` if it
+/// is an affine function of them with constant coefficients.
+static Optional<SmallVector<int64_t>>
+getIVCoefficients(Value v, omp::WsLoopOp loop, DenseMap<Value, bool> &cache) {
+  auto ivs = loop.getRegion().front().getArguments();
+  SmallVector<int64_t> coeffs(ivs.size(), 0);
+  if (!dependsOnIV(v, loop, cache))
+    return coeffs;
+  auto iv = llvm::find(ivs, v);
+  if (iv != ivs.end()) {
+    coeffs[std::distance(ivs.begin(), iv)] = 1;
+    return coeffs;
+  }
+
+  Operation *def = v.getDefiningOp();
+  if (isa<IndexCastOp, ExtSIOp, ExtUIOp, TruncIOp>(def))
+    return getIVCoefficients(def->getOperand(0), loop, cache);
+  if (isa<AddIOp, SubIOp>(def)) {
+    auto lhs = getIVCoefficients(def->getOperand(0), loop, cache);
+    auto rhs = getIVCoefficients(def->getOperand(1), loop, cache);
+    if (!lhs || !rhs)
+      return llvm::None;
+    int64_t sign = isa<SubIOp>(def) ? -1 : 1;
+    for (unsigned i = 0, e = coeffs.size(); i < e; i++)
+      coeffs[i] = (*lhs)[i] + sign * (*rhs)[i];
+    return coeffs;
+  }
+  if (isa<MulIOp>(def)) {
+    for (unsigned i = 0; i < 2; i++) {
+      Optional<int64_t> factor = getConstantIntValue(def->getOperand(1 - i));
+      if (!factor)
+        continue;
+      auto other = getIVCoefficients(def->getOperand(i), loop, cache);
+      if (!other)
+        return llvm::None;
+      for (int64_t &coeff : *other)
+        coeff *= *factor;
+      return other;
+    }
+  }
+  return llvm::None;
+}
+
+/// Classifies the work of the iterations of `loop` by the trip counts of the
+/// loops nested in it.
+static WorkShape getWorkShape(omp::WsLoopOp loop) {
+  DenseMap<Value, bool> cache;
+  WorkShape shape = WorkShape::Uniform;
+  loop->walk([&](scf::ForOp inner) {
+    if (!dependsOnIV(inner.getLowerBound(), loop, cache) &&
+        !dependsOnIV(inner.getUpperBound(), loop, cache) &&
+        !dependsOnIV(inner.getStep(), loop, cache))
+      return WalkResult::advance();
+    auto lb = getIVCoefficients(inner.getLowerBound(), loop, cache);
+    auto ub = getIVCoefficients(inner.getUpperBound(), loop, cache);
+    if (!lb || !ub || dependsOnIV(inner.getStep(), loop, cache)) {
+      shape = WorkShape::Irregular;
+      return WalkResult::interrupt();
+    }
+    // Bounds shifted by the same amount, as in tiled loops, keep the trip
+    // count fixed.
+    if (*lb != *ub)
+      shape = WorkShape::Affine;
+    return WalkResult::advance();
+  });
+  return shape;
+}
+
+/// Returns the iterations of `loop` that write one cache line of `lineSize`
+/// bytes through the stores whose innermost index depends on an induction
+/// variable, or one if there are none.
+static int64_t getIterationsPerLine(omp::WsLoopOp loop, unsigned lineSize) {
+  DenseMap<Value, bool> cache;
+  int64_t iterations = 1;
+  loop->walk([&](Operation *op) {
+    Value memref;
+    bool contiguous = false;
+    if (auto store = dyn_cast<memref::StoreOp>(op)) {
+      memref = store.getMemRef();
+      contiguous = !store.getIndices().empty() &&
+                   dependsOnIV(store.getIndices().back(), loop, cache);
+    } else if (auto store = dyn_cast<AffineWriteOpInterface>(op)) {
+      memref = store.getMemRef();
+      contiguous = llvm::any_of(store.getMapOperands(), [&](Value v) {
+        return dependsOnIV(v, loop, cache);
+      });
+    }
+    if (!contiguous)
+      return;
+    Type element = memref.getType().cast<MemRefType>().getElementType();
+    unsigned bytes =
+        element.isIntOrFloat() ? element.getIntOrFloatBitWidth() / 8 : 8;
+    iterations = std::max<int64_t>(iterations, lineSize / std::max(bytes, 1u));
+  });
+  return iterations;
+}
+
+/// Pick a schedule for worksharing loops whose iterations do uneven amounts of
+/// work, where the default static schedule hands each thread one contiguous
+/// block of iterations:
+///
+///  * when the inner trip counts grow or shrink linearly with the induction
+///    variables, iterations are dealt out cyclically in chunks writing whole
+///    cache lines, `schedule(static, chunk)`, so that every thread gets a
+///    similar share of short and long iterations without any runtime
+///    bookkeeping, and without threads writing the same lines,
+///  * when they vary in any other way, threads take iterations as they go,
+///    `schedule(guided)`.
+///
+/// Loops which already have a schedule are left alone.
+struct BalanceWsLoop : public OpRewritePattern<omp::WsLoopOp> {
+  BalanceWsLoop(MLIRContext *context, unsigned lineSize)
+      : OpRewritePattern<omp::WsLoopOp>(context), lineSize(lineSize) {}
+
+  LogicalResult matchAndRewrite(omp::WsLoopOp loop,
+                                PatternRewriter &rewriter) const override {
+    if (loop.getScheduleVal() || loop.getScheduleChunkVar())
+      return failure();
+
+    WorkShape shape = getWorkShape(loop);
+    if (shape == WorkShape::Uniform)
+      return failure();
+
+    if (shape == WorkShape::Affine) {
+      rewriter.setInsertionPoint(loop);
+      Value chunk = rewriter.create<ConstantIndexOp>(
+          loop.getLoc(), getIterationsPerLine(loop, lineSize));
+      rewriter.updateRootInPlace(loop, [&] {
+        loop.setScheduleValAttr(omp::ClauseScheduleKindAttr::get(
+            loop.getContext(), omp::ClauseScheduleKind::Static));
+        loop.getScheduleChunkVarMutable().assign(chunk);
+      });
+      return success();
+    }
+
+    rewriter.updateRootInPlace(loop, [&] {
+      loop.setScheduleValAttr(omp::ClauseScheduleKindAttr::get(
+          loop.getContext(), omp::ClauseScheduleKind::Guided));
+    });
+    return success();
+  }
+
+private:
+  unsigned lineSize;
+};
+
 void OpenMPOpt::runOnOperation() {
   mlir::RewritePatternSet rpl(getOperation()->getContext());
   rpl.add<CombineParallel, ParallelForInterchange, ParallelIfInterchange>(
       getOperation()->getContext());
+  rpl.add<BalanceWsLoop>(getOperation()->getContext(), cacheLineSize);
   GreedyRewriteConfig config;
   config.maxIterations = 47;
   (void)applyPatternsAndFoldGreedily(getOperation(), std::move(rpl), config);
@@ -13,6 +13,7 @@
 #include "mlir/IR/Matchers.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "mlir/Transforms/LoopInvariantCodeMotionUtils.h"
+#include "polygeist/AliasAnalysis.h"
 #include "polygeist/Passes/Passes.h"
 
 #define DEBUG_TYPE "parallel-licm"
@@ -30,6 +31,7 @@ struct ParallelLICM : public ParallelLICMBase<ParallelLICM> {
 
 static bool canBeParallelHoisted(Operation *op, Operation *scope,
                                  SmallPtrSetImpl<Operation *> &willBeMoved,
+                                 polygeist::AliasAnalysis &aa,
                                  bool includeAfter = false) {
   // Helper to check whether an operation is loop invariant wrt. SSA properties.
   LLVM_DEBUG(llvm::dbgs() << "Checking for parallel hoist: " << *op << "\n");
@@ -97,7 +99,7 @@ static bool canBeParallelHoisted(Operation *op, Operation *scope,
         SmallVector<MemoryEffects::EffectInstance> effects;
         memEffect.getEffectsOnResource(res.getResource(), effects);
         for (auto effect : effects) {
-          if (!mayAlias(effect, res))
+          if (!aa.mayAlias(effect, res))
             continue;
           if (isa<MemoryEffects::Allocate>(effect.getEffect())) {
             LLVM_DEBUG(llvm::dbgs()
@@ -117,7 +119,7 @@ static bool canBeParallelHoisted(Operation *op, Operation *scope,
         SmallVector<MemoryEffects::EffectInstance> effects;
         memEffect.getEffectsOnResource(res.getResource(), effects);
         for (auto effect : effects) {
-          if (!mayAlias(effect, res))
+          if (!aa.mayAlias(effect, res))
             continue;
           if (isa<MemoryEffects::Allocate>(effect.getEffect())) {
             LLVM_DEBUG(llvm::dbgs()
@@ -137,7 +139,7 @@ static bool canBeParallelHoisted(Operation *op, Operation *scope,
         SmallVector<MemoryEffects::EffectInstance> effects;
         memEffect.getEffectsOnResource(res.getResource(), effects);
         for (auto effect : effects) {
-          if (!mayAlias(effect, res))
+          if (!aa.mayAlias(effect, res))
             continue;
           if (isa<MemoryEffects::Allocate>(effect.getEffect())) {
             LLVM_DEBUG(llvm::dbgs()
@@ -226,7 +228,7 @@ static bool canBeParallelHoisted(Operation *op, Operation *scope,
   for (auto &region : op->getRegions()) {
     for (auto &block : region) {
       for (auto &innerOp : block)
-        if (!canBeParallelHoisted(&innerOp, scope, willBeMoved2,
+        if (!canBeParallelHoisted(&innerOp, scope, willBeMoved2, aa,
                                   includeAfter)) {
           LLVM_DEBUG(llvm::dbgs()
                      << " - cannot hoist due to inner: " << innerOp << "\n");
@@ -359,7 +361,8 @@ bool isSpeculatable(Operation *op) {
   return true;
 }
 
-void moveParallelLoopInvariantCode(scf::ParallelOp looplike) {
+void moveParallelLoopInvariantCode(scf::ParallelOp looplike,
+                                   polygeist::AliasAnalysis &aa) {
 
   // We use two collections here as we need to preserve the order for insertion
   // and this is easiest.
@@ -376,7 +379,7 @@ void moveParallelLoopInvariantCode(scf::ParallelOp looplike) {
       for (Block &block : region)
         for (Operation &op : block.without_terminator())
           if ((!checkSpeculative || isSpeculatable(&op)) &&
-              canBeParallelHoisted(&op, looplike, willBeMovedSet)) {
+              canBeParallelHoisted(&op, looplike, willBeMovedSet, aa)) {
             opsToMove.push_back(&op);
             willBeMovedSet.insert(&op);
           } else {
@@ -407,6 +410,8 @@ void moveParallelLoopInvariantCode(scf::ParallelOp looplike) {
 
     looplike->moveBefore(ifOp.thenBlock(), ifOp.thenBlock()->begin());
     looplike.replaceAllUsesWith(ifOp->getResults());
+    // Uses of the loop results moved to the guard.
+    aa.invalidate();
     OpBuilder B(ifOp.thenBlock(), ifOp.thenBlock()->end());
     B.create<scf::YieldOp>(looplike.getLoc(), looplike.getResults());
     if (!looplike.getResultTypes().empty()) {
@@ -420,7 +425,8 @@ void moveParallelLoopInvariantCode(scf::ParallelOp looplike) {
 }
 
 // TODO affine parallel licm
-void moveParallelLoopInvariantCode(AffineParallelOp looplike) {
+void moveParallelLoopInvariantCode(AffineParallelOp looplike,
+                                   polygeist::AliasAnalysis &aa) {
 
   // We use two collections here as we need to preserve the order for insertion
   // and this is easiest.
@@ -436,7 +442,7 @@ void moveParallelLoopInvariantCode(AffineParallelOp looplike) {
       for (Block &block : region)
         for (Operation &op : block.without_terminator())
           if ((!checkSpeculative || isSpeculatable(&op)) &&
-              canBeParallelHoisted(&op, looplike, willBeMovedSet)) {
+              canBeParallelHoisted(&op, looplike, willBeMovedSet, aa)) {
             opsToMove.push_back(&op);
             willBeMovedSet.insert(&op);
           } else {
@@ -516,6 +522,8 @@ void moveParallelLoopInvariantCode(AffineParallelOp looplike) {
 
     looplike->moveBefore(ifOp.getThenBlock(), ifOp.getThenBlock()->begin());
     looplike.replaceAllUsesWith(ifOp->getResults());
+    // Uses of the loop results moved to the guard.
+    aa.invalidate();
     OpBuilder B(ifOp.getThenBlock(), ifOp.getThenBlock()->end());
     B.create<AffineYieldOp>(looplike.getLoc(), looplike.getResults());
     if (!looplike.getResultTypes().empty()) {
@@ -529,7 +537,8 @@ void moveParallelLoopInvariantCode(AffineParallelOp looplike) {
   LLVM_DEBUG(looplike.print(llvm::dbgs() << "\n\nModified loop:\n"));
 }
 
-void moveSerialLoopInvariantCode(scf::ForOp looplike) {
+void moveSerialLoopInvariantCode(scf::ForOp looplike,
+                                 polygeist::AliasAnalysis &aa) {
 
   // We use two collections here as we need to preserve the order for insertion
   // and this is easiest.
@@ -545,7 +554,7 @@ void moveSerialLoopInvariantCode(scf::ForOp looplike) {
       for (Block &block : region)
         for (Operation &op : block.without_terminator())
           if ((!checkSpeculative || isSpeculatable(&op)) &&
-              canBeParallelHoisted(&op, looplike, willBeMovedSet,
+              canBeParallelHoisted(&op, looplike, willBeMovedSet, aa,
                                    /*checkAfter*/ true)) {
             opsToMove.push_back(&op);
             willBeMovedSet.insert(&op);
@@ -570,6 +579,8 @@ void moveSerialLoopInvariantCode(scf::ForOp looplike) {
 
     looplike->moveBefore(ifOp.thenBlock(), ifOp.thenBlock()->begin());
     looplike.replaceAllUsesWith(ifOp->getResults());
+    // Uses of the loop results moved to the guard.
+    aa.invalidate();
     OpBuilder B(ifOp.thenBlock(), ifOp.thenBlock()->end());
     B.create<scf::YieldOp>(looplike.getLoc(), looplike.getResults());
     if (!looplike.getResultTypes().empty()) {
@@ -582,7 +593,8 @@ void moveSerialLoopInvariantCode(scf::ForOp looplike) {
   LLVM_DEBUG(looplike.print(llvm::dbgs() << "\n\nModified loop:\n"));
 }
 
-void moveSerialLoopInvariantCode(AffineForOp looplike) {
+void moveSerialLoopInvariantCode(AffineForOp looplike,
+                                 polygeist::AliasAnalysis &aa) {
 
   // We use two collections here as we need to preserve the order for insertion
   // and this is easiest.
@@ -598,7 +610,7 @@ void moveSerialLoopInvariantCode(AffineForOp looplike) {
       for (Block &block : region)
         for (Operation &op : block.without_terminator()) {
           if ((!checkSpeculative || isSpeculatable(&op)) &&
-              canBeParallelHoisted(&op, looplike, willBeMovedSet,
+              canBeParallelHoisted(&op, looplike, willBeMovedSet, aa,
                                    /*checkAfter*/ true)) {
             opsToMove.push_back(&op);
             willBeMovedSet.insert(&op);
@@ -679,6 +691,8 @@ void moveSerialLoopInvariantCode(AffineForOp looplike) {
 
     looplike->moveBefore(ifOp.getThenBlock(), ifOp.getThenBlock()->begin());
     looplike.replaceAllUsesWith(ifOp->getResults());
+    // Uses of the loop results moved to the guard.
+    aa.invalidate();
     OpBuilder B(ifOp.getThenBlock(), ifOp.getThenBlock()->end());
     B.create<AffineYieldOp>(looplike.getLoc(), looplike.getResults());
     if (!looplike.getResultTypes().empty()) {
@@ -692,17 +706,20 @@ void moveSerialLoopInvariantCode(AffineForOp looplike) {
 }
 
 void ParallelLICM::runOnOperation() {
+  // Moving operations out of loops does not change the base objects or
+  // captures the analysis caches, only guarding a loop does.
+  polygeist::AliasAnalysis &aa = getAnalysis<polygeist::AliasAnalysis>();
   getOperation()->walk([&](LoopLikeOpInterface loopLike) {
     LLVM_DEBUG(loopLike.print(llvm::dbgs() << "\nOriginal loop:\n"));
     moveLoopInvariantCode(loopLike);
     if (auto par = dyn_cast<scf::ParallelOp>((Operation *)loopLike)) {
-      moveParallelLoopInvariantCode(par);
+      moveParallelLoopInvariantCode(par, aa);
     } else if (auto par = dyn_cast<AffineParallelOp>((Operation *)loopLike)) {
-      moveParallelLoopInvariantCode(par);
+      moveParallelLoopInvariantCode(par, aa);
     } else if (auto par = dyn_cast<scf::ForOp>((Operation *)loopLike)) {
-      moveSerialLoopInvariantCode(par);
+      moveSerialLoopInvariantCode(par, aa);
     } else if (auto par = dyn_cast<AffineForOp>((Operation *)loopLike)) {
-      moveSerialLoopInvariantCode(par);
+      moveSerialLoopInvariantCode(par, aa);
     }
   });
 }
@@ -15,6 +15,7 @@
 #include "mlir/Dialect/OpenMP/OpenMPDialect.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/Dialect/SCF/Transforms/Passes.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
 #include "mlir/IR/BlockAndValueMapping.h"
 #include "mlir/IR/Dominance.h"
 #include "mlir/IR/ImplicitLocOpBuilder.h"
@@ -23,12 +24,17 @@
 #include "mlir/Support/LLVM.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+#include "polygeist/AliasAnalysis.h"
 #include "polygeist/BarrierUtils.h"
 #include "polygeist/Ops.h"
 #include "polygeist/Passes/Passes.h"
 #include "polygeist/Passes/Utils.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
 
 #include <deque>
+#include <memory>
+#include <mutex>
 
 #define DEBUG_TYPE "cpuify"
 #define DBGS() ::llvm::dbgs() << "[" DEBUG_TYPE "] "
@@ -142,12 +148,13 @@ static bool arePreceedingOpsFullyRecomputable(Operation *op,
   SmallVector<MemoryEffects::EffectInstance> beforeEffects;
   getEffectsBefore(op, beforeEffects, /*stopAtBarrier*/ false);
 
+  polygeist::AliasAnalysis aa;
   for (auto it : beforeEffects) {
     if (isa<MemoryEffects::Read>(it.getEffect())) {
       if (singleExecution)
         continue;
       if (Value v = it.getValue())
-        if (!mayWriteTo(op, v, /*ignoreBarrier*/ true))
+        if (!aa.mayWriteTo(op, v, /*ignoreBarrier*/ true))
           continue;
     }
     return false;
@@ -157,7 +164,8 @@ static bool arePreceedingOpsFullyRecomputable(Operation *op,
 }
 
 static bool isRecomputableAfterDistribute(Operation *op,
-                                          polygeist::BarrierOp barrier) {
+                                          polygeist::BarrierOp barrier,
+                                          polygeist::AliasAnalysis &aa) {
   // The below logic should not disagree with the logic in interchange and wrap,
   // otherwise we might cache unneeded results or wrap* will ask us to
   // distribute again if it thinks the ops we decide here are recomputable here
@@ -204,7 +212,7 @@ static bool isRecomputableAfterDistribute(Operation *op,
     assert(isa<MemoryEffects::Read>(it.getEffect()));
     if (Value v = it.getValue())
       for (Operation *op = begin; op != end; op = op->getNextNode())
-        if (mayWriteTo(op, v, /*ignoreBarrier*/ true))
+        if (aa.mayWriteTo(op, v, /*ignoreBarrier*/ true))
           return false;
   }
   return true;
@@ -216,10 +224,12 @@ static void minCutCache(polygeist::BarrierOp barrier,
   Graph G;
   llvm::SetVector<Operation *> NonRecomputable;
 
+  // The same locations are checked against every op before the barrier.
+  polygeist::AliasAnalysis aa;
   for (Operation *op = &barrier->getBlock()->front(); op != barrier;
        op = op->getNextNode()) {
 
-    if (!isRecomputableAfterDistribute(op, barrier))
+    if (!isRecomputableAfterDistribute(op, barrier, aa))
       NonRecomputable.insert(op);
 
     for (Value value : op->getResults()) {
@@ -684,10 +694,252 @@ LogicalResult splitSubLoop(AffineParallelOp op, PatternRewriter &rewriter,
   return success();
 }
 
+/// A value live across a barrier, kept in a per-thread cache buffer or
+/// recomputed after the barrier.
+struct CrossingValue {
+  std::string op;
+  std::string loc;
+  std::string type;
+  /// Bytes per thread, None if the size of the type is not known.
+  Optional<int64_t> bytes;
+};
+
+/// The cache buffers allocated to distribute a parallel loop around one
+/// barrier. Buffers are allocated once per iteration of the loops enclosing the
+/// distributed dimensions, i.e. once per block.
+struct BarrierFootprint {
+  std::string loc;
+  /// Trip counts of the dimensions the barrier synchronizes, None where not
+  /// constant.
+  SmallVector<Optional<int64_t>, 3> threads;
+  std::vector<CrossingValue> cached;
+  std::vector<CrossingValue> recomputed;
+  /// Set if caching every value would have exceeded the budget, so values were
+  /// recomputed wherever possible instead.
+  bool overBudget = false;
+
+  Optional<int64_t> getBytesPerThread() const {
+    int64_t total = 0;
+    for (const CrossingValue &v : cached) {
+      if (!v.bytes)
+        return llvm::None;
+      total += *v.bytes;
+    }
+    return total;
+  }
+
+  Optional<int64_t> getBytes() const {
+    Optional<int64_t> total = getBytesPerThread();
+    for (Optional<int64_t> count : threads) {
+      if (!total || !count)
+        return llvm::None;
+      *total *= *count;
+    }
+    return total;
+  }
+
+  /// The buffer size as a product of the bytes per thread and the block
+  /// dimensions, e.g. "12 * 16 * blockDim.y".
+  std::string getSize() const {
+    static const char *dimNames[] = {"blockDim.x", "blockDim.y", "blockDim.z"};
+    std::string str;
+    llvm::raw_string_ostream os(str);
+    if (Optional<int64_t> perThread = getBytesPerThread())
+      os << *perThread;
+    else
+      os << "?";
+    for (auto en : llvm::enumerate(threads)) {
+      os << " * ";
+      if (en.value())
+        os << *en.value();
+      else if (en.index() < 3)
+        os << dimNames[en.index()];
+      else
+        os << "dim" << en.index();
+    }
+    return os.str();
+  }
+};
+
+/// Cache buffers of all barriers of one function, and the budget above which
+/// distribution recomputes values rather than caching them.
+struct CacheFootprint {
+  /// Budget in bytes per block, 0 for none.
+  int64_t budget = 0;
+  /// Emit a remark for every barrier.
+  bool remarks = false;
+  std::vector<BarrierFootprint> barriers;
+};
+
+static std::string getLocString(Location loc) {
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  loc->walk([&](Location nested) {
+    if (auto fileLoc = nested.dyn_cast<FileLineColLoc>()) {
+      os << fileLoc.getFilename().getValue() << ":" << fileLoc.getLine() << ":"
+         << fileLoc.getColumn();
+      return WalkResult::interrupt();
+    }
+    return WalkResult::advance();
+  });
+  return os.str();
+}
+
+static Optional<int64_t> getTypeBytes(Type type, const DataLayout &DLI) {
+  // Memrefs are bare pointers once lowered.
+  if (type.isa<MemRefType>())
+    type = LLVM::LLVMPointerType::get(IntegerType::get(type.getContext(), 8));
+  if (type.isIntOrIndexOrFloat() || type.isa<DataLayoutTypeInterface>())
+    return DLI.getTypeSize(type);
+  return llvm::None;
+}
+
+/// Describes `v`, or for an alloca the memory it allocates, which is what gets
+/// copied into the per-thread buffer.
+static CrossingValue describeValue(Value v, const DataLayout &DLI) {
+  CrossingValue desc;
+  desc.op = v.getDefiningOp()->getName().getStringRef().str();
+  desc.loc = getLocString(v.getLoc());
+  Type type = v.getType();
+  Optional<int64_t> count = 1;
+  if (auto ao = v.getDefiningOp<memref::AllocaOp>()) {
+    type = ao.getType().getElementType();
+    if (ao.getType().hasStaticShape())
+      count = ao.getType().getNumElements();
+    else
+      count = llvm::None;
+  } else if (auto ao = v.getDefiningOp<LLVM::AllocaOp>()) {
+    type = ao.getType().cast<LLVM::LLVMPointerType>().getElementType();
+    APInt size;
+    if (matchPattern(ao.getArraySize(), m_ConstantInt(&size)))
+      count = size.getSExtValue();
+    else
+      count = llvm::None;
+  }
+  if (!type)
+    return desc;
+  {
+    llvm::raw_string_ostream os(desc.type);
+    os << type;
+  }
+  Optional<int64_t> bytes = getTypeBytes(type, DLI);
+  if (bytes && count)
+    desc.bytes = *bytes * *count;
+  return desc;
+}
+
+static void getSynchronizedTripCounts(scf::ParallelOp op, BarrierOp barrier,
+                                      SmallVectorImpl<Optional<int64_t>> &counts) {
+  for (auto en : llvm::enumerate(op.getBody()->getArguments())) {
+    if (!llvm::is_contained(barrier->getOperands(), en.value()))
+      continue;
+    Optional<int64_t> lb = getConstantIntValue(op.getLowerBound()[en.index()]);
+    Optional<int64_t> ub = getConstantIntValue(op.getUpperBound()[en.index()]);
+    Optional<int64_t> step = getConstantIntValue(op.getStep()[en.index()]);
+    if (lb && ub && step && *step > 0)
+      counts.push_back(llvm::divideCeil(std::max<int64_t>(*ub - *lb, 0), *step));
+    else
+      counts.push_back(llvm::None);
+  }
+}
+
+static void getSynchronizedTripCounts(AffineParallelOp op, BarrierOp barrier,
+                                      SmallVectorImpl<Optional<int64_t>> &counts) {
+  auto ranges = op.getConstantRanges();
+  SmallVector<int64_t> steps = op.getSteps();
+  for (auto en : llvm::enumerate(op.getBody()->getArguments())) {
+    if (!llvm::is_contained(barrier->getOperands(), en.value()))
+      continue;
+    if (ranges)
+      counts.push_back(llvm::divideCeil(
+          std::max<int64_t>((*ranges)[en.index()], 0), steps[en.index()]));
+    else
+      counts.push_back(llvm::None);
+  }
+}
+
+/// Records the buffers distributing `op` around `barrier` allocates for
+/// `crossingCache` and `preserveAllocas`, and the values of `usedBelow` that
+/// are recomputed instead.
+template <typename T>
+static void recordFootprint(CacheFootprint &footprint, T op, BarrierOp barrier,
+                            const llvm::SetVector<Value> &usedBelow,
+                            const llvm::SetVector<Value> &crossingCache,
+                            const llvm::SetVector<Operation *> &preserveAllocas,
+                            bool overBudget, const DataLayout &DLI) {
+  BarrierFootprint record;
+  record.loc = getLocString(barrier.getLoc());
+  record.overBudget = overBudget;
+  getSynchronizedTripCounts(op, barrier, record.threads);
+
+  SmallVector<Value> cached;
+  for (Value v : crossingCache) {
+    // Values reloaded from an existing cache need no new buffer.
+    if (!v.getDefiningOp<polygeist::CacheLoad>())
+      cached.push_back(v);
+  }
+  for (Operation *alloca : preserveAllocas)
+    cached.push_back(alloca->getResult(0));
+  SmallVector<Value> recomputed;
+  for (Value v : usedBelow)
+    if (!crossingCache.contains(v) &&
+        !preserveAllocas.contains(v.getDefiningOp()))
+      recomputed.push_back(v);
+
+  for (Value v : cached)
+    record.cached.push_back(describeValue(v, DLI));
+  for (Value v : recomputed)
+    record.recomputed.push_back(describeValue(v, DLI));
+
+  if (footprint.remarks) {
+    InFlightDiagnostic diag = barrier->emitRemark()
+                              << "barrier buffers: " << cached.size()
+                              << " cached value(s) in " << record.getSize();
+    if (Optional<int64_t> bytes = record.getBytes())
+      diag << " = " << *bytes;
+    diag << " bytes per block, " << recomputed.size() << " recomputed";
+    if (overBudget)
+      diag << " (caching all exceeds the budget of " << footprint.budget
+           << " bytes)";
+    for (auto pair : llvm::zip(cached, record.cached)) {
+      Diagnostic &note = diag.attachNote(std::get<0>(pair).getLoc())
+                         << "cached " << std::get<1>(pair).type;
+      if (std::get<1>(pair).bytes)
+        note << " (" << *std::get<1>(pair).bytes << " bytes per thread)";
+    }
+    for (Value v : recomputed)
+      diag.attachNote(v.getLoc()) << "recomputed after the barrier";
+  }
+  footprint.barriers.push_back(std::move(record));
+}
+
+/// Returns true if caching every value of `usedBelow` (and copying
+/// `preserveAllocas`) around `barrier` may take more than the budget. Buffers
+/// whose size is not known at compile time count as exceeding it.
+template <typename T>
+static bool exceedsBudget(const CacheFootprint &footprint, T op,
+                          BarrierOp barrier,
+                          const llvm::SetVector<Value> &usedBelow,
+                          const llvm::SetVector<Operation *> &preserveAllocas,
+                          const DataLayout &DLI) {
+  if (footprint.budget <= 0)
+    return false;
+  BarrierFootprint full;
+  getSynchronizedTripCounts(op, barrier, full.threads);
+  for (Value v : usedBelow)
+    if (!preserveAllocas.contains(v.getDefiningOp()))
+      full.cached.push_back(describeValue(v, DLI));
+  for (Operation *alloca : preserveAllocas)
+    full.cached.push_back(describeValue(alloca->getResult(0), DLI));
+  Optional<int64_t> bytes = full.getBytes();
+  return !bytes || *bytes > footprint.budget;
+}
+
 template <typename T, bool UseMinCut>
 static LogicalResult distributeAroundBarrier(T op, BarrierOp barrier,
                                              T &preLoop, T &postLoop,
                                              PatternRewriter &rewriter,
+                                             CacheFootprint &footprint,
                                              Operation **postPop = nullptr) {
   if (op.getNumResults() != 0) {
     LLVM_DEBUG(DBGS() << "[distribute] not matching reduction loops\n");
@@ -703,8 +955,16 @@ static LogicalResult distributeAroundBarrier(T op, BarrierOp barrier,
   llvm::SetVector<Operation *> preserveAllocas;
   findValuesUsedBelow(barrier, usedBelow, preserveAllocas);
 
+  auto mod = ((Operation *)op)->getParentOfType<ModuleOp>();
+  assert(mod);
+  DataLayout DLI(mod);
+
+  // Over budget, recompute what can be recomputed rather than caching it.
+  bool overBudget = !UseMinCut && exceedsBudget(footprint, op, barrier,
+                                                usedBelow, preserveAllocas, DLI);
+
   llvm::SetVector<Value> crossingCache;
-  if (UseMinCut) {
+  if (UseMinCut || overBudget) {
 
     minCutCache(barrier, usedBelow, crossingCache);
 
@@ -788,6 +1048,9 @@ static LogicalResult distributeAroundBarrier(T op, BarrierOp barrier,
 
   assert(iterCounts.size() == preLoop.getBody()->getArguments().size());
 
+  recordFootprint(footprint, op, barrier, usedBelow, crossingCache,
+                  preserveAllocas, overBudget, DLI);
+
   size_t outIdx = 0;
   size_t inIdx = 0;
   for (auto en : op.getBody()->getArguments()) {
@@ -812,9 +1075,6 @@ static LogicalResult distributeAroundBarrier(T op, BarrierOp barrier,
   SmallVector<Value> allocaAllocations;
   cacheAllocations.reserve(crossingCache.size());
   allocaAllocations.reserve(preserveAllocas.size());
-  auto mod = ((Operation *)op)->getParentOfType<ModuleOp>();
-  assert(mod);
-  DataLayout DLI(mod);
   auto addToAllocations = [&](Value v, SmallVector<Value> &allocations) {
     if (auto cl = v.getDefiningOp<polygeist::CacheLoad>()) {
       allocations.push_back(cl.getMemref());
@@ -970,19 +1230,21 @@ static BarrierOp getFirstBarrier(Block *block) {
 
 template <typename T, bool UseMinCut>
 static LogicalResult distributeAroundFirstBarrier(T op, T &preLoop, T &postLoop,
-                                                  PatternRewriter &rewriter) {
+                                                  PatternRewriter &rewriter,
+                                                  CacheFootprint &footprint) {
   BarrierOp barrier = getFirstBarrier(op.getBody());
   if (!barrier)
     return failure();
   return distributeAroundBarrier<T, UseMinCut>(op, barrier, preLoop, postLoop,
-                                               rewriter);
+                                               rewriter, footprint);
 }
 template <typename T, bool UseMinCut>
 static LogicalResult distributeAroundFirstBarrier(T op,
-                                                  PatternRewriter &rewriter) {
+                                                  PatternRewriter &rewriter,
+                                                  CacheFootprint &footprint) {
   T preLoop, postLoop;
   return distributeAroundFirstBarrier<T, UseMinCut>(op, preLoop, postLoop,
-                                                    rewriter);
+                                                    rewriter, footprint);
 }
 
 /// Splits a parallel loop around the first barrier it immediately contains.
@@ -990,12 +1252,15 @@ static LogicalResult distributeAroundFirstBarrier(T op,
 /// loaded back when needed.
 template <typename T, bool UseMinCut>
 struct DistributeAroundBarrier : public OpRewritePattern<T> {
-  DistributeAroundBarrier(MLIRContext *ctx) : OpRewritePattern<T>(ctx) {}
+  DistributeAroundBarrier(MLIRContext *ctx, CacheFootprint &footprint)
+      : OpRewritePattern<T>(ctx), footprint(footprint) {}
 
   LogicalResult matchAndRewrite(T op,
                                 PatternRewriter &rewriter) const override {
-    return distributeAroundFirstBarrier<T, UseMinCut>(op, rewriter);
+    return distributeAroundFirstBarrier<T, UseMinCut>(op, rewriter, footprint);
   }
+
+  CacheFootprint &footprint;
 };
 
 /// Checks if `op` may need to be wrapped in a pair of barriers. This is a
@@ -1082,6 +1347,7 @@ static LogicalResult wrapWithBarriers(T op, PatternRewriter &rewriter,
 template <typename T, bool UseMinCut>
 static LogicalResult distributeAfterWrap(Operation *pop, BarrierOp barrier,
                                          PatternRewriter &rewriter,
+                                         CacheFootprint &footprint,
                                          Operation **postPop = nullptr) {
   if (!barrier)
     return failure();
@@ -1089,15 +1355,16 @@ static LogicalResult distributeAfterWrap(Operation *pop, BarrierOp barrier,
     return failure();
   T preLoop, postLoop;
   if (auto cast = dyn_cast<T>(pop))
-    return distributeAroundBarrier<T, UseMinCut>(cast, barrier, preLoop,
-                                                 postLoop, rewriter, postPop);
+    return distributeAroundBarrier<T, UseMinCut>(
+        cast, barrier, preLoop, postLoop, rewriter, footprint, postPop);
   else
     return failure();
 }
 
 template <typename T, bool UseMinCut>
 static LogicalResult wrapAndDistribute(T op, bool singleExecution,
-                                       PatternRewriter &rewriter) {
+                                       PatternRewriter &rewriter,
+                                       CacheFootprint &footprint) {
   SmallVector<BlockArgument> vals;
   if (failed(canWrapWithBarriers(op, vals)))
     return failure();
@@ -1118,20 +1385,23 @@ static LogicalResult wrapAndDistribute(T op, bool singleExecution,
   auto pop = op->getParentOp();
   if (before) {
     Operation *postPop = nullptr;
-    (void)distributeAfterWrap<scf::ParallelOp, UseMinCut>(pop, before, rewriter,
-                                                          &postPop);
-    (void)distributeAfterWrap<AffineParallelOp, UseMinCut>(pop, before,
-                                                           rewriter, &postPop);
+    (void)distributeAfterWrap<scf::ParallelOp, UseMinCut>(
+        pop, before, rewriter, footprint, &postPop);
+    (void)distributeAfterWrap<AffineParallelOp, UseMinCut>(
+        pop, before, rewriter, footprint, &postPop);
     after = getFirstBarrier(postPop->getBlock());
     (void)distributeAfterWrap<scf::ParallelOp, UseMinCut>(
-        dyn_cast_or_null<scf::ParallelOp>(postPop), after, rewriter);
+        dyn_cast_or_null<scf::ParallelOp>(postPop), after, rewriter,
+        footprint);
     (void)distributeAfterWrap<AffineParallelOp, UseMinCut>(
-        dyn_cast_or_null<AffineParallelOp>(postPop), after, rewriter);
+        dyn_cast_or_null<AffineParallelOp>(postPop), after, rewriter,
+        footprint);
   } else {
     // We only have a barrier after the op
-    (void)distributeAfterWrap<scf::ParallelOp, UseMinCut>(pop, after, rewriter);
+    (void)distributeAfterWrap<scf::ParallelOp, UseMinCut>(pop, after, rewriter,
+                                                          footprint);
     (void)distributeAfterWrap<AffineParallelOp, UseMinCut>(pop, after,
-                                                           rewriter);
+                                                           rewriter, footprint);
   }
 
   return success();
@@ -1142,15 +1412,18 @@ static LogicalResult wrapAndDistribute(T op, bool singleExecution,
 /// (normalized) loop.
 template <typename IfType, bool UseMinCut>
 struct WrapIfWithBarrier : public OpRewritePattern<IfType> {
-  WrapIfWithBarrier(MLIRContext *ctx) : OpRewritePattern<IfType>(ctx) {}
+  WrapIfWithBarrier(MLIRContext *ctx, CacheFootprint &footprint)
+      : OpRewritePattern<IfType>(ctx), footprint(footprint) {}
   LogicalResult matchAndRewrite(IfType op,
                                 PatternRewriter &rewriter) const override {
     if (op.getNumResults() != 0)
       return failure();
 
     return wrapAndDistribute<IfType, UseMinCut>(op, /* singleExecution */ true,
-                                                rewriter);
+                                                rewriter, footprint);
   }
+
+  CacheFootprint &footprint;
 };
 
 /// Puts a barrier before and/or after a "for" operation if there isn't already
@@ -1158,32 +1431,38 @@ struct WrapIfWithBarrier : public OpRewritePattern<IfType> {
 /// (normalized) loop.
 template <bool UseMinCut>
 struct WrapForWithBarrier : public OpRewritePattern<scf::ForOp> {
-  WrapForWithBarrier(MLIRContext *ctx) : OpRewritePattern<scf::ForOp>(ctx) {}
+  WrapForWithBarrier(MLIRContext *ctx, CacheFootprint &footprint)
+      : OpRewritePattern<scf::ForOp>(ctx), footprint(footprint) {}
 
   LogicalResult matchAndRewrite(scf::ForOp op,
                                 PatternRewriter &rewriter) const override {
     return wrapAndDistribute<scf::ForOp, UseMinCut>(
-        op, /* singleExecution */ false, rewriter);
+        op, /* singleExecution */ false, rewriter, footprint);
   }
+
+  CacheFootprint &footprint;
 };
 
 template <bool UseMinCut>
 struct WrapAffineForWithBarrier : public OpRewritePattern<AffineForOp> {
-  WrapAffineForWithBarrier(MLIRContext *ctx)
-      : OpRewritePattern<AffineForOp>(ctx) {}
+  WrapAffineForWithBarrier(MLIRContext *ctx, CacheFootprint &footprint)
+      : OpRewritePattern<AffineForOp>(ctx), footprint(footprint) {}
 
   LogicalResult matchAndRewrite(AffineForOp op,
                                 PatternRewriter &rewriter) const override {
     return wrapAndDistribute<AffineForOp, UseMinCut>(
-        op, /* singleExecution */ false, rewriter);
+        op, /* singleExecution */ false, rewriter, footprint);
   }
+
+  CacheFootprint &footprint;
 };
 
 /// Puts a barrier before and/or after a "while" operation if there isn't
 /// already one.
 template <bool UseMinCut>
 struct WrapWhileWithBarrier : public OpRewritePattern<scf::WhileOp> {
-  using OpRewritePattern<scf::WhileOp>::OpRewritePattern;
+  WrapWhileWithBarrier(MLIRContext *ctx, CacheFootprint &footprint)
+      : OpRewritePattern<scf::WhileOp>(ctx), footprint(footprint) {}
 
   LogicalResult matchAndRewrite(scf::WhileOp op,
                                 PatternRewriter &rewriter) const override {
@@ -1195,8 +1474,10 @@ struct WrapWhileWithBarrier : public OpRewritePattern<scf::WhileOp> {
     }
 
     return wrapAndDistribute<scf::WhileOp, UseMinCut>(
-        op, /* singleExecution */ false, rewriter);
+        op, /* singleExecution */ false, rewriter, footprint);
   }
+
+  CacheFootprint &footprint;
 };
 
 // Clone the recomputable ops from the old parallel to the new one up until the
@@ -1977,11 +2258,12 @@ struct DistributeIfAroundBarrier : public OpRewritePattern<IfOpType> {
         break;
     }
 
+    polygeist::AliasAnalysis aa;
     for (auto it : effects) {
       assert(isa<MemoryEffects::Read>(it.getEffect()));
       if (Value v = it.getValue())
         for (Operation *op = begin; op != end; op = op->getNextNode())
-          if (mayWriteTo(op, v, /*ignoreBarrier*/ true))
+          if (aa.mayWriteTo(op, v, /*ignoreBarrier*/ true))
             return false;
     }
     return true;
@@ -2637,13 +2919,15 @@ struct LowerCacheLoad : public OpRewritePattern<polygeist::CacheLoad> {
 
 struct CPUifyPass : public SCFCPUifyBase<CPUifyPass> {
   template <bool UseMinCut>
-  void addPatterns(RewritePatternSet &patterns, StringRef method) {
+  void addPatterns(RewritePatternSet &patterns, StringRef method,
+                   CacheFootprint &footprint) {
+    patterns.insert<WrapForWithBarrier<UseMinCut>,
+                    WrapAffineForWithBarrier<UseMinCut>,
+                    WrapWhileWithBarrier<UseMinCut>>(&getContext(), footprint);
     patterns.insert<
         BarrierElim</*TopLevelOnly*/ false>, Reg2MemWhile,
         Reg2MemFor<scf::ForOp, UseMinCut>, Reg2MemFor<AffineForOp, UseMinCut>,
         Reg2MemIf<scf::IfOp, UseMinCut>, Reg2MemIf<AffineIfOp, UseMinCut>,
-        WrapForWithBarrier<UseMinCut>, WrapAffineForWithBarrier<UseMinCut>,
-        WrapWhileWithBarrier<UseMinCut>,
         InterchangeForIfPFor<scf::ParallelOp, scf::ForOp>,
         InterchangeForIfPFor<AffineParallelOp, scf::ForOp>,
         InterchangeForIfPFor<scf::ParallelOp, AffineForOp>,
@@ -2670,28 +2954,111 @@ struct CPUifyPass : public SCFCPUifyBase<CPUifyPass> {
             &getContext());
       }
       patterns.insert<WrapIfWithBarrier<scf::IfOp, UseMinCut>,
-                      WrapIfWithBarrier<AffineIfOp, UseMinCut>>(&getContext());
+                      WrapIfWithBarrier<AffineIfOp, UseMinCut>>(&getContext(),
+                                                                footprint);
     }
 
     patterns.insert<
         // NormalizeLoop,
-        NormalizeParallel,
+        NormalizeParallel
         // RotateWhile,
+        >(&getContext());
+    patterns.insert<DistributeAroundBarrier<scf::ParallelOp, UseMinCut>,
+                    DistributeAroundBarrier<AffineParallelOp, UseMinCut>>(
+        &getContext(), footprint);
+  }
+
+  /// Writes the footprint of the current function to the report file as one
+  /// line of JSON. The first line written by this pass, or its clones running
+  /// on other functions, replaces the contents of the file.
+  void writeReport(const CacheFootprint &footprint) {
+    llvm::json::Array barriers;
+    int64_t total = 0;
+    bool dynamic = false;
+    auto toJSON = [](const CrossingValue &v) {
+      return llvm::json::Object{{"op", v.op},
+                                {"location", v.loc},
+                                {"type", v.type},
+                                {"bytes", v.bytes}};
+    };
+    for (const BarrierFootprint &barrier : footprint.barriers) {
+      llvm::json::Array threads, cached, recomputed;
+      for (Optional<int64_t> count : barrier.threads)
+        threads.push_back(count);
+      for (const CrossingValue &v : barrier.cached)
+        cached.push_back(toJSON(v));
+      for (const CrossingValue &v : barrier.recomputed)
+        recomputed.push_back(toJSON(v));
+      Optional<int64_t> bytes = barrier.getBytes();
+      if (bytes)
+        total += *bytes;
+      else
+        dynamic = true;
+      barriers.push_back(
+          llvm::json::Object{{"location", barrier.loc},
+                             {"threads", std::move(threads)},
+                             {"cached", std::move(cached)},
+                             {"recomputed", std::move(recomputed)},
+                             {"bytes_per_thread", barrier.getBytesPerThread()},
+                             {"size", barrier.getSize()},
+                             {"bytes", bytes},
+                             {"over_budget", barrier.overBudget}});
+    }
+    llvm::json::Object function{
+        {"function", getFunctionName()},
+        {"method", std::string(this->method)},
+        {"barriers", std::move(barriers)},
+        {"bytes", total},
+        {"dynamic", dynamic},
+    };
+    if (cacheBudget > 0)
+      function["budget"] = int64_t(cacheBudget);
+
+    // Functions may be processed concurrently; keep their lines whole.
+    static std::mutex reportMutex;
+    std::lock_guard<std::mutex> lock(reportMutex);
+    std::error_code EC;
+    llvm::raw_fd_ostream os(report, EC,
+                            *reportStarted ? llvm::sys::fs::OF_Append
+                                           : llvm::sys::fs::OF_None);
+    *reportStarted = true;
+    if (EC) {
+      getOperation()->emitError("cannot open cpuify report '")
+          << StringRef(report) << "': " << EC.message();
+      return signalPassFailure();
+    }
+    os << llvm::json::Value(std::move(function)) << "\n";
+  }
 
-        DistributeAroundBarrier<scf::ParallelOp, UseMinCut>,
-        DistributeAroundBarrier<AffineParallelOp, UseMinCut>>(&getContext());
+  std::string getFunctionName() {
+    if (auto symbol = dyn_cast<SymbolOpInterface>(getOperation()))
+      return symbol.getName().str();
+    return getOperation()->getName().getStringRef().str();
   }
+
+  /// Whether the report was written to, shared by the clones of the pass.
+  std::shared_ptr<bool> reportStarted = std::make_shared<bool>(false);
+
   CPUifyPass() = default;
-  CPUifyPass(StringRef method) { this->method.setValue(method.str()); }
+  CPUifyPass(StringRef method, int64_t cacheBudget, StringRef report,
+             bool remarks) {
+    this->method.setValue(method.str());
+    this->cacheBudget.setValue(cacheBudget);
+    this->report.setValue(report.str());
+    this->remarks.setValue(remarks);
+  }
   void runOnOperation() override {
     StringRef method(this->method);
     if (method.startswith("distribute")) {
+      CacheFootprint footprint;
+      footprint.budget = cacheBudget;
+      footprint.remarks = remarks;
       {
         RewritePatternSet patterns(&getContext());
         if (method.contains("mincut"))
-          addPatterns<true>(patterns, method);
+          addPatterns<true>(patterns, method, footprint);
         else
-          addPatterns<false>(patterns, method);
+          addPatterns<false>(patterns, method, footprint);
         GreedyRewriteConfig config;
         config.maxIterations = 142;
         if (failed(applyPatternsAndFoldGreedily(getOperation(),
@@ -2710,6 +3077,8 @@ struct CPUifyPass : public SCFCPUifyBase<CPUifyPass> {
           return;
         }
       }
+      if (!report.empty() && !footprint.barriers.empty())
+        writeReport(footprint);
     } else if (method == "omp") {
       SmallVector<polygeist::BarrierOp> toReplace;
       getOperation()->walk(
@@ -2730,8 +3099,9 @@ struct CPUifyPass : public SCFCPUifyBase<CPUifyPass> {
 
 namespace mlir {
 namespace polygeist {
-std::unique_ptr<Pass> createCPUifyPass(StringRef str) {
-  return std::make_unique<CPUifyPass>(str);
+std::unique_ptr<Pass> createCPUifyPass(StringRef str, int64_t cacheBudget,
+                                       StringRef report, bool remarks) {
+  return std::make_unique<CPUifyPass>(str, cacheBudget, report, remarks);
 }
 } // namespace polygeist
 } // namespace mlir
@@ -30,7 +30,6 @@
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include <algorithm>
-#include <mutex>
 
 #define DEBUG_TYPE "parallel-lower-opt"
 
@@ -75,7 +74,10 @@ namespace {
 // TODO do not take wrap argument, instead, always wrap and if we will be
 // lowering to cpu, remove them before continuing
 struct ParallelLower : public ParallelLowerBase<ParallelLower> {
-  ParallelLower(bool wrapParallelOps) : wrapParallelOps(wrapParallelOps) {}
+  ParallelLower(bool wrapParallelOps, bool inlineAll)
+      : wrapParallelOps(wrapParallelOps) {
+    this->inlineAll.setValue(inlineAll);
+  }
   void runOnOperation() override;
   bool wrapParallelOps;
 };
@@ -92,8 +94,9 @@ namespace polygeist {
 std::unique_ptr<Pass> createCudaRTLowerPass() {
   return std::make_unique<CudaRTLower>();
 }
-std::unique_ptr<Pass> createParallelLowerPass(bool wrapParallelOps) {
-  return std::make_unique<ParallelLower>(wrapParallelOps);
+std::unique_ptr<Pass> createParallelLowerPass(bool wrapParallelOps,
+                                              bool inlineAll) {
+  return std::make_unique<ParallelLower>(wrapParallelOps, inlineAll);
 }
 } // namespace polygeist
 } // namespace mlir
@@ -160,9 +163,6 @@ struct AlwaysInlinerInterface : public InlinerInterface {
 // TODO
 mlir::Value callMalloc(mlir::OpBuilder &ibuilder, mlir::ModuleOp module,
                        mlir::Location loc, mlir::Value arg) {
-  static std::mutex _mutex;
-  std::unique_lock<std::mutex> lock(_mutex);
-
   mlir::OpBuilder builder(module.getContext());
   SymbolTableCollection symbolTable;
   std::vector args = {arg};
@@ -189,9 +189,6 @@ mlir::Value callMalloc(mlir::OpBuilder &ibuilder, mlir::ModuleOp module,
   return ibuilder.create<mlir::LLVM::CallOp>(loc, fn, args)->getResult(0);
 }
 mlir::LLVM::LLVMFuncOp GetOrCreateFreeFunction(ModuleOp module) {
-  static std::mutex _mutex;
-  std::unique_lock<std::mutex> lock(_mutex);
-
   mlir::OpBuilder builder(module.getContext());
   SymbolTableCollection symbolTable;
   if (auto fn = dyn_cast_or_null<LLVM::LLVMFuncOp>(
@@ -212,6 +209,51 @@ mlir::LLVM::LLVMFuncOp GetOrCreateFreeFunction(ModuleOp module) {
 LogicalResult fixupGetFunc(LLVM::CallOp, OpBuilder &rewriter,
                            SmallVectorImpl<Value> &);
 
+/// How calls to a device function are lowered into the thread loop of a
+/// kernel. Ordered so that a caller needs at least the lowering of its
+/// callees.
+enum class CalleeLowering {
+  /// Leave the call alone, the callee does not depend on the thread.
+  Call,
+  /// Call a clone of the callee that takes the block and thread ids and the
+  /// grid and block dimensions as trailing index arguments.
+  Specialize,
+  /// Inline the callee, its barriers and shared memory must end up in the
+  /// thread loop for barrier elimination to see them.
+  Inline,
+};
+
+/// Number of index arguments appended to specialized device functions: the
+/// block ids, thread ids, grid dimensions and block dimensions, each in x, y,
+/// z order like the arguments of the gpu.launch body.
+static constexpr unsigned numLaunchArgs = 12;
+
+static bool isSharedMemory(Operation *op) {
+  if (auto alop = dyn_cast<memref::AllocaOp>(op))
+    if (auto ia =
+            alop.getType().getMemorySpace().dyn_cast_or_null<IntegerAttr>())
+      return ia.getValue() == 5;
+  if (auto alop = dyn_cast<LLVM::AllocaOp>(op))
+    return alop.getType().cast<LLVM::LLVMPointerType>().getAddressSpace() == 5;
+  return false;
+}
+
+/// Returns the lowering `F` needs for the operations in its own body.
+static CalleeLowering getLocalLowering(FunctionOpInterface F) {
+  CalleeLowering lowering = CalleeLowering::Call;
+  F->walk([&](Operation *op) {
+    if (isa<NVVM::Barrier0Op>(op) || isSharedMemory(op)) {
+      lowering = CalleeLowering::Inline;
+      return WalkResult::interrupt();
+    }
+    if (isa<gpu::ThreadIdOp, gpu::BlockIdOp, gpu::GridDimOp, gpu::BlockDimOp>(
+            op))
+      lowering = CalleeLowering::Specialize;
+    return WalkResult::advance();
+  });
+  return lowering;
+}
+
 void ParallelLower::runOnOperation() {
   // The inliner should only be run on operations that define a symbol table,
   // as the callgraph will need to resolve references.
@@ -224,6 +266,61 @@ void ParallelLower::runOnOperation() {
       bidx.erase();
   });
 
+  auto getCallee = [&](Operation *call) -> FunctionOpInterface {
+    auto callable = cast<CallOpInterface>(call).getCallableForCallee();
+    auto symRef = callable.dyn_cast<SymbolRefAttr>();
+    if (!symRef)
+      return nullptr;
+    return dyn_cast_or_null<FunctionOpInterface>(
+        symbolTable.lookupNearestSymbolFrom(getOperation(), symRef));
+  };
+
+  // Only device functions that contain barriers or shared memory, directly
+  // or through their callees, need to be inlined into the thread loop. The
+  // ones that merely read the thread or block ids are specialized to take
+  // them as arguments, and the rest stay calls. Barrier-free libraries of
+  // device functions so keep their size instead of being copied into every
+  // kernel. An llvm.func cannot take index arguments, so it is inlined
+  // whenever it would have to be specialized.
+  DenseMap<Operation *, CalleeLowering> lowering;
+  if (!inlineAll) {
+    getOperation().walk([&](FunctionOpInterface F) {
+      lowering[F] = getLocalLowering(F);
+    });
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto &pair : lowering) {
+        CalleeLowering level = pair.second;
+        pair.first->walk([&](Operation *call) {
+          if (!isa<CallOp, LLVM::CallOp>(call))
+            return;
+          if (FunctionOpInterface callee = getCallee(call))
+            level = std::max(level, lowering.lookup(callee));
+        });
+        if (level == CalleeLowering::Specialize && !isa<FuncOp>(pair.first))
+          level = CalleeLowering::Inline;
+        if (level != pair.second) {
+          pair.second = level;
+          changed = true;
+        }
+      }
+    }
+  }
+  auto getLowering = [&](Operation *call) {
+    FunctionOpInterface callee = getCallee(call);
+    if (!callee)
+      return CalleeLowering::Call;
+    return lowering.lookup(callee);
+  };
+  auto shouldInline = [&](Operation *call) {
+    if (inlineAll)
+      return true;
+    CalleeLowering level = getLowering(call);
+    return level == CalleeLowering::Inline ||
+           (level == CalleeLowering::Specialize && isa<LLVM::CallOp>(call));
+  };
+
   std::function<void(LLVM::CallOp)> LLVMcallInliner;
   std::function<void(CallOp)> callInliner = [&](CallOp caller) {
     // Build the inliner interface.
@@ -247,13 +344,19 @@ void ParallelLower::runOnOperation() {
       return;
     {
       SmallVector<CallOp> ops;
-      callableOp.walk([&](CallOp caller) { ops.push_back(caller); });
+      callableOp.walk([&](CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
       for (auto op : ops)
         callInliner(op);
     }
     {
       SmallVector<LLVM::CallOp> ops;
-      callableOp.walk([&](LLVM::CallOp caller) { ops.push_back(caller); });
+      callableOp.walk([&](LLVM::CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
       for (auto op : ops)
         LLVMcallInliner(op);
     }
@@ -301,13 +404,19 @@ void ParallelLower::runOnOperation() {
       return;
     {
       SmallVector<CallOp> ops;
-      callableOp.walk([&](CallOp caller) { ops.push_back(caller); });
+      callableOp.walk([&](CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
       for (auto op : ops)
         callInliner(op);
     }
     {
       SmallVector<LLVM::CallOp> ops;
-      callableOp.walk([&](LLVM::CallOp caller) { ops.push_back(caller); });
+      callableOp.walk([&](LLVM::CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
       for (auto op : ops)
         LLVMcallInliner(op);
     }
@@ -351,12 +460,23 @@ void ParallelLower::runOnOperation() {
     SmallVector<mlir::Value> toFollowOps;
     SetVector<FunctionOpInterface> toinl;
 
-    getOperation().walk(
-        [&](mlir::gpu::ThreadIdOp bidx) { inlineOps.push_back(bidx); });
-    getOperation().walk(
-        [&](mlir::gpu::GridDimOp bidx) { inlineOps.push_back(bidx); });
-    getOperation().walk(
-        [&](mlir::NVVM::Barrier0Op bidx) { inlineOps.push_back(bidx); });
+    if (inlineAll) {
+      getOperation().walk(
+          [&](mlir::gpu::ThreadIdOp bidx) { inlineOps.push_back(bidx); });
+      getOperation().walk(
+          [&](mlir::gpu::GridDimOp bidx) { inlineOps.push_back(bidx); });
+      getOperation().walk(
+          [&](mlir::NVVM::Barrier0Op bidx) { inlineOps.push_back(bidx); });
+    } else {
+      // Direct calls are handled per launch below, only pointers to device
+      // functions that depend on the thread still need to be resolved.
+      getOperation().walk([&](polygeist::GetFuncOp gf) {
+        auto *F = symbolTable.lookupNearestSymbolFrom(getOperation(),
+                                                      gf.getNameAttr());
+        if (lowering.lookup(F) != CalleeLowering::Call)
+          toFollowOps.push_back(gf.getResult());
+      });
+    }
 
     SymbolUserMap symbolUserMap(symbolTable, getOperation());
     while (inlineOps.size()) {
@@ -432,6 +552,87 @@ void ParallelLower::runOnOperation() {
     }
   }
 
+  // Clones of device functions taking the launch arguments, see
+  // CalleeLowering::Specialize.
+  DenseMap<Operation *, FuncOp> specialized;
+  std::function<FuncOp(FuncOp)> getSpecialized;
+  auto specializeCalls = [&](Operation *root, ValueRange launchArgs) {
+    SmallVector<CallOp> calls;
+    root->walk([&](CallOp call) {
+      if (getLowering(call) == CalleeLowering::Specialize)
+        calls.push_back(call);
+    });
+    for (CallOp call : calls) {
+      FuncOp callee = getSpecialized(cast<FuncOp>(getCallee(call)));
+      SmallVector<Value> args(call.getOperands());
+      args.append(launchArgs.begin(), launchArgs.end());
+      OpBuilder b(call);
+      auto newCall = b.create<CallOp>(call.getLoc(), callee, args);
+      call.replaceAllUsesWith(newCall.getResults());
+      call.erase();
+    }
+  };
+  getSpecialized = [&](FuncOp F) {
+    auto found = specialized.find(F);
+    if (found != specialized.end())
+      return found->second;
+
+    // Calls that cannot forward the ids must be inlined before cloning.
+    {
+      SmallVector<LLVM::CallOp> ops;
+      F.walk([&](LLVM::CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
+      for (auto op : ops)
+        LLVMcallInliner(op);
+    }
+
+    FuncOp clone = F.clone();
+    clone.setName((F.getName() + ".thread").str());
+    clone.setPrivate();
+    symbolTable.getSymbolTable(getOperation())
+        .insert(clone, std::next(F->getIterator()));
+    specialized[F] = clone;
+
+    OpBuilder b(clone);
+    SmallVector<unsigned> indices(numLaunchArgs, clone.getNumArguments());
+    SmallVector<Type> types(numLaunchArgs, b.getIndexType());
+    SmallVector<DictionaryAttr> attrs(numLaunchArgs, b.getDictionaryAttr({}));
+    SmallVector<Location> locs(numLaunchArgs, clone.getLoc());
+    clone.insertArguments(indices, types, attrs, locs);
+    ValueRange launchArgs =
+        clone.getArguments().take_back(numLaunchArgs);
+
+    SmallVector<Operation *> ids;
+    clone.walk([&](Operation *op) {
+      if (isa<gpu::BlockIdOp, gpu::ThreadIdOp, gpu::GridDimOp,
+              gpu::BlockDimOp>(op))
+        ids.push_back(op);
+    });
+    for (Operation *op : ids) {
+      unsigned offset = 0;
+      gpu::Dimension dim;
+      if (auto bidx = dyn_cast<gpu::BlockIdOp>(op)) {
+        dim = bidx.getDimension();
+      } else if (auto tidx = dyn_cast<gpu::ThreadIdOp>(op)) {
+        offset = 3;
+        dim = tidx.getDimension();
+      } else if (auto gdim = dyn_cast<gpu::GridDimOp>(op)) {
+        offset = 6;
+        dim = gdim.getDimension();
+      } else {
+        offset = 9;
+        dim = cast<gpu::BlockDimOp>(op).getDimension();
+      }
+      op->replaceAllUsesWith(
+          ValueRange(launchArgs[offset + static_cast<unsigned>(dim)]));
+      op->erase();
+    }
+    specializeCalls(clone, launchArgs);
+    return clone;
+  };
+
   // Only supports single block functions at the moment.
 
   SmallVector<gpu::LaunchOp> toHandle;
@@ -440,13 +641,19 @@ void ParallelLower::runOnOperation() {
   for (gpu::LaunchOp launchOp : toHandle) {
     {
       SmallVector<CallOp> ops;
-      launchOp.walk([&](CallOp caller) { ops.push_back(caller); });
+      launchOp.walk([&](CallOp caller) {
+        if (shouldInline(caller))
+          ops.push_back(caller);
+      });
       for (auto op : ops)
         callInliner(op);
     }
     {
       SmallVector<LLVM::CallOp> lops;
-      launchOp.walk([&](LLVM::CallOp caller) { lops.push_back(caller); });
+      launchOp.walk([&](LLVM::CallOp caller) {
+        if (shouldInline(caller))
+          lops.push_back(caller);
+      });
       for (auto op : lops)
         LLVMcallInliner(op);
     }
@@ -515,6 +722,9 @@ void ParallelLower::runOnOperation() {
 
     auto container = threadr;
 
+    if (!inlineAll)
+      specializeCalls(container, launchArgs);
+
     container.walk([&](mlir::gpu::BlockIdOp bidx) {
       int idx = -1;
       if (bidx.getDimension() == gpu::Dimension::x)
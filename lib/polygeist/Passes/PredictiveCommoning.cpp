@@ -0,0 +1,411 @@
+//===- PredictiveCommoning.cpp - Carry reused values across iterations ----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Rewrites innermost affine.for loops so that values an iteration recomputes
+// from the same inputs as an earlier iteration are carried in iter_args
+// instead. In a stencil
+//
+//    affine.for %i = 1 to %n - 1 {
+//      %l = affine.load %A[%i - 1]
+//      %c = affine.load %A[%i]
+//      %r = affine.load %A[%i + 1]
+//      ...
+//    }
+//
+// `%l` and `%c` are the `%r` of two and one iterations before, so only `%r`
+// is still loaded and the other two rotate through iter_args. Pure operations
+// whose operands repeat in the same way, such as partial sums of the loaded
+// values, are carried as well.
+//
+// Loads are only carried from memrefs nothing in the loop may write. The
+// values the first iterations take from before the loop are computed ahead
+// of it, under a guard that the loop runs at all when its trip count is not
+// known, as they may read memory the loop would not have read otherwise.
+// For the same reason, operations which may trap, such as integer divisions,
+// are never carried.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "polygeist/AliasAnalysis.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "predictive-commoning"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct PredictiveCommoning
+    : public PredictiveCommoningBase<PredictiveCommoning> {
+  PredictiveCommoning() = default;
+  PredictiveCommoning(unsigned maxDistance) {
+    this->maxDistance.setValue(maxDistance);
+  }
+  void runOnOperation() override;
+};
+
+/// Finds the values of the body of an affine.for which repeat values of
+/// earlier iterations.
+class ReuseAnalysis {
+public:
+  ReuseAnalysis(AffineForOp loop, polygeist::AliasAnalysis &aa)
+      : loop(loop), aa(aa) {}
+
+  /// Returns true if the value of `op` can be carried: it is computed in
+  /// every iteration from loop-invariant values, the induction variable, and
+  /// memory the loop does not write.
+  bool isCandidate(Operation *op);
+
+  /// Returns true if `value` in each iteration equals `leader` computed
+  /// `distance` iterations before.
+  bool isShifted(Value value, Value leader, int64_t distance);
+
+private:
+  bool isReadOnly(Value memref);
+  bool isShiftedLoad(AffineLoadOp load, AffineLoadOp leader, int64_t distance);
+
+  AffineForOp loop;
+  polygeist::AliasAnalysis &aa;
+  DenseMap<Value, bool> readOnly;
+  DenseMap<std::tuple<Value, Value, int64_t>, bool> shifted;
+};
+
+/// A value of the loop body which the rewritten loop carries in iter_args:
+/// its values of the last `distance` iterations, newest first, replace the
+/// `members` which repeat them.
+struct Chain {
+  Value leader;
+  int64_t distance = 0;
+  SmallVector<std::pair<Value, int64_t>> members;
+};
+} // namespace
+
+bool ReuseAnalysis::isReadOnly(Value memref) {
+  auto found = readOnly.find(memref);
+  if (found != readOnly.end())
+    return found->second;
+  bool result = loop.isDefinedOutsideOfLoop(memref) &&
+                llvm::none_of(loop.getBody()->without_terminator(),
+                              [&](Operation &op) {
+                                return aa.mayWriteTo(&op, memref);
+                              });
+  readOnly[memref] = result;
+  return result;
+}
+
+bool ReuseAnalysis::isCandidate(Operation *op) {
+  if (op->getBlock() != loop.getBody() || op->getNumResults() != 1 ||
+      op->getNumRegions() != 0 || op->hasTrait<OpTrait::ConstantLike>())
+    return false;
+  if (auto load = dyn_cast<AffineLoadOp>(op))
+    return isReadOnly(load.getMemRef()) &&
+           llvm::all_of(load.getMapOperands(), [&](Value v) {
+             return v == loop.getInductionVar() ||
+                    loop.isDefinedOutsideOfLoop(v);
+           });
+  // The leaders are computed for iterations before the loop, which the loop
+  // itself may never run.
+  return isMemoryEffectFree(op) && isSpeculatable(op);
+}
+
+bool ReuseAnalysis::isShiftedLoad(AffineLoadOp load, AffineLoadOp leader,
+                                  int64_t distance) {
+  if (load.getMemRef() != leader.getMemRef() ||
+      !llvm::equal(load.getMapOperands(), leader.getMapOperands()))
+    return false;
+
+  // The indices of `leader` in the iteration `distance` before.
+  AffineMap map = leader.getAffineMap();
+  SmallVector<AffineExpr> dims, syms;
+  for (unsigned i = 0, e = map.getNumDims(); i < e; ++i) {
+    dims.push_back(getAffineDimExpr(i, load.getContext()));
+    if (leader.getMapOperands()[i] == loop.getInductionVar())
+      dims.back() = dims.back() - distance * loop.getStep();
+  }
+  for (unsigned i = 0, e = map.getNumSymbols(); i < e; ++i)
+    syms.push_back(getAffineSymbolExpr(i, load.getContext()));
+  AffineMap earlier = simplifyAffineMap(map.replaceDimsAndSymbols(
+      dims, syms, map.getNumDims(), map.getNumSymbols()));
+  return earlier == simplifyAffineMap(load.getAffineMap());
+}
+
+bool ReuseAnalysis::isShifted(Value value, Value leader, int64_t distance) {
+  Operation *op = value.getDefiningOp();
+  Operation *leaderOp = leader.getDefiningOp();
+  if (!op || !leaderOp || op == leaderOp || !isCandidate(op) ||
+      !isCandidate(leaderOp))
+    return false;
+
+  auto key = std::make_tuple(value, leader, distance);
+  auto found = shifted.find(key);
+  if (found != shifted.end())
+    return found->second;
+
+  bool result = false;
+  if (auto load = dyn_cast<AffineLoadOp>(op)) {
+    if (auto leaderLoad = dyn_cast<AffineLoadOp>(leaderOp))
+      result = isShiftedLoad(load, leaderLoad, distance);
+  } else if (op->getName() == leaderOp->getName() &&
+             op->getAttrDictionary() == leaderOp->getAttrDictionary() &&
+             op->getResultTypes() == leaderOp->getResultTypes() &&
+             op->getNumOperands() == leaderOp->getNumOperands()) {
+    // At least one operand must come from the body, or both are the same
+    // loop-invariant value.
+    bool varies = false;
+    result = true;
+    for (auto pair : llvm::zip(op->getOperands(), leaderOp->getOperands())) {
+      Value a = std::get<0>(pair), b = std::get<1>(pair);
+      if (a == b && loop.isDefinedOutsideOfLoop(a))
+        continue;
+      varies = true;
+      if (!isShifted(a, b, distance)) {
+        result = false;
+        break;
+      }
+    }
+    result &= varies;
+  }
+  shifted[key] = result;
+  return result;
+}
+
+/// Groups the values of the body of `loop` which repeat values of earlier
+/// iterations by the value they repeat, keeping only those which are still
+/// used once all of them are carried.
+static SmallVector<Chain> getChains(AffineForOp loop, unsigned maxDistance,
+                                    ReuseAnalysis &reuse) {
+  SmallVector<Value> values;
+  for (Operation &op : loop.getBody()->without_terminator())
+    if (reuse.isCandidate(&op))
+      values.push_back(op.getResult(0));
+
+  // A value repeats another if some earlier iteration computed it; the
+  // values which repeat nothing but are repeated lead the chains.
+  llvm::SetVector<Value> repeats, leaders;
+  for (Value value : values)
+    for (Value other : values)
+      for (unsigned d = 1; d <= maxDistance; ++d)
+        if (reuse.isShifted(value, other, d)) {
+          repeats.insert(value);
+          leaders.insert(other);
+        }
+  leaders.set_subtract(repeats);
+
+  SmallVector<Chain> chains;
+  DenseMap<Value, unsigned> chainOf;
+  for (Value leader : leaders) {
+    chainOf[leader] = chains.size();
+    chains.push_back(Chain{leader});
+  }
+  DenseSet<Value> carried;
+  SmallVector<std::tuple<Value, unsigned, int64_t>> members;
+  for (Value value : repeats) {
+    for (unsigned d = 1; d <= maxDistance; ++d) {
+      auto leader = llvm::find_if(
+          leaders, [&](Value l) { return reuse.isShifted(value, l, d); });
+      if (leader == leaders.end())
+        continue;
+      carried.insert(value);
+      members.push_back({value, chainOf[*leader], d});
+      break;
+    }
+  }
+
+  // Operands of carried values are only needed if something else uses them.
+  for (auto member : members) {
+    Value value = std::get<0>(member);
+    if (llvm::all_of(value.getUsers(), [&](Operation *user) {
+          return user->getNumResults() == 1 &&
+                 carried.contains(user->getResult(0));
+        }))
+      continue;
+    Chain &chain = chains[std::get<1>(member)];
+    chain.members.push_back({value, std::get<2>(member)});
+    chain.distance = std::max(chain.distance, std::get<2>(member));
+  }
+  llvm::erase_if(chains, [](const Chain &chain) { return !chain.distance; });
+  return chains;
+}
+
+/// Returns a guard of `loop` that holds when it runs at least one iteration.
+static AffineIfOp createGuard(OpBuilder &builder, AffineForOp loop) {
+  AffineMap lbMap = loop.getLowerBoundMap(), ubMap = loop.getUpperBoundMap();
+  unsigned lbDims = lbMap.getNumDims(), lbSyms = lbMap.getNumSymbols();
+  SmallVector<AffineExpr> constraints;
+  for (AffineExpr ub : ubMap.getResults()) {
+    ub = ub.shiftDims(ubMap.getNumDims(), lbDims)
+             .shiftSymbols(ubMap.getNumSymbols(), lbSyms);
+    for (AffineExpr lb : lbMap.getResults())
+      constraints.push_back(ub - lb - 1);
+  }
+  IntegerSet set = IntegerSet::get(
+      lbDims + ubMap.getNumDims(), lbSyms + ubMap.getNumSymbols(), constraints,
+      SmallVector<bool>(constraints.size(), false));
+
+  SmallVector<Value> operands;
+  auto lbOperands = loop.getLowerBoundOperands();
+  auto ubOperands = loop.getUpperBoundOperands();
+  operands.append(lbOperands.begin(), lbOperands.begin() + lbDims);
+  operands.append(ubOperands.begin(), ubOperands.begin() + ubMap.getNumDims());
+  operands.append(lbOperands.begin() + lbDims, lbOperands.end());
+  operands.append(ubOperands.begin() + ubMap.getNumDims(), ubOperands.end());
+  canonicalizeSetAndOperands(&set, &operands);
+
+  return builder.create<AffineIfOp>(
+      loop.getLoc(), loop.getResultTypes(), set, operands,
+      /*withElseRegion=*/loop.getNumResults() != 0);
+}
+
+/// Computes the value of `leader` in the iteration `distance` before the
+/// first one of `loop`, at the insertion point of `builder`.
+static Value cloneBeforeLoop(OpBuilder &builder, AffineForOp loop,
+                             Value leader, int64_t distance) {
+  AffineMap lbMap = loop.getLowerBoundMap();
+  AffineMap ivMap =
+      AffineMap::get(lbMap.getNumDims(), lbMap.getNumSymbols(),
+                     lbMap.getResult(0) - distance * loop.getStep());
+  Value iv = builder.create<AffineApplyOp>(loop.getLoc(), ivMap,
+                                           loop.getLowerBoundOperands());
+
+  // The operations of the body `leader` depends on, in order.
+  llvm::SetVector<Operation *> slice;
+  SmallVector<Operation *> worklist = {leader.getDefiningOp()};
+  while (!worklist.empty()) {
+    Operation *op = worklist.pop_back_val();
+    if (!slice.insert(op))
+      continue;
+    for (Value operand : op->getOperands())
+      if (Operation *def = operand.getDefiningOp())
+        if (def->getBlock() == loop.getBody())
+          worklist.push_back(def);
+  }
+
+  BlockAndValueMapping mapping;
+  mapping.map(loop.getInductionVar(), iv);
+  for (Operation &op : loop.getBody()->without_terminator()) {
+    if (!slice.contains(&op))
+      continue;
+    Operation *clone = builder.clone(op, mapping);
+    if (auto load = dyn_cast<AffineLoadOp>(clone)) {
+      AffineMap map = load.getAffineMap();
+      SmallVector<Value> operands(load.getMapOperands());
+      fullyComposeAffineMapAndOperands(&map, &operands);
+      canonicalizeMapAndOperands(&map, &operands);
+      load->setAttr(AffineLoadOp::getMapAttrStrName(), AffineMapAttr::get(map));
+      load->setOperands(1, load->getNumOperands() - 1, operands);
+    }
+  }
+  if (iv.use_empty())
+    iv.getDefiningOp()->erase();
+  return mapping.lookup(leader);
+}
+
+/// Carries the values of `chains` across the iterations of `loop`.
+static void rewriteLoop(AffineForOp loop, ArrayRef<Chain> chains) {
+  OpBuilder builder(loop);
+  if (!getConstantTripCount(loop)) {
+    AffineIfOp guard = createGuard(builder, loop);
+    loop->replaceAllUsesWith(guard);
+    Block *thenBlock = guard.getThenBlock();
+    if (loop.getNumResults()) {
+      loop->moveBefore(thenBlock, thenBlock->end());
+      builder.setInsertionPointToEnd(thenBlock);
+      builder.create<AffineYieldOp>(loop.getLoc(), loop.getResults());
+      builder.setInsertionPointToEnd(guard.getElseBlock());
+      builder.create<AffineYieldOp>(loop.getLoc(), loop.getIterOperands());
+    } else {
+      loop->moveBefore(thenBlock->getTerminator());
+    }
+    builder.setInsertionPoint(loop);
+  }
+
+  SmallVector<Value> inits(loop.getIterOperands());
+  for (const Chain &chain : chains)
+    for (int64_t d = 1; d <= chain.distance; ++d)
+      inits.push_back(cloneBeforeLoop(builder, loop, chain.leader, d));
+
+  auto newLoop = builder.create<AffineForOp>(
+      loop.getLoc(), loop.getLowerBoundOperands(), loop.getLowerBoundMap(),
+      loop.getUpperBoundOperands(), loop.getUpperBoundMap(), loop.getStep(),
+      inits);
+  Block *body = newLoop.getBody();
+  body->getOperations().splice(body->end(), loop.getBody()->getOperations());
+  loop.getInductionVar().replaceAllUsesWith(newLoop.getInductionVar());
+  for (auto pair :
+       llvm::zip(loop.getRegionIterArgs(), newLoop.getRegionIterArgs()))
+    std::get<0>(pair).replaceAllUsesWith(std::get<1>(pair));
+
+  // Each chain yields its leader and passes its other values one iteration
+  // further back.
+  SmallVector<Value> yielded;
+  unsigned arg = loop.getNumIterOperands();
+  for (const Chain &chain : chains) {
+    auto args = newLoop.getRegionIterArgs().slice(arg, chain.distance);
+    for (auto member : chain.members)
+      member.first.replaceAllUsesWith(args[member.second - 1]);
+    yielded.push_back(chain.leader);
+    yielded.append(args.begin(), args.end() - 1);
+    arg += chain.distance;
+  }
+  Operation *yield = body->getTerminator();
+  yield->insertOperands(yield->getNumOperands(), yielded);
+
+  for (auto pair : llvm::zip(loop.getResults(), newLoop.getResults()))
+    std::get<0>(pair).replaceAllUsesWith(std::get<1>(pair));
+  loop.erase();
+
+  // The replaced values, and whatever only they used.
+  for (Operation &op :
+       llvm::make_early_inc_range(llvm::reverse(body->getOperations())))
+    if (op.use_empty() && op.getNumResults() == 1 &&
+        !op.hasTrait<OpTrait::IsTerminator>() &&
+        (isa<AffineLoadOp>(op) || wouldOpBeTriviallyDead(&op)))
+      op.erase();
+}
+
+void PredictiveCommoning::runOnOperation() {
+  auto &aa = getAnalysis<polygeist::AliasAnalysis>();
+
+  SmallVector<AffineForOp> loops;
+  getOperation()->walk([&](AffineForOp loop) {
+    bool innermost = true;
+    loop.getBody()->walk([&](AffineForOp) { innermost = false; });
+    Optional<uint64_t> trips = getConstantTripCount(loop);
+    if (innermost && loop.getLowerBoundMap().getNumResults() == 1 &&
+        (!trips || *trips > 1))
+      loops.push_back(loop);
+  });
+
+  for (AffineForOp loop : loops) {
+    ReuseAnalysis reuse(loop, aa);
+    SmallVector<Chain> chains = getChains(loop, maxDistance, reuse);
+    if (chains.empty())
+      continue;
+    LLVM_DEBUG(llvm::dbgs() << "carrying " << chains.size() << " values at "
+                            << loop.getLoc() << "\n");
+    rewriteLoop(loop, chains);
+    aa.invalidate();
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createPredictiveCommoningPass(unsigned maxDistance) {
+  return std::make_unique<PredictiveCommoning>(maxDistance);
+}
+} // namespace polygeist
+} // namespace mlir
@@ -0,0 +1,472 @@
+//===- SharedStagingElision.cpp - Drop shared-memory staging copies -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Removes the shared-memory staging of tiled CUDA kernels lowered to the CPU.
+// A kernel such as
+//
+//   for (m = 0; m < K / 16; m++) {
+//     As[ty][tx] = A[row * K + m * 16 + tx];
+//     Bs[ty][tx] = B[(m * 16 + ty) * N + col];
+//     __syncthreads();
+//     for (k = 0; k < 16; k++)
+//       sum += As[ty][k] * Bs[k][tx];
+//     __syncthreads();
+//   }
+//
+// copies tiles of global memory into __shared__ buffers so that the threads of
+// a block reuse them. On the CPU the caches already provide that reuse, and
+// the copies and the barriers protecting them force barrier distribution. A
+// buffer whose every element is written once, by the thread with the matching
+// indices, with a value computed from memory that nothing writes while the
+// buffer is live, is an exact copy: each read As[i][j] is replaced by the
+// global read that thread (tx = j, ty = i) performed, and the copy goes away.
+//
+// When all the buffers staged in a loop body (or a stretch of the kernel
+// body) are removed and the stretch then writes no memory, its barriers only
+// protected the copies and are removed too. A single barrier on either side
+// of the stretch still orders it with the writes of the rest of the kernel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassDetails.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BlockAndValueMapping.h"
+#include "mlir/IR/Matchers.h"
+#include "polygeist/Ops.h"
+#include "polygeist/Passes/Passes.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "elide-shared-staging"
+
+using namespace mlir;
+using namespace polygeist;
+
+namespace {
+struct SharedStagingElision
+    : public SharedStagingElisionBase<SharedStagingElision> {
+  void runOnOperation() override;
+};
+
+/// A buffer shared by the threads of a block that each thread fills with one
+/// element.
+struct StagedBuffer {
+  memref::AllocaOp alloca;
+  /// The buffer and the casts of it, e.g. to a dynamically shaped type.
+  SmallVector<Value> views;
+  Operation *fill = nullptr;
+  /// The thread induction variable indexing each dimension in the fill.
+  SmallVector<Value> fillTids;
+  SmallVector<Operation *> reads;
+};
+
+/// A stretch of a block, run by all threads of a block, in which shared
+/// buffers are filled and read.
+struct Stretch {
+  Operation *par;
+  Block *block;
+  /// Whether the stretch is the whole body of a loop directly inside `par`.
+  bool isLoopBody;
+  SmallVector<StagedBuffer> buffers;
+  Block::iterator begin, end;
+};
+} // namespace
+
+static bool isThreadParallel(Operation *op) {
+  return isa<scf::ParallelOp, AffineParallelOp>(op);
+}
+
+static Value getMemref(Operation *op) {
+  if (auto load = dyn_cast<memref::LoadOp>(op))
+    return load.getMemref();
+  if (auto load = dyn_cast<AffineLoadOp>(op))
+    return load.getMemref();
+  if (auto store = dyn_cast<memref::StoreOp>(op))
+    return store.getMemref();
+  if (auto store = dyn_cast<AffineStoreOp>(op))
+    return store.getMemref();
+  return nullptr;
+}
+
+/// The index values of an access, with affine indices materialized at
+/// `builder` if it is given. Returns false if an affine index is not a plain
+/// operand and `builder` is null.
+static bool getIndices(Operation *op, OpBuilder *builder,
+                       SmallVectorImpl<Value> &indices) {
+  if (auto load = dyn_cast<memref::LoadOp>(op)) {
+    llvm::append_range(indices, load.getIndices());
+    return true;
+  }
+  if (auto store = dyn_cast<memref::StoreOp>(op)) {
+    llvm::append_range(indices, store.getIndices());
+    return true;
+  }
+  AffineMap map;
+  SmallVector<Value> operands;
+  if (auto load = dyn_cast<AffineLoadOp>(op)) {
+    map = load.getAffineMap();
+    llvm::append_range(operands, load.getMapOperands());
+  } else {
+    auto store = cast<AffineStoreOp>(op);
+    map = store.getAffineMap();
+    llvm::append_range(operands, store.getMapOperands());
+  }
+  for (unsigned i = 0, e = map.getNumResults(); i < e; i++) {
+    AffineExpr expr = map.getResult(i);
+    if (auto dim = expr.dyn_cast<AffineDimExpr>()) {
+      indices.push_back(operands[dim.getPosition()]);
+    } else if (auto sym = expr.dyn_cast<AffineSymbolExpr>()) {
+      indices.push_back(operands[map.getNumDims() + sym.getPosition()]);
+    } else if (builder) {
+      indices.push_back(builder->create<AffineApplyOp>(
+          op->getLoc(), map.getSubMap({i}), operands));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Whether `op` may write memory other threads can observe. Barriers are
+/// handled by the callers.
+static bool mayWrite(Operation *op) {
+  return op
+      ->walk([&](Operation *nested) {
+        if (nested->hasTrait<OpTrait::HasRecursiveMemoryEffects>() ||
+            isa<polygeist::BarrierOp, memref::AllocaOp>(nested) ||
+            isReadOnly(nested))
+          return WalkResult::advance();
+        return WalkResult::interrupt();
+      })
+      .wasInterrupted();
+}
+
+/// The constant extent of dimension `pos` of `par` if it starts at zero with
+/// unit step.
+static Optional<int64_t> getConstantExtent(Operation *par, unsigned pos) {
+  if (auto scfPar = dyn_cast<scf::ParallelOp>(par)) {
+    if (!matchPattern(scfPar.getLowerBound()[pos], m_Zero()) ||
+        !matchPattern(scfPar.getStep()[pos], m_One()))
+      return llvm::None;
+    APInt ub;
+    if (!matchPattern(scfPar.getUpperBound()[pos], m_ConstantInt(&ub)))
+      return llvm::None;
+    return ub.getSExtValue();
+  }
+  auto affinePar = cast<AffineParallelOp>(par);
+  AffineMap lb = affinePar.getLowerBoundMap(pos);
+  AffineMap ub = affinePar.getUpperBoundMap(pos);
+  if (!lb.isSingleConstant() || lb.getSingleConstantResult() != 0 ||
+      affinePar.getSteps()[pos] != 1 || !ub.isSingleConstant())
+    return llvm::None;
+  return ub.getSingleConstantResult();
+}
+
+/// Whether the value stored by a fill can be recomputed at the reads of the
+/// buffer, for any thread: it is computed from thread and loop indices by
+/// pure ops and loads inside the stretch, none of them from staged buffers.
+static bool canRecompute(Value v, const Stretch &stretch,
+                         const SmallPtrSetImpl<Value> &staged,
+                         SmallVectorImpl<Operation *> &loads) {
+  Operation *par = stretch.par;
+  if (!par->isAncestor(v.getParentRegion()->getParentOp()))
+    return !staged.count(v);
+  if (auto arg = v.dyn_cast<BlockArgument>()) {
+    if (arg.getOwner() == &par->getRegion(0).front())
+      return true;
+    // The induction variable of the loop holding the stretch.
+    return stretch.isLoopBody && arg.getOwner() == stretch.block &&
+           arg.getArgNumber() == 0;
+  }
+  Operation *def = v.getDefiningOp();
+  if (def->getNumRegions())
+    return false;
+  if (isa<memref::LoadOp, AffineLoadOp>(def)) {
+    // Reading the value again later is only valid if nothing can write it in
+    // between, which the stretch guarantees for its own ops.
+    if (def->getBlock() != stretch.block)
+      return false;
+    loads.push_back(def);
+  } else if (!isMemoryEffectFree(def)) {
+    return false;
+  }
+  return llvm::all_of(def->getOperands(), [&](Value operand) {
+    return canRecompute(operand, stretch, staged, loads);
+  });
+}
+
+/// Recomputes `v` at `builder`, with the thread indices remapped by `map`.
+static Value recompute(OpBuilder &builder, Value v, Operation *par,
+                       BlockAndValueMapping &map) {
+  if (Value mapped = map.lookupOrNull(v))
+    return mapped;
+  if (!par->isAncestor(v.getParentRegion()->getParentOp()) ||
+      v.isa<BlockArgument>())
+    return v;
+  Operation *def = v.getDefiningOp();
+  for (Value operand : def->getOperands())
+    recompute(builder, operand, par, map);
+  // Affine accesses are rebuilt as memref ones since their remapped indices
+  // need not be valid affine dimensions.
+  if (auto load = dyn_cast<AffineLoadOp>(def)) {
+    SmallVector<Value> operands;
+    for (Value operand : load.getMapOperands())
+      operands.push_back(map.lookupOrDefault(operand));
+    SmallVector<Value> indices;
+    for (unsigned i = 0, e = load.getAffineMap().getNumResults(); i < e; i++)
+      indices.push_back(builder.create<AffineApplyOp>(
+          load.getLoc(), load.getAffineMap().getSubMap({i}), operands));
+    Value newLoad = builder.create<memref::LoadOp>(
+        load.getLoc(), map.lookupOrDefault(load.getMemref()), indices);
+    map.map(v, newLoad);
+    return newLoad;
+  }
+  builder.clone(*def, map);
+  return map.lookup(v);
+}
+
+/// Finds the buffer filled by `fill`, if it is a shared buffer each thread
+/// of `par` fills once.
+static Optional<StagedBuffer> matchBuffer(Operation *fill, Operation *par,
+                                          ArrayRef<Value> tids) {
+  auto alloca = getMemref(fill).getDefiningOp<memref::AllocaOp>();
+  Value view = getMemref(fill);
+  while (!alloca) {
+    auto cast = view.getDefiningOp<memref::CastOp>();
+    if (!cast)
+      return llvm::None;
+    view = cast.getSource();
+    alloca = view.getDefiningOp<memref::AllocaOp>();
+  }
+  // Memory allocated inside the parallel loop is private to each thread.
+  if (par->isAncestor(alloca))
+    return llvm::None;
+  MemRefType type = alloca.getType();
+  if (!type.hasStaticShape())
+    return llvm::None;
+
+  StagedBuffer buffer;
+  buffer.alloca = alloca;
+  buffer.fill = fill;
+  SmallVector<Value> worklist = {alloca.getResult()};
+  while (!worklist.empty()) {
+    Value v = worklist.pop_back_val();
+    buffer.views.push_back(v);
+    for (OpOperand &use : v.getUses()) {
+      Operation *user = use.getOwner();
+      if (auto cast = dyn_cast<memref::CastOp>(user)) {
+        worklist.push_back(cast.getResult());
+      } else if (isa<memref::LoadOp, AffineLoadOp>(user)) {
+        buffer.reads.push_back(user);
+      } else if (user != fill || getMemref(user) != v) {
+        return llvm::None;
+      }
+    }
+  }
+
+  // Each thread writes the element its own indices select, and the threads
+  // cover the buffer.
+  SmallVector<Value> indices;
+  if (!getIndices(fill, nullptr, indices) ||
+      indices.size() != (size_t)type.getRank())
+    return llvm::None;
+  for (auto en : llvm::enumerate(indices)) {
+    auto tid = llvm::find(tids, en.value());
+    if (tid == tids.end() || llvm::is_contained(buffer.fillTids, *tid))
+      return llvm::None;
+    unsigned dim = en.value().cast<BlockArgument>().getArgNumber();
+    Optional<int64_t> extent = getConstantExtent(par, dim);
+    if (!extent || *extent != type.getDimSize(en.index()))
+      return llvm::None;
+    buffer.fillTids.push_back(*tid);
+  }
+  // Threads that do not index the buffer would all write the same element.
+  for (Value tid : tids) {
+    if (llvm::is_contained(buffer.fillTids, tid))
+      continue;
+    Optional<int64_t> extent =
+        getConstantExtent(par, tid.cast<BlockArgument>().getArgNumber());
+    if (!extent || *extent != 1)
+      return llvm::None;
+  }
+  return buffer;
+}
+
+/// Matches the stretch of `block` (the body of `par` or of a loop directly in
+/// it) in which shared buffers are staged.
+static Optional<Stretch> matchStretch(Operation *par, Block *block) {
+  Stretch stretch;
+  stretch.par = par;
+  stretch.block = block;
+  stretch.isLoopBody = block->getParentOp() != par;
+
+  SmallVector<polygeist::BarrierOp> barriers;
+  for (Operation &op : *block)
+    if (auto barrier = dyn_cast<polygeist::BarrierOp>(op))
+      barriers.push_back(barrier);
+  if (barriers.empty())
+    return llvm::None;
+  SmallVector<Value> tids;
+  for (Value index : barriers.front().getOperands())
+    if (auto arg = index.dyn_cast<BlockArgument>())
+      if (arg.getOwner() == &par->getRegion(0).front())
+        tids.push_back(arg);
+  if (tids.empty())
+    return llvm::None;
+
+  // Fills are stores to buffers allocated outside the parallel loop; stores
+  // to any other memory make the stretch fail below.
+  SmallPtrSet<Value, 4> staged;
+  for (Operation &op : *block) {
+    if (!isa<memref::StoreOp, AffineStoreOp>(op))
+      continue;
+    Optional<StagedBuffer> buffer = matchBuffer(&op, par, tids);
+    if (!buffer)
+      continue;
+    staged.insert(buffer->views.begin(), buffer->views.end());
+    stretch.buffers.push_back(std::move(*buffer));
+  }
+  if (stretch.buffers.empty())
+    return llvm::None;
+
+  // The stretch runs from the first fill, or the first load it recomputes,
+  // to the last read. Reads come after the fills in the block.
+  Operation *first = nullptr, *last = nullptr;
+  auto extend = [&](Operation *op) {
+    if (!first || op->isBeforeInBlock(first))
+      first = op;
+    if (!last || last->isBeforeInBlock(op))
+      last = op;
+  };
+  for (StagedBuffer &buffer : stretch.buffers) {
+    SmallVector<Operation *> loads;
+    if (!canRecompute(buffer.fill->getOperand(0), stretch, staged, loads))
+      return llvm::None;
+    extend(buffer.fill);
+    for (Operation *load : loads)
+      extend(load);
+    for (Operation *read : buffer.reads) {
+      Operation *ancestor = block->findAncestorOpInBlock(*read);
+      if (!ancestor || !buffer.fill->isBeforeInBlock(ancestor))
+        return llvm::None;
+      extend(ancestor);
+    }
+  }
+  if (stretch.isLoopBody) {
+    stretch.begin = block->begin();
+    stretch.end = block->getTerminator()->getIterator();
+  } else {
+    stretch.begin = first->getIterator();
+    stretch.end = std::next(last->getIterator());
+  }
+
+  // Nothing but the fills may write memory while the buffers are live, and
+  // barriers nested deeper than the stretch cannot be removed.
+  SmallPtrSet<Operation *, 4> fills;
+  for (StagedBuffer &buffer : stretch.buffers)
+    fills.insert(buffer.fill);
+  for (Operation &op : llvm::make_range(stretch.begin, stretch.end)) {
+    if (fills.count(&op) || isa<polygeist::BarrierOp>(op))
+      continue;
+    if (mayWrite(&op))
+      return llvm::None;
+    if (op.walk([](polygeist::BarrierOp) { return WalkResult::interrupt(); })
+            .wasInterrupted())
+      return llvm::None;
+  }
+  return stretch;
+}
+
+static void elide(Stretch &stretch) {
+  Operation *par = stretch.par;
+  Block *parBody = &par->getRegion(0).front();
+
+  // Once the copies are gone the stretch only reads memory. Its barriers are
+  // replaced by one on each side that still orders it with the writes of the
+  // rest of the kernel. This is decided first, as the fills delimiting the
+  // stretch are about to be erased.
+  SmallVector<polygeist::BarrierOp> barriers;
+  for (Operation &op : llvm::make_range(stretch.begin, stretch.end))
+    if (auto barrier = dyn_cast<polygeist::BarrierOp>(op))
+      barriers.push_back(barrier);
+  if (!barriers.empty()) {
+    Operation *outer =
+        stretch.isLoopBody ? stretch.block->getParentOp() : nullptr;
+    Block::iterator begin = outer ? outer->getIterator() : stretch.begin;
+    Block::iterator end = outer ? std::next(outer->getIterator()) : stretch.end;
+    bool writesBefore =
+        llvm::any_of(llvm::make_range(parBody->begin(), begin),
+                     [](Operation &op) { return mayWrite(&op); });
+    bool writesAfter =
+        llvm::any_of(llvm::make_range(end, parBody->end()),
+                     [](Operation &op) { return mayWrite(&op); });
+    OpBuilder builder(parBody, begin);
+    ValueRange indices = barriers.front().getOperands();
+    if (writesBefore && (begin == parBody->begin() ||
+                         !isa<polygeist::BarrierOp>(*std::prev(begin))))
+      builder.create<polygeist::BarrierOp>(par->getLoc(), indices);
+    if (writesAfter && !isa<polygeist::BarrierOp>(*end)) {
+      builder.setInsertionPoint(parBody, end);
+      builder.create<polygeist::BarrierOp>(par->getLoc(), indices);
+    }
+  }
+
+  for (StagedBuffer &buffer : stretch.buffers) {
+    for (Operation *read : buffer.reads) {
+      OpBuilder builder(read);
+      SmallVector<Value> indices;
+      getIndices(read, &builder, indices);
+      BlockAndValueMapping map;
+      for (auto en : llvm::zip(buffer.fillTids, indices))
+        map.map(std::get<0>(en), std::get<1>(en));
+      Value value = recompute(builder, buffer.fill->getOperand(0), par, map);
+      read->getResult(0).replaceAllUsesWith(value);
+      read->erase();
+    }
+    buffer.fill->erase();
+    for (Value view : llvm::reverse(buffer.views))
+      if (view.use_empty())
+        view.getDefiningOp()->erase();
+  }
+  for (polygeist::BarrierOp barrier : barriers)
+    barrier.erase();
+}
+
+void SharedStagingElision::runOnOperation() {
+  SmallVector<std::pair<Operation *, Block *>> candidates;
+  getOperation()->walk([&](Operation *op) {
+    if (!isThreadParallel(op))
+      return;
+    Block *body = &op->getRegion(0).front();
+    candidates.emplace_back(op, body);
+    for (Operation &nested : *body)
+      if (isa<scf::ForOp, AffineForOp>(nested))
+        candidates.emplace_back(op, &nested.getRegion(0).front());
+  });
+
+  for (auto [par, block] : candidates) {
+    Optional<Stretch> stretch = matchStretch(par, block);
+    if (!stretch)
+      continue;
+    LLVM_DEBUG(llvm::dbgs() << "eliding " << stretch->buffers.size()
+                            << " shared buffer(s) at " << par->getLoc()
+                            << "\n");
+    elide(*stretch);
+  }
+}
+
+namespace mlir {
+namespace polygeist {
+std::unique_ptr<Pass> createSharedStagingElisionPass() {
+  return std::make_unique<SharedStagingElision>();
+}
+} // namespace polygeist
+} // namespace mlir
@@ -266,3 +266,11 @@ func.func @store_3d_static(%arg0: memref<2x4x42xf32>, %arg1: index, %arg2: index
   memref.store %value,  %arg0[%arg1, %arg2, %arg3] : memref<2x4x42xf32>
   return
 }
+
+// CHECK-LABEL: @store_nontemporal
+// CHECK: llvm.store %{{.*}}, %{{.*}} {nontemporal} : !llvm.ptr<f32>
+func.func @store_nontemporal(%arg0: index, %value: f32) {
+  %1 = memref.get_global @glob_1d : memref<42xf32>
+  memref.store %value, %1[%arg0] {polygeist.nontemporal} : memref<42xf32>
+  return
+}
@@ -0,0 +1,171 @@
+// RUN: polygeist-opt --recognize-collectives --split-input-file %s | FileCheck %s
+
+// Shared-memory tree reduction.
+module {
+  func.func @reduce(%out: memref<?xf32>, %in: memref<?xf32>) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c256 = arith.constant 256 : index
+    %c0_i32 = arith.constant 0 : i32
+    %c1_i32 = arith.constant 1 : i32
+    %c128_i32 = arith.constant 128 : i32
+    %sh = memref.alloca() : memref<256xf32>
+    scf.parallel (%tid) = (%c0) to (%c256) step (%c1) {
+      %0 = memref.load %in[%tid] : memref<?xf32>
+      memref.store %0, %sh[%tid] : memref<256xf32>
+      "polygeist.barrier"(%tid) : (index) -> ()
+      %t = arith.index_cast %tid : index to i32
+      %r = scf.while (%s = %c128_i32) : (i32) -> i32 {
+        %cond = arith.cmpi sgt, %s, %c0_i32 : i32
+        scf.condition(%cond) %s : i32
+      } do {
+      ^bb0(%s: i32):
+        %lt = arith.cmpi slt, %t, %s : i32
+        scf.if %lt {
+          %si = arith.index_cast %s : i32 to index
+          %o = arith.addi %tid, %si : index
+          %a = memref.load %sh[%tid] : memref<256xf32>
+          %b = memref.load %sh[%o] : memref<256xf32>
+          %sum = arith.addf %a, %b : f32
+          memref.store %sum, %sh[%tid] : memref<256xf32>
+        }
+        "polygeist.barrier"(%tid) : (index) -> ()
+        %next = arith.shrsi %s, %c1_i32 : i32
+        scf.yield %next : i32
+      }
+      %first = arith.cmpi eq, %tid, %c0 : index
+      scf.if %first {
+        %v = memref.load %sh[%c0] : memref<256xf32>
+        memref.store %v, %out[%c0] : memref<?xf32>
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @reduce(
+// CHECK-DAG:       %[[C0:.+]] = arith.constant 0 : index
+// CHECK-DAG:       %[[C1:.+]] = arith.constant 1 : index
+// CHECK-DAG:       %[[C256:.+]] = arith.constant 256 : index
+// CHECK-DAG:       %[[SH:.+]] = memref.alloca() : memref<256xf32>
+// CHECK:           scf.parallel (%[[TID:.+]]) = (%[[C0]]) to (%[[C256]]) step (%[[C1]]) {
+// CHECK:             "polygeist.barrier"(%[[TID]]) : (index) -> ()
+// CHECK:             %[[FIRST:.+]] = arith.cmpi eq, %[[TID]], %[[C0]] : index
+// CHECK-NEXT:        scf.if %[[FIRST]] {
+// CHECK-NEXT:          memref.alloca_scope {
+// CHECK-NEXT:            %{{.*}} = scf.while
+// CHECK:                 } do {
+// CHECK-NEXT:            ^bb0(%[[S:.+]]: i32):
+// CHECK-NEXT:              scf.for %[[T:.+]] = %[[C0]] to %[[C256]] step %[[C1]] {
+// CHECK-NEXT:                %[[TI:.+]] = arith.index_cast %[[T]] : index to i32
+// CHECK-NEXT:                %[[LT:.+]] = arith.cmpi slt, %[[TI]], %[[S]] : i32
+// CHECK-NEXT:                scf.if %[[LT]] {
+// CHECK-NEXT:                  %[[SI:.+]] = arith.index_cast %[[S]] : i32 to index
+// CHECK-NEXT:                  %[[O:.+]] = arith.addi %[[T]], %[[SI]] : index
+// CHECK-NEXT:                  %[[A:.+]] = memref.load %[[SH]][%[[T]]] : memref<256xf32>
+// CHECK-NEXT:                  %[[B:.+]] = memref.load %[[SH]][%[[O]]] : memref<256xf32>
+// CHECK-NEXT:                  %[[SUM:.+]] = arith.addf %[[A]], %[[B]] : f32
+// CHECK-NEXT:                  memref.store %[[SUM]], %[[SH]][%[[T]]] : memref<256xf32>
+// CHECK-NEXT:                }
+// CHECK-NEXT:              }
+// CHECK-NEXT:              %[[NEXT:.+]] = arith.shrsi %[[S]], %{{.*}} : i32
+// CHECK-NOT:               polygeist.barrier
+// CHECK:                   scf.yield %[[NEXT]] : i32
+// CHECK:             "polygeist.barrier"(%[[TID]]) : (index) -> ()
+// CHECK-NEXT:        %{{.*}} = arith.cmpi eq, %[[TID]], %[[C0]] : index
+
+// -----
+
+// Hillis-Steele inclusive scan: the value each thread reads before the first
+// barrier of a step is only added after it, so it goes through a buffer.
+module {
+  func.func @scan(%data: memref<?xf32>) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c6 = arith.constant 6 : index
+    %c64 = arith.constant 64 : index
+    %zero = arith.constant 0.000000e+00 : f32
+    %sh = memref.alloca() : memref<64xf32>
+    scf.parallel (%tid) = (%c0) to (%c64) step (%c1) {
+      %0 = memref.load %data[%tid] : memref<?xf32>
+      memref.store %0, %sh[%tid] : memref<64xf32>
+      "polygeist.barrier"(%tid) : (index) -> ()
+      scf.for %k = %c0 to %c6 step %c1 {
+        %off = arith.shli %c1, %k : index
+        %ge = arith.cmpi uge, %tid, %off : index
+        %t = scf.if %ge -> (f32) {
+          %i = arith.subi %tid, %off : index
+          %v = memref.load %sh[%i] : memref<64xf32>
+          scf.yield %v : f32
+        } else {
+          scf.yield %zero : f32
+        }
+        "polygeist.barrier"(%tid) : (index) -> ()
+        %a = memref.load %sh[%tid] : memref<64xf32>
+        %b = arith.addf %a, %t : f32
+        memref.store %b, %sh[%tid] : memref<64xf32>
+        "polygeist.barrier"(%tid) : (index) -> ()
+      }
+      %1 = memref.load %sh[%tid] : memref<64xf32>
+      memref.store %1, %data[%tid] : memref<?xf32>
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @scan(
+// CHECK-DAG:       %[[C0:.+]] = arith.constant 0 : index
+// CHECK-DAG:       %[[C1:.+]] = arith.constant 1 : index
+// CHECK-DAG:       %[[C64:.+]] = arith.constant 64 : index
+// CHECK-DAG:       %[[SH:.+]] = memref.alloca() : memref<64xf32>
+// CHECK:           scf.if %{{.*}} {
+// CHECK-NEXT:        memref.alloca_scope {
+// CHECK-NEXT:          %[[BUF:.+]] = memref.alloca(%[[C64]]) : memref<?xf32>
+// CHECK-NEXT:          scf.for %[[K:.+]] = %[[C0]] to %{{.*}} step %[[C1]] {
+// CHECK-NEXT:            scf.for %[[T:.+]] = %[[C0]] to %[[C64]] step %[[C1]] {
+// CHECK-NEXT:              %[[OFF:.+]] = arith.shli %[[C1]], %[[K]] : index
+// CHECK-NEXT:              %[[GE:.+]] = arith.cmpi uge, %[[T]], %[[OFF]] : index
+// CHECK-NEXT:              %[[V:.+]] = scf.if %[[GE]] -> (f32) {
+// CHECK:                   memref.store %[[V]], %[[BUF]][%[[T]]] : memref<?xf32>
+// CHECK-NEXT:            }
+// CHECK-NEXT:            scf.for %[[T2:.+]] = %[[C0]] to %[[C64]] step %[[C1]] {
+// CHECK-NEXT:              %[[PREV:.+]] = memref.load %[[BUF]][%[[T2]]] : memref<?xf32>
+// CHECK-NEXT:              %[[A:.+]] = memref.load %[[SH]][%[[T2]]] : memref<64xf32>
+// CHECK-NEXT:              %[[B:.+]] = arith.addf %[[A]], %[[PREV]] : f32
+// CHECK-NEXT:              memref.store %[[B]], %[[SH]][%[[T2]]] : memref<64xf32>
+// CHECK-NEXT:            }
+// CHECK-NEXT:          }
+// CHECK-NOT:           polygeist.barrier
+// CHECK:             "polygeist.barrier"
+// CHECK-NEXT:        memref.load %[[SH]]
+
+// -----
+
+// The trip count depends on the thread, so the threads do not all reach the
+// barriers together and the loop is left alone.
+module {
+  func.func @divergent(%data: memref<?xf32>) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c64 = arith.constant 64 : index
+    %sh = memref.alloca() : memref<64xf32>
+    scf.parallel (%tid) = (%c0) to (%c64) step (%c1) {
+      scf.for %k = %c0 to %tid step %c1 {
+        %0 = memref.load %data[%k] : memref<?xf32>
+        memref.store %0, %sh[%tid] : memref<64xf32>
+        "polygeist.barrier"(%tid) : (index) -> ()
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @divergent(
+// CHECK-NOT:       memref.alloca_scope
+// CHECK:           scf.for
+// CHECK-NEXT:        memref.load
+// CHECK-NEXT:        memref.store
+// CHECK-NEXT:        "polygeist.barrier"
@@ -29,3 +29,21 @@ module {
 // CHECK-NEXT:     }
 // CHECK-NEXT:     return
 // CHECK-NEXT:   }
+
+// -----
+
+// Copies created by the loop idiom pass are not expanded again.
+module {
+  func.func @idiom(%66: memref<?xi32>, %51: memref<?xi32>) {
+    %c64_i64 = arith.constant 64 : i64
+    %false = arith.constant false
+      %67 = "polygeist.memref2pointer"(%66) : (memref<?xi32>) -> !llvm.ptr<i8>
+      %68 = "polygeist.memref2pointer"(%51) : (memref<?xi32>) -> !llvm.ptr<i8>
+      "llvm.intr.memcpy"(%67, %68, %c64_i64, %false) {polygeist.loop_idiom} : (!llvm.ptr<i8>, !llvm.ptr<i8>, i64, i1) -> ()
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @idiom(
+// CHECK-NOT:       scf.for
+// CHECK:           "llvm.intr.memcpy"
@@ -0,0 +1,72 @@
+// RUN: echo '{"function":"stale"}' > %t.json
+// RUN: polygeist-opt --cpuify="method=distribute report=%t.json" %s -o /dev/null
+// RUN: polygeist-opt --cpuify="method=distribute report=%t.json" %s -o /dev/null
+// RUN: FileCheck %s --check-prefix=REPORT < %t.json
+// RUN: grep -c function %t.json | FileCheck %s --check-prefix=COUNT
+// RUN: polygeist-opt --cpuify="method=distribute remarks=1" %s -o /dev/null 2>&1 | FileCheck %s --check-prefix=REMARK
+// RUN: polygeist-opt --cpuify="method=distribute cache-budget=64" %s | FileCheck %s --check-prefix=BUDGET
+
+module {
+  func.func @kernel(%out: memref<?xf32>, %nb: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c32 = arith.constant 32 : index
+    scf.parallel (%bx) = (%c0) to (%nb) step (%c1) {
+      %sh = memref.alloca() : memref<32xf32>
+      scf.parallel (%tx) = (%c0) to (%c32) step (%c1) {
+        %t = arith.index_cast %tx : index to i32
+        %sq = arith.muli %t, %t : i32
+        %f = arith.sitofp %t : i32 to f32
+        memref.store %f, %sh[%tx] : memref<32xf32>
+        "polygeist.barrier"(%tx) : (index) -> ()
+        %n = arith.subi %c32, %tx : index
+        %m = arith.subi %n, %c1 : index
+        %v = memref.load %sh[%m] : memref<32xf32>
+        %g = arith.sitofp %sq : i32 to f32
+        %r = arith.addf %v, %g : f32
+        memref.store %r, %out[%tx] : memref<?xf32>
+        scf.yield
+      }
+      scf.yield
+    }
+    return
+  }
+
+  func.func @dynamic(%out: memref<?xf64>, %bd: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %sh = memref.alloca() : memref<1024xf64>
+    scf.parallel (%tx) = (%c0) to (%bd) step (%c1) {
+      %v = memref.load %out[%tx] : memref<?xf64>
+      memref.store %v, %sh[%tx] : memref<1024xf64>
+      "polygeist.barrier"(%tx) : (index) -> ()
+      %w = memref.load %sh[%c0] : memref<1024xf64>
+      %r = arith.addf %v, %w : f64
+      memref.store %r, %out[%tx] : memref<?xf64>
+      scf.yield
+    }
+    return
+  }
+}
+
+// REPORT-DAG: {"barriers":[{"bytes":128,"bytes_per_thread":4,"cached":[{"bytes":4,"location":"{{.*}}cpuifyfootprint.mlir:{{[0-9]+}}:{{[0-9]+}}","op":"arith.muli","type":"i32"}],"location":"{{.*}}cpuifyfootprint.mlir:{{[0-9]+}}:{{[0-9]+}}","over_budget":false,"recomputed":[],"size":"4 * 32","threads":[32]}],"bytes":128,"dynamic":false,"function":"kernel","method":"distribute"}
+// REPORT-DAG: {"barriers":[{"bytes":null,"bytes_per_thread":8,"cached":[{"bytes":8,"location":"{{.*}}","op":"memref.load","type":"f64"}],"location":"{{.*}}","over_budget":false,"recomputed":[],"size":"8 * blockDim.x","threads":[null]}],"bytes":0,"dynamic":true,"function":"dynamic","method":"distribute"}
+
+// Every run replaces the report: one line per function.
+// COUNT: {{^}}2{{$}}
+
+// REMARK-DAG: cpuifyfootprint.mlir:19:9: remark: barrier buffers: 1 cached value(s) in 4 * 32 = 128 bytes per block, 0 recomputed
+// REMARK-DAG: cpuifyfootprint.mlir:16:9: note: cached i32 (4 bytes per thread)
+// REMARK-DAG: cpuifyfootprint.mlir:40:7: remark: barrier buffers: 1 cached value(s) in 8 * blockDim.x bytes per block, 0 recomputed
+
+// The squares would need 128 bytes per block, so they are recomputed after
+// the barrier instead.
+// BUDGET-LABEL: func.func @kernel(
+// BUDGET-NOT:     memref<32xi32>
+// BUDGET:         scf.parallel (%[[TX:.+]]) =
+// BUDGET:           memref.store
+// BUDGET:         scf.parallel (%[[TX2:.+]]) =
+// BUDGET:           %[[T:.+]] = arith.index_cast %[[TX2]] : index to i32
+// BUDGET-NEXT:      %[[SQ:.+]] = arith.muli %[[T]], %[[T]] : i32
+// BUDGET:           arith.sitofp %[[SQ]] : i32 to f32
+// BUDGET-LABEL: func.func @dynamic(
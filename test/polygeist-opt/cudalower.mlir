@@ -1,4 +1,5 @@
-// RUN: polygeist-opt --parallel-lower --cudart-lower --split-input-file %s | FileCheck %s
+// RUN: polygeist-opt --parallel-lower --cudart-lower --split-input-file %s | FileCheck %s --check-prefixes=CHECK,CALL
+// RUN: polygeist-opt --parallel-lower=inline-all --cudart-lower --split-input-file %s | FileCheck %s --check-prefixes=CHECK,INLINE
 
 module attributes {llvm.data_layout = "e-i64:64-i128:128-v16:16-v32:32-n16:32:64", llvm.target_triple = "nvptx64-nvidia-cuda"}  {
   llvm.func @cudaMemcpy(!llvm.ptr<i8>, !llvm.ptr<i8>, i64, i32) -> i32
@@ -53,28 +54,30 @@ module {
 // CHECK-DAG:     %[[c0:.+]] = arith.constant 0 : index
 // CHECK-NEXT:     scf.parallel (%[[arg2:.+]], %[[arg3:.+]], %[[arg4:.+]]) = (%[[c0]], %[[c0]], %[[c0]]) to (%[[c2]], %[[c1]], %[[c1]]) step (%[[c1]], %[[c1]], %[[c1]]) {
 // CHECK-NEXT:       scf.parallel (%[[arg5:.+]], %[[arg6:.+]], %[[arg7:.+]]) = (%[[c0]], %[[c0]], %[[c0]]) to (%[[c1]], %[[c1]], %[[c1]]) step (%[[c1]], %[[c1]], %[[c1]]) {
-// CHECK-NEXT:         %[[V0:.+]] = memref.alloca_scope -> (i8) {
-// CHECK-NEXT:         %[[V1:.+]] = scf.execute_region -> i8 {
-// CHECK-NEXT:           cf.switch %[[arg1]] : i8, [
-// CHECK-NEXT:             default: ^bb2(%[[arg1]] : i8),
-// CHECK-NEXT:             0: ^bb1
-// CHECK-NEXT:           ]
-// CHECK-NEXT:         ^bb1:  // pred: ^bb0
-// CHECK-NEXT:           %[[V2:.+]] = llvm.load %[[arg0]] : !llvm.ptr<i8>
-// CHECK-NEXT:           cf.br ^bb2(%[[V2]] : i8)
-// CHECK-NEXT:         ^bb2(%[[V3:.+]]: i8):  // 2 preds: ^bb0, ^bb1
-// CHECK-NEXT:           cf.br ^bb3(%[[V3]] : i8)
-// CHECK-NEXT:         ^bb3(%[[V4:.+]]: i8):  // pred: ^bb2
-// CHECK-NEXT:           scf.yield %[[V4]] : i8
-// CHECK-NEXT:         }
-// CHECK-NEXT:         memref.alloca_scope.return %[[V1]] : i8
-// CHECK-NEXT:         }
-// CHECK-NEXT:         scf.yield
-// CHECK-NEXT:       }
-// CHECK-NEXT:       scf.yield
-// CHECK-NEXT:     }
-// CHECK-NEXT:     return
-// CHECK-NEXT:   }
+// CALL-NEXT:          %{{.*}} = func.call @S(%[[arg1]], %[[arg0]]) : (i8, !llvm.ptr<i8>) -> i8
+// CALL-NEXT:          scf.yield
+// INLINE-NEXT:         %[[V0:.+]] = memref.alloca_scope -> (i8) {
+// INLINE-NEXT:         %[[V1:.+]] = scf.execute_region -> i8 {
+// INLINE-NEXT:           cf.switch %[[arg1]] : i8, [
+// INLINE-NEXT:             default: ^bb2(%[[arg1]] : i8),
+// INLINE-NEXT:             0: ^bb1
+// INLINE-NEXT:           ]
+// INLINE-NEXT:         ^bb1:  // pred: ^bb0
+// INLINE-NEXT:           %[[V2:.+]] = llvm.load %[[arg0]] : !llvm.ptr<i8>
+// INLINE-NEXT:           cf.br ^bb2(%[[V2]] : i8)
+// INLINE-NEXT:         ^bb2(%[[V3:.+]]: i8):  // 2 preds: ^bb0, ^bb1
+// INLINE-NEXT:           cf.br ^bb3(%[[V3]] : i8)
+// INLINE-NEXT:         ^bb3(%[[V4:.+]]: i8):  // pred: ^bb2
+// INLINE-NEXT:           scf.yield %[[V4]] : i8
+// INLINE-NEXT:         }
+// INLINE-NEXT:         memref.alloca_scope.return %[[V1]] : i8
+// INLINE-NEXT:         }
+// INLINE-NEXT:         scf.yield
+// INLINE-NEXT:       }
+// INLINE-NEXT:       scf.yield
+// INLINE-NEXT:     }
+// INLINE-NEXT:     return
+// INLINE-NEXT:   }
 
 // -----
 
@@ -123,3 +126,46 @@ module {
 // CHECK-NEXT:     }
 // CHECK-NEXT:     return
 // CHECK-NEXT:   }
+
+// -----
+
+// A device function reading the thread id but without barriers is called with
+// the ids as arguments instead of being inlined.
+module {
+  func.func private @store(%arg0: memref<?xf32>, %arg1: f32) {
+    %0 = gpu.thread_id x
+    %1 = gpu.block_dim x
+    %2 = gpu.block_id x
+    %3 = arith.muli %2, %1 : index
+    %4 = arith.addi %3, %0 : index
+    memref.store %arg1, %arg0[%4] : memref<?xf32>
+    return
+  }
+  func.func @launch(%arg0: memref<?xf32>, %arg1: f32) {
+    %c1 = arith.constant 1 : index
+    %c4 = arith.constant 4 : index
+    %c32 = arith.constant 32 : index
+    gpu.launch blocks(%arg4, %arg5, %arg6) in (%arg10 = %c4, %arg11 = %c1, %arg12 = %c1) threads(%arg7, %arg8, %arg9) in (%arg13 = %c32, %arg14 = %c1, %arg15 = %c1) {
+      func.call @store(%arg0, %arg1) : (memref<?xf32>, f32) -> ()
+      gpu.terminator
+    }
+    return
+  }
+}
+
+// CALL:        func.func private @store.thread(%[[MEM:.+]]: memref<?xf32>, %[[VAL:.+]]: f32, %[[BX:[^:]+]]: index, %{{[^:]+}}: index, %{{[^:]+}}: index, %[[TX:[^:]+]]: index, %{{[^:]+}}: index, %{{[^:]+}}: index, %{{[^:]+}}: index, %{{[^:]+}}: index, %{{[^:]+}}: index, %[[BDX:[^:]+]]: index, %{{[^:]+}}: index, %{{[^:]+}}: index) {
+// CALL-NEXT:     %[[V0:.+]] = arith.muli %[[BX]], %[[BDX]] : index
+// CALL-NEXT:     %[[V1:.+]] = arith.addi %[[V0]], %[[TX]] : index
+// CALL-NEXT:     memref.store %[[VAL]], %[[MEM]][%[[V1]]] : memref<?xf32>
+// CALL-NEXT:     return
+// CALL-NEXT:   }
+// CHECK-LABEL: func.func @launch(
+// CHECK-SAME:      %[[ARG0:.+]]: memref<?xf32>, %[[ARG1:.+]]: f32)
+// CHECK:         scf.parallel (%[[B0:.+]], %[[B1:.+]], %[[B2:.+]]) =
+// CHECK-NEXT:      scf.parallel (%[[T0:.+]], %[[T1:.+]], %[[T2:.+]]) =
+// CALL-NEXT:         func.call @store.thread(%[[ARG0]], %[[ARG1]], %[[B0]], %[[B1]], %[[B2]], %[[T0]], %[[T1]], %[[T2]], %{{.*}}) : (memref<?xf32>, f32, index, index, index, index, index, index, index, index, index, index, index, index) -> ()
+// INLINE-NEXT:       memref.alloca_scope {
+// INLINE-NEXT:         scf.execute_region {
+// INLINE-NEXT:           %[[V0:.+]] = arith.muli %[[B0]], %{{.*}} : index
+// INLINE-NEXT:           %[[V1:.+]] = arith.addi %[[V0]], %[[T0]] : index
+// INLINE-NEXT:           memref.store %[[ARG1]], %[[ARG0]][%[[V1]]] : memref<?xf32>
@@ -0,0 +1,69 @@
+// RUN: polygeist-opt --convert-polygeist-to-llvm %s | mlir-translate --mlir-to-llvmir > %t.ll
+// RUN: clang %t.ll -L%shlibdir -lpolygeist_host_runtime -Wl,-rpath,%shlibdir -o %t
+// RUN: env POLYGEIST_HOST_RUNTIME_TRACE=1 %t 2>&1 | FileCheck %s
+
+// Runs the streams and events of gpujoin.mlir against the host runtime stub,
+// which aborts on any use of a destroyed stream or event.
+module attributes {gpu.container_module, polygeist.gpu_module.llvm.data_layout = "e-i64:64-i128:128-v16:16-v32:32-n16:32:64", polygeist.gpu_module.llvm.target_triple = "nvptx64-nvidia-cuda"} {
+  gpu.module @kernels attributes {gpu.binary = "BINARY"} {
+    llvm.func @k(%arg0: !llvm.ptr<f32>) attributes {gpu.kernel} {
+      llvm.return
+    }
+  }
+  func.func @join(%p: memref<?xf32>) {
+    %c1 = arith.constant 1 : index
+    %t0 = gpu.wait async
+    %t1 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t2 = gpu.wait async
+    %t3 = gpu.launch_func async [%t1, %t2] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    gpu.wait [%t3]
+    return
+  }
+  func.func @reuse(%p: memref<?xf32>) {
+    %c1 = arith.constant 1 : index
+    %t0 = gpu.wait async
+    %t1 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t2 = gpu.wait async
+    %t3 = gpu.launch_func async [%t1, %t2] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t4 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    gpu.wait [%t3, %t4]
+    return
+  }
+  func.func @main() -> i32 {
+    %p = memref.alloc() : memref<16xf32>
+    %q = memref.cast %p : memref<16xf32> to memref<?xf32>
+    call @join(%q) : (memref<?xf32>) -> ()
+    call @reuse(%q) : (memref<?xf32>) -> ()
+    memref.dealloc %p : memref<16xf32>
+    %c0 = arith.constant 0 : i32
+    return %c0 : i32
+  }
+}
+
+// The joined stream is destroyed once the other stream waits for it.
+// CHECK:      stream create 1
+// CHECK-NEXT: launch {{.+}} stream 1
+// CHECK-NEXT: stream create 2
+// CHECK-NEXT: event create [[E1:[0-9]+]]
+// CHECK-NEXT: event record [[E1]] stream 1
+// CHECK-NEXT: stream 2 wait event [[E1]]
+// CHECK-NEXT: event destroy [[E1]]
+// CHECK-NEXT: stream destroy 1
+// CHECK-NEXT: launch {{.+}} stream 2
+// CHECK-NEXT: stream synchronize 2
+// CHECK-NEXT: stream destroy 2
+
+// The joined stream is launched on again, and only destroyed by the wait.
+// CHECK-NEXT: stream create 3
+// CHECK-NEXT: launch {{.+}} stream 3
+// CHECK-NEXT: stream create 4
+// CHECK-NEXT: event create [[E2:[0-9]+]]
+// CHECK-NEXT: event record [[E2]] stream 3
+// CHECK-NEXT: stream 4 wait event [[E2]]
+// CHECK-NEXT: event destroy [[E2]]
+// CHECK-NEXT: launch {{.+}} stream 4
+// CHECK-NEXT: launch {{.+}} stream 3
+// CHECK-NEXT: stream synchronize 4
+// CHECK-NEXT: stream destroy 4
+// CHECK-NEXT: stream synchronize 3
+// CHECK-NEXT: stream destroy 3
@@ -0,0 +1,71 @@
+// RUN: polygeist-opt --convert-polygeist-to-llvm --split-input-file %s | FileCheck %s
+
+// The second launch waits for two streams. It runs on the stream with less
+// queued work, which waits for an event recorded on the other one. No other
+// token stands for the other stream, which is destroyed.
+module attributes {gpu.container_module, polygeist.gpu_module.llvm.data_layout = "e-i64:64-i128:128-v16:16-v32:32-n16:32:64", polygeist.gpu_module.llvm.target_triple = "nvptx64-nvidia-cuda"} {
+  gpu.module @kernels attributes {gpu.binary = "BINARY"} {
+    llvm.func @k(%arg0: !llvm.ptr<f32>) attributes {gpu.kernel} {
+      llvm.return
+    }
+  }
+  func.func @join(%p: memref<?xf32>) {
+    %c1 = arith.constant 1 : index
+    %t0 = gpu.wait async
+    %t1 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t2 = gpu.wait async
+    %t3 = gpu.launch_func async [%t1, %t2] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    gpu.wait [%t3]
+    return
+  }
+}
+
+// CHECK-LABEL:   llvm.func @join(
+// CHECK:           %[[S0:.+]] = llvm.call @mgpuStreamCreate() : () -> !llvm.ptr<i8>
+// CHECK:           llvm.call @mgpuLaunchKernelErr({{.+}}, %[[S0]], {{.+}})
+// CHECK:           %[[S1:.+]] = llvm.call @mgpuStreamCreate() : () -> !llvm.ptr<i8>
+// CHECK:           %[[E:.+]] = llvm.call @mgpuEventCreate() : () -> !llvm.ptr<i8>
+// CHECK-NEXT:      llvm.call @mgpuEventRecord(%[[E]], %[[S0]])
+// CHECK-NEXT:      llvm.call @mgpuStreamWaitEvent(%[[S1]], %[[E]])
+// CHECK-NEXT:      llvm.call @mgpuEventDestroy(%[[E]])
+// CHECK-NEXT:      llvm.call @mgpuStreamDestroy(%[[S0]])
+// CHECK:           llvm.call @mgpuLaunchKernelErr({{.+}}, %[[S1]], {{.+}})
+// CHECK:           llvm.call @mgpuStreamSynchronize(%[[S1]])
+// CHECK-NEXT:      llvm.call @mgpuStreamDestroy(%[[S1]])
+
+// -----
+
+// The stream joined into the second launch is still the stream of the first
+// token, which the third launch uses after the join, so it is only destroyed
+// by the final wait.
+module attributes {gpu.container_module, polygeist.gpu_module.llvm.data_layout = "e-i64:64-i128:128-v16:16-v32:32-n16:32:64", polygeist.gpu_module.llvm.target_triple = "nvptx64-nvidia-cuda"} {
+  gpu.module @kernels attributes {gpu.binary = "BINARY"} {
+    llvm.func @k(%arg0: !llvm.ptr<f32>) attributes {gpu.kernel} {
+      llvm.return
+    }
+  }
+  func.func @reuse(%p: memref<?xf32>) {
+    %c1 = arith.constant 1 : index
+    %t0 = gpu.wait async
+    %t1 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t2 = gpu.wait async
+    %t3 = gpu.launch_func async [%t1, %t2] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    %t4 = gpu.launch_func async [%t0] @kernels::@k blocks in (%c1, %c1, %c1) threads in (%c1, %c1, %c1) args(%p : memref<?xf32>)
+    gpu.wait [%t3, %t4]
+    return
+  }
+}
+
+// CHECK-LABEL:   llvm.func @reuse(
+// CHECK:           %[[S0:.+]] = llvm.call @mgpuStreamCreate() : () -> !llvm.ptr<i8>
+// CHECK:           llvm.call @mgpuLaunchKernelErr({{.+}}, %[[S0]], {{.+}})
+// CHECK:           %[[S1:.+]] = llvm.call @mgpuStreamCreate() : () -> !llvm.ptr<i8>
+// CHECK:           llvm.call @mgpuStreamWaitEvent(%[[S1]], %{{.+}})
+// CHECK-NOT:       @mgpuStreamDestroy
+// CHECK:           llvm.call @mgpuLaunchKernelErr({{.+}}, %[[S1]], {{.+}})
+// CHECK-NOT:       @mgpuStreamDestroy
+// CHECK:           llvm.call @mgpuLaunchKernelErr({{.+}}, %[[S0]], {{.+}})
+// CHECK-DAG:       llvm.call @mgpuStreamSynchronize(%[[S0]])
+// CHECK-DAG:       llvm.call @mgpuStreamSynchronize(%[[S1]])
+// CHECK-DAG:       llvm.call @mgpuStreamDestroy(%[[S0]])
+// CHECK-DAG:       llvm.call @mgpuStreamDestroy(%[[S1]])
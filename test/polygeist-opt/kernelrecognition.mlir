@@ -0,0 +1,256 @@
+// RUN: polygeist-opt --recognize-kernels --canonicalize --cse --split-input-file %s | FileCheck %s
+// RUN: polygeist-opt --recognize-kernels="library=cblas" --canonicalize --split-input-file %s | FileCheck %s --check-prefix=CBLAS
+
+// PolyBench gemm: the beta scaling has its own loop and alpha * A[i][k] is
+// hoisted out of the innermost loop.
+module {
+  func.func @gemm(%C: memref<?x1100xf64>, %alpha: f64, %beta: f64, %A: memref<?x1200xf64>, %B: memref<?x1100xf64>) {
+    affine.for %i = 0 to 1000 {
+      affine.for %j = 0 to 1100 {
+        %0 = affine.load %C[%i, %j] : memref<?x1100xf64>
+        %1 = arith.mulf %0, %beta : f64
+        affine.store %1, %C[%i, %j] : memref<?x1100xf64>
+      }
+      affine.for %k = 0 to 1200 {
+        %0 = affine.load %A[%i, %k] : memref<?x1200xf64>
+        %1 = arith.mulf %alpha, %0 : f64
+        affine.for %j = 0 to 1100 {
+          %2 = affine.load %B[%k, %j] : memref<?x1100xf64>
+          %3 = arith.mulf %1, %2 : f64
+          %4 = affine.load %C[%i, %j] : memref<?x1100xf64>
+          %5 = arith.addf %4, %3 : f64
+          affine.store %5, %C[%i, %j] : memref<?x1100xf64>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @gemm(
+// CHECK-SAME:      %[[C:.+]]: memref<?x1100xf64>, %[[ALPHA:.+]]: f64, %[[BETA:.+]]: f64, %[[A:.+]]: memref<?x1200xf64>, %[[B:.+]]: memref<?x1100xf64>)
+// CHECK-DAG:       %[[F:.+]] = arith.constant 0 : i32
+// CHECK-DAG:       %[[M:.+]] = arith.constant 1000 : i64
+// CHECK-DAG:       %[[N:.+]] = arith.constant 1100 : i64
+// CHECK-DAG:       %[[K:.+]] = arith.constant 1200 : i64
+// CHECK-DAG:       %[[PA:.+]] = "polygeist.memref2pointer"(%[[A]]) : (memref<?x1200xf64>) -> !llvm.ptr<f64>
+// CHECK-DAG:       %[[PB:.+]] = "polygeist.memref2pointer"(%[[B]]) : (memref<?x1100xf64>) -> !llvm.ptr<f64>
+// CHECK-DAG:       %[[PC:.+]] = "polygeist.memref2pointer"(%[[C]]) : (memref<?x1100xf64>) -> !llvm.ptr<f64>
+// CHECK:           scf.if %{{.*}} {
+// CHECK-NEXT:        call @polygeist_dgemm(%[[F]], %[[F]], %[[M]], %[[N]], %[[K]], %[[ALPHA]], %[[PA]], %[[K]], %[[PB]], %[[N]], %[[BETA]], %[[PC]], %[[N]])
+// CHECK-NEXT:      } else {
+// CHECK-NEXT:        affine.for
+// CHECK:           return
+
+// CBLAS-LABEL:   func.func @gemm(
+// CBLAS-DAG:       %[[ROWMAJOR:.+]] = arith.constant 101 : i32
+// CBLAS-DAG:       %[[NOTRANS:.+]] = arith.constant 111 : i32
+// CBLAS-DAG:       %[[M:.+]] = arith.constant 1000 : i32
+// CBLAS:           call @cblas_dgemm(%[[ROWMAJOR]], %[[NOTRANS]], %[[NOTRANS]], %[[M]],
+
+// -----
+
+// 2mm-style zero initialization with a trip count only known at run time and
+// a transposed right-hand side.
+module {
+  func.func @matmul_bt(%n: index, %D: memref<?x64xf32>, %A: memref<?x32xf32>, %B: memref<?x32xf32>) {
+    affine.for %i = 0 to %n {
+      affine.for %j = 0 to 64 {
+        %cst = arith.constant 0.000000e+00 : f32
+        affine.store %cst, %D[%i, %j] : memref<?x64xf32>
+        affine.for %k = 0 to 32 {
+          %0 = affine.load %A[%i, %k] : memref<?x32xf32>
+          %1 = affine.load %B[%j, %k] : memref<?x32xf32>
+          %2 = arith.mulf %0, %1 : f32
+          %3 = affine.load %D[%i, %j] : memref<?x64xf32>
+          %4 = arith.addf %3, %2 : f32
+          affine.store %4, %D[%i, %j] : memref<?x64xf32>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @matmul_bt(
+// CHECK-DAG:       %[[NT:.+]] = arith.constant 0 : i32
+// CHECK-DAG:       %[[T:.+]] = arith.constant 1 : i32
+// CHECK-DAG:       %[[ONE:.+]] = arith.constant 1.000000e+00 : f32
+// CHECK-DAG:       %[[ZERO:.+]] = arith.constant 0.000000e+00 : f32
+// CHECK:           scf.if %{{.*}} {
+// CHECK-NEXT:        call @polygeist_sgemm(%[[NT]], %[[T]], %{{.*}}, %{{.*}}, %{{.*}}, %[[ONE]], %{{.*}}, %{{.*}}, %{{.*}}, %{{.*}}, %[[ZERO]], %{{.*}}, %{{.*}})
+// CHECK-NEXT:      } else {
+// CHECK-NEXT:        affine.for %{{.*}} = 0 to %{{.*}} {
+
+// -----
+
+// Transposed matrix-vector product.
+module {
+  func.func @gemv_t(%y: memref<?xf64>, %A: memref<?x300xf64>, %x: memref<?xf64>) {
+    affine.for %j = 0 to 300 {
+      affine.for %i = 0 to 200 {
+        %0 = affine.load %A[%i, %j] : memref<?x300xf64>
+        %1 = affine.load %x[%i] : memref<?xf64>
+        %2 = arith.mulf %0, %1 : f64
+        %3 = affine.load %y[%j] : memref<?xf64>
+        %4 = arith.addf %3, %2 : f64
+        affine.store %4, %y[%j] : memref<?xf64>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @gemv_t(
+// CHECK-DAG:       %[[T:.+]] = arith.constant 1 : i32
+// CHECK-DAG:       %[[ROWS:.+]] = arith.constant 200 : i64
+// CHECK-DAG:       %[[COLS:.+]] = arith.constant 300 : i64
+// CHECK:           scf.if %{{.*}} {
+// CHECK-NEXT:        call @polygeist_dgemv(%[[T]], %[[ROWS]], %[[COLS]], %{{.*}}, %{{.*}}, %[[COLS]], %{{.*}}, %{{.*}}, %{{.*}})
+// CHECK-NEXT:      } else {
+
+// CBLAS-LABEL:   func.func @gemv_t(
+// CBLAS:           call @cblas_dgemv(
+
+// -----
+
+// 2-D convolution; CBLAS has no such kernel, so the bundled one is used.
+module {
+  func.func @conv(%out: memref<?x126xf32>, %w: memref<3x3xf32>, %in: memref<?x128xf32>) {
+    affine.for %i = 0 to 126 {
+      affine.for %j = 0 to 126 {
+        affine.for %p = 0 to 3 {
+          affine.for %q = 0 to 3 {
+            %0 = affine.load %w[%p, %q] : memref<3x3xf32>
+            %1 = affine.load %in[%i + %p, %j + %q] : memref<?x128xf32>
+            %2 = arith.mulf %0, %1 : f32
+            %3 = affine.load %out[%i, %j] : memref<?x126xf32>
+            %4 = arith.addf %3, %2 : f32
+            affine.store %4, %out[%i, %j] : memref<?x126xf32>
+          }
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @conv(
+// CHECK:           call @polygeist_sconv2d(
+
+// CBLAS-LABEL:   func.func @conv(
+// CBLAS:           call @polygeist_sconv2d(
+
+// -----
+
+module {
+  func.func @transpose(%A: memref<?x512xf64>, %B: memref<?x256xf64>) {
+    affine.for %i = 0 to 256 {
+      affine.for %j = 0 to 512 {
+        %0 = affine.load %A[%i, %j] : memref<?x512xf64>
+        affine.store %0, %B[%j, %i] : memref<?x256xf64>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @transpose(
+// CHECK-DAG:       %[[M:.+]] = arith.constant 256 : i64
+// CHECK-DAG:       %[[N:.+]] = arith.constant 512 : i64
+// CHECK:           call @polygeist_dtranspose(%[[M]], %[[N]], %{{.*}}, %[[N]], %{{.*}}, %[[M]])
+
+// -----
+
+// The output may be one of the inputs, which the loops allow but the library
+// does not: the call is only made if their elements are disjoint.
+module {
+  func.func @overlap(%C: memref<?x128xf64>, %A: memref<?x128xf64>) {
+    %B = memref.alloca() : memref<128x128xf64>
+    affine.for %i = 0 to 128 {
+      affine.for %j = 0 to 128 {
+        affine.for %k = 0 to 128 {
+          %0 = affine.load %A[%i, %k] : memref<?x128xf64>
+          %1 = affine.load %B[%k, %j] : memref<128x128xf64>
+          %2 = arith.mulf %0, %1 : f64
+          %3 = affine.load %C[%i, %j] : memref<?x128xf64>
+          %4 = arith.addf %3, %2 : f64
+          affine.store %4, %C[%i, %j] : memref<?x128xf64>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @overlap(
+// CHECK-SAME:      %[[C:.+]]: memref<?x128xf64>, %[[A:.+]]: memref<?x128xf64>)
+// CHECK-DAG:       %[[BYTES:.+]] = arith.constant 131072 : i64
+// CHECK-DAG:       %[[PC:.+]] = "polygeist.memref2pointer"(%[[C]])
+// CHECK-DAG:       %[[PA:.+]] = "polygeist.memref2pointer"(%[[A]])
+// CHECK-DAG:       %[[IC:.+]] = llvm.ptrtoint %[[PC]] : !llvm.ptr<f64> to i64
+// CHECK-DAG:       %[[IA:.+]] = llvm.ptrtoint %[[PA]] : !llvm.ptr<f64> to i64
+// CHECK-DAG:       %[[EC:.+]] = arith.addi %[[IC]], %[[BYTES]] : i64
+// CHECK-DAG:       %[[EA:.+]] = arith.addi %[[IA]], %[[BYTES]] : i64
+// CHECK-DAG:       %[[BEFORE:.+]] = arith.cmpi ule, %[[EC]], %[[IA]] : i64
+// CHECK-DAG:       %[[AFTER:.+]] = arith.cmpi ule, %[[EA]], %[[IC]] : i64
+// CHECK-DAG:       %[[DISJOINT:.+]] = arith.ori %[[BEFORE]], %[[AFTER]] : i1
+// CHECK:           scf.if %[[DISJOINT]] {
+// CHECK-NEXT:        call @polygeist_dgemm(
+// CHECK-NEXT:      } else {
+// CHECK-NEXT:        affine.for %{{.*}} = 0 to 128 {
+
+// -----
+
+// Distinct allocations cannot overlap, so the call needs no guard.
+module {
+  func.func @local(%alpha: f32) {
+    %C = memref.alloca() : memref<64x64xf32>
+    %A = memref.alloca() : memref<64x64xf32>
+    %B = memref.alloca() : memref<64x64xf32>
+    affine.for %i = 0 to 64 {
+      affine.for %j = 0 to 64 {
+        affine.for %k = 0 to 64 {
+          %0 = affine.load %A[%i, %k] : memref<64x64xf32>
+          %1 = affine.load %B[%k, %j] : memref<64x64xf32>
+          %2 = arith.mulf %0, %1 : f32
+          %3 = affine.load %C[%i, %j] : memref<64x64xf32>
+          %4 = arith.addf %3, %2 : f32
+          affine.store %4, %C[%i, %j] : memref<64x64xf32>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @local(
+// CHECK-NOT:       scf.if
+// CHECK:           call @polygeist_sgemm(
+// CHECK-NOT:       affine.for
+// CHECK:           return
+
+// -----
+
+// Too small to be worth a call.
+module {
+  func.func @small(%C: memref<8x8xf64>, %A: memref<8x8xf64>, %B: memref<8x8xf64>) {
+    affine.for %i = 0 to 8 {
+      affine.for %j = 0 to 8 {
+        affine.for %k = 0 to 8 {
+          %0 = affine.load %A[%i, %k] : memref<8x8xf64>
+          %1 = affine.load %B[%k, %j] : memref<8x8xf64>
+          %2 = arith.mulf %0, %1 : f64
+          %3 = affine.load %C[%i, %j] : memref<8x8xf64>
+          %4 = arith.addf %3, %2 : f64
+          affine.store %4, %C[%i, %j] : memref<8x8xf64>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @small(
+// CHECK-NOT:       call
+// CHECK:           affine.for
@@ -0,0 +1,45 @@
+// RUN: polygeist-opt --parallel-licm --split-input-file %s | FileCheck %s
+
+// A stack allocation cannot be what an argument points to, even once it
+// escapes.
+module {
+  func.func private @capture(memref<16xf32>)
+  func.func @argument(%A: memref<?xf32>) {
+    %t = memref.alloca() : memref<16xf32>
+    func.call @capture(%t) : (memref<16xf32>) -> ()
+    affine.for %i = 0 to 16 {
+      %v = affine.load %A[0] : memref<?xf32>
+      affine.store %v, %t[%i] : memref<16xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @argument(
+// CHECK-SAME:      %[[A:.+]]: memref<?xf32>)
+// CHECK:           %[[V:.+]] = affine.load %[[A]][0] : memref<?xf32>
+// CHECK-NEXT:      affine.for
+// CHECK-NEXT:        affine.store %[[V]], %{{.*}}[%{{.*}}] : memref<16xf32>
+
+// -----
+
+// Casts of an allocation used only by loads and stores do not capture it.
+module {
+  func.func private @get() -> memref<?xf32>
+  func.func @derived() {
+    %p = func.call @get() : () -> memref<?xf32>
+    %t = memref.alloca() : memref<16xf32>
+    %c = memref.cast %t : memref<16xf32> to memref<?xf32>
+    affine.for %i = 0 to 16 {
+      %v = affine.load %p[0] : memref<?xf32>
+      affine.store %v, %c[%i] : memref<?xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @derived(
+// CHECK:           %[[P:.+]] = call @get()
+// CHECK:           %[[V:.+]] = affine.load %[[P]][0] : memref<?xf32>
+// CHECK-NEXT:      affine.for
+// CHECK-NEXT:        affine.store %[[V]], %{{.*}}[%{{.*}}] : memref<?xf32>
@@ -0,0 +1,123 @@
+// RUN: polygeist-opt --loop-idiom --split-input-file %s | FileCheck %s
+
+// Zeroing whole rows: the nest becomes one memset of n * 64 floats.
+module {
+  func.func @zero(%A: memref<?x64xf32>, %n: index) {
+    %zero = arith.constant 0.000000e+00 : f32
+    affine.for %i = 0 to %n {
+      affine.for %j = 0 to 64 {
+        affine.store %zero, %A[%i, %j] : memref<?x64xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @zero(
+// CHECK-SAME:      %[[A:.+]]: memref<?x64xf32>, %[[N:.+]]: index)
+// CHECK-DAG:       arith.constant 256 : index
+// CHECK-DAG:       %[[P:.+]] = "polygeist.memref2pointer"(%[[A]]) : (memref<?x64xf32>) -> !llvm.ptr<f32>
+// CHECK:           %[[G:.+]] = llvm.getelementptr %[[P]][%{{.+}}] : (!llvm.ptr<f32>, i64) -> !llvm.ptr<f32>
+// CHECK:           "llvm.intr.memset"(%[[G]], %{{.+}}, %{{.+}}, %{{.+}}) {polygeist.loop_idiom} : (!llvm.ptr<f32>, i8, i64, i1) -> ()
+// CHECK-NEXT:      return
+
+// -----
+
+// A copy between two globals, which cannot alias.
+module {
+  memref.global "private" @src : memref<1024xi32>
+  memref.global "private" @dst : memref<1024xi32>
+  func.func @copy() {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c1024 = arith.constant 1024 : index
+    %src = memref.get_global @src : memref<1024xi32>
+    %dst = memref.get_global @dst : memref<1024xi32>
+    scf.for %i = %c0 to %c1024 step %c1 {
+      %v = memref.load %src[%i] : memref<1024xi32>
+      memref.store %v, %dst[%i] : memref<1024xi32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @copy()
+// CHECK-DAG:       %[[SRC:.+]] = memref.get_global @src : memref<1024xi32>
+// CHECK-DAG:       %[[DST:.+]] = memref.get_global @dst : memref<1024xi32>
+// CHECK-DAG:       %[[D:.+]] = "polygeist.memref2pointer"(%[[DST]]) : (memref<1024xi32>) -> !llvm.ptr<i32>
+// CHECK-DAG:       %[[S:.+]] = "polygeist.memref2pointer"(%[[SRC]]) : (memref<1024xi32>) -> !llvm.ptr<i32>
+// CHECK-DAG:       %[[DG:.+]] = llvm.getelementptr %[[D]][%{{.+}}] : (!llvm.ptr<i32>, i64) -> !llvm.ptr<i32>
+// CHECK-DAG:       %[[SG:.+]] = llvm.getelementptr %[[S]][%{{.+}}] : (!llvm.ptr<i32>, i64) -> !llvm.ptr<i32>
+// CHECK:           "llvm.intr.memcpy"(%[[DG]], %[[SG]], %{{.+}}, %{{.+}}) {polygeist.loop_idiom} : (!llvm.ptr<i32>, !llvm.ptr<i32>, i64, i1) -> ()
+// CHECK-NEXT:      return
+
+// -----
+
+// The leading index is computed from a loop outside the nest, and from none
+// of the nest loops.
+module {
+  func.func @shifted(%A: memref<?x8x64xf32>, %n: index) {
+    %zero = arith.constant 0.000000e+00 : f32
+    affine.for %k = 0 to %n {
+      affine.for %i = 0 to 8 {
+        affine.for %j = 0 to 64 {
+          affine.store %zero, %A[%k + 1, %i, %j] : memref<?x8x64xf32>
+        }
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @shifted(
+// CHECK:           affine.for %[[K:.+]] = 0 to %{{.+}} {
+// CHECK-NOT:         affine.for
+// CHECK:             %{{.+}} = affine.apply #{{.+}}(%[[K]])
+// CHECK-NOT:         affine.for
+// CHECK:             "llvm.intr.memset"(%{{.+}}, %{{.+}}, %{{.+}}, %{{.+}}) {polygeist.loop_idiom} : (!llvm.ptr<f32>, i8, i64, i1) -> ()
+// CHECK-NEXT:      }
+
+// -----
+
+// Only part of each row is filled, so the outer loop stays and each row gets
+// its own memset.
+module {
+  func.func @rows(%A: memref<?x64xi8>, %n: index) {
+    %ones = arith.constant -1 : i8
+    affine.for %i = 0 to %n {
+      affine.for %j = 0 to 32 {
+        affine.store %ones, %A[%i, %j] : memref<?x64xi8>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @rows(
+// CHECK:           affine.for %{{.+}} = 0 to %{{.+}} {
+// CHECK-NOT:         affine.for
+// CHECK:             "llvm.intr.memset"(%{{.+}}, %{{.+}}, %{{.+}}, %{{.+}}) {polygeist.loop_idiom} : (!llvm.ptr<i8>, i8, i64, i1) -> ()
+// CHECK-NEXT:      }
+
+// -----
+
+// The arguments may overlap, and the bytes of 1.0 are not all equal: both
+// loops are kept.
+module {
+  func.func @kept(%A: memref<?xf32>, %B: memref<?xf32>, %n: index) {
+    %one = arith.constant 1.000000e+00 : f32
+    affine.for %i = 0 to %n {
+      %v = affine.load %B[%i] : memref<?xf32>
+      affine.store %v, %A[%i] : memref<?xf32>
+    }
+    affine.for %i = 0 to %n {
+      affine.store %one, %A[%i] : memref<?xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @kept(
+// CHECK:           affine.for
+// CHECK:           affine.for
+// CHECK-NOT:       llvm.intr
@@ -0,0 +1,127 @@
+// RUN: polygeist-opt --loop-interchange --split-input-file %s | FileCheck %s
+
+// Column sums: with j innermost the reads of A are contiguous, and the
+// dependence on B[j] is carried by i either way.
+module {
+  func.func @colsum(%A: memref<1024x512xf32>) {
+    %B = memref.alloca() : memref<512xf32>
+    affine.for %j = 0 to 512 {
+      affine.for %i = 0 to 1024 {
+        %a = affine.load %A[%i, %j] : memref<1024x512xf32>
+        %b = affine.load %B[%j] : memref<512xf32>
+        %s = arith.addf %a, %b : f32
+        affine.store %s, %B[%j] : memref<512xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @colsum(
+// CHECK:           affine.for %[[I:.+]] = 0 to 1024 {
+// CHECK-NEXT:        affine.for %[[J:.+]] = 0 to 512 {
+// CHECK-NEXT:          %{{.*}} = affine.load %{{.*}}[%[[I]], %[[J]]] : memref<1024x512xf32>
+// CHECK-NEXT:          %{{.*}} = affine.load %{{.*}}[%[[J]]] : memref<512xf32>
+
+// -----
+
+// B may be a view of A of a different shape, so writing it may carry
+// dependences between the iterations that the affine analysis does not see.
+module {
+  func.func @colsum_args(%A: memref<1024x512xf32>, %B: memref<512xf32>) {
+    affine.for %j = 0 to 512 {
+      affine.for %i = 0 to 1024 {
+        %a = affine.load %A[%i, %j] : memref<1024x512xf32>
+        %b = affine.load %B[%j] : memref<512xf32>
+        %s = arith.addf %a, %b : f32
+        affine.store %s, %B[%j] : memref<512xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @colsum_args(
+// CHECK:           affine.for %{{.*}} = 0 to 512 {
+// CHECK-NEXT:        affine.for %{{.*}} = 0 to 1024 {
+
+// -----
+
+// A and B may alias, but each element is only read and written by the same
+// iteration, so the order of the iterations does not matter.
+module {
+  func.func @scale_args(%A: memref<1024x512xf32>, %B: memref<1024x512xf32>) {
+    affine.for %j = 0 to 512 {
+      affine.for %i = 0 to 1024 {
+        %a = affine.load %A[%i, %j] : memref<1024x512xf32>
+        %s = arith.mulf %a, %a : f32
+        affine.store %s, %B[%i, %j] : memref<1024x512xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @scale_args(
+// CHECK:           affine.for %[[I:.+]] = 0 to 1024 {
+// CHECK-NEXT:        affine.for %[[J:.+]] = 0 to 512 {
+// CHECK-NEXT:          %{{.*}} = affine.load %{{.*}}[%[[I]], %[[J]]] : memref<1024x512xf32>
+
+// -----
+
+// B may be A, in which case the element written at (i, j) is read at
+// (i + 1, j - 1), so the loops cannot be interchanged.
+module {
+  func.func @skew_args(%A: memref<1024x512xf32>, %B: memref<1024x512xf32>) {
+    affine.for %j = 0 to 511 {
+      affine.for %i = 1 to 1024 {
+        %a = affine.load %A[%i - 1, %j + 1] : memref<1024x512xf32>
+        affine.store %a, %B[%i, %j] : memref<1024x512xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @skew_args(
+// CHECK:           affine.for %{{.*}} = 0 to 511 {
+// CHECK-NEXT:        affine.for %{{.*}} = 1 to 1024 {
+
+// -----
+
+// Each element is read by a later j iteration and an earlier i iteration, so
+// the loops cannot be interchanged.
+module {
+  func.func @skew(%A: memref<1024x512xf32>) {
+    affine.for %j = 0 to 511 {
+      affine.for %i = 1 to 1024 {
+        %a = affine.load %A[%i - 1, %j + 1] : memref<1024x512xf32>
+        affine.store %a, %A[%i, %j] : memref<1024x512xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @skew(
+// CHECK:           affine.for %{{.*}} = 0 to 511 {
+// CHECK-NEXT:        affine.for %{{.*}} = 1 to 1024 {
+
+// -----
+
+// A copy walking down the columns of A and B. The dimensions of a parallel
+// loop are independent and always reordered.
+module {
+  func.func @copy(%A: memref<1024x512xf32>, %B: memref<1024x512xf32>) {
+    affine.parallel (%i, %j) = (0, 0) to (512, 1024) {
+      %a = affine.load %A[%j, %i] : memref<1024x512xf32>
+      affine.store %a, %B[%j, %i] : memref<1024x512xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @copy(
+// CHECK:           affine.parallel (%[[J:.+]], %[[I:.+]]) = (0, 0) to (1024, 512) {
+// CHECK-NEXT:        %[[A:.+]] = affine.load %{{.*}}[%[[J]], %[[I]]] : memref<1024x512xf32>
+// CHECK-NEXT:        affine.store %[[A]], %{{.*}}[%[[J]], %[[I]]] : memref<1024x512xf32>
@@ -0,0 +1,109 @@
+// RUN: polygeist-opt --loop-unswitch --split-input-file %s | FileCheck %s
+// RUN: polygeist-opt --loop-unswitch=growth-budget=4 --split-input-file %s | FileCheck %s --check-prefix=BUDGET
+
+// A loop-invariant flag: one copy of the loop per branch.
+module {
+  func.func @flag(%A: memref<?xf32>, %n: index, %flag: i1) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %one = arith.constant 1.000000e+00 : f32
+    scf.for %i = %c0 to %n step %c1 {
+      %a = memref.load %A[%i] : memref<?xf32>
+      %b = scf.if %flag -> (f32) {
+        %s = arith.addf %a, %one : f32
+        scf.yield %s : f32
+      } else {
+        scf.yield %a : f32
+      }
+      memref.store %b, %A[%i] : memref<?xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @flag(
+// CHECK-SAME:      %[[FLAG:[a-z0-9]+]]: i1)
+// CHECK:           scf.if %[[FLAG]] {
+// CHECK-NEXT:        scf.for %[[I:.+]] =
+// CHECK-NEXT:          %[[A:.+]] = memref.load %{{.*}}[%[[I]]] : memref<?xf32>
+// CHECK-NEXT:          %[[S:.+]] = arith.addf %[[A]], %{{.*}} : f32
+// CHECK-NEXT:          memref.store %[[S]], %{{.*}}[%[[I]]] : memref<?xf32>
+// CHECK-NEXT:        }
+// CHECK-NEXT:      } else {
+// CHECK-NEXT:        scf.for %[[I2:.+]] =
+// CHECK-NEXT:          %[[A2:.+]] = memref.load %{{.*}}[%[[I2]]] : memref<?xf32>
+// CHECK-NEXT:          memref.store %[[A2]], %{{.*}}[%[[I2]]] : memref<?xf32>
+// CHECK-NEXT:        }
+// CHECK-NEXT:      }
+
+// The loop is larger than the budget.
+// BUDGET-LABEL:  func.func @flag(
+// BUDGET:          scf.for
+// BUDGET-NEXT:       memref.load
+// BUDGET-NEXT:       scf.if
+
+// -----
+
+// Boundary conditions of a stencil: the first and last iterations are split
+// off and the steady-state loop has no branch.
+#interior = affine_set<(d0)[s0] : (d0 - 1 >= 0, s0 - d0 - 2 >= 0)>
+module {
+  func.func @stencil(%A: memref<?xf32>, %B: memref<?xf32>, %n: index) {
+    affine.for %i = 0 to %n {
+      %a = affine.load %A[%i] : memref<?xf32>
+      affine.if #interior(%i)[%n] {
+        %l = affine.load %A[%i - 1] : memref<?xf32>
+        %s = arith.addf %a, %l : f32
+        affine.store %s, %B[%i] : memref<?xf32>
+      } else {
+        affine.store %a, %B[%i] : memref<?xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @stencil(
+// CHECK:           affine.for %[[I0:.+]] = 0 to min #{{.+}}()[%{{.+}}] {
+// CHECK-NEXT:        %[[A0:.+]] = affine.load %{{.*}}[%[[I0]]] : memref<?xf32>
+// CHECK-NEXT:        affine.store %[[A0]], %{{.*}}[%[[I0]]] : memref<?xf32>
+// CHECK-NEXT:      }
+// CHECK-NEXT:      affine.for %[[I1:.+]] = max #{{.+}}() to min #{{.+}}()[%{{.+}}] {
+// CHECK-NEXT:        %[[A1:.+]] = affine.load %{{.*}}[%[[I1]]] : memref<?xf32>
+// CHECK-NEXT:        %[[L:.+]] = affine.load %{{.*}}[%[[I1]] - 1] : memref<?xf32>
+// CHECK-NEXT:        %[[S:.+]] = arith.addf %[[A1]], %[[L]] : f32
+// CHECK-NEXT:        affine.store %[[S]], %{{.*}}[%[[I1]]] : memref<?xf32>
+// CHECK-NEXT:      }
+// CHECK-NEXT:      affine.for %[[I2:.+]] = max #{{.+}}()[%{{.+}}] to %{{.+}} {
+// CHECK-NEXT:        %[[A2:.+]] = affine.load %{{.*}}[%[[I2]]] : memref<?xf32>
+// CHECK-NEXT:        affine.store %[[A2]], %{{.*}}[%[[I2]]] : memref<?xf32>
+// CHECK-NEXT:      }
+// CHECK-NOT:       affine.if
+
+// -----
+
+// The bounds guard of a lowered CUDA kernel: the threads past the end run an
+// empty loop of their own.
+#guard = affine_set<(d0)[s0] : (s0 - d0 - 1 >= 0)>
+module {
+  func.func @guard(%A: memref<?xf32>, %n: index) {
+    affine.parallel (%i) = (0) to (1024) {
+      affine.if #guard(%i)[%n] {
+        %a = affine.load %A[%i] : memref<?xf32>
+        %s = arith.addf %a, %a : f32
+        affine.store %s, %A[%i] : memref<?xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @guard(
+// CHECK:           affine.parallel (%[[I:.+]]) = (0) to (min(
+// CHECK-NEXT:        %[[A:.+]] = affine.load %{{.*}}[%[[I]]] : memref<?xf32>
+// CHECK-NEXT:        %[[S:.+]] = arith.addf %[[A]], %[[A]] : f32
+// CHECK-NEXT:        affine.store %[[S]], %{{.*}}[%[[I]]] : memref<?xf32>
+// CHECK-NEXT:      }
+// CHECK-NEXT:      affine.parallel (%{{.+}}) = (max(
+// CHECK-NEXT:      }
+// CHECK-NOT:       affine.if
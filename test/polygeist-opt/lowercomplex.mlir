@@ -0,0 +1,79 @@
+// RUN: polygeist-opt --lower-complex --split-input-file %s | FileCheck %s
+
+// Under -ffast-math the product uses the textbook formula.
+module {
+  func.func @fastmul(%a: complex<f32>, %b: complex<f32>) -> complex<f32> {
+    %0 = complex.mul %a, %b {polygeist.limited_range} : complex<f32>
+    return %0 : complex<f32>
+  }
+}
+
+// CHECK-LABEL:   func.func @fastmul(
+// CHECK-SAME:      %[[A:.+]]: complex<f32>, %[[B:.+]]: complex<f32>) -> complex<f32>
+// CHECK-DAG:       %[[AR:.+]] = complex.re %[[A]] : complex<f32>
+// CHECK-DAG:       %[[AI:.+]] = complex.im %[[A]] : complex<f32>
+// CHECK-DAG:       %[[BR:.+]] = complex.re %[[B]] : complex<f32>
+// CHECK-DAG:       %[[BI:.+]] = complex.im %[[B]] : complex<f32>
+// CHECK-DAG:       %[[AC:.+]] = arith.mulf %[[AR]], %[[BR]] : f32
+// CHECK-DAG:       %[[BD:.+]] = arith.mulf %[[AI]], %[[BI]] : f32
+// CHECK-DAG:       %[[RE:.+]] = arith.subf %[[AC]], %[[BD]] : f32
+// CHECK-DAG:       %[[AD:.+]] = arith.mulf %[[AR]], %[[BI]] : f32
+// CHECK-DAG:       %[[BC:.+]] = arith.mulf %[[AI]], %[[BR]] : f32
+// CHECK-DAG:       %[[IM:.+]] = arith.addf %[[AD]], %[[BC]] : f32
+// CHECK:           %[[R:.+]] = complex.create %[[RE]], %[[IM]] : complex<f32>
+// CHECK-NEXT:      return %[[R]] : complex<f32>
+
+// -----
+
+// The quotient divides both parts by the squared magnitude of the divisor.
+module {
+  func.func @fastdiv(%a: complex<f64>, %b: complex<f64>) -> complex<f64> {
+    %0 = complex.div %a, %b {polygeist.limited_range} : complex<f64>
+    return %0 : complex<f64>
+  }
+}
+
+// CHECK-LABEL:   func.func @fastdiv(
+// CHECK-NOT:       arith.select
+// CHECK-NOT:       arith.cmpf
+// CHECK-COUNT-2:   arith.divf %{{.+}}, %{{.+}} : f64
+// CHECK-NOT:       arith.divf
+// CHECK:           complex.create
+
+// -----
+
+// Without -ffast-math, infinities are recovered with selects rather than
+// branches, so that loops over the values remain vectorizable.
+module {
+  func.func @mul(%a: complex<f32>, %b: complex<f32>) -> complex<f32> {
+    %0 = complex.mul %a, %b : complex<f32>
+    return %0 : complex<f32>
+  }
+}
+
+// CHECK-LABEL:   func.func @mul(
+// CHECK-NOT:       complex.mul
+// CHECK-NOT:       cf.cond_br
+// CHECK:           arith.select
+// CHECK:           complex.create
+// CHECK-NEXT:      return
+
+// -----
+
+// The parts of values created in the function fold away.
+module {
+  func.func @parts(%a: f32, %b: f32, %c: f32, %d: f32) -> (f32, f32) {
+    %x = complex.create %a, %b : complex<f32>
+    %y = complex.create %c, %d : complex<f32>
+    %0 = complex.sub %x, %y : complex<f32>
+    %re = complex.re %0 : complex<f32>
+    %im = complex.im %0 : complex<f32>
+    return %re, %im : f32, f32
+  }
+}
+
+// CHECK-LABEL:   func.func @parts(
+// CHECK-SAME:      %[[A:.+]]: f32, %[[B:.+]]: f32, %[[C:.+]]: f32, %[[D:.+]]: f32) -> (f32, f32)
+// CHECK-NEXT:      %[[RE:.+]] = arith.subf %[[A]], %[[C]] : f32
+// CHECK-NEXT:      %[[IM:.+]] = arith.subf %[[B]], %[[D]] : f32
+// CHECK-NEXT:      return %[[RE]], %[[IM]] : f32, f32
@@ -0,0 +1,45 @@
+// RUN: polygeist-opt --mem2reg --split-input-file %s | FileCheck %s
+
+// Once an allocation escapes, only writes which may alias it stop the
+// forwarding of a store to a load.
+module {
+  func.func private @capture(memref<1xf32>)
+  func.func @forward(%v: f32, %w: f32) -> f32 {
+    %c0 = arith.constant 0 : index
+    %a = memref.alloca() : memref<1xf32>
+    %b = memref.alloca() : memref<1xf32>
+    func.call @capture(%a) : (memref<1xf32>) -> ()
+    func.call @capture(%b) : (memref<1xf32>) -> ()
+    memref.store %v, %a[%c0] : memref<1xf32>
+    memref.store %w, %b[%c0] : memref<1xf32>
+    %r = memref.load %a[%c0] : memref<1xf32>
+    return %r : f32
+  }
+}
+
+// CHECK-LABEL:   func.func @forward(
+// CHECK-SAME:      %[[V:.+]]: f32, %[[W:.+]]: f32) -> f32
+// CHECK-NOT:       memref.load
+// CHECK:           return %[[V]] : f32
+
+// -----
+
+// A write through a pointer obtained after the escape may be to it.
+module {
+  func.func private @capture(memref<1xf32>)
+  func.func private @get() -> memref<1xf32>
+  func.func @clobbered(%v: f32, %w: f32) -> f32 {
+    %c0 = arith.constant 0 : index
+    %a = memref.alloca() : memref<1xf32>
+    func.call @capture(%a) : (memref<1xf32>) -> ()
+    %p = func.call @get() : () -> memref<1xf32>
+    memref.store %v, %a[%c0] : memref<1xf32>
+    memref.store %w, %p[%c0] : memref<1xf32>
+    %r = memref.load %a[%c0] : memref<1xf32>
+    return %r : f32
+  }
+}
+
+// CHECK-LABEL:   func.func @clobbered(
+// CHECK:           %[[R:.+]] = memref.load
+// CHECK-NEXT:      return %[[R]] : f32
@@ -0,0 +1,89 @@
+// RUN: polygeist-opt --nontemporal-stores=llc-size=65536 --split-input-file %s | FileCheck %s
+
+// Initialization of a 512 KiB array which is not read in the function.
+module {
+  func.func @init(%A: memref<512x256xf32>) {
+    affine.for %i = 0 to 512 {
+      affine.for %j = 0 to 256 {
+        %v = arith.index_cast %j : index to i32
+        %f = arith.sitofp %v : i32 to f32
+        affine.store %f, %A[%i, %j] : memref<512x256xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @init(
+// CHECK-SAME:      %[[A:.+]]: memref<512x256xf32>)
+// CHECK:           affine.for %[[I:.+]] = 0 to 512 {
+// CHECK-NEXT:        affine.for %[[J:.+]] = 0 to 256 {
+// CHECK:               memref.store %{{.+}}, %[[A]][%{{.+}}, %{{.+}}] {polygeist.nontemporal} : memref<512x256xf32>
+// CHECK-NEXT:        }
+// CHECK-NEXT:      }
+// CHECK-NEXT:      llvm.fence seq_cst
+// CHECK-NEXT:      return
+
+// -----
+
+// The array is read back afterwards, so the stores should stay in the cache.
+module {
+  func.func @reread(%A: memref<512x256xf32>) -> f32 {
+    %cst = arith.constant 1.000000e+00 : f32
+    affine.for %i = 0 to 512 {
+      affine.for %j = 0 to 256 {
+        affine.store %cst, %A[%i, %j] : memref<512x256xf32>
+      }
+    }
+    %v = affine.load %A[0, 0] : memref<512x256xf32>
+    return %v : f32
+  }
+}
+
+// CHECK-LABEL:   func.func @reread(
+// CHECK:           affine.store
+// CHECK-NOT:       llvm.fence
+
+// -----
+
+// The array fits in the cache, and a column walk does not fill whole lines.
+module {
+  func.func @small(%A: memref<64x64xf32>, %B: memref<512x256xf32>) {
+    %cst = arith.constant 1.000000e+00 : f32
+    affine.for %i = 0 to 64 {
+      affine.for %j = 0 to 64 {
+        affine.store %cst, %A[%i, %j] : memref<64x64xf32>
+      }
+    }
+    affine.for %j = 0 to 256 {
+      affine.for %i = 0 to 512 {
+        affine.store %cst, %B[%i, %j] : memref<512x256xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @small(
+// CHECK:           affine.store
+// CHECK:           affine.store
+// CHECK-NOT:       llvm.fence
+
+// -----
+
+// The same 16 KiB row is written again and again: it stays in the cache.
+module {
+  func.func @rewrite(%A: memref<4096xf32>) {
+    %cst = arith.constant 1.000000e+00 : f32
+    affine.for %t = 0 to 1000 {
+      affine.for %j = 0 to 4096 {
+        affine.store %cst, %A[%j] : memref<4096xf32>
+      }
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @rewrite(
+// CHECK:           affine.store
+// CHECK-NOT:       llvm.fence
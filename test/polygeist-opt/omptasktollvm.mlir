@@ -0,0 +1,70 @@
+// RUN: polygeist-opt --convert-polygeist-to-llvm --split-input-file %s | FileCheck %s
+
+// The tasks of a taskloop, created by a loop inside a taskgroup: the regions
+// of the task and the taskgroup are converted in place.
+module {
+  func.func @scale(%x: memref<?xf64>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c64 = arith.constant 64 : index
+    %two = arith.constant 2.000000e+00 : f64
+    omp.taskgroup {
+      scf.for %i = %c0 to %n step %c64 {
+        omp.task {
+          %v = memref.load %x[%i] : memref<?xf64>
+          %m = arith.mulf %v, %two : f64
+          memref.store %m, %x[%i] : memref<?xf64>
+          omp.terminator
+        }
+      }
+      omp.terminator
+    }
+    omp.taskwait
+    return
+  }
+}
+
+// CHECK-LABEL:   llvm.func @scale(
+// CHECK-SAME:      %[[X:.+]]: !llvm.ptr<f64>, %[[N:.+]]: i64)
+// CHECK:           omp.taskgroup {
+// CHECK:             llvm.icmp "slt"
+// CHECK:             omp.task {
+// CHECK:               %[[P:.+]] = llvm.getelementptr %[[X]][%{{.+}}] : (!llvm.ptr<f64>, i64) -> !llvm.ptr<f64>
+// CHECK-NEXT:          %[[V:.+]] = llvm.load %[[P]] : !llvm.ptr<f64>
+// CHECK-NEXT:          %[[M:.+]] = llvm.fmul %[[V]], %{{.+}} : f64
+// CHECK:               llvm.store %[[M]], %{{.+}} : !llvm.ptr<f64>
+// CHECK-NEXT:          omp.terminator
+// CHECK-NEXT:        }
+// CHECK:             omp.terminator
+// CHECK-NEXT:      }
+// CHECK-NEXT:      omp.taskwait
+// CHECK-NEXT:      llvm.return
+// CHECK-NOT:       memref.
+// CHECK-NOT:       scf.
+
+// -----
+
+// A task whose body branches, with an if clause.
+module {
+  func.func @cond(%x: memref<?xi32>, %c: i1, %d: i1) {
+    %c0 = arith.constant 0 : index
+    %one = arith.constant 1 : i32
+    omp.task if(%c) {
+      scf.if %d {
+        memref.store %one, %x[%c0] : memref<?xi32>
+      }
+      omp.terminator
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   llvm.func @cond(
+// CHECK-SAME:      %[[X:.+]]: !llvm.ptr<i32>, %[[C:.+]]: i1, %[[D:.+]]: i1)
+// CHECK:           omp.task if(%[[C]]) {
+// CHECK:             llvm.cond_br %[[D]], ^[[THEN:.+]], ^[[END:.+]]
+// CHECK:           ^[[THEN]]:
+// CHECK:             llvm.store %{{.+}}, %{{.+}} : !llvm.ptr<i32>
+// CHECK:           ^[[END]]:
+// CHECK-NEXT:        omp.terminator
+// CHECK-NEXT:      }
+// CHECK-NEXT:      llvm.return
@@ -51,3 +51,118 @@ module {
 // CHECK-NEXT:     }
 // CHECK-NEXT:     return
 // CHECK-NEXT:   }
+
+// -----
+
+// A triangular nest: the inner loop runs to the outer induction variable, so
+// iterations are dealt out cyclically. Each writes its own rows.
+module {
+  func.func @triangular(%A: memref<?x?xf32>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %zero = arith.constant 0.000000e+00 : f32
+    omp.parallel   {
+      omp.wsloop   for  (%i) : index = (%c0) to (%n) step (%c1) {
+        %ub = arith.addi %i, %c1 : index
+        scf.for %j = %c0 to %ub step %c1 {
+          memref.store %zero, %A[%i, %j] : memref<?x?xf32>
+        }
+        omp.yield
+      }
+      omp.terminator
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @triangular(
+// CHECK:           omp.wsloop {{.*}}schedule(static = %{{.+}} : index)
+
+// -----
+
+// A triangular matrix-vector product: consecutive iterations write adjacent
+// elements of y, so each chunk covers a cache line of them.
+module {
+  func.func @trmv(%A: memref<?x?xf32>, %x: memref<?xf32>, %y: memref<?xf32>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %zero = arith.constant 0.000000e+00 : f32
+    omp.parallel   {
+      omp.wsloop   for  (%i) : index = (%c0) to (%n) step (%c1) {
+        %ub = arith.addi %i, %c1 : index
+        %sum = scf.for %j = %c0 to %ub step %c1 iter_args(%acc = %zero) -> (f32) {
+          %a = memref.load %A[%i, %j] : memref<?x?xf32>
+          %b = memref.load %x[%j] : memref<?xf32>
+          %p = arith.mulf %a, %b : f32
+          %s = arith.addf %acc, %p : f32
+          scf.yield %s : f32
+        }
+        memref.store %sum, %y[%i] : memref<?xf32>
+        omp.yield
+      }
+      omp.terminator
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @trmv(
+// CHECK:           %[[C16:.+]] = arith.constant 16 : index
+// CHECK:           omp.wsloop {{.*}}schedule(static = %[[C16]] : index)
+
+// -----
+
+// Sparse rows: the inner trip count is loaded, so threads take rows as they
+// go.
+module {
+  func.func @csr(%rows: memref<?xindex>, %y: memref<?xf32>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %one = arith.constant 1.000000e+00 : f32
+    omp.parallel   {
+      omp.wsloop   for  (%i) : index = (%c0) to (%n) step (%c1) {
+        %lb = memref.load %rows[%i] : memref<?xindex>
+        %i1 = arith.addi %i, %c1 : index
+        %ub = memref.load %rows[%i1] : memref<?xindex>
+        scf.for %j = %lb to %ub step %c1 {
+          memref.store %one, %y[%j] : memref<?xf32>
+        }
+        omp.yield
+      }
+      omp.terminator
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @csr(
+// CHECK:           omp.wsloop {{.*}}schedule(guided)
+
+// -----
+
+// Tiles: both bounds move with the induction variable, the trip count does
+// not, and the default schedule is kept.
+module {
+  func.func @tiled(%A: memref<?xf32>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c32 = arith.constant 32 : index
+    %zero = arith.constant 0.000000e+00 : f32
+    omp.parallel   {
+      omp.wsloop   for  (%i) : index = (%c0) to (%n) step (%c1) {
+        %lb = arith.muli %i, %c32 : index
+        %ub = arith.addi %lb, %c32 : index
+        scf.for %j = %lb to %ub step %c1 {
+          memref.store %zero, %A[%j] : memref<?xf32>
+        }
+        omp.yield
+      }
+      omp.terminator
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @tiled(
+// CHECK-NOT:       schedule
+// CHECK:           return
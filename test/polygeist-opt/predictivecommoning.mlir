@@ -0,0 +1,131 @@
+// RUN: polygeist-opt --predictive-commoning --split-input-file %s | FileCheck %s
+
+// A three point stencil: two of the three loads repeat the last load of the
+// previous iterations. The trip count is unknown, so the loads before the
+// loop are guarded.
+#ub = affine_map<()[s0] -> (s0 - 1)>
+module {
+  memref.global "private" @A : memref<1024xf32>
+  memref.global "private" @B : memref<1024xf32>
+  func.func @stencil(%n: index) {
+    %A = memref.get_global @A : memref<1024xf32>
+    %B = memref.get_global @B : memref<1024xf32>
+    affine.for %i = 1 to #ub()[%n] {
+      %l = affine.load %A[%i - 1] : memref<1024xf32>
+      %c = affine.load %A[%i] : memref<1024xf32>
+      %r = affine.load %A[%i + 1] : memref<1024xf32>
+      %s = arith.addf %l, %c : f32
+      %t = arith.addf %s, %r : f32
+      affine.store %t, %B[%i] : memref<1024xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @stencil(
+// CHECK-SAME:      %[[N:.+]]: index)
+// CHECK-DAG:       %[[A:.+]] = memref.get_global @A : memref<1024xf32>
+// CHECK:           affine.if #{{.+}}()[%[[N]]] {
+// CHECK-NEXT:        %[[P1:.+]] = affine.load %[[A]][1] : memref<1024xf32>
+// CHECK-NEXT:        %[[P2:.+]] = affine.load %[[A]][0] : memref<1024xf32>
+// CHECK-NEXT:        %{{.+}}:2 = affine.for %[[I:.+]] = 1 to #{{.+}}()[%[[N]]] iter_args(%[[R1:.+]] = %[[P1]], %[[R2:.+]] = %[[P2]]) -> (f32, f32) {
+// CHECK-NEXT:          %[[R:.+]] = affine.load %[[A]][%[[I]] + 1] : memref<1024xf32>
+// CHECK-NEXT:          %[[S:.+]] = arith.addf %[[R2]], %[[R1]] : f32
+// CHECK-NEXT:          %[[T:.+]] = arith.addf %[[S]], %[[R]] : f32
+// CHECK-NEXT:          affine.store %[[T]], %{{.+}}[%[[I]]] : memref<1024xf32>
+// CHECK-NEXT:          affine.yield %[[R]], %[[R1]] : f32, f32
+// CHECK-NEXT:        }
+// CHECK-NEXT:      }
+
+// -----
+
+// The partial sum of the first two points is the sum of the last two points
+// of the previous iteration.
+module {
+  memref.global "private" @A : memref<1024xf32>
+  memref.global "private" @B : memref<1024xf32>
+  func.func @partial() {
+    %A = memref.get_global @A : memref<1024xf32>
+    %B = memref.get_global @B : memref<1024xf32>
+    affine.for %i = 1 to 1023 {
+      %a = affine.load %A[%i - 1] : memref<1024xf32>
+      %b = affine.load %A[%i] : memref<1024xf32>
+      %c = affine.load %A[%i + 1] : memref<1024xf32>
+      %s1 = arith.addf %a, %b : f32
+      %s2 = arith.addf %b, %c : f32
+      %t = arith.mulf %s1, %s2 : f32
+      affine.store %t, %B[%i] : memref<1024xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @partial()
+// CHECK-DAG:       %[[A:.+]] = memref.get_global @A : memref<1024xf32>
+// CHECK:           %[[C0:.+]] = affine.load %[[A]][1] : memref<1024xf32>
+// CHECK-NEXT:      %[[B1:.+]] = affine.load %[[A]][0] : memref<1024xf32>
+// CHECK-NEXT:      %[[C1:.+]] = affine.load %[[A]][1] : memref<1024xf32>
+// CHECK-NEXT:      %[[S0:.+]] = arith.addf %[[B1]], %[[C1]] : f32
+// CHECK-NEXT:      %{{.+}}:2 = affine.for %[[I:.+]] = 1 to 1023 iter_args(%[[RC:.+]] = %[[C0]], %[[RS:.+]] = %[[S0]]) -> (f32, f32) {
+// CHECK-NEXT:        %[[C:.+]] = affine.load %[[A]][%[[I]] + 1] : memref<1024xf32>
+// CHECK-NEXT:        %[[S2:.+]] = arith.addf %[[RC]], %[[C]] : f32
+// CHECK-NEXT:        %[[T:.+]] = arith.mulf %[[RS]], %[[S2]] : f32
+// CHECK-NEXT:        affine.store %[[T]], %{{.+}}[%[[I]]] : memref<1024xf32>
+// CHECK-NEXT:        affine.yield %[[C]], %[[S2]] : f32, f32
+// CHECK-NEXT:      }
+
+// -----
+
+// The loop writes the array it reads, so the loaded values may change
+// between iterations.
+module {
+  memref.global "private" @A : memref<1024xf32>
+  func.func @inplace() {
+    %A = memref.get_global @A : memref<1024xf32>
+    affine.for %i = 1 to 1023 {
+      %l = affine.load %A[%i - 1] : memref<1024xf32>
+      %r = affine.load %A[%i + 1] : memref<1024xf32>
+      %s = arith.addf %l, %r : f32
+      affine.store %s, %A[%i] : memref<1024xf32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @inplace()
+// CHECK-NOT:       iter_args
+// CHECK:           return
+
+// -----
+
+// The loads repeat, but the quotients are not carried: the one before the
+// loop would divide by an element the loop may never divide by.
+module {
+  memref.global "private" @A : memref<1024xi32>
+  memref.global "private" @B : memref<1024xi32>
+  func.func @quotient(%x: i32) {
+    %A = memref.get_global @A : memref<1024xi32>
+    %B = memref.get_global @B : memref<1024xi32>
+    affine.for %i = 1 to 1024 {
+      %a = affine.load %A[%i - 1] : memref<1024xi32>
+      %b = affine.load %A[%i] : memref<1024xi32>
+      %q1 = arith.divsi %x, %a : i32
+      %q2 = arith.divsi %x, %b : i32
+      %s = arith.addi %q1, %q2 : i32
+      affine.store %s, %B[%i] : memref<1024xi32>
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @quotient(
+// CHECK-SAME:      %[[X:.+]]: i32)
+// CHECK:           %[[P:.+]] = affine.load %{{.+}}[0] : memref<1024xi32>
+// CHECK-NEXT:      affine.for %[[I:.+]] = 1 to 1024 iter_args(%[[RA:.+]] = %[[P]]) -> (i32) {
+// CHECK-NEXT:        %[[B:.+]] = affine.load %{{.+}}[%[[I]]] : memref<1024xi32>
+// CHECK-NEXT:        %[[Q1:.+]] = arith.divsi %[[X]], %[[RA]] : i32
+// CHECK-NEXT:        %[[Q2:.+]] = arith.divsi %[[X]], %[[B]] : i32
+// CHECK-NEXT:        %[[S:.+]] = arith.addi %[[Q1]], %[[Q2]] : i32
+// CHECK-NEXT:        affine.store %[[S]], %{{.+}}[%[[I]]] : memref<1024xi32>
+// CHECK-NEXT:        affine.yield %[[B]] : i32
+// CHECK-NEXT:      }
@@ -0,0 +1,33 @@
+// RUN: polygeist-opt --loop-restructure --split-input-file %s | FileCheck %s
+
+module {
+  func.func @kernel(%arg0: i32, %arg1: memref<?xi32>) {
+    %c0 = arith.constant 0 : index
+    cf.br ^bb1
+  ^bb1:  // 3 preds: ^bb0, ^bb2, ^bb3
+    %0 = memref.load %arg1[%c0] : memref<?xi32>
+    cf.switch %0 : i32, [
+      default: ^bb4,
+      0: ^bb2,
+      1: ^bb3
+    ]
+  ^bb2:  // pred: ^bb1
+    memref.store %arg0, %arg1[%c0] : memref<?xi32>
+    cf.br ^bb1
+  ^bb3:  // pred: ^bb1
+    cf.br ^bb1
+  ^bb4:  // pred: ^bb1
+    return
+  }
+}
+
+// CHECK:   func.func @kernel(%[[arg0:.+]]: i32, %[[arg1:.+]]: memref<?xi32>) {
+// CHECK:     scf.while
+// CHECK:       scf.execute_region
+// CHECK:         cf.switch %{{.*}} : i32, [
+// CHECK-NEXT:      default: ^[[exit:.+]](%false
+// CHECK-NEXT:      0: ^[[bb2:.+]],
+// CHECK-NEXT:      1: ^[[bb3:.+]]
+// CHECK-NEXT:    ]
+// CHECK:       scf.condition
+// CHECK:     return
@@ -0,0 +1,187 @@
+// RUN: polygeist-opt --elide-shared-staging --split-input-file %s | FileCheck %s
+
+// Tiled matrix multiplication: both tiles are copies of A and B, so the k loop
+// reads A and B directly and the barriers in the m loop go away.
+module {
+  func.func @matmul(%A: memref<?xf32>, %B: memref<?xf32>, %C: memref<?xf32>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c16 = arith.constant 16 : index
+    %zero = arith.constant 0.000000e+00 : f32
+    %nt = arith.divui %n, %c16 : index
+    scf.parallel (%bx, %by) = (%c0, %c0) to (%nt, %nt) step (%c1, %c1) {
+      %As = memref.alloca() : memref<16x16xf32>
+      %Bs = memref.alloca() : memref<16x16xf32>
+      scf.parallel (%tx, %ty) = (%c0, %c0) to (%c16, %c16) step (%c1, %c1) {
+        %row0 = arith.muli %by, %c16 : index
+        %row = arith.addi %row0, %ty : index
+        %col0 = arith.muli %bx, %c16 : index
+        %col = arith.addi %col0, %tx : index
+        %sum = scf.for %m = %c0 to %nt step %c1 iter_args(%acc = %zero) -> (f32) {
+          %m16 = arith.muli %m, %c16 : index
+          %ai0 = arith.muli %row, %n : index
+          %ai1 = arith.addi %ai0, %m16 : index
+          %ai = arith.addi %ai1, %tx : index
+          %a = memref.load %A[%ai] : memref<?xf32>
+          memref.store %a, %As[%ty, %tx] : memref<16x16xf32>
+          %bi0 = arith.addi %m16, %ty : index
+          %bi1 = arith.muli %bi0, %n : index
+          %bi = arith.addi %bi1, %col : index
+          %b = memref.load %B[%bi] : memref<?xf32>
+          memref.store %b, %Bs[%ty, %tx] : memref<16x16xf32>
+          "polygeist.barrier"(%tx, %ty) : (index, index) -> ()
+          %r = scf.for %k = %c0 to %c16 step %c1 iter_args(%s = %acc) -> (f32) {
+            %x = memref.load %As[%ty, %k] : memref<16x16xf32>
+            %y = memref.load %Bs[%k, %tx] : memref<16x16xf32>
+            %p = arith.mulf %x, %y : f32
+            %q = arith.addf %s, %p : f32
+            scf.yield %q : f32
+          }
+          "polygeist.barrier"(%tx, %ty) : (index, index) -> ()
+          scf.yield %r : f32
+        }
+        %ci0 = arith.muli %row, %n : index
+        %ci = arith.addi %ci0, %col : index
+        memref.store %sum, %C[%ci] : memref<?xf32>
+        scf.yield
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @matmul(
+// CHECK-SAME:      %[[A:.+]]: memref<?xf32>, %[[B:.+]]: memref<?xf32>, %[[C:.+]]: memref<?xf32>, %{{.+}}: index)
+// CHECK-NOT:       memref.alloca
+// CHECK:           scf.parallel (%[[TX:.+]], %[[TY:.+]]) =
+// CHECK:             %{{.*}} = scf.for %[[M:.+]] =
+// CHECK-NOT:           memref.store
+// CHECK-NOT:           polygeist.barrier
+// CHECK:               %{{.*}} = scf.for %[[K:.+]] =
+// CHECK:                 %[[AI:.+]] = arith.addi %{{.*}}, %[[K]] : index
+// CHECK-NEXT:            %[[X:.+]] = memref.load %[[A]][%[[AI]]] : memref<?xf32>
+// CHECK:                 %{{.*}} = arith.addi %{{.*}}, %[[K]] : index
+// CHECK:                 %[[Y:.+]] = memref.load %[[B]][%{{.*}}] : memref<?xf32>
+// CHECK-NEXT:            %{{.*}} = arith.mulf %[[X]], %[[Y]] : f32
+// CHECK-NOT:           polygeist.barrier
+// CHECK:             "polygeist.barrier"(%[[TX]], %[[TY]]) : (index, index) -> ()
+// CHECK-NEXT:        %{{.*}} = arith.muli
+// CHECK:             memref.store %{{.*}}, %[[C]][%{{.*}}] : memref<?xf32>
+
+// -----
+
+// A tile with a halo read once, outside of any loop.
+module {
+  func.func @stencil(%in: memref<?xf32>, %out: memref<?xf32>, %nb: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c64 = arith.constant 64 : index
+    scf.parallel (%bx) = (%c0) to (%nb) step (%c1) {
+      %sh = memref.alloca() : memref<64xf32>
+      scf.parallel (%tx) = (%c0) to (%c64) step (%c1) {
+        %i0 = arith.muli %bx, %c64 : index
+        %i = arith.addi %i0, %tx : index
+        %v = memref.load %in[%i] : memref<?xf32>
+        memref.store %v, %sh[%tx] : memref<64xf32>
+        "polygeist.barrier"(%tx) : (index) -> ()
+        %t1 = arith.addi %tx, %c1 : index
+        %t2 = arith.remui %t1, %c64 : index
+        %a = memref.load %sh[%tx] : memref<64xf32>
+        %b = memref.load %sh[%t2] : memref<64xf32>
+        %sum = arith.addf %a, %b : f32
+        memref.store %sum, %out[%i] : memref<?xf32>
+        scf.yield
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @stencil(
+// CHECK-SAME:      %[[IN:.+]]: memref<?xf32>, %[[OUT:.+]]: memref<?xf32>, %{{.+}}: index)
+// CHECK-NOT:       memref.alloca
+// CHECK:           scf.parallel (%[[TX:.+]]) =
+// CHECK:             %[[T2:.+]] = arith.remui
+// CHECK:             %[[A:.+]] = memref.load %[[IN]][%{{.*}}] : memref<?xf32>
+// CHECK:             %[[J:.+]] = arith.addi %{{.*}}, %[[T2]] : index
+// CHECK-NEXT:        %[[B:.+]] = memref.load %[[IN]][%[[J]]] : memref<?xf32>
+// CHECK-NEXT:        "polygeist.barrier"(%[[TX]]) : (index) -> ()
+// CHECK-NEXT:        %{{.*}} = arith.addf %[[A]], %[[B]] : f32
+
+// -----
+
+// The tile is in the GPU private address space of the CUDA frontend and read
+// through a cast to a dynamic shape.
+module {
+  func.func @addrspace(%in: memref<?xf32>, %out: memref<?xf32>, %nb: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c64 = arith.constant 64 : index
+    scf.parallel (%bx) = (%c0) to (%nb) step (%c1) {
+      %sh = memref.alloca() : memref<64xf32, 5>
+      %view = memref.cast %sh : memref<64xf32, 5> to memref<?xf32, 5>
+      scf.parallel (%tx) = (%c0) to (%c64) step (%c1) {
+        %i0 = arith.muli %bx, %c64 : index
+        %i = arith.addi %i0, %tx : index
+        %v = memref.load %in[%i] : memref<?xf32>
+        memref.store %v, %sh[%tx] : memref<64xf32, 5>
+        "polygeist.barrier"(%tx) : (index) -> ()
+        %t1 = arith.addi %tx, %c1 : index
+        %t2 = arith.remui %t1, %c64 : index
+        %b = memref.load %view[%t2] : memref<?xf32, 5>
+        memref.store %b, %out[%i] : memref<?xf32>
+        scf.yield
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @addrspace(
+// CHECK-SAME:      %[[IN:.+]]: memref<?xf32>, %[[OUT:.+]]: memref<?xf32>, %{{.+}}: index)
+// CHECK-NOT:       memref.alloca
+// CHECK-NOT:       memref.cast
+// CHECK:           scf.parallel (%[[TX:.+]]) =
+// CHECK:             %[[T2:.+]] = arith.remui
+// CHECK:             %[[J:.+]] = arith.addi %{{.*}}, %[[T2]] : index
+// CHECK-NEXT:        %[[B:.+]] = memref.load %[[IN]][%[[J]]] : memref<?xf32>
+// CHECK-NOT:         memref.load %{{.*}} : memref<?xf32, 5>
+// CHECK:             memref.store %[[B]], %[[OUT]][%{{.*}}] : memref<?xf32>
+
+// -----
+
+// The global source is written while the tile is live, so the copy stays.
+module {
+  func.func @inplace(%A: memref<?xf32>, %nb: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c4 = arith.constant 4 : index
+    %c64 = arith.constant 64 : index
+    scf.parallel (%bx) = (%c0) to (%nb) step (%c1) {
+      %sh = memref.alloca() : memref<64xf32>
+      scf.parallel (%tx) = (%c0) to (%c64) step (%c1) {
+        scf.for %m = %c0 to %c4 step %c1 {
+          %v = memref.load %A[%tx] : memref<?xf32>
+          memref.store %v, %sh[%tx] : memref<64xf32>
+          "polygeist.barrier"(%tx) : (index) -> ()
+          %t1 = arith.addi %tx, %c1 : index
+          %t2 = arith.remui %t1, %c64 : index
+          %b = memref.load %sh[%t2] : memref<64xf32>
+          memref.store %b, %A[%tx] : memref<?xf32>
+          "polygeist.barrier"(%tx) : (index) -> ()
+        }
+        scf.yield
+      }
+      scf.yield
+    }
+    return
+  }
+}
+
+// CHECK-LABEL:   func.func @inplace(
+// CHECK:           %[[SH:.+]] = memref.alloca() : memref<64xf32>
+// CHECK:             memref.store %{{.*}}, %[[SH]][%{{.*}}] : memref<64xf32>
+// CHECK-NEXT:        "polygeist.barrier"
@@ -20,8 +20,6 @@ using namespace mlir::arith;
 using namespace mlir::func;
 using namespace mlirclang;
 
-extern llvm::cl::opt<bool> CStyleMemRef;
-
 /// Try to typecast the caller arg of type MemRef to fit the corresponding
 /// callee arg type. We only deal with the cast where src and dst have the same
 /// shape size and elem type, and just the first shape differs: src has -1 and
@@ -1040,7 +1038,7 @@ ValueCategory MLIRScanner::VisitCallExpr(clang::CallExpr *expr) {
       }
     }
 
-  if (!CStyleMemRef) {
+  if (!Glob.options.cStyleMemRef) {
     if (auto *ic = dyn_cast<ImplicitCastExpr>(expr->getCallee()))
       if (auto *sr = dyn_cast<DeclRefExpr>(ic->getSubExpr())) {
         if ((sr->getDecl()->getIdentifier() &&
@@ -1491,19 +1489,13 @@ ValueCategory MLIRScanner::VisitCallExpr(clang::CallExpr *expr) {
       "cudaOccupancyMaxActiveBlocksPerMultiprocessor",
       "cudaOccupancyMaxActiveBlocksPerMultiprocessorWithFlags",
       "cudaEventRecord"};
-  if (!CStyleMemRef) {
+  if (!Glob.options.cStyleMemRef) {
     if (auto *ic = dyn_cast<ImplicitCastExpr>(expr->getCallee()))
       if (auto *sr = dyn_cast<DeclRefExpr>(ic->getSubExpr())) {
         StringRef name;
-        if (auto *CC = dyn_cast<CXXConstructorDecl>(sr->getDecl()))
-          name = Glob.CGM.getMangledName(
-              GlobalDecl(CC, CXXCtorType::Ctor_Complete));
-        else if (auto *CC = dyn_cast<CXXDestructorDecl>(sr->getDecl()))
-          name = Glob.CGM.getMangledName(
-              GlobalDecl(CC, CXXDtorType::Dtor_Complete));
-        else if (sr->getDecl()->hasAttr<CUDAGlobalAttr>())
-          name = Glob.CGM.getMangledName(GlobalDecl(
-              cast<FunctionDecl>(sr->getDecl()), KernelReferenceKind::Kernel));
+        if (auto *FD = dyn_cast<FunctionDecl>(sr->getDecl()))
+          name = Glob.getMangledFunctionName(FD,
+                                             FD->hasAttr<CUDAGlobalAttr>());
         else
           name = Glob.CGM.getMangledName(sr->getDecl());
         if (funcs.count(name.str()) || name.startswith("mkl_") ||
@@ -704,6 +704,757 @@ ValueCategory MLIRScanner::VisitOMPParallelForDirective(
   return nullptr;
 }
 
+void MLIRScanner::getOMPLoopBounds(clang::OMPLoopDirective *fors,
+                                   SmallVectorImpl<mlir::Value> &inits,
+                                   SmallVectorImpl<mlir::Value> &finals,
+                                   SmallVectorImpl<mlir::Value> &incs) {
+  auto loc = getMLIRLocation(fors->getBeginLoc());
+
+  for (auto *f : fors->inits()) {
+    assert(f);
+    f = cast<clang::BinaryOperator>(f)->getRHS();
+    inits.push_back(builder.create<IndexCastOp>(
+        loc, builder.getIndexType(), Visit(f).getValue(loc, builder)));
+  }
+
+  for (auto *f : fors->finals()) {
+    f = cast<clang::BinaryOperator>(f)->getRHS();
+    finals.push_back(builder.create<IndexCastOp>(
+        loc, builder.getIndexType(), Visit(f).getValue(loc, builder)));
+  }
+
+  for (auto *f : fors->updates()) {
+    f = cast<clang::BinaryOperator>(f)->getRHS();
+    while (auto *ce = dyn_cast<clang::CastExpr>(f))
+      f = ce->getSubExpr();
+    auto *bo = cast<clang::BinaryOperator>(f);
+    assert(bo->getOpcode() == clang::BinaryOperator::Opcode::BO_Add);
+    f = bo->getRHS();
+    while (auto *ce = dyn_cast<clang::CastExpr>(f))
+      f = ce->getSubExpr();
+    bo = cast<clang::BinaryOperator>(f);
+    assert(bo->getOpcode() == clang::BinaryOperator::Opcode::BO_Mul);
+    f = bo->getRHS();
+    incs.push_back(builder.create<IndexCastOp>(
+        loc, builder.getIndexType(), Visit(f).getValue(loc, builder)));
+  }
+}
+
+/// Converts the value of a C condition to i1.
+static mlir::Value getCondition(mlir::OpBuilder &builder, mlir::Location loc,
+                                mlir::Value cond) {
+  auto ty = cond.getType().cast<mlir::IntegerType>();
+  if (ty.isInteger(1))
+    return cond;
+  return builder.create<arith::CmpIOp>(
+      loc, CmpIPredicate::ne, cond,
+      builder.create<ConstantIntOp>(loc, 0, ty));
+}
+
+/// Reports that `what` on a task construct cannot be compiled, which fails the
+/// compilation.
+static void reportUnsupportedTaskClause(MLIRASTConsumer &Glob,
+                                        clang::SourceLocation loc,
+                                        llvm::StringRef what) {
+  auto &diags = Glob.CGM.getDiags();
+  diags.Report(loc, diags.getCustomDiagID(clang::DiagnosticsEngine::Error,
+                                          "cannot compile %0 of a task yet"))
+      << what;
+}
+
+/// Returns an i8 pointer to the memref or LLVM pointer `val`.
+static mlir::Value getBytePointer(mlir::Location loc, mlir::OpBuilder &builder,
+                                  mlir::Value val) {
+  auto i8Ptr = LLVM::LLVMPointerType::get(builder.getI8Type());
+  if (val.getType().isa<MemRefType>())
+    return builder.create<polygeist::Memref2PointerOp>(loc, i8Ptr, val);
+  return builder.create<LLVM::BitcastOp>(loc, i8Ptr, val);
+}
+
+/// Copies the `bytes` bytes of the array `src` to `dst`.
+static void copyArrayBytes(mlir::Location loc, mlir::OpBuilder &builder,
+                           mlir::Value dst, mlir::Value src, int64_t bytes) {
+  builder.create<LLVM::MemcpyOp>(
+      loc, getBytePointer(loc, builder, dst), getBytePointer(loc, builder, src),
+      builder.create<ConstantIntOp>(loc, bytes, 64),
+      builder.create<ConstantIntOp>(loc, false, 1));
+}
+
+MLIRScanner::OMPTaskClauses
+MLIRScanner::getOMPTaskClauses(mlir::Location loc,
+                               clang::OMPExecutableDirective *dir) {
+  OMPTaskClauses clauses;
+  for (auto *f : dir->clauses()) {
+    switch (f->getClauseKind()) {
+    case llvm::omp::OMPC_if:
+      clauses.ifExpr = getCondition(
+          builder, loc,
+          Visit(cast<OMPIfClause>(f)->getCondition()).getValue(loc, builder));
+      break;
+    case llvm::omp::OMPC_final:
+      clauses.finalExpr = getCondition(
+          builder, loc,
+          Visit(cast<OMPFinalClause>(f)->getCondition())
+              .getValue(loc, builder));
+      break;
+    case llvm::omp::OMPC_priority: {
+      auto priority = Visit(cast<OMPPriorityClause>(f)->getPriority())
+                          .getValue(loc, builder);
+      auto i32 = builder.getI32Type();
+      unsigned width = priority.getType().getIntOrFloatBitWidth();
+      if (width > 32)
+        priority = builder.create<TruncIOp>(loc, i32, priority);
+      else if (width < 32)
+        priority = builder.create<ExtSIOp>(loc, i32, priority);
+      clauses.priority = priority;
+      break;
+    }
+    case llvm::omp::OMPC_untied:
+      clauses.untied = true;
+      break;
+    case llvm::omp::OMPC_mergeable:
+      clauses.mergeable = true;
+      break;
+    case llvm::omp::OMPC_depend:
+      clauses.depends = true;
+      break;
+    // Sema lists the variables which are firstprivate by default, such as
+    // locals of the enclosing function, as implicit firstprivate clauses.
+    case llvm::omp::OMPC_private:
+    case llvm::omp::OMPC_firstprivate:
+      for (auto *stmt : f->children()) {
+        auto *ref = cast<DeclRefExpr>(stmt);
+        OMPTaskPrivate priv = {cast<VarDecl>(ref->getDecl())};
+        if (f->getClauseKind() == llvm::omp::OMPC_firstprivate) {
+          auto ty = priv.var->getType();
+          if (ty->isVariablyModifiedType()) {
+            reportUnsupportedTaskClause(Glob, ref->getExprLoc(),
+                                        "a firstprivate variable length array");
+            continue;
+          }
+          // The value is captured when the task is created, not when it runs.
+          ValueCategory orig = Visit(ref);
+          if (ty->isArrayType())
+            priv.array = orig.val;
+          else
+            priv.init = orig.getValue(loc, builder);
+        }
+        clauses.privates.push_back(priv);
+      }
+      break;
+    // Tasks do not combine partial results or copy values back.
+    case llvm::omp::OMPC_reduction:
+    case llvm::omp::OMPC_in_reduction:
+    case llvm::omp::OMPC_lastprivate:
+      reportUnsupportedTaskClause(
+          Glob, f->getBeginLoc(),
+          llvm::omp::getOpenMPClauseName(f->getClauseKind()).str() +
+              " clauses");
+      break;
+    // Variables are shared unless privatized, and the taskloop handles its
+    // own clauses.
+    case llvm::omp::OMPC_shared:
+    case llvm::omp::OMPC_default:
+    case llvm::omp::OMPC_collapse:
+    case llvm::omp::OMPC_grainsize:
+    case llvm::omp::OMPC_num_tasks:
+    case llvm::omp::OMPC_nogroup:
+      break;
+    default:
+      llvm::errs() << "may not handle omp clause " << (int)f->getClauseKind()
+                   << "\n";
+    }
+  }
+  return clauses;
+}
+
+omp::TaskOp MLIRScanner::createOMPTask(mlir::Location loc,
+                                       OMPTaskClauses &clauses) {
+  // Firstprivate arrays are copied to the heap when the task is created, as
+  // the task may run after the creating code changed them. The task copies
+  // them to its own storage and frees them.
+  auto &ctx = Glob.CGM.getContext();
+  for (auto &priv : clauses.privates) {
+    if (!priv.array)
+      continue;
+    int64_t bytes = ctx.getTypeSizeInChars(priv.var->getType()).getQuantity();
+    priv.snapshot = builder.create<memref::AllocOp>(
+        loc, MemRefType::get(bytes, builder.getI8Type()));
+    copyArrayBytes(loc, builder, priv.snapshot, priv.array, bytes);
+  }
+
+  // omp.task has no depend clause here, so dependences are deliberately
+  // approximated: waiting for all earlier sibling tasks orders this one after
+  // those it depends on, and the later tasks depending on it wait for it in
+  // the same way. This is correct but serializes the task against unrelated
+  // siblings as well.
+  if (clauses.depends)
+    builder.create<omp::TaskwaitOp>(loc);
+
+  auto unit = [&](bool set) {
+    return set ? builder.getUnitAttr() : mlir::UnitAttr();
+  };
+  return builder.create<omp::TaskOp>(
+      loc, clauses.ifExpr, clauses.finalExpr, unit(clauses.untied),
+      unit(clauses.mergeable), /*in_reduction_vars*/ ValueRange(),
+      /*in_reductions*/ nullptr, clauses.priority,
+      /*allocate_vars*/ ValueRange(), /*allocators_vars*/ ValueRange());
+}
+
+void MLIRScanner::privatizeOMPVariables(
+    mlir::Location loc, const OMPTaskClauses &clauses,
+    std::map<VarDecl *, ValueCategory> &prev) {
+  for (auto &priv : clauses.privates) {
+    VarDecl *name = priv.var;
+    auto found = params.find(name);
+    if (found != params.end() && !prev.count(name))
+      prev[name] = found->second;
+
+    bool LLVMABI = false;
+    bool isArray = false;
+    mlir::Type ty;
+    if (Glob.getMLIRType(
+                Glob.CGM.getContext().getLValueReferenceType(name->getType()))
+            .isa<mlir::LLVM::LLVMPointerType>()) {
+      LLVMABI = true;
+      bool undef;
+      ty = Glob.getMLIRType(name->getType(), &undef);
+    } else
+      ty = Glob.getMLIRType(name->getType(), &isArray);
+
+    auto allocop = createAllocOp(ty, name, /*memtype*/ 0,
+                                 /*isArray*/ isArray, /*LLVMABI*/ LLVMABI);
+    params[name] = ValueCategory(allocop, true);
+    if (priv.init)
+      params[name].store(loc, builder, priv.init);
+    if (priv.snapshot) {
+      int64_t bytes = priv.snapshot.getType().cast<MemRefType>().getShape()[0];
+      copyArrayBytes(loc, builder, allocop, priv.snapshot, bytes);
+      builder.create<memref::DeallocOp>(loc, priv.snapshot);
+    }
+  }
+}
+
+void MLIRScanner::restoreOMPVariables(
+    const OMPTaskClauses &clauses, std::map<VarDecl *, ValueCategory> &prev) {
+  for (auto &priv : clauses.privates) {
+    auto found = prev.find(priv.var);
+    if (found != prev.end())
+      params[priv.var] = found->second;
+    else
+      params.erase(priv.var);
+  }
+}
+
+ValueCategory
+MLIRScanner::VisitOMPTaskDirective(clang::OMPTaskDirective *task) {
+  IfScope scope(*this);
+  auto loc = getMLIRLocation(task->getBeginLoc());
+
+  OMPTaskClauses clauses = getOMPTaskClauses(loc, task);
+  auto taskOp = createOMPTask(loc, clauses);
+
+  auto oldpoint = builder.getInsertionPoint();
+  auto *oldblock = builder.getInsertionBlock();
+
+  taskOp.getRegion().push_back(new Block());
+  builder.setInsertionPointToStart(&taskOp.getRegion().front());
+
+  auto executeRegion =
+      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+  executeRegion.getRegion().push_back(new Block());
+  builder.create<omp::TerminatorOp>(loc);
+  builder.setInsertionPointToStart(&executeRegion.getRegion().back());
+
+  auto *oldScope = allocationScope;
+  allocationScope = &executeRegion.getRegion().back();
+
+  std::map<VarDecl *, ValueCategory> prev;
+  privatizeOMPVariables(loc, clauses, prev);
+
+  Visit(cast<CapturedStmt>(task->getAssociatedStmt())
+            ->getCapturedDecl()
+            ->getBody());
+
+  builder.create<scf::YieldOp>(loc);
+  allocationScope = oldScope;
+  builder.setInsertionPoint(oldblock, oldpoint);
+
+  restoreOMPVariables(clauses, prev);
+  return nullptr;
+}
+
+ValueCategory
+MLIRScanner::VisitOMPTaskLoopDirective(clang::OMPTaskLoopDirective *fors) {
+  IfScope scope(*this);
+  auto loc = getMLIRLocation(fors->getBeginLoc());
+
+  if (fors->getPreInits()) {
+    Visit(fors->getPreInits());
+  }
+
+  SmallVector<mlir::Value> inits, finals, incs;
+  getOMPLoopBounds(fors, inits, finals, incs);
+
+  mlir::Value grainsize, numTasks;
+  bool nogroup = false;
+  for (auto *f : fors->clauses()) {
+    if (auto *clause = dyn_cast<OMPGrainsizeClause>(f))
+      grainsize = castToIndex(
+          loc, Visit(clause->getGrainsize()).getValue(loc, builder));
+    else if (auto *clause = dyn_cast<OMPNumTasksClause>(f))
+      numTasks = castToIndex(
+          loc, Visit(clause->getNumTasks()).getValue(loc, builder));
+    else if (isa<OMPNogroupClause>(f))
+      nogroup = true;
+  }
+  OMPTaskClauses clauses = getOMPTaskClauses(loc, fors);
+
+  // The number of iterations of each loop. Those of the outermost loop are
+  // split between the tasks.
+  mlir::Value zero = getConstantIndex(0);
+  mlir::Value one = getConstantIndex(1);
+  SmallVector<mlir::Value> trips;
+  for (unsigned i = 0, e = inits.size(); i < e; ++i)
+    trips.push_back(builder.create<DivSIOp>(
+        loc, builder.create<SubIOp>(loc, finals[i], inits[i]), incs[i]));
+  auto precond = getCondition(
+      builder, loc, Visit(fors->getPreCond()).getValue(loc, builder));
+  trips[0] = builder.create<SelectOp>(loc, precond, trips[0], zero);
+
+  // With a grainsize, every task runs between one and two times that many
+  // iterations; without either clause, each thread gets a few tasks.
+  mlir::Value tasks;
+  if (numTasks) {
+    tasks = numTasks;
+  } else if (grainsize) {
+    tasks = builder.create<MaxSIOp>(
+        loc, builder.create<DivSIOp>(loc, trips[0], grainsize), one);
+  } else {
+    auto threads = builder.create<mlir::LLVM::CallOp>(
+        loc, Glob.GetOrCreateOMPNumThreadsFunction(), ValueRange());
+    tasks = builder.create<MulIOp>(loc, castToIndex(loc, threads.getResult()),
+                                   getConstantIndex(4));
+  }
+  tasks = builder.create<MinSIOp>(loc, tasks, trips[0]);
+
+  auto oldpoint = builder.getInsertionPoint();
+  auto *oldblock = builder.getInsertionBlock();
+
+  // Unless nogroup is given, the taskloop waits for its tasks and their
+  // descendants.
+  if (!nogroup) {
+    auto group = builder.create<omp::TaskGroupOp>(
+        loc, /*task_reduction_vars*/ ValueRange(),
+        /*task_reductions*/ nullptr, /*allocate_vars*/ ValueRange(),
+        /*allocators_vars*/ ValueRange());
+    group.getRegion().push_back(new Block());
+    builder.setInsertionPointToStart(&group.getRegion().front());
+    builder.create<omp::TerminatorOp>(loc);
+    builder.setInsertionPointToStart(&group.getRegion().front());
+  }
+
+  // Task `k` of `tasks` runs the logical iterations from k * trips / tasks to
+  // (k + 1) * trips / tasks of the outermost loop.
+  auto chunks = builder.create<scf::ForOp>(loc, zero, tasks, one);
+  builder.setInsertionPointToStart(chunks.getBody());
+  mlir::Value chunk = chunks.getInductionVar();
+  mlir::Value begin = builder.create<DivUIOp>(
+      loc, builder.create<MulIOp>(loc, chunk, trips[0]), tasks);
+  mlir::Value end = builder.create<DivUIOp>(
+      loc,
+      builder.create<MulIOp>(loc, builder.create<AddIOp>(loc, chunk, one),
+                             trips[0]),
+      tasks);
+
+  auto taskOp = createOMPTask(loc, clauses);
+  taskOp.getRegion().push_back(new Block());
+  builder.setInsertionPointToStart(&taskOp.getRegion().front());
+
+  auto executeRegion =
+      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+  executeRegion.getRegion().push_back(new Block());
+  builder.create<omp::TerminatorOp>(loc);
+  builder.setInsertionPointToStart(&executeRegion.getRegion().back());
+
+  auto *oldScope = allocationScope;
+  allocationScope = &executeRegion.getRegion().back();
+
+  std::map<VarDecl *, ValueCategory> prev;
+  privatizeOMPVariables(loc, clauses, prev);
+
+  SmallVector<mlir::Value> ivs;
+  for (unsigned i = 0, e = trips.size(); i < e; ++i) {
+    auto loop = builder.create<scf::ForOp>(loc, i ? zero : begin,
+                                           i ? trips[i] : end, one);
+    builder.setInsertionPointToStart(loop.getBody());
+    ivs.push_back(loop.getInductionVar());
+  }
+
+  // The body may branch, so it gets a region of its own.
+  auto bodyRegion =
+      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+  bodyRegion.getRegion().push_back(new Block());
+  builder.setInsertionPointToStart(&bodyRegion.getRegion().back());
+
+  std::map<VarDecl *, ValueCategory> prevInduction;
+  for (auto en : llvm::enumerate(fors->counters())) {
+    unsigned i = en.index();
+    VarDecl *name = cast<VarDecl>(cast<DeclRefExpr>(en.value())->getDecl());
+    mlir::Value counter = builder.create<AddIOp>(
+        loc, inits[i], builder.create<MulIOp>(loc, ivs[i], incs[i]));
+    auto idx = builder.create<IndexCastOp>(loc, getMLIRType(name->getType()),
+                                           counter);
+
+    if (params.find(name) != params.end()) {
+      prevInduction[name] = params[name];
+      params.erase(name);
+    }
+
+    bool LLVMABI = false;
+    bool isArray = false;
+    if (Glob.getMLIRType(
+                Glob.CGM.getContext().getLValueReferenceType(name->getType()))
+            .isa<mlir::LLVM::LLVMPointerType>())
+      LLVMABI = true;
+    else
+      Glob.getMLIRType(name->getType(), &isArray);
+
+    auto allocop = createAllocOp(idx.getType(), name, /*memtype*/ 0,
+                                 /*isArray*/ isArray, /*LLVMABI*/ LLVMABI);
+    params[name] = ValueCategory(allocop, true);
+    params[name].store(loc, builder, idx);
+  }
+
+  Visit(fors->getBody());
+
+  builder.create<scf::YieldOp>(loc);
+  builder.setInsertionPointToEnd(&executeRegion.getRegion().back());
+  builder.create<scf::YieldOp>(loc);
+
+  allocationScope = oldScope;
+  builder.setInsertionPoint(oldblock, oldpoint);
+
+  for (auto pair : prevInduction)
+    params[pair.first] = pair.second;
+  restoreOMPVariables(clauses, prev);
+  return nullptr;
+}
+
+ValueCategory
+MLIRScanner::VisitOMPTaskwaitDirective(clang::OMPTaskwaitDirective *wait) {
+  builder.create<omp::TaskwaitOp>(getMLIRLocation(wait->getBeginLoc()));
+  return nullptr;
+}
+
+ValueCategory
+MLIRScanner::VisitOMPTaskyieldDirective(clang::OMPTaskyieldDirective *yield) {
+  builder.create<omp::TaskyieldOp>(getMLIRLocation(yield->getBeginLoc()));
+  return nullptr;
+}
+
+ValueCategory
+MLIRScanner::VisitOMPTaskgroupDirective(clang::OMPTaskgroupDirective *group) {
+  IfScope scope(*this);
+  auto loc = getMLIRLocation(group->getBeginLoc());
+
+  auto groupOp = builder.create<omp::TaskGroupOp>(
+      loc, /*task_reduction_vars*/ ValueRange(),
+      /*task_reductions*/ nullptr, /*allocate_vars*/ ValueRange(),
+      /*allocators_vars*/ ValueRange());
+
+  auto oldpoint = builder.getInsertionPoint();
+  auto *oldblock = builder.getInsertionBlock();
+
+  groupOp.getRegion().push_back(new Block());
+  builder.setInsertionPointToStart(&groupOp.getRegion().front());
+
+  auto executeRegion =
+      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+  executeRegion.getRegion().push_back(new Block());
+  builder.create<omp::TerminatorOp>(loc);
+  builder.setInsertionPointToStart(&executeRegion.getRegion().back());
+
+  auto *oldScope = allocationScope;
+  allocationScope = &executeRegion.getRegion().back();
+
+  Visit(cast<CapturedStmt>(group->getAssociatedStmt())
+            ->getCapturedDecl()
+            ->getBody());
+
+  builder.create<scf::YieldOp>(loc);
+  allocationScope = oldScope;
+  builder.setInsertionPoint(oldblock, oldpoint);
+  return nullptr;
+}
+
+ValueCategory
+MLIRScanner::VisitOMPSimdDirective(clang::OMPSimdDirective *fors) {
+  IfScope scope(*this);
+  auto loc = getMLIRLocation(fors->getBeginLoc());
+  auto &ctx = Glob.CGM.getContext();
+
+  if (fors->getPreInits()) {
+    Visit(fors->getPreInits());
+  }
+
+  SmallVector<mlir::Value> inits, finals, incs;
+  getOMPLoopBounds(fors, inits, finals, incs);
+
+  llvm::SmallPtrSet<const VarDecl *, 2> counters;
+  for (auto *counter : fors->counters())
+    counters.insert(cast<VarDecl>(cast<DeclRefExpr>(counter)->getDecl()));
+
+  // Variables with a private copy in every lane. Giving them a private
+  // variable in the function keeps them out of the accesses the lowering
+  // declares free of loop-carried dependences. The original variable is set
+  // from the copy after the loop, but for private ones.
+  struct SimdPrivate {
+    VarDecl *name;
+    bool copyOut;
+    bool linear;
+    /// The step of a linear variable, or null for a step of one.
+    clang::Expr *step;
+  };
+  SmallVector<SimdPrivate> privates;
+  int64_t safelen = 0;
+  int64_t simdlen = 0;
+  for (auto *f : fors->clauses()) {
+    switch (f->getClauseKind()) {
+    case llvm::omp::OMPC_safelen:
+      safelen = cast<OMPSafelenClause>(f)
+                    ->getSafelen()
+                    ->EvaluateKnownConstInt(ctx)
+                    .getSExtValue();
+      break;
+    case llvm::omp::OMPC_simdlen:
+      simdlen = cast<OMPSimdlenClause>(f)
+                    ->getSimdlen()
+                    ->EvaluateKnownConstInt(ctx)
+                    .getSExtValue();
+      break;
+    case llvm::omp::OMPC_aligned: {
+      auto *clause = cast<OMPAlignedClause>(f);
+      for (auto *var : clause->varlists()) {
+        int64_t align = ctx.getOpenMPDefaultSimdAlign(var->getType()) / 8;
+        if (auto *alignment = clause->getAlignment())
+          align = alignment->EvaluateKnownConstInt(ctx).getSExtValue();
+        mlir::Value ptr = Visit(var).getValue(loc, builder);
+        if (auto mt = ptr.getType().dyn_cast<MemRefType>())
+          ptr = builder.create<polygeist::Memref2PointerOp>(
+              loc,
+              LLVM::LLVMPointerType::get(mt.getElementType(),
+                                         mt.getMemorySpaceAsInt()),
+              ptr);
+        if (!ptr.getType().isa<LLVM::LLVMPointerType>() || align <= 0) {
+          llvm::errs() << "may not handle aligned variable\n";
+          continue;
+        }
+        auto i64 = builder.getI64Type();
+        mlir::Value addr = builder.create<LLVM::PtrToIntOp>(loc, i64, ptr);
+        mlir::Value low = builder.create<AndIOp>(
+            loc, addr, builder.create<ConstantIntOp>(loc, align - 1, i64));
+        builder.create<LLVM::AssumeOp>(
+            loc, builder.create<arith::CmpIOp>(
+                     loc, CmpIPredicate::eq, low,
+                     builder.create<ConstantIntOp>(loc, 0, i64)));
+      }
+      break;
+    }
+    case llvm::omp::OMPC_private:
+    case llvm::omp::OMPC_lastprivate:
+    case llvm::omp::OMPC_reduction:
+    case llvm::omp::OMPC_linear: {
+      bool isPrivate = f->getClauseKind() == llvm::omp::OMPC_private;
+      auto *linear = dyn_cast<OMPLinearClause>(f);
+      clang::Expr *step = linear ? linear->getStep() : nullptr;
+      SmallVector<clang::Expr *> vars;
+      if (auto *clause = dyn_cast<OMPPrivateClause>(f))
+        vars.append(clause->varlist_begin(), clause->varlist_end());
+      else if (auto *clause = dyn_cast<OMPLastprivateClause>(f))
+        vars.append(clause->varlist_begin(), clause->varlist_end());
+      else if (auto *clause = dyn_cast<OMPReductionClause>(f))
+        vars.append(clause->varlist_begin(), clause->varlist_end());
+      else
+        vars.append(cast<OMPLinearClause>(f)->varlist_begin(),
+                    cast<OMPLinearClause>(f)->varlist_end());
+      for (auto *var : vars) {
+        auto *ref = dyn_cast<DeclRefExpr>(var->IgnoreParenImpCasts());
+        auto *name = ref ? dyn_cast<VarDecl>(ref->getDecl()) : nullptr;
+        if (!name || counters.count(name))
+          continue;
+        privates.push_back({name, !isPrivate, linear != nullptr, step});
+      }
+      break;
+    }
+    case llvm::omp::OMPC_collapse:
+    case llvm::omp::OMPC_order:
+      break;
+    default:
+      llvm::errs() << "may not handle omp clause " << (int)f->getClauseKind()
+                   << "\n";
+    }
+  }
+
+  // With a safelen, only iterations that many apart are independent.
+  if (safelen && (!simdlen || simdlen > safelen))
+    simdlen = safelen;
+
+  std::map<VarDecl *, ValueCategory> prev;
+  SmallVector<std::pair<SimdPrivate, mlir::Value>> linears;
+  for (auto &priv : privates) {
+    VarDecl *name = priv.name;
+    auto found = params.find(name);
+    bool isArray = false;
+    auto ty = Glob.getMLIRType(name->getType(), &isArray);
+    if (found == params.end() || !found->second.isReference || isArray ||
+        Glob.getMLIRType(ctx.getLValueReferenceType(name->getType()))
+            .isa<LLVM::LLVMPointerType>()) {
+      llvm::errs() << "may not handle simd private variable "
+                   << name->getName() << "\n";
+      continue;
+    }
+    // A linear variable left shared still takes its sequential values, as
+    // the loop runs its iterations in order.
+    if (priv.linear &&
+        (!ty.isa<mlir::IntegerType, MemRefType, LLVM::LLVMPointerType>() ||
+         inits.size() != 1)) {
+      llvm::errs() << "may not handle linear variable " << name->getName()
+                   << "\n";
+      continue;
+    }
+    prev[name] = found->second;
+    mlir::Value init = found->second.getValue(loc, builder);
+    auto allocop = createAllocOp(ty, name, /*memtype*/ 0, /*isArray*/ false,
+                                 /*LLVMABI*/ false);
+    params[name] = ValueCategory(allocop, true);
+    params[name].store(loc, builder, init);
+    if (priv.linear)
+      linears.emplace_back(priv, init);
+  }
+
+  // The logical iterations of each loop.
+  mlir::Value zero = getConstantIndex(0);
+  mlir::Value one = getConstantIndex(1);
+  SmallVector<mlir::Value> trips;
+  for (unsigned i = 0, e = inits.size(); i < e; ++i)
+    trips.push_back(builder.create<DivSIOp>(
+        loc, builder.create<SubIOp>(loc, finals[i], inits[i]), incs[i]));
+  auto precond = getCondition(
+      builder, loc, Visit(fors->getPreCond()).getValue(loc, builder));
+  trips[0] = builder.create<SelectOp>(loc, precond, trips[0], zero);
+
+  auto oldpoint = builder.getInsertionPoint();
+  auto *oldblock = builder.getInsertionBlock();
+
+  SmallVector<mlir::Value> ivs;
+  for (auto trip : trips) {
+    auto loop = builder.create<scf::ForOp>(loc, zero, trip, one);
+    builder.setInsertionPointToStart(loop.getBody());
+    ivs.push_back(loop.getInductionVar());
+  }
+
+  // The body may branch, so it gets a region of its own. The hint follows it
+  // in the latch of the innermost loop, where the lowering to LLVM IR turns
+  // it into the loop's vectorization metadata.
+  auto bodyRegion =
+      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+  bodyRegion.getRegion().push_back(new Block());
+  auto i32 = builder.getI32Type();
+  builder.create<LLVM::CallOp>(
+      loc, Glob.GetOrCreateSimdHintFunction(),
+      ValueRange({builder.create<ConstantIntOp>(loc, safelen, i32),
+                  builder.create<ConstantIntOp>(loc, simdlen, i32)}));
+  builder.setInsertionPointToStart(&bodyRegion.getRegion().back());
+
+  auto *oldScope = allocationScope;
+  allocationScope = &bodyRegion.getRegion().back();
+
+  std::map<VarDecl *, ValueCategory> prevInduction;
+  for (auto en : llvm::enumerate(fors->counters())) {
+    unsigned i = en.index();
+    VarDecl *name = cast<VarDecl>(cast<DeclRefExpr>(en.value())->getDecl());
+    mlir::Value counter = builder.create<AddIOp>(
+        loc, inits[i], builder.create<MulIOp>(loc, ivs[i], incs[i]));
+    auto idx = builder.create<IndexCastOp>(loc, getMLIRType(name->getType()),
+                                           counter);
+
+    if (params.find(name) != params.end()) {
+      prevInduction[name] = params[name];
+      params.erase(name);
+    }
+
+    bool LLVMABI = false;
+    bool isArray = false;
+    if (Glob.getMLIRType(ctx.getLValueReferenceType(name->getType()))
+            .isa<mlir::LLVM::LLVMPointerType>())
+      LLVMABI = true;
+    else
+      Glob.getMLIRType(name->getType(), &isArray);
+
+    auto allocop = createAllocOp(idx.getType(), name, /*memtype*/ 0,
+                                 /*isArray*/ isArray, /*LLVMABI*/ LLVMABI);
+    params[name] = ValueCategory(allocop, true);
+    params[name].store(loc, builder, idx);
+  }
+
+  // A linear variable starts every iteration at its value before the loop
+  // plus the iteration number times its step, counted in elements for
+  // pointers.
+  for (auto &linear : linears) {
+    mlir::Value init = linear.second;
+    auto ty = init.getType().dyn_cast<mlir::IntegerType>();
+    if (!ty)
+      ty = builder.getI64Type();
+    mlir::Value step = builder.create<ConstantIntOp>(loc, 1, ty);
+    if (linear.first.step) {
+      step = Visit(linear.first.step).getValue(loc, builder);
+      unsigned width = step.getType().getIntOrFloatBitWidth();
+      if (width > ty.getWidth())
+        step = builder.create<TruncIOp>(loc, ty, step);
+      else if (width < ty.getWidth())
+        step = builder.create<ExtSIOp>(loc, ty, step);
+    }
+    mlir::Value iter = builder.create<IndexCastOp>(loc, ty, ivs[0]);
+    mlir::Value offset = builder.create<MulIOp>(loc, iter, step);
+    mlir::Value value;
+    if (auto mt = init.getType().dyn_cast<MemRefType>()) {
+      auto shape = std::vector<int64_t>(mt.getShape());
+      shape[0] = -1;
+      auto mt0 = mlir::MemRefType::get(shape, mt.getElementType(),
+                                       MemRefLayoutAttrInterface(),
+                                       mt.getMemorySpace());
+      value = builder.create<polygeist::SubIndexOp>(loc, mt0, init,
+                                                    castToIndex(loc, offset));
+    } else if (auto pt = init.getType().dyn_cast<LLVM::LLVMPointerType>()) {
+      value = builder.create<LLVM::GEPOp>(loc, pt, init,
+                                          std::vector<mlir::Value>({offset}));
+    } else {
+      value = builder.create<AddIOp>(loc, init, offset);
+    }
+    params[linear.first.name].store(loc, builder, value);
+  }
+
+  Visit(fors->getBody());
+
+  builder.create<scf::YieldOp>(loc);
+  allocationScope = oldScope;
+  builder.setInsertionPoint(oldblock, oldpoint);
+
+  for (auto pair : prevInduction)
+    params[pair.first] = pair.second;
+  for (auto &priv : privates) {
+    auto found = prev.find(priv.name);
+    if (found == prev.end())
+      continue;
+    if (priv.copyOut)
+      found->second.store(loc, builder,
+                          params[priv.name].getValue(loc, builder));
+    params[priv.name] = found->second;
+  }
+  return nullptr;
+}
+
 ValueCategory MLIRScanner::VisitDoStmt(clang::DoStmt *fors) {
   IfScope scope(*this);
 
@@ -875,12 +1626,20 @@ ValueCategory MLIRScanner::VisitIfStmt(clang::IfStmt *stmt) {
   return nullptr;
 }
 
+// GNU case ranges up to this many values are expanded into individual
+// switch cases so that they stay part of the jump table; wider ranges are
+// dispatched through a range check on the default edge instead.
+static constexpr uint64_t MaxExpandedCaseRange = 64;
+
 ValueCategory MLIRScanner::VisitSwitchStmt(clang::SwitchStmt *stmt) {
   IfScope scope(*this);
   auto cond = Visit(stmt->getCond())
                   .getValue(getMLIRLocation(stmt->getSwitchLoc()), builder);
   assert(cond != nullptr);
-  SmallVector<int64_t> caseVals;
+  auto ity = cond.getType().cast<mlir::IntegerType>();
+  SmallVector<APInt> caseVals;
+  SmallVector<Block *> blocks;
+  SmallVector<std::tuple<APInt, APInt, Block *>> caseRanges;
 
   auto er = builder.create<scf::ExecuteRegionOp>(
       getMLIRLocation(stmt->getSwitchLoc()), ArrayRef<mlir::Type>());
@@ -893,29 +1652,47 @@ ValueCategory MLIRScanner::VisitSwitchStmt(clang::SwitchStmt *stmt) {
   builder.create<scf::YieldOp>(getMLIRLocation(stmt->getSwitchLoc()));
   builder.setInsertionPointToStart(&exitB);
 
-  SmallVector<Block *> blocks;
   bool inCase = false;
 
   Block *defaultB = &exitB;
 
+  // Record every value of a (possibly ranged) case label as a direct edge to
+  // the given block so that consecutive labels share a single destination.
+  auto addCase = [&](CaseStmt *cses, Block *dest) {
+    auto width = ity.getWidth();
+    llvm::APSInt loVal =
+        cses->getLHS()->EvaluateKnownConstInt(Glob.astContext);
+    APInt lo = loVal.extOrTrunc(width);
+    if (!cses->caseStmtIsGNURange()) {
+      caseVals.push_back(lo);
+      blocks.push_back(dest);
+      return;
+    }
+    llvm::APSInt hiVal =
+        cses->getRHS()->EvaluateKnownConstInt(Glob.astContext);
+    // An empty range (hi < lo) only gets a warning from clang and matches
+    // nothing.
+    if (hiVal < loVal)
+      return;
+    APInt hi = hiVal.extOrTrunc(width);
+    APInt span = hi - lo;
+    if (span.ugt(MaxExpandedCaseRange)) {
+      caseRanges.emplace_back(lo, span, dest);
+      return;
+    }
+    for (APInt v = lo;; ++v) {
+      caseVals.push_back(v);
+      blocks.push_back(dest);
+      if (v == hi)
+        break;
+    }
+  };
+
   for (auto *cse : stmt->getBody()->children()) {
-    if (auto *cses = dyn_cast<CaseStmt>(cse)) {
-      auto loc = getMLIRLocation(cses->getCaseLoc());
+    if (auto *label = dyn_cast<SwitchCase>(cse)) {
+      auto loc = getMLIRLocation(label->getKeywordLoc());
       auto &condB = *(new Block());
 
-      auto cval = Visit(cses->getLHS());
-      if (!cval.val) {
-        cses->getLHS()->dump();
-      }
-      assert(cval.val);
-      auto cint = cval.getValue(loc, builder).getDefiningOp<ConstantIntOp>();
-      if (!cint) {
-        cses->getLHS()->dump();
-        llvm::errs() << "cval: " << cval.val << "\n";
-      }
-      assert(cint);
-      caseVals.push_back(cint.value());
-
       if (inCase) {
         auto noBreak =
             builder.create<mlir::memref::LoadOp>(loc, loops.back().noBreak);
@@ -925,7 +1702,6 @@ ValueCategory MLIRScanner::VisitSwitchStmt(clang::SwitchStmt *stmt) {
 
       inCase = true;
       er.getRegion().getBlocks().push_back(&condB);
-      blocks.push_back(&condB);
       builder.setInsertionPointToStart(&condB);
 
       auto i1Ty = builder.getIntegerType(1);
@@ -936,76 +1712,63 @@ ValueCategory MLIRScanner::VisitSwitchStmt(clang::SwitchStmt *stmt) {
       builder.create<mlir::memref::StoreOp>(loc, truev, loops.back().noBreak);
       builder.create<mlir::memref::StoreOp>(loc, truev,
                                             loops.back().keepRunning);
-      Visit(cses->getSubStmt());
-    } else if (auto *cses = dyn_cast<DefaultStmt>(cse)) {
-      auto loc = getMLIRLocation(cses->getDefaultLoc());
-      auto &condB = *(new Block());
 
-      if (inCase) {
-        auto noBreak =
-            builder.create<mlir::memref::LoadOp>(loc, loops.back().noBreak);
-        builder.create<mlir::cf::CondBranchOp>(loc, noBreak, &condB, &exitB);
-        loops.pop_back();
+      // Stacked labels (`case 1: case 2: default: ...`) all enter the same
+      // block rather than each getting an empty fallthrough block.
+      Stmt *sub = label;
+      while (auto *nested = dyn_cast<SwitchCase>(sub)) {
+        if (auto *cses = dyn_cast<CaseStmt>(nested))
+          addCase(cses, &condB);
+        else
+          defaultB = &condB;
+        sub = nested->getSubStmt();
       }
-
-      inCase = true;
-      er.getRegion().getBlocks().push_back(&condB);
-      builder.setInsertionPointToStart(&condB);
-
-      auto i1Ty = builder.getIntegerType(1);
-      auto type = mlir::MemRefType::get({}, i1Ty, {}, 0);
-      auto truev = builder.create<ConstantIntOp>(loc, true, 1);
-      loops.push_back({builder.create<mlir::memref::AllocaOp>(loc, type),
-                       builder.create<mlir::memref::AllocaOp>(loc, type)});
-      builder.create<mlir::memref::StoreOp>(loc, truev, loops.back().noBreak);
-      builder.create<mlir::memref::StoreOp>(loc, truev,
-                                            loops.back().keepRunning);
-      defaultB = &condB;
-      Visit(cses->getSubStmt());
+      Visit(sub);
     } else {
       Visit(cse);
     }
   }
 
-  if (caseVals.size() == 0) {
+  if (!inCase) {
     delete &exitB;
     er.erase();
     builder.setInsertionPoint(oldblock2, oldpoint2);
     return nullptr;
   }
 
-  if (inCase)
-    loops.pop_back();
+  loops.pop_back();
   auto loc = getMLIRLocation(stmt->getSwitchLoc());
   builder.create<mlir::cf::BranchOp>(loc, &exitB);
 
   er.getRegion().getBlocks().push_back(&exitB);
 
-  DenseIntElementsAttr caseValuesAttr;
-  ShapedType caseValueType = mlir::VectorType::get(
-      static_cast<int64_t>(caseVals.size()), cond.getType());
-  auto ity = cond.getType().cast<mlir::IntegerType>();
-  if (ity.getWidth() == 64)
-    caseValuesAttr = DenseIntElementsAttr::get(caseValueType, caseVals);
-  else if (ity.getWidth() == 32) {
-    SmallVector<int32_t> caseVals32;
-    for (auto v : caseVals)
-      caseVals32.push_back((int32_t)v);
-    caseValuesAttr = DenseIntElementsAttr::get(caseValueType, caseVals32);
-  } else if (ity.getWidth() == 16) {
-    SmallVector<int16_t> caseVals16;
-    for (auto v : caseVals)
-      caseVals16.push_back((int16_t)v);
-    caseValuesAttr = DenseIntElementsAttr::get(caseValueType, caseVals16);
-  } else {
-    assert(ity.getWidth() == 8);
-    SmallVector<int8_t> caseVals8;
-    for (auto v : caseVals)
-      caseVals8.push_back((int8_t)v);
-    caseValuesAttr = DenseIntElementsAttr::get(caseValueType, caseVals8);
+  // Wide GNU case ranges are checked in order before reaching the default.
+  for (auto &range : llvm::reverse(caseRanges)) {
+    auto &checkB = *(new Block());
+    er.getRegion().getBlocks().push_back(&checkB);
+    builder.setInsertionPointToStart(&checkB);
+    auto lo = builder.create<arith::ConstantOp>(
+        loc, builder.getIntegerAttr(ity, std::get<0>(range)));
+    auto span = builder.create<arith::ConstantOp>(
+        loc, builder.getIntegerAttr(ity, std::get<1>(range)));
+    auto offset = builder.create<SubIOp>(loc, cond, lo);
+    auto inRange =
+        builder.create<arith::CmpIOp>(loc, CmpIPredicate::ule, offset, span);
+    builder.create<mlir::cf::CondBranchOp>(loc, inRange, std::get<2>(range),
+                                           defaultB);
+    defaultB = &checkB;
   }
 
   builder.setInsertionPointToStart(&er.getRegion().front());
+  if (caseVals.empty()) {
+    builder.create<mlir::cf::BranchOp>(loc, defaultB);
+    builder.setInsertionPoint(oldblock2, oldpoint2);
+    return nullptr;
+  }
+
+  ShapedType caseValueType = mlir::VectorType::get(
+      static_cast<int64_t>(caseVals.size()), cond.getType());
+  auto caseValuesAttr = DenseIntElementsAttr::get(caseValueType, caseVals);
   builder.create<mlir::cf::SwitchOp>(
       loc, cond, defaultB, ArrayRef<mlir::Value>(), caseValuesAttr, blocks,
       SmallVector<mlir::ValueRange>(caseVals.size(), ArrayRef<mlir::Value>()));
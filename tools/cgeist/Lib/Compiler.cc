@@ -0,0 +1,1055 @@
+//===- Compiler.cc - Embeddable clang to MLIR/LLVM pipeline -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "Compiler.h"
+
+#include "clang/../../lib/Driver/ToolChains/Cuda.h"
+#include <clang/Basic/DiagnosticIDs.h>
+#include <clang/Driver/Driver.h>
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+
+#include "mlir/Conversion/AffineToStandard/AffineToStandard.h"
+#include "mlir/Conversion/LLVMCommon/LoweringOptions.h"
+#include "mlir/Conversion/SCFToOpenMP/SCFToOpenMP.h"
+#include "mlir/Dialect/Affine/Passes.h"
+#include "mlir/Dialect/Async/IR/Async.h"
+#include "mlir/Dialect/Complex/IR/Complex.h"
+#include "mlir/Dialect/DLTI/DLTI.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/GPU/Transforms/Passes.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/LLVMIR/NVVMDialect.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/OpenMP/OpenMPDialect.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/IR/Verifier.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
+#include "mlir/Target/LLVMIR/Dialect/OpenMP/OpenMPToLLVMIRTranslation.h"
+#include "mlir/Target/LLVMIR/Export.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+#include "mlir/Transforms/Passes.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include "polygeist/Dialect.h"
+#include "polygeist/Passes/Passes.h"
+
+#include <mutex>
+
+using namespace llvm;
+using namespace mlirclang;
+
+namespace {
+class MemRefInsider
+    : public mlir::MemRefElementTypeInterface::FallbackModel<MemRefInsider> {};
+
+template <typename T>
+struct PtrElementModel
+    : public mlir::LLVM::PointerElementTypeInterface::ExternalModel<
+          PtrElementModel<T>, T> {};
+
+#if POLYGEIST_ENABLE_CUDA
+class PolygeistCudaDetectorArgList : public llvm::opt::ArgList {
+public:
+  PolygeistCudaDetectorArgList(StringRef CUDAPath) : CUDAPath(CUDAPath) {}
+  virtual ~PolygeistCudaDetectorArgList() {}
+  template <typename... OptSpecifiers> bool hasArg(OptSpecifiers... Ids) const {
+    std::vector _Ids({Ids...});
+    for (auto &Id : _Ids) {
+      if (Id == clang::driver::options::OPT_nogpulib) {
+        continue;
+      } else if (Id == clang::driver::options::OPT_cuda_path_EQ) {
+        if (CUDAPath == "")
+          continue;
+        else
+          return true;
+      } else if (Id == clang::driver::options::OPT_cuda_path_ignore_env) {
+        continue;
+      } else {
+        continue;
+      }
+    }
+    return false;
+  }
+  StringRef getLastArgValue(llvm::opt::OptSpecifier Id,
+                            StringRef Default = "") const {
+    if (Id == clang::driver::options::OPT_cuda_path_EQ) {
+      return CUDAPath;
+    }
+    return Default;
+  }
+  const char *getArgString(unsigned Index) const override { return ""; }
+  unsigned getNumInputArgStrings() const override { return 0; }
+  const char *MakeArgStringRef(StringRef Str) const override { return ""; }
+
+private:
+  StringRef CUDAPath;
+};
+#endif
+} // namespace
+
+void mlirclang::prepareMLIRContext(mlir::MLIRContext &context) {
+  using namespace mlir;
+  DialectRegistry registry;
+  registerOpenMPDialectTranslation(registry);
+  registerLLVMDialectTranslation(registry);
+  context.appendDialectRegistry(registry);
+
+  context.getOrLoadDialect<AffineDialect>();
+  context.getOrLoadDialect<func::FuncDialect>();
+  context.getOrLoadDialect<DLTIDialect>();
+  context.getOrLoadDialect<mlir::scf::SCFDialect>();
+  context.getOrLoadDialect<mlir::async::AsyncDialect>();
+  context.getOrLoadDialect<mlir::LLVM::LLVMDialect>();
+  context.getOrLoadDialect<mlir::NVVM::NVVMDialect>();
+  context.getOrLoadDialect<mlir::gpu::GPUDialect>();
+  context.getOrLoadDialect<mlir::omp::OpenMPDialect>();
+  context.getOrLoadDialect<mlir::math::MathDialect>();
+  context.getOrLoadDialect<mlir::complex::ComplexDialect>();
+  context.getOrLoadDialect<mlir::memref::MemRefDialect>();
+  context.getOrLoadDialect<mlir::linalg::LinalgDialect>();
+  context.getOrLoadDialect<mlir::polygeist::PolygeistDialect>();
+
+  LLVM::LLVMFunctionType::attachInterface<MemRefInsider>(context);
+  LLVM::LLVMPointerType::attachInterface<MemRefInsider>(context);
+  LLVM::LLVMArrayType::attachInterface<MemRefInsider>(context);
+  LLVM::LLVMStructType::attachInterface<MemRefInsider>(context);
+  MemRefType::attachInterface<PtrElementModel<MemRefType>>(context);
+  IndexType::attachInterface<PtrElementModel<IndexType>>(context);
+  LLVM::LLVMStructType::attachInterface<PtrElementModel<LLVM::LLVMStructType>>(
+      context);
+  LLVM::LLVMPointerType::attachInterface<
+      PtrElementModel<LLVM::LLVMPointerType>>(context);
+  LLVM::LLVMArrayType::attachInterface<PtrElementModel<LLVM::LLVMArrayType>>(
+      context);
+}
+
+void mlirclang::configureThreading(mlir::MLIRContext &context,
+                                   unsigned threads,
+                                   std::unique_ptr<llvm::ThreadPool> &pool) {
+  if (threads == 1)
+    return;
+  if (threads == 0) {
+    context.enableMultithreading();
+    return;
+  }
+  pool =
+      std::make_unique<llvm::ThreadPool>(llvm::hardware_concurrency(threads));
+  context.setThreadPool(*pool);
+}
+
+int mlirclang::runPolygeistPipeline(mlir::MLIRContext &context,
+                                    mlir::OwningOpRef<mlir::ModuleOp> &module,
+                                    const CompilerOptions &options,
+                                    EmitKind kind, const llvm::Triple &triple,
+                                    const llvm::DataLayout &DL,
+                                    const llvm::Triple &gpuTriple,
+                                    bool &linkOpenMP) {
+  using namespace mlir;
+
+#if !POLYGEIST_ENABLE_CUDA
+  if (options.emitCuda) {
+    llvm::errs() << "error: no CUDA support, aborting\n";
+    return 1;
+  }
+#endif
+
+  bool RaiseToAffine = options.raiseToAffine;
+  bool ParallelLICM = options.parallelLICM;
+  bool ScalarReplacement = options.scalarReplacement;
+  unsigned unrollSize = options.unrollSize;
+
+  mlir::PassManager pm(&context);
+  pm.enableVerifier(options.earlyVerifier);
+  mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
+  GreedyRewriteConfig canonicalizerConfig;
+  canonicalizerConfig.maxIterations = options.canonicalizeIterations;
+  optPM.addPass(mlir::createCSEPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  optPM.addPass(polygeist::createMem2RegPass());
+  optPM.addPass(mlir::createCSEPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  optPM.addPass(polygeist::createMem2RegPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  optPM.addPass(polygeist::createRemoveTrivialUsePass());
+  optPM.addPass(polygeist::createMem2RegPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  optPM.addPass(polygeist::createLoopRestructurePass());
+  optPM.addPass(polygeist::replaceAffineCFGPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  if (ScalarReplacement)
+    optPM.addPass(mlir::createAffineScalarReplacementPass());
+  if (ParallelLICM)
+    optPM.addPass(polygeist::createParallelLICMPass());
+  else
+    optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  optPM.addPass(polygeist::createCanonicalizeForPass());
+  optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+  if (RaiseToAffine) {
+    optPM.addPass(polygeist::createCanonicalizeForPass());
+    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    if (ParallelLICM)
+      optPM.addPass(polygeist::createParallelLICMPass());
+    else
+      optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
+    optPM.addPass(polygeist::createRaiseSCFToAffinePass());
+    optPM.addPass(polygeist::replaceAffineCFGPass());
+    if (options.loopUnswitch)
+      optPM.addPass(polygeist::createLoopUnswitchPass(options.unswitchBudget));
+    if (options.loopInterchange)
+      optPM.addPass(polygeist::createLoopInterchangePass());
+    if (ScalarReplacement)
+      optPM.addPass(mlir::createAffineScalarReplacementPass());
+  }
+  if (mlir::failed(pm.run(module.get()))) {
+    module->dump();
+    return 4;
+  }
+  if (mlir::failed(mlir::verify(module.get()))) {
+    module->dump();
+    return 5;
+  }
+
+  {
+    mlir::PassManager pm(&context);
+    if (RaiseToAffine && options.recognizeKernels)
+      pm.addPass(polygeist::createKernelRecognitionPass(
+          options.kernelLibrary, options.kernelMinWork));
+    mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
+
+    if (options.detectReduction)
+      optPM.addPass(polygeist::detectReductionPass());
+
+    // Disable inlining for -O0
+    if (options.inlining) {
+      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM.addPass(mlir::createCSEPass());
+      // Affine must be lowered to enable inlining
+      if (RaiseToAffine)
+        optPM.addPass(mlir::createLowerAffinePass());
+      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      pm.addPass(mlir::createInlinerPass());
+      mlir::OpPassManager &optPM2 = pm.nest<mlir::func::FuncOp>();
+      optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(mlir::createCSEPass());
+      optPM2.addPass(polygeist::createMem2RegPass());
+      optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(mlir::createCSEPass());
+      optPM2.addPass(polygeist::createCanonicalizeForPass());
+      if (RaiseToAffine) {
+        optPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      }
+      optPM2.addPass(polygeist::replaceAffineCFGPass());
+      if (RaiseToAffine && options.loopUnswitch)
+        optPM2.addPass(
+            polygeist::createLoopUnswitchPass(options.unswitchBudget));
+      if (RaiseToAffine && options.loopInterchange)
+        optPM2.addPass(polygeist::createLoopInterchangePass());
+      optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(mlir::createCSEPass());
+      if (ParallelLICM)
+        optPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        optPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    }
+    if (mlir::failed(pm.run(module.get()))) {
+      module->dump();
+      return 6;
+    }
+  }
+
+  if (options.cudaLower) {
+    mlir::PassManager pm(&context);
+    mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
+    optPM.addPass(mlir::createLowerAffinePass());
+    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+#if POLYGEIST_ENABLE_CUDA
+    pm.addPass(polygeist::createParallelLowerPass(
+        /* wrapParallelOps */ options.emitCuda, options.cudaInlineAll));
+    if (!options.emitCuda)
+      pm.addPass(polygeist::createCudaRTLowerPass());
+#else
+    pm.addPass(polygeist::createParallelLowerPass(
+        /* wrapParallelOps */ false, options.cudaInlineAll));
+    pm.addPass(polygeist::createCudaRTLowerPass());
+#endif
+
+    pm.addPass(mlir::createSymbolDCEPass());
+    mlir::OpPassManager &noptPM = pm.nest<mlir::func::FuncOp>();
+    noptPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    noptPM.addPass(polygeist::createMem2RegPass());
+    noptPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    // Keep the device functions parallel-lower left as calls at -O0.
+    if (options.inlining || options.cudaInlineAll)
+      pm.addPass(mlir::createInlinerPass());
+    mlir::OpPassManager &noptPM2 = pm.nest<mlir::func::FuncOp>();
+    noptPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    noptPM2.addPass(polygeist::createMem2RegPass());
+    noptPM2.addPass(polygeist::createCanonicalizeForPass());
+    noptPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    noptPM2.addPass(mlir::createCSEPass());
+    if (ParallelLICM)
+      noptPM2.addPass(polygeist::createParallelLICMPass());
+    else
+      noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+    noptPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    if (RaiseToAffine) {
+      noptPM2.addPass(polygeist::createCanonicalizeForPass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ParallelLICM)
+        noptPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      noptPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      noptPM2.addPass(polygeist::replaceAffineCFGPass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (options.loopUnroll)
+        noptPM2.addPass(mlir::createLoopUnrollPass(unrollSize, false, true));
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      noptPM2.addPass(mlir::createCSEPass());
+      noptPM2.addPass(polygeist::createMem2RegPass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ParallelLICM)
+        noptPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      noptPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      noptPM2.addPass(polygeist::replaceAffineCFGPass());
+      noptPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ScalarReplacement)
+        noptPM2.addPass(mlir::createAffineScalarReplacementPass());
+    }
+    if (mlir::failed(pm.run(module.get()))) {
+      module->dump();
+      return 7;
+    }
+  }
+
+  mlir::PassManager pm2(&context);
+  mlir::OpPassManager &optPM2 = pm2.nest<mlir::func::FuncOp>();
+  if (options.cudaLower) {
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    optPM2.addPass(mlir::createCSEPass());
+    optPM2.addPass(polygeist::createMem2RegPass());
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    optPM2.addPass(mlir::createCSEPass());
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    optPM2.addPass(polygeist::createCanonicalizeForPass());
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+
+    if (RaiseToAffine) {
+      optPM2.addPass(polygeist::createCanonicalizeForPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ParallelLICM)
+        optPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        optPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      optPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(polygeist::replaceAffineCFGPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ScalarReplacement)
+        optPM2.addPass(mlir::createAffineScalarReplacementPass());
+    }
+    if (options.cpuify.size() != 0 && options.elideSharedStaging)
+      optPM2.addPass(polygeist::createSharedStagingElisionPass());
+    if (options.cpuify.size() != 0 && options.recognizeCollectives)
+      optPM2.addPass(polygeist::createCollectiveRecognitionPass());
+    if (options.cpuify == "continuation") {
+      optPM2.addPass(polygeist::createBarrierRemovalContinuation());
+      // pm.nest<mlir::FuncOp>().addPass(mlir::createCanonicalizerPass());
+    } else if (options.cpuify.size() != 0) {
+      optPM2.addPass(polygeist::createCPUifyPass(
+          options.cpuify, options.cpuifyCacheBudget, options.cpuifyReport,
+          options.cpuifyRemarks));
+    }
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    optPM2.addPass(mlir::createCSEPass());
+    optPM2.addPass(polygeist::createMem2RegPass());
+    optPM2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    optPM2.addPass(mlir::createCSEPass());
+    if (RaiseToAffine) {
+      optPM2.addPass(polygeist::createCanonicalizeForPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ParallelLICM)
+        optPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        optPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      if (options.earlyInnerSerialize) {
+        optPM2.addPass(mlir::createLowerAffinePass());
+        optPM2.addPass(polygeist::createInnerSerializationPass());
+        optPM2.addPass(polygeist::createCanonicalizeForPass());
+      }
+      optPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(polygeist::replaceAffineCFGPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (options.loopUnroll)
+        optPM2.addPass(mlir::createLoopUnrollPass(unrollSize, false, true));
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(mlir::createCSEPass());
+      optPM2.addPass(polygeist::createMem2RegPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      if (ParallelLICM)
+        optPM2.addPass(polygeist::createParallelLICMPass());
+      else
+        optPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
+      optPM2.addPass(polygeist::createRaiseSCFToAffinePass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      optPM2.addPass(polygeist::replaceAffineCFGPass());
+      optPM2.addPass(
+          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+      // Barriers are gone, so the bounds guards of the thread loops can be
+      // split off.
+      if (options.loopUnswitch)
+        optPM2.addPass(
+            polygeist::createLoopUnswitchPass(options.unswitchBudget));
+      if (ScalarReplacement)
+        optPM2.addPass(mlir::createAffineScalarReplacementPass());
+    }
+  }
+  pm2.addPass(mlir::createSymbolDCEPass());
+
+  if (options.emitCuda || kind != EmitKind::MLIR) {
+    if (options.loopIdiom)
+      pm2.nest<mlir::func::FuncOp>().addPass(polygeist::createLoopIdiomPass());
+    if (RaiseToAffine && options.predictiveCommoning)
+      pm2.nest<mlir::func::FuncOp>().addPass(
+          polygeist::createPredictiveCommoningPass());
+    if (RaiseToAffine && options.nonTemporalStores)
+      pm2.nest<mlir::func::FuncOp>().addPass(
+          polygeist::createNonTemporalStoresPass(options.llcSize));
+    pm2.addPass(mlir::createLowerAffinePass());
+    if (options.innerSerialize)
+      pm2.addPass(polygeist::createInnerSerializationPass());
+
+    if (mlir::failed(pm2.run(module.get()))) {
+      module->dump();
+      return 8;
+    }
+  }
+
+#if POLYGEIST_ENABLE_CUDA
+  if (options.emitCuda) {
+    if (options.cudaLower)
+      pm2.addPass(polygeist::createConvertParallelToGPUPass1(
+          options.useOriginalGPUBlockSize));
+    // We cannot canonicalize here because we have sunk some operations in the
+    // kernel which the canonicalizer would hoist
+
+    // TODO pass in gpuDL, the format is weird
+    pm2.addPass(mlir::createGpuKernelOutliningPass());
+    pm2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    // TODO maybe preserve info about which original kernel corresponds to
+    // which outlined kernel, might be useful for calls to
+    // cudaFuncSetCacheConfig e.g.
+    pm2.addPass(polygeist::createConvertParallelToGPUPass2());
+    pm2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+
+    if (mlir::failed(pm2.run(module.get()))) {
+      module->dump();
+      return 12;
+    }
+  }
+#endif
+
+  if (kind != EmitKind::MLIR) {
+    mlir::PassManager pm3(&context);
+    if (options.scfOpenMP) {
+      pm3.addPass(createConvertSCFToOpenMPPass());
+    } else
+      pm3.addPass(polygeist::createSerializationPass());
+    pm3.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    if (options.openMPOpt) {
+      pm3.addPass(polygeist::createOpenMPOptPass());
+      pm3.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    }
+    pm3.nest<mlir::func::FuncOp>().addPass(polygeist::createMem2RegPass());
+    pm3.addPass(mlir::createCSEPass());
+    pm3.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+    if (mlir::failed(pm3.run(module.get()))) {
+      module->dump();
+      return 9;
+    }
+    if (kind != EmitKind::OpenMPIR) {
+      module->walk([&](mlir::Operation *op) {
+        if (isa<mlir::omp::ParallelOp, mlir::omp::TaskOp,
+                mlir::omp::TaskGroupOp, mlir::omp::TaskwaitOp,
+                mlir::omp::TaskyieldOp>(op))
+          linkOpenMP = true;
+      });
+      mlir::PassManager pm4(&context);
+      pm4.addPass(polygeist::createLowerComplexPass());
+      LowerToLLVMOptions lowerOptions(&context);
+      lowerOptions.dataLayout = DL;
+      // invalid for gemm.c init array
+      // lowerOptions.useBarePtrCallConv = true;
+
+#if POLYGEIST_ENABLE_CUDA
+      if (options.emitCuda) {
+        pm4.addPass(polygeist::createConvertPolygeistToLLVMPass(
+            lowerOptions, options.cStyleMemRef, /* onlyGpuModules */ true));
+
+        using namespace clang;
+        using namespace clang::driver;
+        IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
+        IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts =
+            new DiagnosticOptions();
+        TextDiagnosticPrinter *DiagBuffer =
+            new TextDiagnosticPrinter(llvm::errs(), &*DiagOpts);
+        DiagnosticsEngine Diags(DiagID, &*DiagOpts, DiagBuffer);
+        const std::unique_ptr<Driver> driver(
+            new Driver("clang", triple.str(), Diags));
+        PolygeistCudaDetectorArgList argList(options.cudaPath);
+        CudaInstallationDetector detector(*driver, triple, argList);
+
+        std::string arch = options.cudaGPUArch;
+        if (arch == "")
+          arch = "sm_60";
+        std::string libDevicePath = detector.getLibDeviceFile(arch);
+        std::string ptxasPath = std::string(detector.getBinPath()) + "/ptxas";
+
+        // TODO what should the ptx version be?
+        mlir::OpPassManager &gpuPM = pm4.nest<gpu::GPUModuleOp>();
+        gpuPM.addPass(polygeist::createGpuSerializeToCubinPass(
+            gpuTriple.getTriple(), arch, "+ptx74", options.optLevel,
+            options.nvptxOptLevel, ptxasPath, libDevicePath,
+            options.outputIntermediateGPU));
+      }
+#endif
+
+      pm4.addPass(polygeist::createConvertPolygeistToLLVMPass(
+          lowerOptions, options.cStyleMemRef, /* onlyGpuModules */ false));
+      pm4.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
+
+      if (mlir::failed(pm4.run(module.get()))) {
+        module->dump();
+        return 10;
+      }
+    }
+  } else {
+    if (mlir::failed(pm2.run(module.get()))) {
+      module->dump();
+      return 11;
+    }
+  }
+  if (mlir::failed(mlir::verify(module.get()))) {
+    module->dump();
+    return 5;
+  }
+  return 0;
+}
+
+/// Turns the `__polygeist_simd(safelen, simdlen)` calls the frontend leaves
+/// in the latch of `#pragma omp simd` loops into the loop's metadata: the
+/// loop vectorizer is enabled, with the width of simdlen or safelen, and
+/// without a safelen the memory accesses are declared free of loop-carried
+/// dependences. Variables privatized for the loop live on the stack and are
+/// left out, so that the vectorizer still sees their dependences.
+static void applySimdHints(llvm::Module &M) {
+  llvm::Function *hint = M.getFunction("__polygeist_simd");
+  if (!hint)
+    return;
+  llvm::MapVector<llvm::Function *, SmallVector<llvm::CallInst *>> hints;
+  for (auto *U : hint->users())
+    if (auto *CI = dyn_cast<llvm::CallInst>(U))
+      hints[CI->getFunction()].push_back(CI);
+
+  llvm::LLVMContext &ctx = M.getContext();
+  for (auto &pair : hints) {
+    llvm::DominatorTree DT(*pair.first);
+    llvm::LoopInfo LI(DT);
+    for (llvm::CallInst *CI : pair.second) {
+      llvm::Loop *L = LI.getLoopFor(CI->getParent());
+      llvm::BasicBlock *latch = L ? L->getLoopLatch() : nullptr;
+      auto *safelen = dyn_cast<llvm::ConstantInt>(CI->getArgOperand(0));
+      auto *simdlen = dyn_cast<llvm::ConstantInt>(CI->getArgOperand(1));
+      if (!latch || !safelen || !simdlen)
+        continue;
+
+      SmallVector<llvm::Metadata *> ops = {nullptr};
+      if (llvm::MDNode *loopID = L->getLoopID())
+        ops.append(loopID->op_begin() + 1, loopID->op_end());
+      ops.push_back(llvm::MDNode::get(
+          ctx,
+          {llvm::MDString::get(ctx, "llvm.loop.vectorize.enable"),
+           llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(ctx))}));
+      if (!simdlen->isZero())
+        ops.push_back(llvm::MDNode::get(
+            ctx,
+            {llvm::MDString::get(ctx, "llvm.loop.vectorize.width"),
+             llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+                 llvm::Type::getInt32Ty(ctx), simdlen->getZExtValue()))}));
+      if (safelen->isZero()) {
+        llvm::MDNode *group = llvm::MDNode::getDistinct(ctx, {});
+        for (llvm::BasicBlock *BB : L->blocks())
+          for (llvm::Instruction &I : *BB) {
+            llvm::Value *ptr = llvm::getLoadStorePointerOperand(&I);
+            if (!ptr || isa<llvm::AllocaInst>(llvm::getUnderlyingObject(ptr)))
+              continue;
+            auto *groups = I.getMetadata(llvm::LLVMContext::MD_access_group);
+            I.setMetadata(llvm::LLVMContext::MD_access_group,
+                          llvm::uniteAccessGroups(groups, group));
+          }
+        ops.push_back(llvm::MDNode::get(
+            ctx, {llvm::MDString::get(ctx, "llvm.loop.parallel_accesses"),
+                  group}));
+      }
+      llvm::MDNode *loopID = llvm::MDNode::getDistinct(ctx, ops);
+      loopID->replaceOperandWith(0, loopID);
+      L->setLoopID(loopID);
+    }
+    for (llvm::CallInst *CI : pair.second)
+      CI->eraseFromParent();
+  }
+  if (hint->use_empty())
+    hint->eraseFromParent();
+}
+
+/// Returns true if `caller` may use vector instructions of `isa`.
+static bool hasISA(const llvm::Function &caller, llvm::VFISAKind isa) {
+  StringRef features =
+      caller.getFnAttribute("target-features").getValueAsString();
+  switch (isa) {
+  case llvm::VFISAKind::SSE:
+  case llvm::VFISAKind::AdvancedSIMD:
+    return true;
+  case llvm::VFISAKind::AVX:
+    return features.contains("+avx");
+  case llvm::VFISAKind::AVX2:
+    return features.contains("+avx2");
+  case llvm::VFISAKind::AVX512:
+    return features.contains("+avx512f");
+  default:
+    return false;
+  }
+}
+
+/// Defines the vector variant `info` of `F`, which runs `F` on each lane in
+/// turn. Returns null for variants with a mask or with parameter kinds it
+/// does not handle.
+static llvm::Function *emitVectorVariant(llvm::Function &F,
+                                         const llvm::VFInfo &info) {
+  llvm::Module &M = *F.getParent();
+  if (info.Shape.VF.isScalable() ||
+      info.Shape.Parameters.size() != F.arg_size())
+    return nullptr;
+  unsigned lanes = info.Shape.VF.getFixedValue();
+
+  SmallVector<llvm::Type *> params;
+  for (const llvm::VFParameter &param : info.Shape.Parameters) {
+    llvm::Type *ty = F.getArg(param.ParamPos)->getType();
+    switch (param.ParamKind) {
+    case llvm::VFParamKind::Vector:
+      if (!llvm::VectorType::isValidElementType(ty))
+        return nullptr;
+      params.push_back(llvm::FixedVectorType::get(ty, lanes));
+      break;
+    case llvm::VFParamKind::OMP_Linear:
+      if (!ty->isIntegerTy() && !ty->isPointerTy())
+        return nullptr;
+      params.push_back(ty);
+      break;
+    case llvm::VFParamKind::OMP_Uniform:
+      params.push_back(ty);
+      break;
+    default:
+      return nullptr;
+    }
+  }
+  llvm::Type *retTy = F.getReturnType();
+  if (!retTy->isVoidTy()) {
+    if (!llvm::VectorType::isValidElementType(retTy))
+      return nullptr;
+    retTy = llvm::FixedVectorType::get(retTy, lanes);
+  }
+  auto *fnTy = llvm::FunctionType::get(retTy, params, /*isVarArg*/ false);
+
+  llvm::Function *V = M.getFunction(info.VectorName);
+  if (V && (V->getFunctionType() != fnTy || !V->isDeclaration()))
+    return V->getFunctionType() == fnTy ? V : nullptr;
+  if (!V)
+    V = llvm::Function::Create(fnTy, llvm::GlobalValue::WeakODRLinkage,
+                               info.VectorName, M);
+  V->setLinkage(llvm::GlobalValue::WeakODRLinkage);
+  for (StringRef attr : {"target-cpu", "tune-cpu"})
+    if (F.hasFnAttribute(attr))
+      V->addFnAttr(F.getFnAttribute(attr));
+  std::string features =
+      F.getFnAttribute("target-features").getValueAsString().str();
+  StringRef extra;
+  switch (info.ISA) {
+  case llvm::VFISAKind::AVX:
+    extra = "+avx";
+    break;
+  case llvm::VFISAKind::AVX2:
+    extra = "+avx2";
+    break;
+  case llvm::VFISAKind::AVX512:
+    extra = "+avx512f";
+    break;
+  default:
+    break;
+  }
+  if (!extra.empty())
+    features = features.empty() ? extra.str() : features + "," + extra.str();
+  if (!features.empty())
+    V->addFnAttr("target-features", features);
+
+  llvm::IRBuilder<> B(llvm::BasicBlock::Create(M.getContext(), "entry", V));
+  llvm::Value *result =
+      retTy->isVoidTy() ? nullptr : llvm::PoisonValue::get(retTy);
+  for (unsigned lane = 0; lane < lanes; ++lane) {
+    SmallVector<llvm::Value *> args;
+    for (const llvm::VFParameter &param : info.Shape.Parameters) {
+      llvm::Value *arg = V->getArg(param.ParamPos);
+      if (param.ParamKind == llvm::VFParamKind::Vector) {
+        arg = B.CreateExtractElement(arg, lane);
+      } else if (param.ParamKind == llvm::VFParamKind::OMP_Linear) {
+        // Pointer steps are in bytes.
+        int64_t offset = (int64_t)lane * param.LinearStepOrPos;
+        if (arg->getType()->isPointerTy()) {
+          auto *bytes = B.CreatePointerCast(
+              arg, B.getInt8PtrTy(arg->getType()->getPointerAddressSpace()));
+          arg = B.CreatePointerCast(
+              B.CreateGEP(B.getInt8Ty(), bytes, B.getInt64(offset)),
+              arg->getType());
+        } else {
+          arg = B.CreateAdd(arg,
+                            llvm::ConstantInt::get(arg->getType(), offset));
+        }
+      }
+      args.push_back(arg);
+    }
+    llvm::CallInst *call = B.CreateCall(&F, args);
+    if (result)
+      result = B.CreateInsertElement(result, call, lane);
+  }
+  if (result)
+    B.CreateRet(result);
+  else
+    B.CreateRetVoid();
+  return V;
+}
+
+/// Defines the vector variants `#pragma omp declare simd` requests of the
+/// functions defined in the module, which the frontend lists as function
+/// attributes with their vector function ABI names, and lets the loop
+/// vectorizer call those taking every argument as a vector.
+static void emitDeclareSimdVariants(llvm::Module &M) {
+  SmallVector<llvm::Function *> functions;
+  for (llvm::Function &F : M)
+    if (!F.isDeclaration() &&
+        llvm::any_of(F.getAttributes().getFnAttrs(), [](llvm::Attribute A) {
+          return A.isStringAttribute() &&
+                 A.getKindAsString().startswith("_ZGV");
+        }))
+      functions.push_back(&F);
+
+  for (llvm::Function *F : functions) {
+    SmallVector<std::pair<llvm::VFISAKind, std::string>> mappings;
+    for (llvm::Attribute A : F->getAttributes().getFnAttrs()) {
+      if (!A.isStringAttribute() || !A.getKindAsString().startswith("_ZGV"))
+        continue;
+      Optional<llvm::VFInfo> info =
+          llvm::VFABI::tryDemangleForVFABI(A.getKindAsString(), M);
+      if (!info || info->ScalarName != F->getName())
+        continue;
+      llvm::Function *V = emitVectorVariant(*F, *info);
+      if (!V || !llvm::all_of(info->Shape.Parameters,
+                              [](const llvm::VFParameter &param) {
+                                return param.ParamKind ==
+                                       llvm::VFParamKind::Vector;
+                              }))
+        continue;
+      mappings.emplace_back(info->ISA, (A.getKindAsString() + "(" +
+                                        V->getName() + ")")
+                                           .str());
+    }
+    if (mappings.empty())
+      continue;
+
+    for (auto *U : F->users()) {
+      auto *CI = dyn_cast<llvm::CallInst>(U);
+      if (!CI || CI->getCalledFunction() != F)
+        continue;
+      SmallVector<std::string> names;
+      for (auto &mapping : mappings)
+        if (hasISA(*CI->getFunction(), mapping.first))
+          names.push_back(mapping.second);
+      if (!names.empty())
+        llvm::VFABI::setVectorVariantNames(CI, names);
+    }
+  }
+}
+
+/// Redirects the C allocation functions to the polygeist_allocator runtime,
+/// which aligns allocations to cache lines, backs large ones with huge pages
+/// and recycles them.
+static void redirectAllocator(llvm::Module &M) {
+  for (StringRef name :
+       {"malloc", "calloc", "aligned_alloc", "realloc", "free"}) {
+    llvm::Function *F = M.getFunction(name);
+    if (!F || !F->isDeclaration())
+      continue;
+    auto *NF = llvm::Function::Create(F->getFunctionType(),
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      "polygeist_" + name, M);
+    NF->copyAttributesFrom(F);
+    F->replaceAllUsesWith(NF);
+    F->eraseFromParent();
+  }
+}
+
+std::unique_ptr<llvm::Module>
+mlirclang::translateToLLVMIR(mlir::ModuleOp module,
+                             llvm::LLVMContext &llvmContext,
+                             const CompilerOptions &options,
+                             const llvm::Triple &triple,
+                             const llvm::DataLayout &DL) {
+  auto llvmModule = mlir::translateModuleToLLVMIR(module, llvmContext);
+  if (!llvmModule) {
+    module->dump();
+    llvm::errs() << "Failed to emit LLVM IR\n";
+    return nullptr;
+  }
+  if (options.inBoundsGEP) {
+    for (auto &F : *llvmModule)
+      for (auto &BB : F)
+        for (auto &I : BB)
+          if (auto g = dyn_cast<GetElementPtrInst>(&I))
+            g->setIsInBounds(true);
+  }
+  for (auto &F : *llvmModule) {
+    for (auto AttrName : {"target-cpu", "tune-cpu", "target-features"})
+      if (auto V = module->getAttrOfType<mlir::StringAttr>(
+              (StringRef("polygeist.") + AttrName).str())) {
+        F.addFnAttr(AttrName, V.getValue());
+      }
+  }
+  applySimdHints(*llvmModule);
+  emitDeclareSimdVariants(*llvmModule);
+  if (auto F = llvmModule->getFunction("malloc")) {
+    // allocsize
+    for (auto Attr : {llvm::Attribute::InaccessibleMemOnly,
+                      llvm::Attribute::MustProgress, llvm::Attribute::NoFree,
+                      llvm::Attribute::NoUnwind, llvm::Attribute::WillReturn})
+      F->addFnAttr(Attr);
+    F->addRetAttr(llvm::Attribute::NoAlias);
+    F->addRetAttr(llvm::Attribute::NoUndef);
+    SmallVector<llvm::Value *> todo = {F};
+    while (todo.size()) {
+      auto cur = todo.back();
+      todo.pop_back();
+      if (isa<llvm::Function>(cur)) {
+        for (auto u : cur->users())
+          todo.push_back(u);
+        continue;
+      }
+      if (auto CE = dyn_cast<llvm::ConstantExpr>(cur))
+        if (CE->isCast()) {
+          for (auto u : cur->users())
+            todo.push_back(u);
+          continue;
+        }
+      if (auto CI = dyn_cast<llvm::CallInst>(cur)) {
+        CI->addRetAttr(llvm::Attribute::NoAlias);
+        CI->addRetAttr(llvm::Attribute::NoUndef);
+      }
+    }
+  }
+  if (options.allocator == "hugepage")
+    redirectAllocator(*llvmModule);
+  llvmModule->setDataLayout(DL);
+  llvmModule->setTargetTriple(triple.getTriple());
+  return llvmModule;
+}
+
+bool mlirclang::emitObject(llvm::Module &llvmModule,
+                           const CompilerOptions &options,
+                           llvm::SmallVectorImpl<char> &object) {
+  static std::once_flag initTargets;
+  std::call_once(initTargets, [] {
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmPrinters();
+  });
+
+  std::string error;
+  const llvm::Target *target =
+      llvm::TargetRegistry::lookupTarget(llvmModule.getTargetTriple(), error);
+  if (!target) {
+    llvm::errs() << "Failed to find target: " << error << "\n";
+    return false;
+  }
+
+  llvm::CodeGenOpt::Level codegenLevel;
+  llvm::OptimizationLevel optLevel;
+  switch (options.optLevel) {
+  case 0:
+    codegenLevel = llvm::CodeGenOpt::None;
+    optLevel = llvm::OptimizationLevel::O0;
+    break;
+  case 1:
+    codegenLevel = llvm::CodeGenOpt::Less;
+    optLevel = llvm::OptimizationLevel::O1;
+    break;
+  case 2:
+    codegenLevel = llvm::CodeGenOpt::Default;
+    optLevel = llvm::OptimizationLevel::O2;
+    break;
+  default:
+    codegenLevel = llvm::CodeGenOpt::Aggressive;
+    optLevel = llvm::OptimizationLevel::O3;
+    break;
+  }
+
+  StringRef cpu = options.mcpu;
+  std::string features;
+  if (auto *F = llvmModule.begin() != llvmModule.end() ? &*llvmModule.begin()
+                                                        : nullptr) {
+    if (cpu.empty())
+      cpu = F->getFnAttribute("target-cpu").getValueAsString();
+    features = F->getFnAttribute("target-features").getValueAsString().str();
+  }
+
+  llvm::TargetOptions targetOptions;
+  std::unique_ptr<llvm::TargetMachine> targetMachine(
+      target->createTargetMachine(llvmModule.getTargetTriple(), cpu, features,
+                                  targetOptions, llvm::Reloc::PIC_,
+                                  llvm::None, codegenLevel));
+  if (!targetMachine) {
+    llvm::errs() << "Failed to create target machine\n";
+    return false;
+  }
+  llvmModule.setDataLayout(targetMachine->createDataLayout());
+
+  {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(targetMachine.get());
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    llvm::ModulePassManager MPM =
+        optLevel == llvm::OptimizationLevel::O0
+            ? PB.buildO0DefaultPipeline(optLevel)
+            : PB.buildPerModuleDefaultPipeline(optLevel);
+    MPM.run(llvmModule, MAM);
+  }
+
+  llvm::raw_svector_ostream out(object);
+  llvm::legacy::PassManager codegenPM;
+  if (targetMachine->addPassesToEmitFile(codegenPM, out, nullptr,
+                                         llvm::CGFT_ObjectFile)) {
+    llvm::errs() << "Target does not support object emission\n";
+    return false;
+  }
+  codegenPM.run(llvmModule);
+  return true;
+}
+
+mlir::OwningOpRef<mlir::ModuleOp>
+Compiler::compile(mlir::MLIRContext &context,
+                  llvm::ArrayRef<SourceBuffer> sources, EmitKind kind,
+                  llvm::Triple &triple, llvm::DataLayout &DL) const {
+  prepareMLIRContext(context);
+  mlir::OwningOpRef<mlir::ModuleOp> module(
+      mlir::ModuleOp::create(mlir::OpBuilder(&context).getUnknownLoc()));
+
+  llvm::Triple gpuTriple;
+  llvm::DataLayout gpuDL("");
+  if (!parseMLIR(argv0.c_str(), {}, options, module, triple, DL, gpuTriple,
+                 gpuDL, sources))
+    return nullptr;
+
+  bool linkOpenMP = false;
+  if (runPolygeistPipeline(context, module, options, kind, triple, DL,
+                           gpuTriple, linkOpenMP))
+    return nullptr;
+  return module;
+}
+
+mlir::OwningOpRef<mlir::ModuleOp>
+Compiler::compileToMLIR(mlir::MLIRContext &context,
+                        llvm::ArrayRef<SourceBuffer> sources,
+                        EmitKind kind) const {
+  llvm::Triple triple;
+  llvm::DataLayout DL("");
+  return compile(context, sources, kind, triple, DL);
+}
+
+std::unique_ptr<llvm::Module>
+Compiler::compileToLLVM(llvm::LLVMContext &llvmContext,
+                        llvm::ArrayRef<SourceBuffer> sources) const {
+  std::unique_ptr<llvm::ThreadPool> threadPool;
+  mlir::MLIRContext context(mlir::MLIRContext::Threading::DISABLED);
+  configureThreading(context, options.threads, threadPool);
+  llvm::Triple triple;
+  llvm::DataLayout DL("");
+  auto module = compile(context, sources, EmitKind::LLVMIR, triple, DL);
+  if (!module)
+    return nullptr;
+  return translateToLLVMIR(module.get(), llvmContext, options, triple, DL);
+}
+
+bool Compiler::compileToObject(llvm::ArrayRef<SourceBuffer> sources,
+                               llvm::SmallVectorImpl<char> &object) const {
+  llvm::LLVMContext llvmContext;
+  auto llvmModule = compileToLLVM(llvmContext, sources);
+  if (!llvmModule)
+    return false;
+  return emitObject(*llvmModule, options, object);
+}
@@ -0,0 +1,270 @@
+//===- Compiler.h - Embeddable clang to MLIR/LLVM pipeline ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Library interface to the cgeist pipeline: parse C/C++/CUDA sources into
+// MLIR, run the Polygeist pass pipeline and lower the result to LLVM IR or
+// object code. All configuration is carried by CompilerOptions rather than by
+// command line globals, so independent compilations may run concurrently in
+// one process as long as each uses its own MLIRContext and LLVMContext.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TOOLS_CGEIST_LIB_COMPILER_H
+#define MLIR_TOOLS_CGEIST_LIB_COMPILER_H
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/OwningOpRef.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/DataLayout.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+class ThreadPool;
+} // namespace llvm
+
+namespace mlir {
+class MLIRContext;
+} // namespace mlir
+
+namespace mlirclang {
+
+/// How far a compilation is lowered.
+enum class EmitKind {
+  /// Optimized affine/scf/memref MLIR, as printed by `cgeist -S`.
+  MLIR,
+  /// MLIR after parallel loops are converted to OpenMP (`-emit-openmpir`).
+  OpenMPIR,
+  /// MLIR in the LLVM dialect (`-emit-llvm-dialect`).
+  LLVMDialect,
+  /// Fully lowered module ready for translation to LLVM IR (`-emit-llvm`).
+  LLVMIR,
+};
+
+/// Options controlling one compilation. These mirror the cgeist command line
+/// flags of the same name.
+struct CompilerOptions {
+  // Frontend.
+  std::string function = "main";
+  std::vector<std::string> includeDirs;
+  std::vector<std::string> defines;
+  std::vector<std::string> includes;
+  std::string standard;
+  std::string targetTriple;
+  std::string mcpu;
+  std::string march;
+  std::string resourceDir;
+  std::string sysRoot;
+  std::string cudaGPUArch;
+  std::string cudaPath;
+  bool noCUDAInc = false;
+  bool noCUDALib = false;
+  bool openMP = false;
+  bool verbose = false;
+  bool showAST = false;
+  /// Use memrefs for pointers and arrays where possible.
+  bool memRefABI = true;
+  /// Give memrefs of nested arrays the full rank of the array.
+  bool memRefFullRank = false;
+  /// Use C style memrefs, which lower to bare pointers, where possible.
+  bool cStyleMemRef = true;
+  /// Use memrefs for structs where possible, rather than always the literal
+  /// LLVM struct type.
+  bool structABI = true;
+  /// Prefix of every emitted symbol.
+  std::string prefixABI;
+
+  // Optimization pipeline.
+  unsigned optLevel = 0;
+  /// Run the MLIR inliner (disabled by an explicit -O0).
+  bool inlining = true;
+  bool cudaLower = false;
+  bool emitCuda = false;
+  /// Inline every device function reachable from a kernel when lowering CUDA.
+  /// Otherwise only those with barriers or shared memory are inlined, and
+  /// those reading the thread or block ids get them as arguments.
+  bool cudaInlineAll = false;
+  bool useOriginalGPUBlockSize = false;
+  bool outputIntermediateGPU = false;
+  int nvptxOptLevel = 4;
+  bool scfOpenMP = true;
+  bool openMPOpt = true;
+  bool parallelLICM = true;
+  bool innerSerialize = false;
+  bool earlyInnerSerialize = false;
+  bool raiseToAffine = false;
+  /// With raiseToAffine, permute affine loop nests so that the innermost loop
+  /// walks memory with the smallest stride.
+  bool loopInterchange = false;
+  /// With raiseToAffine, version loops to remove loop-invariant conditionals
+  /// and conditionals on the induction variable, adding at most
+  /// `unswitchBudget` operations per function.
+  bool loopUnswitch = false;
+  unsigned unswitchBudget = 256;
+  /// Replace loop nests copying or filling contiguous memory with memcpy and
+  /// memset, before lowering to LLVM.
+  bool loopIdiom = false;
+  /// With raiseToAffine, carry loaded values and partial results that later
+  /// iterations of innermost loops repeat in iter_args, before lowering to
+  /// LLVM.
+  bool predictiveCommoning = false;
+  /// With raiseToAffine, make stores streaming through arrays larger than
+  /// `llcSize` bytes and never read back in the function non-temporal.
+  bool nonTemporalStores = false;
+  unsigned llcSize = 16777216;
+  bool scalarReplacement = true;
+  bool loopUnroll = false;
+  unsigned unrollSize = 32;
+  bool detectReduction = false;
+  /// Replace matmul, matvec, convolution and transpose nests with calls to
+  /// `kernelLibrary`, "polygeist" (the bundled microkernels) or "cblas".
+  bool recognizeKernels = false;
+  std::string kernelLibrary = "polygeist";
+  unsigned kernelMinWork = 4096;
+  /// Heap allocator of the program: "libc", or "hugepage" to call the
+  /// polygeist_allocator runtime instead of malloc, calloc, aligned_alloc,
+  /// realloc and free.
+  std::string allocator = "libc";
+  /// Barrier elimination method, empty to leave barriers in place.
+  std::string cpuify;
+  /// Bytes per block of buffers for values live across barriers above which
+  /// the distribute methods recompute values instead, 0 for no budget.
+  int64_t cpuifyCacheBudget = 0;
+  /// File the distribute methods write their per-function buffer footprint
+  /// to, as JSON lines, replacing its contents. Empty for none.
+  std::string cpuifyReport;
+  /// Emit a remark for every barrier the distribute methods eliminate.
+  bool cpuifyRemarks = false;
+  /// Run loops of barrier-separated phases, such as shared-memory reductions
+  /// and scans, on one thread per block before eliminating barriers.
+  bool recognizeCollectives = false;
+  /// Read tiles staged in shared memory directly from global memory before
+  /// eliminating barriers.
+  bool elideSharedStaging = false;
+  bool earlyVerifier = false;
+  int canonicalizeIterations = 400;
+  /// Threads running function passes in parallel: 0 for one per hardware
+  /// thread, 1 to run the pipeline single-threaded.
+  unsigned threads = 0;
+
+  // LLVM IR emission.
+  bool inBoundsGEP = false;
+};
+
+/// The options an autotuning database may set, spelled like the cgeist flags
+/// they correspond to (e.g. "raise-scf-to-affine", "unroll-size", "cpuify").
+llvm::ArrayRef<llvm::StringRef> getTunableOptionNames();
+
+/// Apply the best configuration recorded for `sources` in the autotuning
+/// database at `path` to `options`. An entry applies if its "source" names one
+/// of `sources` (by file name, or by full path if it contains a separator) and
+/// its optional "function" equals `options.function`; entries naming the
+/// function win over file-wide ones. Options listed in `pinned` were set
+/// explicitly by the user and are left alone. Returns false and prints a
+/// diagnostic if the database cannot be read; finding no entry is not an
+/// error.
+bool applyTuningDatabase(llvm::StringRef path,
+                         llvm::ArrayRef<std::string> sources,
+                         CompilerOptions &options,
+                         const llvm::StringSet<> &pinned = {});
+
+/// A source file provided from memory rather than from disk. `name` is the
+/// path clang sees, and determines the input language from its extension.
+struct SourceBuffer {
+  std::string name;
+  std::string contents;
+};
+
+/// Load the dialects and attach the type interfaces the pipeline relies on.
+void prepareMLIRContext(mlir::MLIRContext &context);
+
+/// Make `context`, created with multithreading disabled, run function passes
+/// on `threads` threads as described by CompilerOptions::threads. A dedicated
+/// pool is created in `pool` if needed and must outlive the context.
+void configureThreading(mlir::MLIRContext &context, unsigned threads,
+                        std::unique_ptr<llvm::ThreadPool> &pool);
+
+/// Parse `filenames` and the in-memory `buffers` with clang and emit the
+/// requested function (and everything it reaches) into `module`. The host and
+/// GPU target descriptions chosen by the clang driver are returned through
+/// `triple`/`DL` and `gpuTriple`/`gpuDL`. Returns false if clang reported an
+/// error.
+bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
+               const CompilerOptions &options,
+               mlir::OwningOpRef<mlir::ModuleOp> &module, llvm::Triple &triple,
+               llvm::DataLayout &DL, llvm::Triple &gpuTriple,
+               llvm::DataLayout &gpuDL,
+               llvm::ArrayRef<SourceBuffer> buffers = {});
+
+/// Run the Polygeist pass pipeline on `module`, lowering it as far as `kind`.
+/// Returns 0 on success or the cgeist exit code of the failing stage. Sets
+/// `linkOpenMP` if the result needs the OpenMP runtime.
+int runPolygeistPipeline(mlir::MLIRContext &context,
+                         mlir::OwningOpRef<mlir::ModuleOp> &module,
+                         const CompilerOptions &options, EmitKind kind,
+                         const llvm::Triple &triple, const llvm::DataLayout &DL,
+                         const llvm::Triple &gpuTriple, bool &linkOpenMP);
+
+/// Translate a module lowered to EmitKind::LLVMIR into LLVM IR, applying the
+/// target attributes and allocator annotations cgeist adds to its output.
+std::unique_ptr<llvm::Module>
+translateToLLVMIR(mlir::ModuleOp module, llvm::LLVMContext &llvmContext,
+                  const CompilerOptions &options, const llvm::Triple &triple,
+                  const llvm::DataLayout &DL);
+
+/// Optimize `llvmModule` at `options.optLevel` and emit an object file for its
+/// target triple into `object`.
+bool emitObject(llvm::Module &llvmModule, const CompilerOptions &options,
+                llvm::SmallVectorImpl<char> &object);
+
+/// Convenience wrapper running the whole pipeline on in-memory sources. A
+/// Compiler holds no per-compilation state, so one instance can run any
+/// number of compilations in turn, or run them concurrently from several
+/// threads.
+class Compiler {
+public:
+  explicit Compiler(CompilerOptions options, std::string argv0 = "cgeist")
+      : options(std::move(options)), argv0(std::move(argv0)) {}
+
+  const CompilerOptions &getOptions() const { return options; }
+
+  /// Compile `sources` into a module in `context`, lowered as far as `kind`.
+  /// Returns a null module on failure.
+  mlir::OwningOpRef<mlir::ModuleOp>
+  compileToMLIR(mlir::MLIRContext &context,
+                llvm::ArrayRef<SourceBuffer> sources,
+                EmitKind kind = EmitKind::MLIR) const;
+
+  /// Compile `sources` into an LLVM module owned by `llvmContext`.
+  std::unique_ptr<llvm::Module>
+  compileToLLVM(llvm::LLVMContext &llvmContext,
+                llvm::ArrayRef<SourceBuffer> sources) const;
+
+  /// Compile `sources` into a relocatable object file.
+  bool compileToObject(llvm::ArrayRef<SourceBuffer> sources,
+                       llvm::SmallVectorImpl<char> &object) const;
+
+private:
+  mlir::OwningOpRef<mlir::ModuleOp>
+  compile(mlir::MLIRContext &context, llvm::ArrayRef<SourceBuffer> sources,
+          EmitKind kind, llvm::Triple &triple, llvm::DataLayout &DL) const;
+
+  CompilerOptions options;
+  std::string argv0;
+};
+
+} // namespace mlirclang
+
+#endif // MLIR_TOOLS_CGEIST_LIB_COMPILER_H
@@ -0,0 +1,192 @@
+//===- TuningDB.cc - Apply autotuned pipeline configurations ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Reads the databases written by tools/polygeist-tune/polygeist-tune.py. The
+// format is
+//
+//   {
+//     "version": 1,
+//     "entries": [
+//       { "source": "gemm.c", "function": "kernel_gemm", "time": 0.0123,
+//         "options": { "raise-scf-to-affine": true, "unroll-size": 8 } }
+//     ]
+//   }
+//
+//===----------------------------------------------------------------------===//
+
+#include "Compiler.h"
+
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace mlirclang;
+
+namespace {
+enum class TunableKind { Bool, Unsigned, String };
+
+struct Tunable {
+  StringRef name;
+  TunableKind kind;
+  bool CompilerOptions::*boolField;
+  unsigned CompilerOptions::*unsignedField;
+  std::string CompilerOptions::*stringField;
+};
+
+Tunable boolTunable(StringRef name, bool CompilerOptions::*field) {
+  return {name, TunableKind::Bool, field, nullptr, nullptr};
+}
+Tunable unsignedTunable(StringRef name, unsigned CompilerOptions::*field) {
+  return {name, TunableKind::Unsigned, nullptr, field, nullptr};
+}
+Tunable stringTunable(StringRef name, std::string CompilerOptions::*field) {
+  return {name, TunableKind::String, nullptr, nullptr, field};
+}
+} // namespace
+
+static ArrayRef<Tunable> getTunables() {
+  static const Tunable tunables[] = {
+      boolTunable("raise-scf-to-affine", &CompilerOptions::raiseToAffine),
+      boolTunable("loop-interchange", &CompilerOptions::loopInterchange),
+      boolTunable("unswitch-loops", &CompilerOptions::loopUnswitch),
+      unsignedTunable("unswitch-budget", &CompilerOptions::unswitchBudget),
+      boolTunable("loop-idiom", &CompilerOptions::loopIdiom),
+      boolTunable("predictive-commoning",
+                  &CompilerOptions::predictiveCommoning),
+      boolTunable("nontemporal-stores", &CompilerOptions::nonTemporalStores),
+      boolTunable("scal-rep", &CompilerOptions::scalarReplacement),
+      boolTunable("unroll-loops", &CompilerOptions::loopUnroll),
+      unsignedTunable("unroll-size", &CompilerOptions::unrollSize),
+      boolTunable("detect-reduction", &CompilerOptions::detectReduction),
+      boolTunable("inner-serialize", &CompilerOptions::innerSerialize),
+      boolTunable("early-inner-serialize",
+                  &CompilerOptions::earlyInnerSerialize),
+      boolTunable("parallel-licm", &CompilerOptions::parallelLICM),
+      boolTunable("openmp-opt", &CompilerOptions::openMPOpt),
+      boolTunable("scf-openmp", &CompilerOptions::scfOpenMP),
+      stringTunable("cpuify", &CompilerOptions::cpuify),
+  };
+  return tunables;
+}
+
+ArrayRef<StringRef> mlirclang::getTunableOptionNames() {
+  static const SmallVector<StringRef> names = [] {
+    SmallVector<StringRef> names;
+    for (const Tunable &tunable : getTunables())
+      names.push_back(tunable.name);
+    return names;
+  }();
+  return names;
+}
+
+static bool matchesSource(StringRef entrySource,
+                          ArrayRef<std::string> sources) {
+  bool byPath = entrySource.find_first_of("/\\") != StringRef::npos;
+  for (const std::string &source : sources) {
+    if (byPath ? entrySource == source
+               : entrySource == sys::path::filename(source))
+      return true;
+  }
+  return false;
+}
+
+bool mlirclang::applyTuningDatabase(StringRef path,
+                                    ArrayRef<std::string> sources,
+                                    CompilerOptions &options,
+                                    const StringSet<> &pinned) {
+  auto buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    errs() << "error: could not open tuning database '" << path
+           << "': " << buffer.getError().message() << "\n";
+    return false;
+  }
+  Expected<json::Value> db = json::parse((*buffer)->getBuffer());
+  if (!db) {
+    errs() << "error: malformed tuning database '" << path
+           << "': " << toString(db.takeError()) << "\n";
+    return false;
+  }
+  const json::Object *root = db->getAsObject();
+  const json::Array *entries = root ? root->getArray("entries") : nullptr;
+  if (!entries) {
+    errs() << "error: tuning database '" << path
+           << "' has no \"entries\" array\n";
+    return false;
+  }
+
+  // Pick the most specific entry, and the fastest one among equally specific
+  // entries in case the database was merged from several tuning runs.
+  const json::Object *best = nullptr;
+  bool bestHasFunction = false;
+  double bestTime = 0;
+  for (const json::Value &value : *entries) {
+    const json::Object *entry = value.getAsObject();
+    if (!entry)
+      continue;
+    Optional<StringRef> source = entry->getString("source");
+    if (!source || !matchesSource(*source, sources))
+      continue;
+    Optional<StringRef> function = entry->getString("function");
+    if (function && *function != options.function)
+      continue;
+    double time = entry->getNumber("time").value_or(0);
+    bool hasFunction = function.has_value();
+    if (best && (bestHasFunction > hasFunction ||
+                 (bestHasFunction == hasFunction && bestTime <= time)))
+      continue;
+    best = entry;
+    bestHasFunction = hasFunction;
+    bestTime = time;
+  }
+  if (!best)
+    return true;
+
+  const json::Object *settings = best->getObject("options");
+  if (!settings)
+    return true;
+  for (const auto &setting : *settings) {
+    StringRef name = setting.first;
+    const Tunable *tunable = llvm::find_if(
+        getTunables(), [&](const Tunable &t) { return t.name == name; });
+    if (tunable == getTunables().end()) {
+      errs() << "warning: ignoring unknown option '" << name
+             << "' in tuning database '" << path << "'\n";
+      continue;
+    }
+    if (pinned.count(name))
+      continue;
+    bool valid = false;
+    switch (tunable->kind) {
+    case TunableKind::Bool:
+      if (Optional<bool> b = setting.second.getAsBoolean()) {
+        options.*tunable->boolField = *b;
+        valid = true;
+      }
+      break;
+    case TunableKind::Unsigned:
+      if (Optional<int64_t> i = setting.second.getAsInteger())
+        if (*i > 0) {
+          options.*tunable->unsignedField = *i;
+          valid = true;
+        }
+      break;
+    case TunableKind::String:
+      if (Optional<StringRef> s = setting.second.getAsString()) {
+        options.*tunable->stringField = s->str();
+        valid = true;
+      }
+      break;
+    }
+    if (!valid)
+      errs() << "warning: ignoring invalid value for '" << name
+             << "' in tuning database '" << path << "'\n";
+  }
+  return true;
+}
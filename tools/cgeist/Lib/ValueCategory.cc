@@ -144,6 +144,58 @@ ValueCategory ValueCategory::dereference(mlir::Location loc,
   llvm_unreachable("type must be LLVMPointer or MemRef");
 }
 
+/// Array copies of more elements than this are emitted as a single memcpy
+/// rather than as a load and a store per element.
+static constexpr ssize_t maxUnrolledArrayCopy = 8;
+
+static mlir::Value getBytePointer(mlir::Location loc, mlir::OpBuilder &builder,
+                                  mlir::Value val) {
+  if (auto mt = val.getType().dyn_cast<MemRefType>())
+    return builder.create<polygeist::Memref2PointerOp>(
+        loc,
+        LLVM::LLVMPointerType::get(builder.getI8Type(),
+                                   mt.getMemorySpaceAsInt()),
+        val);
+  auto pt = val.getType().cast<LLVM::LLVMPointerType>();
+  return builder.create<LLVM::BitcastOp>(
+      loc,
+      LLVM::LLVMPointerType::get(builder.getI8Type(), pt.getAddressSpace()),
+      val);
+}
+
+/// Copies `count` elements of type `elty` from `src` to `dst`, each either a
+/// memref or an LLVM pointer, with one memcpy.
+static void copyArray(mlir::Location loc, mlir::OpBuilder &builder,
+                      mlir::Value dst, mlir::Value src, mlir::Type elty,
+                      ssize_t count) {
+  mlir::Value len;
+  if (elty.isIntOrFloat() && elty.getIntOrFloatBitWidth() % 8 == 0) {
+    // A constant length lets CopySimplification see the element count.
+    len = builder.create<ConstantIntOp>(
+        loc, count * (elty.getIntOrFloatBitWidth() / 8), 64);
+  } else {
+    len = builder.create<arith::MulIOp>(
+        loc,
+        builder.create<polygeist::TypeSizeOp>(loc, builder.getIndexType(),
+                                              mlir::TypeAttr::get(elty)),
+        builder.create<ConstantIndexOp>(loc, count));
+    len = builder.create<arith::IndexCastOp>(loc, builder.getI64Type(), len);
+  }
+  mlir::Value volatileCpy = builder.create<ConstantIntOp>(loc, false, 1);
+  builder.create<LLVM::MemcpyOp>(loc, getBytePointer(loc, builder, dst),
+                                 getBytePointer(loc, builder, src), len,
+                                 volatileCpy);
+}
+
+/// Returns true if the LLVM array or struct `aggregate` has the layout of an
+/// array of its first element type.
+static bool hasArrayLayout(mlir::Type aggregate) {
+  if (aggregate.isa<LLVM::LLVMArrayType>())
+    return true;
+  auto body = aggregate.cast<LLVM::LLVMStructType>().getBody();
+  return llvm::all_of(body, [&](mlir::Type t) { return t == body[0]; });
+}
+
 // TODO: too long and difficult to understand.
 void ValueCategory::store(mlir::Location loc, mlir::OpBuilder &builder,
                           ValueCategory toStore, bool isArray) const {
@@ -168,6 +220,11 @@ void ValueCategory::store(mlir::Location loc, mlir::OpBuilder &builder,
         assert(mt.getShape().size() == smt.getShape().size());
         assert(smt.getShape().back() == mt.getShape().back());
 
+        if (smt.getShape().back() > maxUnrolledArrayCopy) {
+          copyArray(loc, builder, val, toStore.val, smt.getElementType(),
+                    smt.getShape().back());
+          return;
+        }
         for (ssize_t i = 0; i < smt.getShape().back(); i++) {
           SmallVector<mlir::Value, 2> idx;
           if (smt.getShape().size() == 2)
@@ -206,6 +263,12 @@ void ValueCategory::store(mlir::Location loc, mlir::OpBuilder &builder,
                        << " isArray: " << isArray << "\n";
         }
         assert(elty == smt.getElementType());
+        if (smt.getShape().back() > maxUnrolledArrayCopy &&
+            hasArrayLayout(pt.getElementType())) {
+          copyArray(loc, builder, val, toStore.val, elty,
+                    smt.getShape().back());
+          return;
+        }
         elty = LLVM::LLVMPointerType::get(elty, pt.getAddressSpace());
 
         auto zero32 = builder.create<ConstantIntOp>(loc, 0, 32);
@@ -235,6 +298,11 @@ void ValueCategory::store(mlir::Location loc, mlir::OpBuilder &builder,
         assert(smt.getShape().back() == (ssize_t)st.getBody().size());
       }
       assert(elty == smt.getElementType());
+      if (smt.getShape().back() > maxUnrolledArrayCopy &&
+          hasArrayLayout(pt.getElementType())) {
+        copyArray(loc, builder, val, toStore.val, elty, smt.getShape().back());
+        return;
+      }
       elty = LLVM::LLVMPointerType::get(elty, pt.getAddressSpace());
 
       auto zero32 = builder.create<ConstantIntOp>(loc, 0, 32);
@@ -10,7 +10,9 @@
 #include "../ArgumentList.h"
 #include "TypeUtils.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Complex/IR/Complex.h"
 #include "mlir/Dialect/DLTI/DLTI.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/Target/LLVMIR/Import.h"
 #include "utils.h"
@@ -36,7 +38,10 @@
 #include "clang/Parse/Parser.h"
 #include "clang/Sema/Sema.h"
 #include "clang/Sema/SemaDiagnostic.h"
+#include "llvm/Support/AtomicOrdering.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace std;
@@ -51,23 +56,6 @@ using namespace mlirclang;
 
 #define DEBUG_TYPE "clang-mlir"
 
-static cl::opt<bool>
-    memRefFullRank("memref-fullrank", cl::init(false),
-                   cl::desc("Get the full rank of the memref."));
-
-static cl::opt<bool> memRefABI("memref-abi", cl::init(true),
-                               cl::desc("Use memrefs when possible"));
-
-cl::opt<std::string> PrefixABI("prefix-abi", cl::init(""),
-                               cl::desc("Prefix for emitted symbols"));
-
-cl::opt<bool> CStyleMemRef("c-style-memref", cl::init(true),
-                           cl::desc("Use c style memrefs when possible"));
-
-static cl::opt<bool>
-    CombinedStructABI("struct-abi", cl::init(true),
-                      cl::desc("Use literal LLVM ABI for structs"));
-
 ValueCategory MLIRScanner::createComplexFloat(mlir::Location loc,
                                               mlir::Value real,
                                               mlir::Value imag,
@@ -180,8 +168,67 @@ mlir::Value MLIRScanner::getComplexPart(mlir::Location loc, mlir::Value complex,
   }
 }
 
-bool isLLVMStructABI(const RecordDecl *RD, llvm::StructType *ST) {
-  if (!CombinedStructABI)
+/// Applies the complex arithmetic `opcode` to `lhs` and `rhs`, of which one
+/// may be real. A real operand only scales or shifts the parts of the other,
+/// as in clang. Multiplications and divisions of two complex values are left
+/// to the complex dialect, and use the textbook formulas under -ffast-math.
+ValueCategory MLIRScanner::createComplexBinOp(mlir::Location loc,
+                                              clang::BinaryOperatorKind opcode,
+                                              mlir::Value lhs, mlir::Value rhs,
+                                              clang::QualType cty) {
+  auto elTy = getMLIRType(cty->castAs<clang::ComplexType>()->getElementType())
+                  .dyn_cast<mlir::FloatType>();
+  assert(elTy && "Unhandled integer complex arithmetic");
+
+  auto getPart = [&](mlir::Value v, int fnum) -> mlir::Value {
+    mlir::Value part = getComplexPart(loc, v, fnum);
+    auto ft = part.getType().cast<mlir::FloatType>();
+    if (ft.getWidth() < elTy.getWidth())
+      return builder.create<arith::ExtFOp>(loc, elTy, part);
+    if (ft.getWidth() > elTy.getWidth())
+      return builder.create<arith::TruncFOp>(loc, elTy, part);
+    return part;
+  };
+  bool lhsReal = lhs.getType().isa<mlir::FloatType>();
+  bool rhsReal = rhs.getType().isa<mlir::FloatType>();
+  mlir::Value a = getPart(lhs, 0), b = getPart(lhs, 1);
+  mlir::Value c = getPart(rhs, 0), d = getPart(rhs, 1);
+
+  mlir::Value real, imag;
+  if (opcode == clang::BinaryOperator::Opcode::BO_Sub) {
+    real = builder.create<SubFOp>(loc, a, c);
+    imag = lhsReal ? builder.create<NegFOp>(loc, d).getResult()
+                   : builder.create<SubFOp>(loc, b, d).getResult();
+  } else if (opcode == clang::BinaryOperator::Opcode::BO_Mul &&
+             (lhsReal || rhsReal)) {
+    real = builder.create<MulFOp>(loc, a, c);
+    imag = lhsReal ? builder.create<MulFOp>(loc, a, d)
+                   : builder.create<MulFOp>(loc, b, c);
+  } else if (opcode == clang::BinaryOperator::Opcode::BO_Div && rhsReal) {
+    real = builder.create<DivFOp>(loc, a, c);
+    imag = builder.create<DivFOp>(loc, b, c);
+  } else {
+    auto CT = mlir::ComplexType::get(elTy);
+    mlir::Value lhsC = builder.create<complex::CreateOp>(loc, CT, a, b);
+    mlir::Value rhsC = builder.create<complex::CreateOp>(loc, CT, c, d);
+    mlir::Operation *op;
+    if (opcode == clang::BinaryOperator::Opcode::BO_Mul)
+      op = builder.create<complex::MulOp>(loc, lhsC, rhsC);
+    else if (opcode == clang::BinaryOperator::Opcode::BO_Div)
+      op = builder.create<complex::DivOp>(loc, lhsC, rhsC);
+    else
+      llvm_unreachable("Unhandled complex arithmetic");
+    if (Glob.CGM.getLangOpts().FastMath)
+      op->setAttr("polygeist.limited_range", builder.getUnitAttr());
+    real = builder.create<complex::ReOp>(loc, elTy, op->getResult(0));
+    imag = builder.create<complex::ImOp>(loc, elTy, op->getResult(0));
+  }
+  return createComplexFloat(loc, real, imag, cty);
+}
+
+bool MLIRASTConsumer::isLLVMStructABI(const RecordDecl *RD,
+                                      llvm::StructType *ST) {
+  if (!options.structABI)
     return true;
   if (RD->isUnion())
     return true;
@@ -223,7 +270,7 @@ void MLIRScanner::init(mlir::func::FuncOp function, const FunctionDecl *fd) {
   this->function = function;
   this->EmittingFunctionDecl = fd;
 
-  if (ShowAST) {
+  if (Glob.options.showAST) {
     llvm::errs() << "Emitting fn: " << function.getName() << "\n";
     llvm::errs() << *fd << "\n";
   }
@@ -294,7 +341,7 @@ void MLIRScanner::init(mlir::func::FuncOp function, const FunctionDecl *fd) {
   if (auto CC = dyn_cast<CXXConstructorDecl>(fd)) {
     const CXXRecordDecl *ClassDecl = CC->getParent();
     for (auto expr : CC->inits()) {
-      if (ShowAST) {
+      if (Glob.options.showAST) {
         llvm::errs() << " init: - baseInit:" << (int)expr->isBaseInitializer()
                      << " memberInit:" << (int)expr->isMemberInitializer()
                      << " anyMember:" << (int)expr->isAnyMemberInitializer()
@@ -450,7 +497,7 @@ void MLIRScanner::init(mlir::func::FuncOp function, const FunctionDecl *fd) {
 
   Stmt *stmt = fd->getBody();
   if (stmt) {
-    if (ShowAST) {
+    if (Glob.options.showAST) {
       stmt->dump();
     }
     Visit(stmt);
@@ -1884,7 +1931,7 @@ MLIRScanner::EmitGPUCallExpr(clang::CallExpr *expr) {
         builder.create<mlir::NVVM::Barrier0Op>(loc);
         return make_pair(ValueCategory(), true);
       }
-      if (sr->getDecl()->getIdentifier() && CudaLower &&
+      if (sr->getDecl()->getIdentifier() && Glob.options.cudaLower &&
           sr->getDecl()->getName() == "cudaFuncSetCacheConfig") {
         llvm::errs() << " Not emitting GPU option: cudaFuncSetCacheConfig\n";
         return make_pair(ValueCategory(), true);
@@ -1894,8 +1941,9 @@ MLIRScanner::EmitGPUCallExpr(clang::CallExpr *expr) {
       llvm::raw_string_ostream ss(str);
       ss.str();
       sr->getDecl()->printQualifiedName(ss);
-      if (str == "free" || ((CudaLower && !EmitCuda) &&
-                            (str == "cudaFree" || str == "cudaFreeHost"))) {
+      if (str == "free" ||
+          ((Glob.options.cudaLower && !Glob.options.emitCuda) &&
+           (str == "cudaFree" || str == "cudaFreeHost"))) {
 
         auto sub = expr->getArg(0);
         while (auto BC = dyn_cast<clang::CastExpr>(sub))
@@ -1921,7 +1969,7 @@ MLIRScanner::EmitGPUCallExpr(clang::CallExpr *expr) {
         // TODO remove me when the free is removed.
         return make_pair(ValueCategory(), true);
       }
-      if ((CudaLower && !EmitCuda) &&
+      if ((Glob.options.cudaLower && !Glob.options.emitCuda) &&
           (str == "cudaMalloc" || str == "cudaMallocHost" ||
            str == "cudaMallocPitch")) {
         auto sub = expr->getArg(0);
@@ -1959,7 +2007,7 @@ MLIRScanner::EmitGPUCallExpr(clang::CallExpr *expr) {
                   elemSize)};
               auto alloc = builder.create<mlir::memref::AllocOp>(
                   loc,
-                  (str != "cudaMallocHost" && !CudaLower)
+                  (str != "cudaMallocHost" && !Glob.options.cudaLower)
                       ? mlir::MemRefType::get(shape, mt.getElementType(),
                                               MemRefLayoutAttrInterface())
                       : mt,
@@ -2461,115 +2509,365 @@ bool hasAffineArith(Operation *op, AffineExpr &expr,
   return hasAffineArith(nonCstOperand.getDefiningOp(), expr, affineForIndVar);
 }
 
+/// Map the C11 memory order of an atomic builtin to the LLVM ordering. Orders
+/// that are not valid for the operation are strengthened to the closest valid
+/// one, and orders that are only known at run time are treated as
+/// sequentially consistent.
+static LLVM::AtomicOrdering getAtomicOrdering(clang::Expr *order,
+                                              clang::ASTContext &ctx,
+                                              bool isLoad, bool isStore) {
+  clang::Expr::EvalResult result;
+  if (!order->EvaluateAsInt(result, ctx) ||
+      !llvm::isValidAtomicOrderingCABI(result.Val.getInt().getZExtValue()))
+    return LLVM::AtomicOrdering::seq_cst;
+  switch ((llvm::AtomicOrderingCABI)result.Val.getInt().getZExtValue()) {
+  case llvm::AtomicOrderingCABI::relaxed:
+    return LLVM::AtomicOrdering::monotonic;
+  case llvm::AtomicOrderingCABI::consume:
+  case llvm::AtomicOrderingCABI::acquire:
+    return isStore ? LLVM::AtomicOrdering::release
+                   : LLVM::AtomicOrdering::acquire;
+  case llvm::AtomicOrderingCABI::release:
+    return isLoad ? LLVM::AtomicOrdering::acquire
+                  : LLVM::AtomicOrdering::release;
+  case llvm::AtomicOrderingCABI::acq_rel:
+    return isLoad    ? LLVM::AtomicOrdering::acquire
+           : isStore ? LLVM::AtomicOrdering::release
+                     : LLVM::AtomicOrdering::acq_rel;
+  case llvm::AtomicOrderingCABI::seq_cst:
+    return LLVM::AtomicOrdering::seq_cst;
+  }
+  llvm_unreachable("unknown atomic ordering");
+}
+
 ValueCategory MLIRScanner::VisitAtomicExpr(clang::AtomicExpr *BO) {
   auto loc = getMLIRLocation(BO->getExprLoc());
+  auto op = BO->getOp();
+
+  bool isLoad = false, isStore = false, isExchange = false, isCmpXchg = false;
+  // The returned value of the RMW builtins is either the old value
+  // (__atomic_fetch_op) or the new one (__atomic_op_fetch).
+  bool returnsNew = false;
+  Optional<LLVM::AtomicBinOp> binOp;
+  switch (op) {
+  case AtomicExpr::AO__c11_atomic_load:
+  case AtomicExpr::AO__atomic_load_n:
+  case AtomicExpr::AO__atomic_load:
+    isLoad = true;
+    break;
+  case AtomicExpr::AO__c11_atomic_store:
+  case AtomicExpr::AO__atomic_store_n:
+  case AtomicExpr::AO__atomic_store:
+    isStore = true;
+    break;
+  case AtomicExpr::AO__c11_atomic_exchange:
+  case AtomicExpr::AO__atomic_exchange_n:
+  case AtomicExpr::AO__atomic_exchange:
+    isExchange = true;
+    break;
+  case AtomicExpr::AO__c11_atomic_compare_exchange_strong:
+  case AtomicExpr::AO__c11_atomic_compare_exchange_weak:
+  case AtomicExpr::AO__atomic_compare_exchange_n:
+  case AtomicExpr::AO__atomic_compare_exchange:
+    isCmpXchg = true;
+    break;
+  case AtomicExpr::AO__atomic_add_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_add:
+  case AtomicExpr::AO__atomic_fetch_add:
+    binOp = LLVM::AtomicBinOp::add;
+    break;
+  case AtomicExpr::AO__atomic_sub_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_sub:
+  case AtomicExpr::AO__atomic_fetch_sub:
+    binOp = LLVM::AtomicBinOp::sub;
+    break;
+  case AtomicExpr::AO__atomic_and_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_and:
+  case AtomicExpr::AO__atomic_fetch_and:
+    binOp = LLVM::AtomicBinOp::_and;
+    break;
+  case AtomicExpr::AO__atomic_or_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_or:
+  case AtomicExpr::AO__atomic_fetch_or:
+    binOp = LLVM::AtomicBinOp::_or;
+    break;
+  case AtomicExpr::AO__atomic_xor_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_xor:
+  case AtomicExpr::AO__atomic_fetch_xor:
+    binOp = LLVM::AtomicBinOp::_xor;
+    break;
+  case AtomicExpr::AO__atomic_nand_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__atomic_fetch_nand:
+    binOp = LLVM::AtomicBinOp::nand;
+    break;
+  case AtomicExpr::AO__atomic_min_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_min:
+  case AtomicExpr::AO__atomic_fetch_min:
+    binOp = LLVM::AtomicBinOp::min;
+    break;
+  case AtomicExpr::AO__atomic_max_fetch:
+    returnsNew = true;
+    LLVM_FALLTHROUGH;
+  case AtomicExpr::AO__c11_atomic_fetch_max:
+  case AtomicExpr::AO__atomic_fetch_max:
+    binOp = LLVM::AtomicBinOp::max;
+    break;
+  default:
+    llvm::errs() << "unhandled atomic:";
+    BO->dump();
+    assert(0);
+  }
 
-  switch (BO->getOp()) {
-  case AtomicExpr::AtomicOp::AO__atomic_add_fetch: {
-    auto a0 = Visit(BO->getPtr()).getValue(loc, builder);
-    auto a1 = Visit(BO->getVal1()).getValue(loc, builder);
-    auto ty = a1.getType();
-    AtomicRMWKind op;
-    LLVM::AtomicBinOp lop;
-    if (ty.isa<mlir::IntegerType>()) {
-      op = AtomicRMWKind::addi;
-      lop = LLVM::AtomicBinOp::add;
-    } else {
-      op = AtomicRMWKind::addf;
-      lop = LLVM::AtomicBinOp::fadd;
-    }
-    // TODO add atomic ordering
-    mlir::Value v;
-    if (a0.getType().isa<MemRefType>())
-      v = builder.create<memref::AtomicRMWOp>(
-          loc, a1.getType(), op, a1, a0,
-          std::vector<mlir::Value>({getConstantIndex(0)}));
-    else
-      v = builder.create<LLVM::AtomicRMWOp>(loc, a1.getType(), lop, a0, a1,
-                                            LLVM::AtomicOrdering::acq_rel);
+  // The generic (non-_n) GNU builtins pass values through pointers.
+  bool generic = op == AtomicExpr::AO__atomic_load ||
+                 op == AtomicExpr::AO__atomic_store ||
+                 op == AtomicExpr::AO__atomic_exchange ||
+                 op == AtomicExpr::AO__atomic_compare_exchange;
 
-    if (ty.isa<mlir::IntegerType>())
-      v = builder.create<arith::AddIOp>(loc, v, a1);
-    else
-      v = builder.create<arith::AddFOp>(loc, v, a1);
+  auto valueTy = BO->getValueType();
+  auto ordering =
+      getAtomicOrdering(BO->getOrder(), Glob.CGM.getContext(), isLoad, isStore);
+  auto ptr = Visit(BO->getPtr()).getValue(loc, builder);
+  mlir::Type elemTy;
+  if (auto MT = ptr.getType().dyn_cast<MemRefType>())
+    elemTy = MT.getElementType();
+  else
+    elemTy = ptr.getType().cast<LLVM::LLVMPointerType>().getElementType();
 
-    return ValueCategory(v, false);
-  }
-  case AtomicExpr::AtomicOp::AO__atomic_load: {
-    // In the absence of an atomic load instruction, fall back to += 0.0
-    auto a0 = Visit(BO->getPtr()).getValue(loc, builder);
-    auto ret = Visit(BO->getVal1()).dereference(loc, builder);
-    mlir::Type ty;
-    if (auto MT = a0.getType().dyn_cast<MemRefType>()) {
-      ty = MT.getElementType();
-    } else {
-      ty = a0.getType().cast<LLVM::LLVMPointerType>().getElementType();
-    }
-    AtomicRMWKind op;
-    LLVM::AtomicBinOp lop;
-    mlir::Value a1;
-    if (ty.isa<mlir::IntegerType>()) {
-      op = AtomicRMWKind::addi;
-      lop = LLVM::AtomicBinOp::add;
-      a1 = builder.create<ConstantIntOp>(loc, 0, ty);
-    } else {
-      op = AtomicRMWKind::addf;
-      lop = LLVM::AtomicBinOp::fadd;
-      a1 = builder.create<ConstantFloatOp>(
-          loc, APFloat(ty.cast<mlir::FloatType>().getFloatSemantics(), "0"),
-          ty.cast<mlir::FloatType>());
-    }
-    // TODO add atomic ordering
-    mlir::Value v;
-    if (a0.getType().isa<MemRefType>())
-      v = builder.create<memref::AtomicRMWOp>(
-          loc, a1.getType(), op, a1, a0,
-          std::vector<mlir::Value>({getConstantIndex(0)}));
-    else
-      v = builder.create<LLVM::AtomicRMWOp>(loc, a1.getType(), lop, a0, a1,
-                                            LLVM::AtomicOrdering::acq_rel);
-    ret.store(loc, builder, v);
-    return ValueCategory(v, false);
-  }
-  case AtomicExpr::AtomicOp::AO__atomic_store: {
-    llvm::errs() << " TODO: implement atomic store with atomics\n";
-    auto a0 = Visit(BO->getPtr()).dereference(loc, builder);
-    auto a1 =
-        Visit(BO->getVal1()).dereference(loc, builder).getValue(loc, builder);
-    a0.store(loc, builder, a1);
-    return ValueCategory();
-  }
-  case AtomicExpr::AtomicOp::AO__atomic_compare_exchange: {
-    // In the absence of an atomic load instruction, fall back to += 0.0
-    auto a0 = Visit(BO->getPtr()).getValue(loc, builder);
-    auto a1 =
-        Visit(BO->getVal1()).dereference(loc, builder).getValue(loc, builder);
-    auto a2 =
-        Visit(BO->getVal2()).dereference(loc, builder).getValue(loc, builder);
-    if (auto mt = a0.getType().dyn_cast<MemRefType>()) {
-      a0 = builder.create<polygeist::Memref2PointerOp>(
+  auto toLLVMPointer = [&](mlir::Value ptr) -> mlir::Value {
+    if (auto mt = ptr.getType().dyn_cast<MemRefType>())
+      return builder.create<polygeist::Memref2PointerOp>(
           loc,
           LLVM::LLVMPointerType::get(mt.getElementType(),
                                      mt.getMemorySpaceAsInt()),
-          a0);
-    }
-    // TODO add atomic ordering
-    mlir::Type tys[2] = {a1.getType(), builder.getIntegerType(1)};
-    auto RT = LLVM::LLVMStructType::getLiteral(a1.getContext(), tys);
-    mlir::Value v = builder.create<LLVM::AtomicCmpXchgOp>(
-        loc, RT, a0, a1, a2, LLVM::AtomicOrdering::seq_cst,
-        LLVM::AtomicOrdering::seq_cst);
-    v = builder.create<LLVM::ExtractValueOp>(loc, v, 1);
+          ptr);
+    return ptr;
+  };
+
+  // Loads, stores, exchanges and compare-exchanges only care about the bits,
+  // so they operate on an integer of the value's size. This also covers
+  // floating point and pointer values, which cmpxchg does not accept.
+  unsigned bits = Glob.CGM.getContext().getTypeSize(valueTy);
+  auto intTy = builder.getIntegerType(bits);
+  auto intPointer = [&]() -> mlir::Value {
+    mlir::Value p = toLLVMPointer(ptr);
+    auto PT = p.getType().cast<LLVM::LLVMPointerType>();
+    if (PT.getAddressSpace() != 0)
+      p = builder.create<LLVM::AddrSpaceCastOp>(
+          loc, LLVM::LLVMPointerType::get(PT.getElementType()), p);
+    auto intPtrTy = LLVM::LLVMPointerType::get(intTy);
+    if (p.getType() == intPtrTy)
+      return p;
+    return builder.create<LLVM::BitcastOp>(loc, intPtrTy, p);
+  };
+  auto toInt = [&](mlir::Value v) -> mlir::Value {
+    if (v.getType().isa<mlir::FloatType>())
+      return builder.create<arith::BitcastOp>(loc, intTy, v);
+    if (v.getType().isa<MemRefType>())
+      v = toLLVMPointer(v);
+    if (v.getType().isa<LLVM::LLVMPointerType>())
+      return builder.create<LLVM::PtrToIntOp>(loc, intTy, v);
+    return v;
+  };
+  auto fromInt = [&](mlir::Value v) -> mlir::Value {
+    if (elemTy.isa<mlir::FloatType>())
+      return builder.create<arith::BitcastOp>(loc, elemTy, v);
+    if (auto MT = elemTy.dyn_cast<MemRefType>())
+      return builder.create<polygeist::Pointer2MemrefOp>(
+          loc, MT,
+          builder.create<LLVM::IntToPtrOp>(
+              loc,
+              LLVM::LLVMPointerType::get(builder.getI8Type(),
+                                         MT.getMemorySpaceAsInt()),
+              v));
+    if (elemTy.isa<LLVM::LLVMPointerType>())
+      return builder.create<LLVM::IntToPtrOp>(loc, elemTy, v);
+    return v;
+  };
+  auto getOperand = [&](clang::Expr *E) -> mlir::Value {
+    auto V = Visit(E);
+    if (generic)
+      V = V.dereference(loc, builder);
+    return V.getValue(loc, builder);
+  };
+  // Return the result of the builtin, storing it through the `ret` pointer
+  // for the generic builtins.
+  auto result = [&](mlir::Value v) -> ValueCategory {
+    if (!generic)
+      return ValueCategory(v, false);
+    auto ret = op == AtomicExpr::AO__atomic_load ? BO->getVal1()
+                                                  : BO->getVal2();
+    Visit(ret).dereference(loc, builder).store(loc, builder, v);
+    return ValueCategory();
+  };
+
+  // LLVM dialect loads and stores carry no ordering, so loads are emitted as
+  // an atomic or of zero and stores as an exchange whose result is unused.
+  // InstCombine turns relaxed and acquire loads and relaxed and release
+  // stores into atomic loads and stores; sequentially consistent ones stay
+  // read-modify-writes. Either way no libatomic call is needed.
+  if (isLoad) {
+    mlir::Value v = builder.create<LLVM::AtomicRMWOp>(
+        loc, intTy, LLVM::AtomicBinOp::_or, intPointer(),
+        builder.create<ConstantIntOp>(loc, 0, intTy), ordering);
+    return result(fromInt(v));
+  }
+
+  if (isStore) {
+    mlir::Value val = toInt(getOperand(BO->getVal1()));
+    builder.create<LLVM::AtomicRMWOp>(loc, intTy, LLVM::AtomicBinOp::xchg,
+                                      intPointer(), val, ordering);
+    return ValueCategory();
+  }
+
+  if (isExchange) {
+    mlir::Value val = toInt(getOperand(BO->getVal1()));
+    mlir::Value v = builder.create<LLVM::AtomicRMWOp>(
+        loc, intTy, LLVM::AtomicBinOp::xchg, intPointer(), val, ordering);
+    return result(fromInt(v));
+  }
+
+  if (isCmpXchg) {
+    // C11 weak compare-exchange is allowed to fail spuriously, so emitting
+    // it as a strong one is correct.
+    auto failOrdering = getAtomicOrdering(
+        BO->getOrderFail(), Glob.CGM.getContext(), /*isLoad*/ true, false);
+    auto expected = Visit(BO->getVal1()).dereference(loc, builder);
+    mlir::Value cmp = toInt(expected.getValue(loc, builder));
+    mlir::Value desired = toInt(getOperand(BO->getVal2()));
+    mlir::Type tys[2] = {intTy, builder.getIntegerType(1)};
+    auto RT = LLVM::LLVMStructType::getLiteral(builder.getContext(), tys);
+    mlir::Value pair = builder.create<LLVM::AtomicCmpXchgOp>(
+        loc, RT, intPointer(), cmp, desired, ordering, failOrdering);
+    mlir::Value old = builder.create<LLVM::ExtractValueOp>(loc, pair, 0);
+    mlir::Value success = builder.create<LLVM::ExtractValueOp>(loc, pair, 1);
+
+    // On failure, the current value is written back to `expected`.
+    mlir::Value failed = builder.create<XOrIOp>(
+        loc, success, builder.create<ConstantIntOp>(loc, 1, 1));
+    auto ifOp = builder.create<scf::IfOp>(loc, failed, /*hasElse*/ false);
+    {
+      mlir::OpBuilder::InsertionGuard guard(builder);
+      builder.setInsertionPointToStart(ifOp.thenBlock());
+      expected.store(loc, builder, fromInt(old));
+    }
+
     auto postTy = getMLIRType(BO->getType()).cast<mlir::IntegerType>();
     if (postTy.getWidth() > 1)
-      v = builder.create<arith::ExtUIOp>(loc, postTy, v);
-    return ValueCategory(v, false);
+      success = builder.create<arith::ExtUIOp>(loc, postTy, success);
+    return ValueCategory(success, false);
   }
-  default:
-    llvm::errs() << "unhandled atomic:";
+
+  assert(binOp);
+  if (valueTy->isPointerType()) {
+    llvm::errs() << "unhandled atomic on a pointer:";
     BO->dump();
     assert(0);
   }
+  mlir::Value val = getOperand(BO->getVal1());
+  auto ty = val.getType();
+  bool isFloat = ty.isa<mlir::FloatType>();
+  bool isSigned = valueTy->isSignedIntegerType();
+  LLVM::AtomicBinOp lop = *binOp;
+  Optional<AtomicRMWKind> kind;
+  switch (lop) {
+  case LLVM::AtomicBinOp::add:
+    lop = isFloat ? LLVM::AtomicBinOp::fadd : lop;
+    kind = isFloat ? AtomicRMWKind::addf : AtomicRMWKind::addi;
+    break;
+  case LLVM::AtomicBinOp::sub:
+    lop = isFloat ? LLVM::AtomicBinOp::fsub : lop;
+    break;
+  case LLVM::AtomicBinOp::_and:
+    kind = AtomicRMWKind::andi;
+    break;
+  case LLVM::AtomicBinOp::_or:
+    kind = AtomicRMWKind::ori;
+    break;
+  case LLVM::AtomicBinOp::min:
+    lop = isSigned ? lop : LLVM::AtomicBinOp::umin;
+    kind = isSigned ? AtomicRMWKind::mins : AtomicRMWKind::minu;
+    break;
+  case LLVM::AtomicBinOp::max:
+    lop = isSigned ? lop : LLVM::AtomicBinOp::umax;
+    kind = isSigned ? AtomicRMWKind::maxs : AtomicRMWKind::maxu;
+    break;
+  default:
+    break;
+  }
+
+  // memref.atomic_rmw has no ordering and is lowered as acq_rel, so it is only
+  // used for acq_rel. seq_cst needs the LLVM op to keep its ordering.
+  mlir::Value v;
+  auto MT = ptr.getType().dyn_cast<MemRefType>();
+  if (kind && MT && MT.getRank() == 1 &&
+      ordering == LLVM::AtomicOrdering::acq_rel)
+    v = builder.create<memref::AtomicRMWOp>(
+        loc, ty, *kind, val, ptr,
+        std::vector<mlir::Value>({getConstantIndex(0)}));
+  else
+    v = builder.create<LLVM::AtomicRMWOp>(loc, ty, lop, toLLVMPointer(ptr),
+                                          val, ordering);
+  if (!returnsNew)
+    return ValueCategory(v, false);
+
+  switch (lop) {
+  case LLVM::AtomicBinOp::add:
+    v = builder.create<arith::AddIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::fadd:
+    v = builder.create<arith::AddFOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::sub:
+    v = builder.create<arith::SubIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::fsub:
+    v = builder.create<arith::SubFOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::_and:
+    v = builder.create<arith::AndIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::_or:
+    v = builder.create<arith::OrIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::_xor:
+    v = builder.create<arith::XOrIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::nand:
+    v = builder.create<arith::XOrIOp>(
+        loc, builder.create<arith::AndIOp>(loc, v, val),
+        builder.create<ConstantIntOp>(loc, -1, ty));
+    break;
+  case LLVM::AtomicBinOp::min:
+    v = builder.create<arith::MinSIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::umin:
+    v = builder.create<arith::MinUIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::max:
+    v = builder.create<arith::MaxSIOp>(loc, v, val);
+    break;
+  case LLVM::AtomicBinOp::umax:
+    v = builder.create<arith::MaxUIOp>(loc, v, val);
+    break;
+  default:
+    llvm_unreachable("unexpected atomic operation");
+  }
+  return ValueCategory(v, false);
 }
 
 ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
@@ -2841,9 +3139,9 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     return fixInteger(res);
   }
   case clang::BinaryOperator::Opcode::BO_Mul: {
-    if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex mult");
-    }
+    if (isa<clang::ComplexType>(BO->getType()))
+      return createComplexBinOp(loc, BO->getOpcode(), lhs.val, rhs.val,
+                                BO->getType());
     auto lhs_v = lhs.getValue(loc, builder);
     if (lhs_v.getType().isa<mlir::FloatType>()) {
       return ValueCategory(
@@ -2856,9 +3154,9 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     }
   }
   case clang::BinaryOperator::Opcode::BO_Div: {
-    if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex div");
-    }
+    if (isa<clang::ComplexType>(BO->getType()))
+      return createComplexBinOp(loc, BO->getOpcode(), lhs.val, rhs.val,
+                                BO->getType());
     auto lhs_v = lhs.getValue(loc, builder);
     if (lhs_v.getType().isa<mlir::FloatType>()) {
       return ValueCategory(
@@ -2940,9 +3238,9 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     }
   }
   case clang::BinaryOperator::Opcode::BO_Sub: {
-    if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex sub");
-    }
+    if (isa<clang::ComplexType>(BO->getType()))
+      return createComplexBinOp(loc, BO->getOpcode(), lhs.val, rhs.val,
+                                BO->getType());
     auto lhs_v = lhs.getValue(loc, builder);
     auto rhs_v = rhs.getValue(loc, builder);
     if (auto mt = lhs_v.getType().dyn_cast<mlir::MemRefType>()) {
@@ -3098,10 +3396,15 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     return lhs;
   }
   case clang::BinaryOperator::Opcode::BO_SubAssign: {
+    assert(lhs.isReference);
     if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex sub");
+      mlir::Value result =
+          createComplexBinOp(loc, clang::BinaryOperator::Opcode::BO_Sub, lhs.val,
+                             rhs.val, BO->getType())
+              .getValue(loc, builder);
+      lhs.store(loc, builder, result);
+      return lhs;
     }
-    assert(lhs.isReference);
     auto prev = lhs.getValue(loc, builder);
 
     mlir::Value result;
@@ -3130,10 +3433,15 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     return lhs;
   }
   case clang::BinaryOperator::Opcode::BO_MulAssign: {
+    assert(lhs.isReference);
     if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex mult");
+      mlir::Value result =
+          createComplexBinOp(loc, clang::BinaryOperator::Opcode::BO_Mul, lhs.val,
+                             rhs.val, BO->getType())
+              .getValue(loc, builder);
+      lhs.store(loc, builder, result);
+      return lhs;
     }
-    assert(lhs.isReference);
     auto prev = lhs.getValue(loc, builder);
 
     mlir::Value result;
@@ -3162,10 +3470,15 @@ ValueCategory MLIRScanner::VisitBinaryOperator(clang::BinaryOperator *BO) {
     return lhs;
   }
   case clang::BinaryOperator::Opcode::BO_DivAssign: {
+    assert(lhs.isReference);
     if (isa<clang::ComplexType>(BO->getType())) {
-      assert(0 && "Unhandled complex div");
+      mlir::Value result =
+          createComplexBinOp(loc, clang::BinaryOperator::Opcode::BO_Div, lhs.val,
+                             rhs.val, BO->getType())
+              .getValue(loc, builder);
+      lhs.store(loc, builder, result);
+      return lhs;
     }
-    assert(lhs.isReference);
     auto prev = lhs.getValue(loc, builder);
 
     mlir::Value result;
@@ -3296,7 +3609,7 @@ ValueCategory MLIRScanner::CommonFieldLookup(mlir::Location loc,
 
   auto CXRD = dyn_cast<CXXRecordDecl>(rd);
 
-  if (isLLVMStructABI(rd, ST)) {
+  if (Glob.isLLVMStructABI(rd, ST)) {
     auto &layout = Glob.CGM.getTypes().getCGRecordLayout(rd);
     fnum = layout.getLLVMFieldNo(FD);
   } else {
@@ -3610,7 +3923,7 @@ mlir::Value MLIRScanner::GetAddressOfDerivedClass(
         QualType(RD->getTypeForDecl(), 0)));
 
     mlir::Value Offset = nullptr;
-    if (isLLVMStructABI(RD, /*ST*/ nullptr)) {
+    if (Glob.isLLVMStructABI(RD, /*ST*/ nullptr)) {
       Offset = builder.create<arith::ConstantIntOp>(
           loc, -(ssize_t)Layout.getBaseClassOffset(BaseDecl).getQuantity(), 32);
     } else {
@@ -3684,7 +3997,7 @@ mlir::Value MLIRScanner::GetAddressOfBaseClass(
     size_t fnum;
     bool subIndex = true;
 
-    if (isLLVMStructABI(RD, /*ST*/ nullptr)) {
+    if (Glob.isLLVMStructABI(RD, /*ST*/ nullptr)) {
       auto &layout = Glob.CGM.getTypes().getCGRecordLayout(RD);
       if (std::get<1>(tup))
         fnum = layout.getVirtualBaseIndex(BaseDecl);
@@ -4549,7 +4862,7 @@ mlir::Value MLIRASTConsumer::CallMalloc(mlir::OpBuilder &builder,
   std::string name = "malloc";
   auto ctx = module->getContext();
   mlir::Type types[] = {mlir::IntegerType::get(ctx, 64)};
-  if (CStyleMemRef) {
+  if (options.cStyleMemRef) {
     if (functions.find(name) == functions.end()) {
       auto funcType = fbuilder.getFunctionType(
           types, mlir::MemRefType::get({-1}, builder.getI8Type()));
@@ -4597,18 +4910,197 @@ mlir::LLVM::LLVMFuncOp MLIRASTConsumer::GetOrCreateFreeFunction() {
              module->getLoc(), name, llvmFnType, lnk);
 }
 
+mlir::LLVM::LLVMFuncOp MLIRASTConsumer::GetOrCreateOMPNumThreadsFunction() {
+  std::string name = "omp_get_num_threads";
+  if (llvmFunctions.find(name) != llvmFunctions.end()) {
+    return llvmFunctions[name];
+  }
+  auto ctx = module->getContext();
+  auto llvmFnType =
+      LLVM::LLVMFunctionType::get(mlir::IntegerType::get(ctx, 32), {}, false);
+
+  LLVM::Linkage lnk = LLVM::Linkage::External;
+  mlir::OpBuilder builder(module->getContext());
+  builder.setInsertionPointToStart(module->getBody());
+  return llvmFunctions[name] = builder.create<LLVM::LLVMFuncOp>(
+             module->getLoc(), name, llvmFnType, lnk);
+}
+
+mlir::LLVM::LLVMFuncOp MLIRASTConsumer::GetOrCreateSimdHintFunction() {
+  std::string name = "__polygeist_simd";
+  if (llvmFunctions.find(name) != llvmFunctions.end()) {
+    return llvmFunctions[name];
+  }
+  auto ctx = module->getContext();
+  auto i32 = mlir::IntegerType::get(ctx, 32);
+  auto llvmFnType = LLVM::LLVMFunctionType::get(
+      LLVM::LLVMVoidType::get(ctx), {i32, i32}, false);
+
+  LLVM::Linkage lnk = LLVM::Linkage::External;
+  mlir::OpBuilder builder(module->getContext());
+  builder.setInsertionPointToStart(module->getBody());
+  return llvmFunctions[name] = builder.create<LLVM::LLVMFuncOp>(
+             module->getLoc(), name, llvmFnType, lnk);
+}
+
+std::vector<std::string>
+MLIRASTConsumer::getDeclareSimdVariants(const FunctionDecl *FD,
+                                        StringRef name) {
+  std::vector<std::string> variants;
+  if (!CGM.getLangOpts().OpenMP)
+    return variants;
+  const FunctionDecl *last = FD->getMostRecentDecl();
+  if (llvm::none_of(last->redecls(), [](const FunctionDecl *D) {
+        return D->hasAttr<OMPDeclareSimdDeclAttr>();
+      }))
+    return variants;
+  if (!CGM.getTarget().getTriple().isX86()) {
+    llvm::errs() << "may not handle declare simd for target "
+                 << CGM.getTarget().getTriple().str() << "\n";
+    return variants;
+  }
+
+  auto &ctx = CGM.getContext();
+  // The parameters as the function takes them, the object first for methods.
+  unsigned offset = 0;
+  if (auto *MD = dyn_cast<CXXMethodDecl>(FD))
+    if (MD->isInstance())
+      offset = 1;
+  unsigned numParams = FD->getNumParams() + offset;
+  auto getPosition = [&](const clang::Expr *E) -> Optional<unsigned> {
+    E = E->IgnoreParenImpCasts();
+    if (isa<CXXThisExpr>(E) && offset)
+      return 0;
+    if (auto *DRE = dyn_cast<DeclRefExpr>(E))
+      if (auto *PVD = dyn_cast<ParmVarDecl>(DRE->getDecl()))
+        return PVD->getFunctionScopeIndex() + offset;
+    return llvm::None;
+  };
+  auto getParamType = [&](unsigned pos) {
+    return pos < offset ? cast<CXXMethodDecl>(FD)->getThisType()
+                        : FD->getParamDecl(pos - offset)->getType();
+  };
+
+  for (const FunctionDecl *D : last->redecls()) {
+    for (auto *attr : D->specific_attrs<OMPDeclareSimdDeclAttr>()) {
+      // The parameter kinds of the vector function ABI: vector, uniform or
+      // linear with a constant or parameter step, with their alignment.
+      std::vector<std::string> kinds(numParams, "v");
+      for (auto *E : attr->uniforms())
+        if (auto pos = getPosition(E))
+          kinds[*pos] = "u";
+
+      auto *step = attr->steps_begin();
+      auto *modifier = attr->modifiers_begin();
+      for (auto *E : attr->linears()) {
+        clang::Expr *stepExpr = *step++;
+        unsigned mod = *modifier++;
+        auto pos = getPosition(E);
+        if (!pos)
+          continue;
+        QualType ty = getParamType(*pos);
+        std::string kind = "l";
+        if (mod == OMPC_LINEAR_ref)
+          kind = "R";
+        else if (mod == OMPC_LINEAR_uval)
+          kind = "U";
+        else if (ty->isReferenceType())
+          kind = "L";
+        if (!stepExpr) {
+          kinds[*pos] = kind;
+          continue;
+        }
+        if (auto stepPos = getPosition(stepExpr)) {
+          kinds[*pos] = kind + "s" + std::to_string(*stepPos);
+          continue;
+        }
+        clang::Expr::EvalResult result;
+        if (!stepExpr->EvaluateAsInt(result, ctx)) {
+          kinds[*pos] = "v";
+          continue;
+        }
+        int64_t stride = result.Val.getInt().getSExtValue();
+        // Pointer steps are in bytes.
+        if (auto *PT = ty->getAs<clang::PointerType>())
+          stride *= ctx.getTypeSizeInChars(PT->getPointeeType()).getQuantity();
+        if (stride == 1)
+          kinds[*pos] = kind;
+        else if (stride < 0)
+          kinds[*pos] = kind + "n" + std::to_string(-stride);
+        else
+          kinds[*pos] = kind + std::to_string(stride);
+      }
+
+      auto *alignment = attr->alignments_begin();
+      for (auto *E : attr->aligneds()) {
+        clang::Expr *alignExpr = *alignment++;
+        auto pos = getPosition(E);
+        if (!pos)
+          continue;
+        uint64_t bytes =
+            alignExpr
+                ? alignExpr->EvaluateKnownConstInt(ctx).getZExtValue()
+                : ctx.getOpenMPDefaultSimdAlign(getParamType(*pos)) / 8;
+        kinds[*pos] += "a" + std::to_string(bytes);
+      }
+
+      // The lanes fill a vector register with the characteristic data type:
+      // the return type, or else that of the first vector parameter.
+      QualType cdt = FD->getReturnType();
+      if (cdt->isVoidType()) {
+        cdt = QualType();
+        for (unsigned pos = 0; pos < numParams && cdt.isNull(); ++pos)
+          if (kinds[pos][0] == 'v')
+            cdt = getParamType(pos);
+      }
+      if (cdt.isNull() || cdt->isVoidType() || cdt->isRecordType())
+        cdt = ctx.IntTy;
+      uint64_t cdtBits = ctx.getTypeSize(cdt);
+      uint64_t simdlen = 0;
+      if (auto *E = attr->getSimdlen())
+        simdlen = E->EvaluateKnownConstInt(ctx).getZExtValue();
+
+      std::string masks;
+      switch (attr->getBranchState()) {
+      case OMPDeclareSimdDeclAttr::BS_Inbranch:
+        masks = "M";
+        break;
+      case OMPDeclareSimdDeclAttr::BS_Notinbranch:
+        masks = "N";
+        break;
+      default:
+        masks = "NM";
+      }
+
+      const std::pair<char, uint64_t> isas[] = {
+          {'b', 128}, {'c', 256}, {'d', 256}, {'e', 512}};
+      for (auto isa : isas) {
+        uint64_t lanes = simdlen ? simdlen : isa.second / cdtBits;
+        if (!lanes)
+          continue;
+        for (char mask : masks) {
+          std::string variant = "_ZGV";
+          variant += isa.first;
+          variant += mask;
+          variant += std::to_string(lanes);
+          for (auto &kind : kinds)
+            variant += kind;
+          variant += "_" + name.str();
+          if (llvm::find(variants, variant) == variants.end())
+            variants.push_back(variant);
+        }
+      }
+    }
+  }
+  return variants;
+}
+
 mlir::LLVM::LLVMFuncOp
 MLIRASTConsumer::GetOrCreateLLVMFunction(const FunctionDecl *FD) {
-  std::string name;
-  if (auto CC = dyn_cast<CXXConstructorDecl>(FD))
-    name = CGM.getMangledName(GlobalDecl(CC, CXXCtorType::Ctor_Complete)).str();
-  else if (auto CC = dyn_cast<CXXDestructorDecl>(FD))
-    name = CGM.getMangledName(GlobalDecl(CC, CXXDtorType::Dtor_Complete)).str();
-  else
-    name = CGM.getMangledName(FD).str();
+  std::string name = getMangledFunctionName(FD).str();
 
   if (name != "malloc" && name != "free")
-    name = (PrefixABI + name);
+    name = (options.prefixABI + name);
 
   if (llvmFunctions.find(name) != llvmFunctions.end()) {
     return llvmFunctions[name];
@@ -4680,7 +5172,7 @@ MLIRASTConsumer::GetOrCreateLLVMGlobal(const ValueDecl *FD,
                                        std::string prefix) {
   std::string name = prefix + CGM.getMangledName(FD).str();
 
-  name = (PrefixABI + name);
+  name = (options.prefixABI + name);
 
   if (llvmGlobals.find(name) != llvmGlobals.end()) {
     return llvmGlobals[name];
@@ -4821,7 +5313,7 @@ MLIRASTConsumer::GetOrCreateGlobal(const ValueDecl *FD, std::string prefix,
                                    bool tryInit) {
   std::string name = prefix + CGM.getMangledName(FD).str();
 
-  name = (PrefixABI + name);
+  name = (options.prefixABI + name);
 
   if (globals.find(name) != globals.end()) {
     return globals[name];
@@ -4950,23 +5442,40 @@ mlir::Value MLIRASTConsumer::GetOrCreateGlobalLLVMString(
     mlir::Location loc, mlir::OpBuilder &builder, StringRef value) {
   using namespace mlir;
   // Create the global at the entry of the module.
-  if (llvmStringGlobals.find(value.str()) == llvmStringGlobals.end()) {
+  auto found = llvmStringGlobals.find(value);
+  if (found == llvmStringGlobals.end()) {
     OpBuilder::InsertionGuard insertGuard(builder);
     builder.setInsertionPointToStart(module->getBody());
     auto type = LLVM::LLVMArrayType::get(
         mlir::IntegerType::get(builder.getContext(), 8), value.size() + 1);
-    llvmStringGlobals[value.str()] = builder.create<LLVM::GlobalOp>(
+    auto glob = builder.create<LLVM::GlobalOp>(
         loc, type, /*isConstant=*/true, LLVM::Linkage::Internal,
         "str" + std::to_string(llvmStringGlobals.size()),
         builder.getStringAttr(value.str() + '\0'));
+    found = llvmStringGlobals.try_emplace(value, glob).first;
   }
 
-  LLVM::GlobalOp global = llvmStringGlobals[value.str()];
+  LLVM::GlobalOp global = found->second;
   // Get the pointer to the first character in the global string.
   mlir::Value globalPtr = builder.create<mlir::LLVM::AddressOfOp>(loc, global);
   return globalPtr;
 }
 
+StringRef MLIRASTConsumer::getMangledFunctionName(const FunctionDecl *FD,
+                                                  bool getDeviceStub) {
+  GlobalDecl GD;
+  if (getDeviceStub)
+    GD = GlobalDecl(FD, KernelReferenceKind::Kernel);
+  else if (auto CC = dyn_cast<CXXConstructorDecl>(FD))
+    GD = GlobalDecl(CC, CXXCtorType::Ctor_Complete);
+  else if (auto CC = dyn_cast<CXXDestructorDecl>(FD))
+    GD = GlobalDecl(CC, CXXDtorType::Dtor_Complete);
+  else
+    GD = GlobalDecl(FD);
+
+  return CGM.getMangledName(GD);
+}
+
 mlir::func::FuncOp
 MLIRASTConsumer::GetOrCreateMLIRFunction(const FunctionDecl *FD,
                                          bool getDeviceStub) {
@@ -4975,18 +5484,8 @@ MLIRASTConsumer::GetOrCreateMLIRFunction(const FunctionDecl *FD,
   assert(
       FD->getTemplatedKind() !=
       FunctionDecl::TemplatedKind::TK_DependentFunctionTemplateSpecialization);
-  std::string name;
-  if (getDeviceStub)
-    name =
-        CGM.getMangledName(GlobalDecl(FD, KernelReferenceKind::Kernel)).str();
-  else if (auto CC = dyn_cast<CXXConstructorDecl>(FD))
-    name = CGM.getMangledName(GlobalDecl(CC, CXXCtorType::Ctor_Complete)).str();
-  else if (auto CC = dyn_cast<CXXDestructorDecl>(FD))
-    name = CGM.getMangledName(GlobalDecl(CC, CXXDtorType::Dtor_Complete)).str();
-  else
-    name = CGM.getMangledName(FD).str();
-
-  name = (PrefixABI + name);
+  std::string name =
+      (options.prefixABI + getMangledFunctionName(FD, getDeviceStub)).str();
 
   assert(name != "free");
 
@@ -5107,7 +5606,7 @@ MLIRASTConsumer::GetOrCreateMLIRFunction(const FunctionDecl *FD,
         }
       }
     }
-    if (llvmType && !CStyleMemRef) {
+    if (llvmType && !options.cStyleMemRef) {
       types.push_back(typeTranslator.translateType(
           anonymize(getLLVMType(parm->getType()))));
     } else {
@@ -5166,6 +5665,13 @@ MLIRASTConsumer::GetOrCreateMLIRFunction(const FunctionDecl *FD,
   NamedAttrList attrs(function->getAttrDictionary());
   attrs.set("llvm.linkage",
             mlir::LLVM::LinkageAttr::get(builder.getContext(), lnk));
+  // Like clang, list the vector variants as function attributes, which the
+  // lowering to LLVM IR defines.
+  auto variants = getDeclareSimdVariants(FD, name);
+  if (!variants.empty())
+    attrs.set("passthrough",
+              builder.getStrArrayAttr(SmallVector<StringRef>(
+                  variants.begin(), variants.end())));
   function->setAttrs(attrs.getDictionary(builder.getContext()));
 
   functions[name] = function;
@@ -5193,19 +5699,8 @@ void MLIRASTConsumer::run() {
     assert(FD->getTemplatedKind() !=
            FunctionDecl::TemplatedKind::
                TK_DependentFunctionTemplateSpecialization);
-    std::string name;
-    if (auto CC = dyn_cast<CXXConstructorDecl>(FD))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXCtorType::Ctor_Complete)).str();
-    else if (auto CC = dyn_cast<CXXDestructorDecl>(FD))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXDtorType::Dtor_Complete)).str();
-    else
-      name = CGM.getMangledName(FD).str();
-
-    if (done.count(name))
+    if (!done.insert(getMangledFunctionName(FD)).second)
       continue;
-    done.insert(name);
     MLIRScanner ms(*this, module, LTInfo);
     ms.init(GetOrCreateMLIRFunction(FD), FD);
   }
@@ -5252,24 +5747,16 @@ void MLIRASTConsumer::HandleDeclContext(DeclContext *DC) {
     if (!CGM.getContext().DeclMustBeEmitted(fd))
       externLinkage = false;
 
-    std::string name;
-    if (auto CC = dyn_cast<CXXConstructorDecl>(fd))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXCtorType::Ctor_Complete)).str();
-    else if (auto CC = dyn_cast<CXXDestructorDecl>(fd))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXDtorType::Dtor_Complete)).str();
-    else
-      name = CGM.getMangledName(fd).str();
+    StringRef name = getMangledFunctionName(fd);
 
     // Don't create std functions unless necessary
-    if (StringRef(name).startswith("_ZNKSt"))
+    if (name.startswith("_ZNKSt"))
       continue;
-    if (StringRef(name).startswith("_ZSt"))
+    if (name.startswith("_ZSt"))
       continue;
-    if (StringRef(name).startswith("_ZNSt"))
+    if (name.startswith("_ZNSt"))
       continue;
-    if (StringRef(name).startswith("_ZN9__gnu"))
+    if (name.startswith("_ZN9__gnu"))
       continue;
     if (name == "cudaGetDevice" || name == "cudaMalloc")
       continue;
@@ -5327,24 +5814,16 @@ bool MLIRASTConsumer::HandleTopLevelDecl(DeclGroupRef dg) {
     if (!CGM.getContext().DeclMustBeEmitted(fd))
       externLinkage = false;
 
-    std::string name;
-    if (auto CC = dyn_cast<CXXConstructorDecl>(fd))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXCtorType::Ctor_Complete)).str();
-    else if (auto CC = dyn_cast<CXXDestructorDecl>(fd))
-      name =
-          CGM.getMangledName(GlobalDecl(CC, CXXDtorType::Dtor_Complete)).str();
-    else
-      name = CGM.getMangledName(fd).str();
+    StringRef name = getMangledFunctionName(fd);
 
     // Don't create std functions unless necessary
-    if (StringRef(name).startswith("_ZNKSt"))
+    if (name.startswith("_ZNKSt"))
       continue;
-    if (StringRef(name).startswith("_ZSt"))
+    if (name.startswith("_ZSt"))
       continue;
-    if (StringRef(name).startswith("_ZNSt"))
+    if (name.startswith("_ZNSt"))
       continue;
-    if (StringRef(name).startswith("_ZN9__gnu"))
+    if (name.startswith("_ZN9__gnu"))
       continue;
     if (name == "cudaGetDevice" || name == "cudaMalloc")
       continue;
@@ -5420,14 +5899,14 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
   if (auto DT = dyn_cast<clang::DecayedType>(qt)) {
     bool assumeRef = false;
     auto mlirty = getMLIRType(DT->getOriginalType(), &assumeRef, allowMerge);
-    if (memRefABI && assumeRef) {
+    if (options.memRefABI && assumeRef) {
       // Constant array types like `int A[30][20]` will be converted to LLVM
       // type `[20 x i32]* %0`, which has the outermost dimension size erased,
       // and we can only recover to `memref<?x20xi32>` from there. This prevents
       // us from doing more comprehensive analysis. Here we specifically handle
       // this case by unwrapping the clang-adjusted type, to get the
       // corresponding ConstantArrayType with the full dimensions.
-      if (memRefFullRank) {
+      if (options.memRefFullRank) {
         clang::QualType origTy = DT->getOriginalType();
         if (origTy->isConstantArrayType()) {
           SmallVector<int64_t, 4> shape;
@@ -5454,7 +5933,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
     bool assumeRef = false;
     auto subType =
         getMLIRType(CT->getElementType(), &assumeRef, /*allowMerge*/ false);
-    if (CombinedStructABI && memRefABI && allowMerge) {
+    if (options.structABI && options.memRefABI && allowMerge) {
       assert(!assumeRef);
       if (implicitRef)
         *implicitRef = true;
@@ -5469,8 +5948,9 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
       RT->dump();
     }
     assert(!RT->getDecl()->isInvalidDecl());
-    if (typeCache.find(RT) != typeCache.end())
-      return typeCache[RT];
+    auto cached = typeCache.find(RT);
+    if (cached != typeCache.end())
+      return cached->second;
     llvm::Type *LT = CGM.getTypes().ConvertType(qt);
     if (!isa<llvm::StructType>(LT)) {
       qt->dump();
@@ -5541,7 +6021,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
       return typeCache[RT];
     }
 
-    if (!memRefABI || notAllSame || !allowMerge || innerLLVM) {
+    if (!options.memRefABI || notAllSame || !allowMerge || innerLLVM) {
       auto retTy =
           mlir::LLVM::LLVMStructType::getLiteral(module->getContext(), types);
       return retTy;
@@ -5579,7 +6059,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
 
   if (auto AT = dyn_cast<clang::ArrayType>(t)) {
     auto PTT = AT->getElementType()->getUnqualifiedDesugaredType();
-    if (!CStyleMemRef && PTT->isCharType()) {
+    if (!options.cStyleMemRef && PTT->isCharType()) {
       llvm::Type *T = CGM.getTypes().ConvertType(QualType(t, 0));
       return typeTranslator.translateType(T);
     }
@@ -5588,7 +6068,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
     int64_t size = -1;
     if (auto CAT = dyn_cast<clang::ConstantArrayType>(AT))
       size = CAT->getSize().getZExtValue();
-    if (memRefABI && subRef) {
+    if (options.memRefABI && subRef) {
       auto mt = ET.cast<MemRefType>();
       auto shape2 = std::vector<int64_t>(mt.getShape());
       shape2.insert(shape2.begin(), size);
@@ -5598,8 +6078,8 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
                                    MemRefLayoutAttrInterface(),
                                    mt.getMemorySpace());
     }
-    if (!memRefABI || !allowMerge ||
-        (!CStyleMemRef &&
+    if (!options.memRefABI || !allowMerge ||
+        (!options.cStyleMemRef &&
          ET.isa<LLVM::LLVMPointerType, LLVM::LLVMArrayType,
                 LLVM::LLVMFunctionType, LLVM::LLVMStructType>()))
       return LLVM::LLVMArrayType::get(ET, (size == -1) ? 0 : size);
@@ -5612,7 +6092,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
     bool subRef = false;
     auto ET = getMLIRType(AT->getElementType(), &subRef, allowMerge);
     int64_t size = AT->getNumElements();
-    if (CombinedStructABI && subRef) {
+    if (options.structABI && subRef) {
       auto mt = ET.cast<MemRefType>();
       auto shape2 = std::vector<int64_t>(mt.getShape());
       shape2.insert(shape2.begin(), size);
@@ -5622,8 +6102,8 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
                                    MemRefLayoutAttrInterface(),
                                    mt.getMemorySpace());
     }
-    if (!memRefABI || !allowMerge || !CombinedStructABI ||
-        (!CStyleMemRef &&
+    if (!options.memRefABI || !allowMerge || !options.structABI ||
+        (!options.cStyleMemRef &&
          ET.isa<LLVM::LLVMPointerType, LLVM::LLVMArrayType,
                 LLVM::LLVMFunctionType, LLVM::LLVMStructType>())) {
       if (mlir::LLVM::LLVMFixedVectorType::isValidElementType(ET)) {
@@ -5663,14 +6143,14 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
                                                 ->getPointeeType()
                                                 ->getUnqualifiedDesugaredType();
 
-    if (!CStyleMemRef && PTT->isCharType()) {
+    if (!options.cStyleMemRef && PTT->isCharType()) {
       llvm::Type *T = CGM.getTypes().ConvertType(QualType(t, 0));
       return typeTranslator.translateType(T);
     }
     if (PTT->isVoidType()) {
       llvm::Type *T = CGM.getTypes().ConvertType(QualType(t, 0));
       auto MT = typeTranslator.translateType(T);
-      if (!CStyleMemRef)
+      if (!options.cStyleMemRef)
         return MT;
       else
         return MemRefType::get(
@@ -5683,10 +6163,10 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
                         : cast<clang::ReferenceType>(t)->getPointeeType(),
                     &subRef, /*allowMerge*/ true);
 
-    if (!memRefABI)
+    if (!options.memRefABI)
       return LLVM::LLVMPointerType::get(subType);
 
-    if (!CStyleMemRef &&
+    if (!options.cStyleMemRef &&
         subType.isa<LLVM::LLVMArrayType, LLVM::LLVMStructType,
                     LLVM::LLVMPointerType, LLVM::LLVMFunctionType>())
       return LLVM::LLVMPointerType::get(subType);
@@ -5696,7 +6176,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
         assert(subRef);
         return subType;
       } else {
-        if (!CStyleMemRef)
+        if (!options.cStyleMemRef)
           return LLVM::LLVMPointerType::get(subType);
       }
     }
@@ -5711,7 +6191,7 @@ mlir::Type MLIRASTConsumer::getMLIRType(clang::QualType qt, bool *implicitRef,
                                      MemRefLayoutAttrInterface(),
                                      mt.getMemorySpace());
       } else {
-        if (!CStyleMemRef)
+        if (!options.cStyleMemRef)
           return LLVM::LLVMPointerType::get(subType);
       }
     }
@@ -5772,24 +6252,26 @@ llvm::Type *MLIRASTConsumer::getLLVMType(clang::QualType t) {
 #include "clang/Frontend/FrontendAction.h"
 class MLIRAction : public clang::ASTFrontendAction {
 public:
-  std::set<std::string> emitIfFound;
-  std::set<std::string> done;
+  llvm::StringSet<> emitIfFound;
+  llvm::StringSet<> done;
   mlir::OwningOpRef<mlir::ModuleOp> &module;
-  std::map<std::string, mlir::LLVM::GlobalOp> llvmStringGlobals;
-  std::map<std::string, std::pair<mlir::memref::GlobalOp, bool>> globals;
-  std::map<std::string, mlir::func::FuncOp> functions;
-  std::map<std::string, mlir::LLVM::GlobalOp> llvmGlobals;
-  std::map<std::string, mlir::LLVM::LLVMFuncOp> llvmFunctions;
-  MLIRAction(std::string fn, mlir::OwningOpRef<mlir::ModuleOp> &module)
-      : module(module) {
-    emitIfFound.insert(fn);
+  llvm::StringMap<mlir::LLVM::GlobalOp> llvmStringGlobals;
+  llvm::StringMap<std::pair<mlir::memref::GlobalOp, bool>> globals;
+  llvm::StringMap<mlir::func::FuncOp> functions;
+  llvm::StringMap<mlir::LLVM::GlobalOp> llvmGlobals;
+  llvm::StringMap<mlir::LLVM::LLVMFuncOp> llvmFunctions;
+  const mlirclang::CompilerOptions &options;
+  MLIRAction(const mlirclang::CompilerOptions &options,
+             mlir::OwningOpRef<mlir::ModuleOp> &module)
+      : module(module), options(options) {
+    emitIfFound.insert(options.function);
   }
   std::unique_ptr<clang::ASTConsumer>
   CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
     return std::unique_ptr<clang::ASTConsumer>(new MLIRASTConsumer(
         emitIfFound, done, llvmStringGlobals, globals, functions, llvmGlobals,
-        llvmFunctions, CI.getPreprocessor(), CI.getASTContext(), module,
-        CI.getSourceManager(), CI.getCodeGenOpts()));
+        llvmFunctions, options, CI.getPreprocessor(), CI.getASTContext(),
+        module, CI.getSourceManager(), CI.getCodeGenOpts()));
   }
 };
 
@@ -5847,12 +6329,13 @@ mlir::Value MLIRScanner::getTypeAlign(mlir::Location loc, clang::QualType t) {
 
 #include "clang/Frontend/TextDiagnosticBuffer.h"
 
-static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
-                      std::string fn, std::vector<std::string> includeDirs,
-                      std::vector<std::string> defines,
-                      mlir::OwningOpRef<mlir::ModuleOp> &module,
-                      llvm::Triple &triple, llvm::DataLayout &DL,
-                      llvm::Triple &gpuTriple, llvm::DataLayout &gpuDL) {
+bool mlirclang::parseMLIR(const char *Argv0,
+                          std::vector<std::string> filenames,
+                          const CompilerOptions &options,
+                          mlir::OwningOpRef<mlir::ModuleOp> &module,
+                          llvm::Triple &triple, llvm::DataLayout &DL,
+                          llvm::Triple &gpuTriple, llvm::DataLayout &gpuDL,
+                          llvm::ArrayRef<SourceBuffer> buffers) {
 
   IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
   // Buffer diagnostics from argument parsing so that we can output them using a
@@ -5861,62 +6344,79 @@ static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
   TextDiagnosticBuffer *DiagsBuffer = new TextDiagnosticBuffer;
   DiagnosticsEngine Diags(DiagID, &*DiagOpts, DiagsBuffer);
 
+  // Sources handed over in memory are layered on top of the real file system,
+  // so they can still include headers from disk.
+  IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS(
+      new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem()));
+  if (!buffers.empty()) {
+    IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> MemFS(
+        new llvm::vfs::InMemoryFileSystem);
+    for (const auto &buffer : buffers) {
+      MemFS->addFile(buffer.name, /*ModificationTime*/ 0,
+                     llvm::MemoryBuffer::getMemBufferCopy(buffer.contents,
+                                                          buffer.name));
+      filenames.push_back(buffer.name);
+    }
+    VFS->pushOverlay(MemFS);
+  }
+
   bool Success;
   //{
   const char *binary = Argv0; // CudaLower ? "clang++" : "clang";
-  const unique_ptr<Driver> driver(
-      new Driver(binary, llvm::sys::getDefaultTargetTriple(), Diags));
+  const unique_ptr<Driver> driver(new Driver(
+      binary, llvm::sys::getDefaultTargetTriple(), Diags, "clang LLVM compiler",
+      VFS));
   mlirclang::ArgumentList Argv;
   Argv.push_back(binary);
   for (const auto &filename : filenames) {
     Argv.emplace_back(filename);
   }
-  if (FOpenMP)
+  if (options.openMP)
     Argv.push_back("-fopenmp");
-  if (TargetTripleOpt != "") {
+  if (options.targetTriple != "") {
     Argv.push_back("-target");
-    Argv.emplace_back(TargetTripleOpt);
+    Argv.emplace_back(options.targetTriple);
   }
-  if (McpuOpt != "") {
-    Argv.emplace_back("-mcpu=", McpuOpt);
+  if (options.mcpu != "") {
+    Argv.emplace_back("-mcpu=", options.mcpu);
   }
-  if (Standard != "") {
-    Argv.emplace_back("-std=", Standard);
+  if (options.standard != "") {
+    Argv.emplace_back("-std=", options.standard);
   }
-  if (ResourceDir != "") {
+  if (options.resourceDir != "") {
     Argv.push_back("-resource-dir");
-    Argv.emplace_back(ResourceDir);
+    Argv.emplace_back(options.resourceDir);
   }
-  if (SysRoot != "") {
+  if (options.sysRoot != "") {
     Argv.push_back("--sysroot");
-    Argv.emplace_back(SysRoot);
+    Argv.emplace_back(options.sysRoot);
   }
-  if (Verbose) {
+  if (options.verbose) {
     Argv.push_back("-v");
   }
-  if (NoCUDAInc) {
+  if (options.noCUDAInc) {
     Argv.push_back("-nocudainc");
   }
-  if (NoCUDALib) {
+  if (options.noCUDALib) {
     Argv.push_back("-nocudalib");
   }
-  if (CUDAGPUArch != "") {
-    Argv.emplace_back("--cuda-gpu-arch=", CUDAGPUArch);
+  if (options.cudaGPUArch != "") {
+    Argv.emplace_back("--cuda-gpu-arch=", options.cudaGPUArch);
   }
-  if (CUDAPath != "") {
-    Argv.emplace_back("--cuda-path=", CUDAPath);
+  if (options.cudaPath != "") {
+    Argv.emplace_back("--cuda-path=", options.cudaPath);
   }
-  if (MArch != "") {
-    Argv.emplace_back("-march=", MArch);
+  if (options.march != "") {
+    Argv.emplace_back("-march=", options.march);
   }
-  for (const auto &dir : includeDirs) {
+  for (const auto &dir : options.includeDirs) {
     Argv.push_back("-I");
     Argv.emplace_back(dir);
   }
-  for (const auto &define : defines) {
+  for (const auto &define : options.defines) {
     Argv.emplace_back("-D", define);
   }
-  for (const auto &Include : Includes) {
+  for (const auto &Include : options.includes) {
     Argv.push_back("-include");
     Argv.emplace_back(Include);
   }
@@ -5929,7 +6429,7 @@ static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
   if (Jobs.size() < 1)
     return false;
 
-  MLIRAction Act(fn, module);
+  MLIRAction Act(options, module);
 
   for (auto &job : Jobs) {
     std::unique_ptr<CompilerInstance> Clang(new CompilerInstance());
@@ -5945,12 +6445,13 @@ static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
                                                  Diags);
     Clang->getInvocation().getFrontendOpts().DisableFree = false;
 
-    void *GetExecutablePathVP = (void *)(intptr_t)GetExecutablePath;
+    // This just needs to be some symbol in the binary.
+    void *MainAddr = (void *)(intptr_t)mlirclang::parseMLIR;
     // Infer the builtin include path if unspecified.
     if (Clang->getHeaderSearchOpts().UseBuiltinIncludes &&
         Clang->getHeaderSearchOpts().ResourceDir.size() == 0)
       Clang->getHeaderSearchOpts().ResourceDir =
-          CompilerInvocation::GetResourcesPath(Argv0, GetExecutablePathVP);
+          CompilerInvocation::GetResourcesPath(Argv0, MainAddr);
 
     //}
     Clang->getInvocation().getFrontendOpts().DisableFree = false;
@@ -5959,6 +6460,7 @@ static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
     Clang->createDiagnostics();
     if (!Clang->hasDiagnostics())
       return false;
+    Clang->createFileManager(VFS);
 
     DiagsBuffer->FlushDiagnostics(Clang->getDiagnostics());
     if (!Success)
@@ -6062,6 +6564,9 @@ static bool parseMLIR(const char *Argv0, std::vector<std::string> filenames,
         assert(Clang->hasSourceManager());
 
         Act.EndSourceFile();
+        // Constructs the scanner cannot compile are reported as errors.
+        if (Clang->getDiagnostics().hasErrorOccurred())
+          return false;
       }
     }
   }
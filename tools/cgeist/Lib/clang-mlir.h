@@ -10,6 +10,7 @@
 #define CLANG_MLIR_H
 
 #include "AffineUtils.h"
+#include "Compiler.h"
 #include "ValueCategory.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
@@ -18,6 +19,7 @@
 #include "mlir/Dialect/LLVMIR/NVVMDialect.h"
 #include "mlir/Dialect/Math/IR/Math.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/OpenMP/OpenMPDialect.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/OpDefinition.h"
@@ -27,11 +29,15 @@
 #include "polygeist/Ops.h"
 #include "pragmaHandler.h"
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/GlobalDecl.h"
 #include "clang/AST/StmtVisitor.h"
 #include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/HeaderSearchOptions.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/Support/CommandLine.h"
 
@@ -42,21 +48,20 @@
 using namespace clang;
 using namespace mlir;
 
-extern llvm::cl::opt<std::string> PrefixABI;
-
 struct LoopContext {
   mlir::Value keepRunning;
   mlir::Value noBreak;
 };
 
 struct MLIRASTConsumer : public ASTConsumer {
-  std::set<std::string> &emitIfFound;
-  std::set<std::string> &done;
-  std::map<std::string, mlir::LLVM::GlobalOp> &llvmStringGlobals;
-  std::map<std::string, std::pair<mlir::memref::GlobalOp, bool>> &globals;
-  std::map<std::string, mlir::func::FuncOp> &functions;
-  std::map<std::string, mlir::LLVM::GlobalOp> &llvmGlobals;
-  std::map<std::string, mlir::LLVM::LLVMFuncOp> &llvmFunctions;
+  llvm::StringSet<> &emitIfFound;
+  llvm::StringSet<> &done;
+  llvm::StringMap<mlir::LLVM::GlobalOp> &llvmStringGlobals;
+  llvm::StringMap<std::pair<mlir::memref::GlobalOp, bool>> &globals;
+  llvm::StringMap<mlir::func::FuncOp> &functions;
+  llvm::StringMap<mlir::LLVM::GlobalOp> &llvmGlobals;
+  llvm::StringMap<mlir::LLVM::LLVMFuncOp> &llvmFunctions;
+  const mlirclang::CompilerOptions &options;
   Preprocessor &PP;
   ASTContext &astContext;
   mlir::OwningOpRef<mlir::ModuleOp> &module;
@@ -74,20 +79,21 @@ struct MLIRASTConsumer : public ASTConsumer {
   LLVM::TypeToLLVMIRTranslator reverseTypeTranslator;
 
   MLIRASTConsumer(
-      std::set<std::string> &emitIfFound, std::set<std::string> &done,
-      std::map<std::string, mlir::LLVM::GlobalOp> &llvmStringGlobals,
-      std::map<std::string, std::pair<mlir::memref::GlobalOp, bool>> &globals,
-      std::map<std::string, mlir::func::FuncOp> &functions,
-      std::map<std::string, mlir::LLVM::GlobalOp> &llvmGlobals,
-      std::map<std::string, mlir::LLVM::LLVMFuncOp> &llvmFunctions,
-      Preprocessor &PP, ASTContext &astContext,
+      llvm::StringSet<> &emitIfFound, llvm::StringSet<> &done,
+      llvm::StringMap<mlir::LLVM::GlobalOp> &llvmStringGlobals,
+      llvm::StringMap<std::pair<mlir::memref::GlobalOp, bool>> &globals,
+      llvm::StringMap<mlir::func::FuncOp> &functions,
+      llvm::StringMap<mlir::LLVM::GlobalOp> &llvmGlobals,
+      llvm::StringMap<mlir::LLVM::LLVMFuncOp> &llvmFunctions,
+      const mlirclang::CompilerOptions &options, Preprocessor &PP,
+      ASTContext &astContext,
       mlir::OwningOpRef<mlir::ModuleOp> &module, clang::SourceManager &SM,
       CodeGenOptions &codegenops)
       : emitIfFound(emitIfFound), done(done),
         llvmStringGlobals(llvmStringGlobals), globals(globals),
         functions(functions), llvmGlobals(llvmGlobals),
-        llvmFunctions(llvmFunctions), PP(PP), astContext(astContext),
-        module(module), SM(SM), lcontext(), llvmMod("tmp", lcontext),
+        llvmFunctions(llvmFunctions), options(options), PP(PP),
+        astContext(astContext), module(module), SM(SM), lcontext(), llvmMod("tmp", lcontext),
         codegenops(codegenops),
         CGM(astContext, nullptr, PP.getHeaderSearchInfo().getHeaderSearchOpts(),
             PP.getPreprocessorOpts(), codegenops, llvmMod, PP.getDiagnostics()),
@@ -100,11 +106,34 @@ struct MLIRASTConsumer : public ASTConsumer {
 
   ~MLIRASTConsumer() {}
 
+  /// Return the mangled name of the given function. Constructors and
+  /// destructors are named by their complete-object variant and CUDA kernels
+  /// by their device-side symbol if `getDeviceStub` is set. CGM memoizes the
+  /// names and owns them for its lifetime.
+  StringRef getMangledFunctionName(const FunctionDecl *FD,
+                                   bool getDeviceStub = false);
+
   mlir::func::FuncOp GetOrCreateMLIRFunction(const FunctionDecl *FD,
                                              bool getDeviceStub = false);
 
+  /// Whether the record `RD`, of LLVM type `ST` if known, is kept as an LLVM
+  /// struct rather than a memref of its fields.
+  bool isLLVMStructABI(const RecordDecl *RD, llvm::StructType *ST);
+
   mlir::LLVM::LLVMFuncOp GetOrCreateLLVMFunction(const FunctionDecl *FD);
   mlir::LLVM::LLVMFuncOp GetOrCreateFreeFunction();
+  /// Declare `omp_get_num_threads`, which sizes taskloops without a
+  /// grainsize or num_tasks clause.
+  mlir::LLVM::LLVMFuncOp GetOrCreateOMPNumThreadsFunction();
+  /// Declare `__polygeist_simd(safelen, simdlen)`, which marks the latch of a
+  /// `#pragma omp simd` loop until the lowering to LLVM IR replaces it with
+  /// the loop's vectorization metadata. The memory effect analyses know the
+  /// call accesses no memory.
+  mlir::LLVM::LLVMFuncOp GetOrCreateSimdHintFunction();
+  /// The vector function ABI names of the variants of `FD` declared with
+  /// `#pragma omp declare simd`, for the function symbol `name`.
+  std::vector<std::string> getDeclareSimdVariants(const FunctionDecl *FD,
+                                                  StringRef name);
   mlir::Value CallMalloc(mlir::OpBuilder &builder, mlir::Location loc,
                          mlir::Value arg);
 
@@ -131,7 +160,8 @@ struct MLIRASTConsumer : public ASTConsumer {
 
   void HandleDeclContext(DeclContext *DC);
 
-  std::map<const clang::RecordType *, mlir::LLVM::LLVMStructType> typeCache;
+  llvm::DenseMap<const clang::RecordType *, mlir::LLVM::LLVMStructType>
+      typeCache;
   mlir::Type getMLIRType(clang::QualType t, bool *implicitRef = nullptr,
                          bool allowMerge = true);
 
@@ -205,6 +235,52 @@ private:
                            mlir::Value lb, mlir::Value ub,
                            const mlirclang::AffineLoopDescriptor &descr);
 
+  /// The bounds of each loop of an OpenMP loop directive, as index values.
+  /// `finals` holds the value of the counter after the last iteration.
+  void getOMPLoopBounds(clang::OMPLoopDirective *fors,
+                        SmallVectorImpl<mlir::Value> &inits,
+                        SmallVectorImpl<mlir::Value> &finals,
+                        SmallVectorImpl<mlir::Value> &incs);
+
+  /// The clauses of a task or taskloop directive, evaluated where the
+  /// directive is encountered.
+  /// A variable each task gets its own copy of.
+  struct OMPTaskPrivate {
+    VarDecl *var;
+    /// The value of a firstprivate scalar when the task is created.
+    mlir::Value init;
+    /// The storage of a firstprivate array, and the heap copy of it made
+    /// when the task is created.
+    mlir::Value array;
+    mlir::Value snapshot;
+  };
+
+  struct OMPTaskClauses {
+    mlir::Value ifExpr;
+    mlir::Value finalExpr;
+    mlir::Value priority;
+    bool untied = false;
+    bool mergeable = false;
+    bool depends = false;
+    std::vector<OMPTaskPrivate> privates;
+  };
+
+  OMPTaskClauses getOMPTaskClauses(mlir::Location loc,
+                                   clang::OMPExecutableDirective *dir);
+
+  /// Creates an empty omp.task with `clauses`, copying the firstprivate
+  /// arrays for it.
+  mlir::omp::TaskOp createOMPTask(mlir::Location loc, OMPTaskClauses &clauses);
+
+  /// Allocates the private variables of a task in the current allocation
+  /// scope and records the variables they shadow in `prev`.
+  void privatizeOMPVariables(mlir::Location loc, const OMPTaskClauses &clauses,
+                             std::map<VarDecl *, ValueCategory> &prev);
+
+  /// Restores the variables shadowed by the private variables of a task.
+  void restoreOMPVariables(const OMPTaskClauses &clauses,
+                           std::map<VarDecl *, ValueCategory> &prev);
+
 public:
   const FunctionDecl *EmittingFunctionDecl;
   std::map<const ValueDecl *, ValueCategory> params;
@@ -235,6 +311,10 @@ public:
   mlir::Value getComplexPart(mlir::Location loc, mlir::Value complex, int fnum);
   ValueCategory getComplexPartRef(mlir::Location loc, mlir::Value complex,
                                   int fnum);
+  ValueCategory createComplexBinOp(mlir::Location loc,
+                                   clang::BinaryOperatorKind opcode,
+                                   mlir::Value lhs, mlir::Value rhs,
+                                   clang::QualType cty);
 
   ValueCategory VisitDeclStmt(clang::DeclStmt *decl);
 
@@ -282,6 +362,18 @@ public:
   ValueCategory
   VisitOMPParallelForDirective(clang::OMPParallelForDirective *fors);
 
+  ValueCategory VisitOMPTaskDirective(clang::OMPTaskDirective *task);
+
+  ValueCategory VisitOMPTaskLoopDirective(clang::OMPTaskLoopDirective *fors);
+
+  ValueCategory VisitOMPTaskwaitDirective(clang::OMPTaskwaitDirective *);
+
+  ValueCategory VisitOMPTaskyieldDirective(clang::OMPTaskyieldDirective *);
+
+  ValueCategory VisitOMPTaskgroupDirective(clang::OMPTaskgroupDirective *);
+
+  ValueCategory VisitOMPSimdDirective(clang::OMPSimdDirective *fors);
+
   ValueCategory VisitWhileStmt(clang::WhileStmt *fors);
 
   ValueCategory VisitDoStmt(clang::DoStmt *fors);
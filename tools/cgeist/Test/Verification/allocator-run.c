@@ -0,0 +1,64 @@
+// RUN: cgeist %s %stdinclude -O2 -polygeist-allocator=hugepage -o %t && %t | FileCheck %s
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HUGE_PAGE (2 << 20)
+
+int main() {
+  char *small = (char *)malloc(100);
+  // CHECK: small aligned 1
+  printf("small aligned %d\n", (unsigned long)small % 64 == 0);
+
+  char *big = (char *)malloc(3 * HUGE_PAGE + 1);
+  // CHECK: big aligned 1
+  printf("big aligned %d\n", (unsigned long)big % HUGE_PAGE == 0);
+  for (int i = 0; i < 3 * HUGE_PAGE + 1; i += 4096)
+    big[i] = (char)(i / 4096);
+  big[3 * HUGE_PAGE] = 42;
+
+  // Growing a huge page allocation keeps its contents.
+  big = (char *)realloc(big, 5 * HUGE_PAGE);
+  int kept = big[3 * HUGE_PAGE] == 42;
+  for (int i = 0; i < 3 * HUGE_PAGE; i += 4096)
+    kept &= big[i] == (char)(i / 4096);
+  // CHECK: grown kept 1
+  printf("grown kept %d\n", kept);
+
+  // Shrinking within the rounded size keeps the allocation in place.
+  char *shrunk = (char *)realloc(big, 4 * HUGE_PAGE + 1);
+  // CHECK: shrunk in place 1
+  printf("shrunk in place %d\n", shrunk == big);
+
+  // A freed mapping is handed out again to an allocation of the same size.
+  unsigned long freed = (unsigned long)shrunk;
+  free(shrunk);
+  char *again = (char *)malloc(5 * HUGE_PAGE);
+  // CHECK: reused 1
+  printf("reused %d\n", (unsigned long)again == freed);
+
+  // Small allocations growing past a huge page move to a mapping.
+  small[99] = 7;
+  small = (char *)realloc(small, 2 * HUGE_PAGE);
+  // CHECK: small grown 1 1
+  printf("small grown %d %d\n", small[99] == 7,
+         (unsigned long)small % HUGE_PAGE == 0);
+
+  // Cleared allocations are zero even when they reuse a written mapping.
+  unsigned long written = (unsigned long)again;
+  again[HUGE_PAGE] = 1;
+  free(again);
+  again = (char *)calloc(5, HUGE_PAGE);
+  // CHECK: cleared 1 0
+  printf("cleared %d %d\n", (unsigned long)again == written, again[HUGE_PAGE]);
+
+  char *page = (char *)aligned_alloc(4096, 4096);
+  // CHECK: page aligned 1
+  printf("page aligned %d\n", (unsigned long)page % 4096 == 0);
+  free(page);
+
+  free(again);
+  free(small);
+  free(NULL);
+  return 0;
+}
@@ -0,0 +1,31 @@
+// RUN: cgeist %s %stdinclude --function=* -S -emit-llvm -polygeist-allocator=hugepage | FileCheck %s --implicit-check-not="@malloc(" --implicit-check-not="@free(" --implicit-check-not="@calloc(" --implicit-check-not="@aligned_alloc("
+// RUN: cgeist %s %stdinclude --function=* -S -emit-llvm | FileCheck %s --check-prefix=LIBC
+
+#include <stdlib.h>
+
+double *make(int n) {
+  return (double *)malloc(n * sizeof(double));
+}
+
+double *grow(double *p, int n) {
+  return (double *)realloc(p, n * sizeof(double));
+}
+
+double *make_aligned(int n) {
+  return (double *)aligned_alloc(4096, n * sizeof(double));
+}
+
+void release(double *p) {
+  free(p);
+}
+
+// CHECK-DAG: call {{.*}}@polygeist_malloc(i64
+// CHECK-DAG: call {{.*}}@polygeist_realloc(
+// CHECK-DAG: call {{.*}}@polygeist_aligned_alloc(i64 4096,
+// CHECK-DAG: call void @polygeist_free(
+
+// LIBC-DAG: call {{.*}}@malloc(i64
+// LIBC-DAG: call void @free(
+
+// RUN: not cgeist %s %stdinclude --function=* -S -polygeist-allocator=jemalloc 2>&1 | FileCheck %s --check-prefix=INVALID
+// INVALID: Cannot find option named 'jemalloc'
@@ -0,0 +1,37 @@
+// RUN: cgeist %s --function=* -S -immediate -o %t 2>&1 | FileCheck %s
+
+// Aggregates with the layout of an array are copied with one memcpy when they
+// have more than eight elements, and element by element otherwise.
+
+typedef struct {
+  int v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15;
+} big;
+
+typedef struct {
+  float x, y, z, w;
+} small;
+
+int copy_big(big *p) {
+  big b = *p;
+  p->v0 = 0;
+  return b.v15;
+}
+
+float copy_small(small *p) {
+  small s = *p;
+  p->x = 0;
+  return s.w;
+}
+
+// CHECK-LABEL:   func.func @copy_big(
+// CHECK-DAG:       %[[LEN:.+]] = arith.constant 64 : i64
+// CHECK-DAG:       %[[DST:.+]] = "polygeist.memref2pointer"(%{{.*}}) : (memref<{{.*}}x16xi32>) -> !llvm.ptr<i8>
+// CHECK-DAG:       %[[SRC:.+]] = "polygeist.memref2pointer"(%{{.*}}) : (memref<{{.*}}x16xi32>) -> !llvm.ptr<i8>
+// CHECK:           "llvm.intr.memcpy"(%[[DST]], %[[SRC]], %[[LEN]], %{{.*}}) : (!llvm.ptr<i8>, !llvm.ptr<i8>, i64, i1) -> ()
+// CHECK:           return
+
+// CHECK-LABEL:   func.func @copy_small(
+// CHECK-NOT:       llvm.intr.memcpy
+// CHECK-COUNT-4:   memref.store %{{.*}}, %{{.*}}[%{{.*}}, %{{.*}}] : memref<{{.*}}x4xf32>
+// CHECK-NOT:       llvm.intr.memcpy
+// CHECK:           return
@@ -0,0 +1,78 @@
+// RUN: cgeist %s %stdinclude --function=* -S | FileCheck %s
+// RUN: cgeist %s %stdinclude --function=* -S -emit-llvm | FileCheck %s --check-prefix=LLVM
+
+int acquire(int *flag) {
+  return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+}
+
+void release(int *flag, int v) {
+  __atomic_store_n(flag, v, __ATOMIC_RELEASE);
+}
+
+float swap(float *x, float v) {
+  return __atomic_exchange_n(x, v, __ATOMIC_SEQ_CST);
+}
+
+unsigned fetch_sub(unsigned *x) {
+  return __atomic_fetch_sub(x, 1, __ATOMIC_RELAXED);
+}
+
+int max_fetch(int *x, int v) {
+  return __atomic_max_fetch(x, v, __ATOMIC_SEQ_CST);
+}
+
+int add_fetch(int *x, int v) {
+  return __atomic_add_fetch(x, v, __ATOMIC_ACQ_REL);
+}
+
+int dynamic_order(int *flag, int order) {
+  return __atomic_load_n(flag, order);
+}
+
+int cas(long *x, long *expected, long desired) {
+  return __atomic_compare_exchange_n(x, expected, desired, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// CHECK-NOT: __atomic_load
+// CHECK-NOT: __atomic_store
+
+// CHECK-LABEL: func.func @acquire(
+// CHECK: llvm.atomicrmw _or %{{.*}}, %c0_i32 acquire : i32
+
+// CHECK-LABEL: func.func @release(
+// CHECK: llvm.atomicrmw xchg %{{.*}}, %arg1 release : i32
+
+// CHECK-LABEL: func.func @swap(
+// CHECK: %[[I:.+]] = arith.bitcast %arg1 : f32 to i32
+// CHECK: %[[OLD:.+]] = llvm.atomicrmw xchg %{{.*}}, %[[I]] seq_cst : i32
+// CHECK: arith.bitcast %[[OLD]] : i32 to f32
+
+// CHECK-LABEL: func.func @fetch_sub(
+// CHECK: llvm.atomicrmw sub %{{.*}}, %c1_i32 monotonic : i32
+
+// CHECK-LABEL: func.func @max_fetch(
+// CHECK: %[[OLD:.+]] = llvm.atomicrmw max %{{.*}}, %arg1 seq_cst : i32
+// CHECK: arith.maxsi %[[OLD]], %arg1 : i32
+
+// CHECK-LABEL: func.func @add_fetch(
+// CHECK: %[[OLD:.+]] = memref.atomic_rmw addi %arg1, %arg0[%{{.*}}] : (i32, memref<?xi32>) -> i32
+// CHECK: arith.addi %[[OLD]], %arg1 : i32
+
+// An order only known at run time is taken as seq_cst.
+// CHECK-LABEL: func.func @dynamic_order(
+// CHECK: llvm.atomicrmw _or %{{.*}}, %c0_i32 seq_cst : i32
+
+// CHECK-LABEL: func.func @cas(
+// CHECK: %[[PAIR:.+]] = llvm.cmpxchg %{{.*}}, %{{.*}}, %arg2 acq_rel acquire : i64
+// CHECK: %[[OK:.+]] = llvm.extractvalue %[[PAIR]][1] : !llvm.struct<(i64, i1)>
+// CHECK: scf.if
+// CHECK: store
+// CHECK: arith.extui %[[OK]] : i1 to i32
+
+// LLVM-NOT: __atomic_load
+// LLVM-NOT: __atomic_store
+// LLVM-LABEL: define i32 @acquire(
+// LLVM: atomicrmw or i32* %{{.*}}, i32 0 acquire, align 4
+// LLVM-LABEL: define void @release(
+// LLVM: atomicrmw xchg i32* %{{.*}}, i32 %1 release, align 4
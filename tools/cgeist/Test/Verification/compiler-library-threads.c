@@ -0,0 +1,18 @@
+// RUN: rm -rf %t && split-file %s %t
+// RUN: cgeist-compile-test %resourcedir --function=* -concurrent %t/first.c %t/second.c | FileCheck %s
+
+// Two compilations on separate threads, whose Compilers differ in the symbol
+// prefix and in the type of pointers: neither sees the options of the other.
+
+//--- first.c
+int load(int *p) { return *p; }
+
+//--- second.c
+int load(int *p) { return *p; }
+
+// CHECK-LABEL: // source: first.c
+// CHECK:         func @first_load(%{{.+}}: memref<?xi32>) -> i32
+// CHECK-NOT:     second_
+// CHECK-LABEL: // source: second.c
+// CHECK:         func @second_load(%{{.+}}: !llvm.ptr<i32>) -> i32
+// CHECK-NOT:     first_
@@ -0,0 +1,20 @@
+// RUN: rm -rf %t && split-file %s %t
+// RUN: cgeist-compile-test %resourcedir --function=* %t/first.c %t/second.c | FileCheck %s
+
+// Two compilations through the same Compiler: each module only holds the
+// functions of its own source.
+
+//--- first.c
+int twice(int x) { return 2 * x; }
+
+//--- second.c
+float half(float x) { return x / 2; }
+
+// CHECK-LABEL: // source: first.c
+// CHECK:         func @twice(
+// CHECK:           arith.muli
+// CHECK-NOT:     func @half(
+// CHECK-LABEL: // source: second.c
+// CHECK-NOT:     func @twice(
+// CHECK:         func @half(
+// CHECK:           arith.divf
@@ -0,0 +1,26 @@
+// RUN: cgeist %s --function=* -S | FileCheck %s
+// RUN: cgeist %s --function=* -ffast-math -S | FileCheck %s --check-prefix=FAST
+
+void mul(float _Complex *a, float _Complex *b, float _Complex *c, int n) {
+  for (int i = 0; i < n; i++)
+    c[i] = a[i] * b[i];
+}
+
+void scale(float _Complex *a, float s, int n) {
+  for (int i = 0; i < n; i++)
+    a[i] /= s;
+}
+
+// CHECK-LABEL:   func @mul(
+// CHECK:           complex.create
+// CHECK:           complex.create
+// CHECK:           %[[M:.+]] = complex.mul %{{.+}}, %{{.+}} : complex<f32>
+// CHECK-DAG:       complex.re %[[M]] : complex<f32>
+// CHECK-DAG:       complex.im %[[M]] : complex<f32>
+
+// CHECK-LABEL:   func @scale(
+// CHECK-NOT:       complex.div
+// CHECK-COUNT-2:   arith.divf %{{.+}}, %{{.+}} : f32
+
+// FAST-LABEL:    func @mul(
+// FAST:            complex.mul %{{.+}}, %{{.+}} {polygeist.limited_range} : complex<f32>
@@ -0,0 +1,70 @@
+// RUN: cgeist %s --function=* -fopenmp -S | FileCheck %s
+// RUN: cgeist %s --function=* -fopenmp -S -emit-llvm | FileCheck %s --check-prefix=LLVM
+
+#pragma omp declare simd notinbranch
+float scale(float x, float y) {
+    return x * y;
+}
+
+void saxpy(float* y, float* x, float a, int n) {
+    #pragma omp simd aligned(x, y : 32) safelen(8)
+    for(int i=0; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+float dot(float* x, float* y, int n) {
+    float sum = 0;
+    #pragma omp simd reduction(+ : sum) simdlen(4)
+    for(int i=0; i < n; i++) {
+        sum += scale(x[i], y[i]);
+    }
+    return sum;
+}
+
+void stride(float* y, float* p, int n) {
+    #pragma omp simd linear(p : 2)
+    for(int i=0; i < n; i++) {
+        y[i] = *p;
+    }
+}
+
+// CHECK-LABEL:   func @scale(
+// CHECK-SAME:      passthrough = ["_ZGVbN4vv_scale", "_ZGVcN8vv_scale", "_ZGVdN8vv_scale", "_ZGVeN16vv_scale"]
+
+// CHECK-LABEL:   func @saxpy(
+// CHECK:           "llvm.intr.assume"
+// CHECK:           "llvm.intr.assume"
+// CHECK:           scf.for
+// CHECK:             arith.mulf
+// CHECK:             llvm.call @__polygeist_simd(%{{.+}}, %{{.+}}) : (i32, i32) -> ()
+
+// CHECK-LABEL:   func @dot(
+// CHECK:           scf.for
+// CHECK:             call @scale(
+// CHECK:             llvm.call @__polygeist_simd(%{{.+}}, %{{.+}}) : (i32, i32) -> ()
+
+// CHECK-LABEL:   func @stride(
+// CHECK:           scf.for %[[IV:.+]] =
+// CHECK:             %[[I:.+]] = arith.index_cast %[[IV]] : index to i64
+// CHECK:             arith.muli %[[I]], %{{.+}} : i64
+// CHECK:             memref.load
+// CHECK:             llvm.call @__polygeist_simd(
+
+// LLVM-LABEL: define {{.*}}float @scale(
+// LLVM-LABEL: define {{.*}}void @saxpy(
+// LLVM:         br {{.*}}!llvm.loop
+// LLVM-LABEL: define {{.*}}float @dot(
+// LLVM:         load float, {{.*}}!llvm.access.group ![[GROUP:[0-9]+]]
+// LLVM:         call float @scale({{.*}}) #[[VARIANTS:[0-9]+]]
+// LLVM:         br {{.*}}!llvm.loop
+// LLVM-NOT:     @__polygeist_simd
+// LLVM:       define weak_odr <4 x float> @_ZGVbN4vv_scale(<4 x float> %{{.*}}, <4 x float> %{{.*}})
+// LLVM:         extractelement <4 x float>
+// LLVM:         call float @scale(
+// LLVM:         insertelement <4 x float>
+// LLVM:       attributes #[[VARIANTS]] = { {{.*}}"vector-function-abi-variant"="{{[^"]*}}_ZGVbN4vv_scale(_ZGVbN4vv_scale)
+// LLVM-DAG:   !{!"llvm.loop.vectorize.enable", i1 true}
+// LLVM-DAG:   !{!"llvm.loop.vectorize.width", i32 8}
+// LLVM-DAG:   !{!"llvm.loop.vectorize.width", i32 4}
+// LLVM-DAG:   !{!"llvm.loop.parallel_accesses", ![[GROUP]]}
@@ -0,0 +1,26 @@
+// RUN: cgeist %s --function=* -fopenmp -S | FileCheck %s
+
+void use(int *);
+
+void spawn(int n) {
+    int buf[16];
+    for (int i = 0; i < n; i++) {
+        buf[0] = i;
+        #pragma omp task firstprivate(buf)
+        use(buf);
+    }
+    #pragma omp taskwait
+}
+
+// The array is copied when the task is created, not when it runs.
+// CHECK-LABEL:   func @spawn(
+// CHECK:           scf.for
+// CHECK:             %[[SNAP:.+]] = memref.alloc() : memref<64xi8>
+// CHECK:             "llvm.intr.memcpy"
+// CHECK:             omp.task {
+// CHECK:               %[[PRIV:.+]] = memref.alloca() : memref<16xi32>
+// CHECK:               %[[SRC:.+]] = "polygeist.memref2pointer"(%[[SNAP]])
+// CHECK:               "llvm.intr.memcpy"(%{{.+}}, %[[SRC]]
+// CHECK:               memref.dealloc %[[SNAP]] : memref<64xi8>
+// CHECK:               func.call @use(
+// CHECK:               omp.terminator
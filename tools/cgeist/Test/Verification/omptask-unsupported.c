@@ -0,0 +1,26 @@
+// RUN: not cgeist %s --function=* -fopenmp -S 2>&1 | FileCheck %s
+
+int sum(int *x, int n) {
+    int total = 0;
+    // CHECK: error: cannot compile reduction clauses of a task yet
+    #pragma omp taskloop reduction(+:total)
+    for (int i = 0; i < n; i++)
+        total += x[i];
+    return total;
+}
+
+int last(int *x, int n) {
+    int v = 0;
+    // CHECK: error: cannot compile lastprivate clauses of a task yet
+    #pragma omp taskloop lastprivate(v)
+    for (int i = 0; i < n; i++)
+        v = x[i];
+    return v;
+}
+
+void vla(int n) {
+    int buf[n];
+    // CHECK: error: cannot compile a firstprivate variable length array of a task yet
+    #pragma omp task firstprivate(buf)
+    buf[0] = 0;
+}
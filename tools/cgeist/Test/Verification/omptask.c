@@ -0,0 +1,58 @@
+// RUN: cgeist %s --function=* -fopenmp -S | FileCheck %s
+
+int fib(int n) {
+    int x, y;
+    if (n < 2)
+        return n;
+    #pragma omp task shared(x)
+    x = fib(n - 1);
+    #pragma omp task shared(y)
+    y = fib(n - 2);
+    #pragma omp taskwait
+    return x + y;
+}
+
+void scale(double* x, int n) {
+    #pragma omp taskloop grainsize(64)
+    for(int i=0; i < n; i++) {
+        x[i] *= 2;
+    }
+}
+
+void scale_nogroup(double* x, int n) {
+    #pragma omp taskloop num_tasks(8) nogroup
+    for(int i=0; i < n; i++) {
+        x[i] *= 2;
+    }
+    #pragma omp taskgroup
+    {
+        #pragma omp task
+        x[0] = 0;
+    }
+}
+
+// CHECK-LABEL:   func @fib(
+// CHECK:           omp.task {
+// CHECK:             func.call @fib(
+// CHECK:             omp.terminator
+// CHECK:           omp.task {
+// CHECK:             func.call @fib(
+// CHECK:             omp.terminator
+// CHECK:           omp.taskwait
+
+// CHECK-LABEL:   func @scale(
+// CHECK:           omp.taskgroup {
+// CHECK:             scf.for
+// CHECK:               omp.task {
+// CHECK:                 scf.for
+// CHECK:                   arith.mulf
+// CHECK:                 omp.terminator
+// CHECK:             omp.terminator
+
+// CHECK-LABEL:   func @scale_nogroup(
+// CHECK-NOT:       omp.taskgroup
+// CHECK:           scf.for
+// CHECK:             omp.task {
+// CHECK:               arith.mulf
+// CHECK:           omp.taskgroup {
+// CHECK:             omp.task {
@@ -0,0 +1,54 @@
+// RUN: cgeist %s --function=decode -S | FileCheck %s
+// RUN: cgeist %s --function=decode -S -emit-llvm | FileCheck %s --check-prefix=LLVM
+
+int decode(int op, int a, int b) {
+  int r = 0;
+  switch (op) {
+  case 0:
+    r = a + b;
+    break;
+  case 1:
+  case 2:
+    r = a - b;
+    break;
+  case 3:
+    r = a * b;
+    break;
+  case 4 ... 6:
+    r = a ^ b;
+    break;
+  case 100 ... 1000:
+    r = a;
+    break;
+  default:
+    r = b;
+    break;
+  }
+  return r;
+}
+
+// CHECK:   func @decode(%[[arg0:.+]]: i32, %[[arg1:.+]]: i32, %[[arg2:.+]]: i32) -> i32
+// CHECK:     switch %[[arg0]] : i32, [
+// CHECK-NEXT:       default: ^[[range:.+]],
+// CHECK-NEXT:       0: ^[[add:[^(,]+]]
+// CHECK-NEXT:       1: ^[[sub:[^(,]+]]
+// CHECK-NEXT:       2: ^[[sub]]
+// CHECK-NEXT:       3: ^[[mul:[^(,]+]]
+// CHECK-NEXT:       4: ^[[xor:[^(,]+]]
+// CHECK-NEXT:       5: ^[[xor]]
+// CHECK-NEXT:       6: ^[[xor]]
+// CHECK-NEXT:     ]
+// CHECK:   ^[[range]]:
+// CHECK:     arith.subi %[[arg0]]
+// CHECK:     arith.cmpi ule
+
+// LLVM: define i32 @decode(i32 %0, i32 %1, i32 %2)
+// LLVM:   switch i32 %0, label %[[default:.+]] [
+// LLVM-NEXT:     i32 0, label %[[add:.+]]
+// LLVM-NEXT:     i32 1, label %[[sub:.+]]
+// LLVM-NEXT:     i32 2, label %[[sub]]
+// LLVM-NEXT:     i32 3, label %[[mul:.+]]
+// LLVM-NEXT:     i32 4, label %[[xor:.+]]
+// LLVM-NEXT:     i32 5, label %[[xor]]
+// LLVM-NEXT:     i32 6, label %[[xor]]
+// LLVM-NEXT:   ]
@@ -0,0 +1,29 @@
+// RUN: cgeist %s --function=pick -S | FileCheck %s
+
+// The range 500 ... 100 is empty: it must not match anything, in particular
+// not through an unsigned range check that wraps around.
+int pick(int op) {
+  int r = 0;
+  switch (op) {
+  case 1:
+    r = 10;
+    break;
+  case 500 ... 100:
+    r = 20;
+    break;
+  case 7 ... 3:
+    r = 30;
+    break;
+  default:
+    r = 40;
+    break;
+  }
+  return r;
+}
+
+// CHECK:   func @pick(%[[arg0:.+]]: i32) -> i32
+// CHECK:     switch %[[arg0]] : i32, [
+// CHECK-NEXT:       default: ^{{.+}},
+// CHECK-NEXT:       1: ^{{.+}}
+// CHECK-NEXT:     ]
+// CHECK-NOT:   arith.cmpi ule
@@ -0,0 +1,25 @@
+// RUN: cgeist %s --function=* -S -threads=1 > %t.serial.mlir
+// RUN: cgeist %s --function=* -S -threads=4 > %t.parallel.mlir
+// RUN: diff %t.serial.mlir %t.parallel.mlir
+// RUN: FileCheck %s < %t.parallel.mlir
+
+int square(int x) {
+  int y = x;
+  return y * y;
+}
+
+int sum(int *a, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i];
+  return s;
+}
+
+void scale(double *a, double f, int n) {
+  for (int i = 0; i < n; i++)
+    a[i] *= f;
+}
+
+// CHECK-DAG: func @square(
+// CHECK-DAG: func @sum(
+// CHECK-DAG: func @scale(
@@ -0,0 +1,16 @@
+// RUN: echo '{"version": 1, "entries": [{"source": "tuningdb.c", "function": "kernel", "time": 1.0, "options": {"raise-scf-to-affine": true}}, {"source": "other.c", "options": {"raise-scf-to-affine": false}}]}' > %t.json
+// RUN: cgeist %s --function=kernel -S -tuning-db=%t.json | FileCheck %s
+// RUN: cgeist %s --function=kernel -S -tuning-db=%t.json -raise-scf-to-affine=0 | FileCheck %s --check-prefix=PINNED
+
+void kernel(int n, double *a) {
+  for (int i = 0; i < n; i++)
+    a[i] = 0;
+}
+
+// CHECK: func @kernel
+// CHECK: affine.for
+// CHECK: affine.store
+
+// PINNED: func @kernel
+// PINNED-NOT: affine.for
+// PINNED: scf.for
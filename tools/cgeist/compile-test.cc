@@ -0,0 +1,111 @@
+//===- compile-test.cc - Drive the cgeist compiler library ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Compiles each input file separately, in memory, with one shared
+// mlirclang::Compiler and prints the resulting modules in order. With
+// -concurrent, every input is compiled on a thread of its own by a Compiler
+// with its own options instead. Used by the tests of the compiler library.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/IR/MLIRContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Lib/Compiler.h"
+
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> inputFileNames(cl::Positional, cl::OneOrMore,
+                                            cl::desc("<Specify input file>"));
+
+static cl::opt<std::string> cfunction("function",
+                                      cl::desc("<Specify function>"),
+                                      cl::init("main"));
+
+static cl::opt<std::string> resourceDir("resource-dir", cl::init(""),
+                                        cl::desc("Resource-dir"));
+
+static cl::opt<bool> concurrent(
+    "concurrent", cl::init(false),
+    cl::desc("Compile each input on its own thread, prefixing its symbols "
+             "with the input's file stem, and using memrefs for pointers "
+             "only in the first input"));
+
+/// Compiles the file `name` with `compiler` and prints the module to
+/// `output`. Returns the exit code of the tool.
+static int compileFile(const mlirclang::Compiler &compiler, StringRef name,
+                       std::string &output) {
+  auto buffer = MemoryBuffer::getFile(name);
+  if (!buffer) {
+    errs() << "cannot read " << name << "\n";
+    return 1;
+  }
+  mlirclang::SourceBuffer source = {name.str(),
+                                    (*buffer)->getBuffer().str()};
+
+  mlir::MLIRContext context;
+  auto module = compiler.compileToMLIR(context, source);
+  if (!module) {
+    errs() << "compilation of " << name << " failed\n";
+    return 2;
+  }
+  raw_string_ostream os(output);
+  os << "// source: " << sys::path::filename(name) << "\n";
+  module->print(os);
+  os << "\n";
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM y(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "cgeist compiler library driver\n");
+
+  mlirclang::CompilerOptions options;
+  options.function = cfunction;
+  options.resourceDir = resourceDir;
+
+  std::vector<std::string> outputs(inputFileNames.size());
+  std::vector<int> results(inputFileNames.size(), 0);
+  if (concurrent) {
+    // Each thread has its own Compiler, whose options differ in the ABI
+    // settings the frontend reads.
+    std::vector<std::thread> threads;
+    for (unsigned i = 0, e = inputFileNames.size(); i < e; ++i) {
+      mlirclang::CompilerOptions own = options;
+      own.prefixABI = (sys::path::stem(inputFileNames[i]) + "_").str();
+      own.memRefABI = i == 0;
+      threads.emplace_back([&, i, own]() {
+        mlirclang::Compiler compiler(own, argv[0]);
+        results[i] = compileFile(compiler, inputFileNames[i], outputs[i]);
+      });
+    }
+    for (std::thread &thread : threads)
+      thread.join();
+  } else {
+    mlirclang::Compiler compiler(options, argv[0]);
+    for (unsigned i = 0, e = inputFileNames.size(); i < e; ++i) {
+      results[i] = compileFile(compiler, inputFileNames[i], outputs[i]);
+      if (results[i])
+        break;
+    }
+  }
+
+  for (unsigned i = 0, e = inputFileNames.size(); i < e; ++i) {
+    if (results[i])
+      return results[i];
+    outs() << outputs[i];
+  }
+  return 0;
+}
@@ -55,13 +55,16 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/ThreadPool.h"
 #include <fstream>
 
 #include "polygeist/Dialect.h"
 #include "polygeist/Passes/Passes.h"
 
 #include "ArgumentList.h"
+#include "Lib/Compiler.h"
 
 using namespace llvm;
 
@@ -73,6 +76,11 @@ static cl::opt<bool> CudaLower("cuda-lower", cl::init(false),
 static cl::opt<bool> EmitCuda("emit-cuda", cl::init(false),
                               cl::desc("Emit CUDA code"));
 
+static cl::opt<bool> CudaInlineAll(
+    "cuda-inline-all", cl::init(false),
+    cl::desc("Inline every device function into the kernels when lowering "
+             "CUDA, not only those containing barriers or shared memory"));
+
 static cl::opt<bool>
     OutputIntermediateGPU("output-intermediate-gpu", cl::init(false),
                           cl::desc("Output intermediate gpu code"));
@@ -131,16 +139,101 @@ static cl::opt<bool> ImmediateMLIR("immediate", cl::init(false),
 static cl::opt<bool> RaiseToAffine("raise-scf-to-affine", cl::init(false),
                                    cl::desc("Raise SCF to Affine"));
 
+static cl::opt<bool> LoopInterchange(
+    "loop-interchange", cl::init(false),
+    cl::desc("With -raise-scf-to-affine, permute loop nests so that the "
+             "innermost loop has the smallest memory stride"));
+
+static cl::opt<bool> LoopUnswitch(
+    "unswitch-loops", cl::init(false),
+    cl::desc("With -raise-scf-to-affine, version loops to remove "
+             "loop-invariant conditionals and conditionals on the induction "
+             "variable"));
+
+static cl::opt<unsigned> UnswitchBudget(
+    "unswitch-budget", cl::init(256),
+    cl::desc("Operations -unswitch-loops may add to a function"));
+
+static cl::opt<bool> LoopIdiom(
+    "loop-idiom", cl::init(false),
+    cl::desc("Replace copy and fill loop nests with memcpy and memset"));
+
+static cl::opt<bool> PredictiveCommoning(
+    "predictive-commoning", cl::init(false),
+    cl::desc("With -raise-scf-to-affine, carry values repeated by later loop "
+             "iterations in registers"));
+
+static cl::opt<bool> NonTemporalStores(
+    "nontemporal-stores", cl::init(false),
+    cl::desc("With -raise-scf-to-affine, make stores streaming through arrays "
+             "larger than the last level cache non-temporal"));
+
+static cl::opt<unsigned>
+    LLCSize("llc-size", cl::init(16777216),
+            cl::desc("Bytes of the last level cache for -nontemporal-stores"));
+
 static cl::opt<bool> ScalarReplacement("scal-rep", cl::init(true),
                                        cl::desc("Raise SCF to Affine"));
 
 static cl::opt<bool> LoopUnroll("unroll-loops", cl::init(false),
                                 cl::desc("Unroll Affine Loops"));
 
+static cl::opt<unsigned> UnrollSize("unroll-size", cl::init(32),
+                                    cl::desc("Unroll factor for -unroll-loops"));
+
+static cl::opt<std::string>
+    TuningDB("tuning-db", cl::init(""),
+             cl::desc("Autotuning database to take the pass configuration "
+                      "from, as written by polygeist-tune"));
+
 static cl::opt<bool>
     DetectReduction("detect-reduction", cl::init(false),
                     cl::desc("Detect reduction in inner most loop"));
 
+static cl::opt<bool> RecognizeKernels(
+    "recognize-kernels", cl::init(false),
+    cl::desc("Replace matmul, matvec, convolution and transpose loop nests "
+             "with kernel library calls (requires -raise-scf-to-affine)"));
+
+static cl::opt<std::string>
+    KernelLibrary("kernel-library", cl::init("polygeist"),
+                  cl::desc("Library for -recognize-kernels: polygeist (the "
+                           "bundled microkernels) or cblas"));
+
+namespace {
+enum class AllocatorKind { LibC, HugePage };
+} // namespace
+
+static cl::opt<AllocatorKind> PolygeistAllocator(
+    "polygeist-allocator", cl::init(AllocatorKind::LibC),
+    cl::desc("Heap allocator of the program"),
+    cl::values(clEnumValN(AllocatorKind::LibC, "libc", "The C library"),
+               clEnumValN(AllocatorKind::HugePage, "hugepage",
+                          "Cache-line aligned, huge page backed and recycled "
+                          "allocations")));
+
+static cl::opt<unsigned> KernelMinWork(
+    "kernel-min-work", cl::init(4096),
+    cl::desc("Smallest loop nest (in iterations) -recognize-kernels replaces"));
+
+static cl::opt<bool>
+    MemRefFullRank("memref-fullrank", cl::init(false),
+                   cl::desc("Get the full rank of the memref."));
+
+static cl::opt<bool> MemRefABI("memref-abi", cl::init(true),
+                               cl::desc("Use memrefs when possible"));
+
+static cl::opt<std::string> PrefixABI("prefix-abi", cl::init(""),
+                                      cl::desc("Prefix for emitted symbols"));
+
+static cl::opt<bool>
+    CStyleMemRef("c-style-memref", cl::init(true),
+                 cl::desc("Use c style memrefs when possible"));
+
+static cl::opt<bool>
+    CombinedStructABI("struct-abi", cl::init(true),
+                      cl::desc("Use literal LLVM ABI for structs"));
+
 static cl::opt<std::string> Standard("std", cl::init(""),
                                      cl::desc("C/C++ std"));
 
@@ -168,6 +261,30 @@ static cl::opt<bool> FOpenMP("fopenmp", cl::init(false),
 static cl::opt<std::string> ToCPU("cpuify", cl::init(""),
                                   cl::desc("Convert to cpu"));
 
+static cl::opt<int64_t> CPUifyCacheBudget(
+    "cpuify-cache-budget", cl::init(0),
+    cl::desc("Bytes per block of buffers for values live across barriers "
+             "above which -cpuify=distribute recomputes values instead"));
+
+static cl::opt<std::string> CPUifyReport(
+    "cpuify-report", cl::init(""),
+    cl::desc("Write the barrier buffer footprint of every function to this "
+             "file, one JSON object per line"));
+
+static cl::opt<bool> CPUifyRemarks(
+    "cpuify-remarks", cl::init(false),
+    cl::desc("Report the values cached and recomputed at every barrier"));
+
+static cl::opt<bool> RecognizeCollectives(
+    "recognize-collectives", cl::init(false),
+    cl::desc("With -cpuify, run loops of barrier-separated phases such as "
+             "shared-memory reductions and scans on one thread per block"));
+
+static cl::opt<bool> ElideSharedStaging(
+    "elide-shared-staging", cl::init(false),
+    cl::desc("With -cpuify, read tiles staged in shared memory directly from "
+             "global memory and drop the copies"));
+
 static cl::opt<std::string> MArch("march", cl::init(""),
                                   cl::desc("Architecture"));
 
@@ -177,6 +294,11 @@ static cl::opt<std::string> ResourceDir("resource-dir", cl::init(""),
 static cl::opt<std::string> SysRoot("sysroot", cl::init(""),
                                     cl::desc("sysroot"));
 
+static cl::opt<unsigned>
+    NumThreads("threads", cl::init(0),
+               cl::desc("Number of threads running function passes "
+                        "(0: one per hardware thread)"));
+
 static cl::opt<bool> EarlyVerifier("early-verifier", cl::init(false),
                                    cl::desc("Enable verifier ASAP"));
 
@@ -206,49 +328,6 @@ static cl::opt<int>
 static cl::opt<std::string>
     McpuOpt("mcpu", cl::init(""), cl::desc("Target CPU"), cl::cat(toolOptions));
 
-#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
-
-class PolygeistCudaDetectorArgList : public llvm::opt::ArgList {
-public:
-  virtual ~PolygeistCudaDetectorArgList() {}
-  template <typename... OptSpecifiers> bool hasArg(OptSpecifiers... Ids) const {
-    std::vector _Ids({Ids...});
-    for (auto &Id : _Ids) {
-      if (Id == clang::driver::options::OPT_nogpulib) {
-        continue;
-      } else if (Id == clang::driver::options::OPT_cuda_path_EQ) {
-        if (CUDAPath == "")
-          continue;
-        else
-          return true;
-      } else if (Id == clang::driver::options::OPT_cuda_path_ignore_env) {
-        continue;
-      } else {
-        continue;
-      }
-    }
-    return false;
-  }
-  StringRef getLastArgValue(llvm::opt::OptSpecifier Id,
-                            StringRef Default = "") const {
-    if (Id == clang::driver::options::OPT_cuda_path_EQ) {
-      return CUDAPath;
-    }
-    return Default;
-  }
-  const char *getArgString(unsigned Index) const override { return ""; }
-  unsigned getNumInputArgStrings() const override { return 0; }
-  const char *MakeArgStringRef(StringRef Str) const override { return ""; }
-};
-
-class MemRefInsider
-    : public mlir::MemRefElementTypeInterface::FallbackModel<MemRefInsider> {};
-
-template <typename T>
-struct PtrElementModel
-    : public mlir::LLVM::PointerElementTypeInterface::ExternalModel<
-          PtrElementModel<T>, T> {};
-
 extern int cc1_main(ArrayRef<const char *> Argv, const char *Argv0,
                     void *MainAddr);
 extern int cc1as_main(ArrayRef<const char *> Argv, const char *Argv0,
@@ -359,6 +438,19 @@ int emitBinary(char *Argv0, const char *filename,
   }
   for (const auto *arg : LinkArgs)
     Argv.push_back(arg);
+  bool LinkKernels = RecognizeKernels && KernelLibrary == "polygeist";
+  bool LinkAllocator = PolygeistAllocator == AllocatorKind::HugePage;
+  if (LinkKernels || LinkAllocator) {
+    // The bundled runtime libraries are installed next to cgeist.
+    SmallString<128> LibDir(GetExecutablePath(Argv0, true));
+    llvm::sys::path::remove_filename(LibDir);
+    llvm::sys::path::append(LibDir, "..", "lib");
+    Argv.emplace_back("-L", LibDir);
+    if (LinkKernels)
+      Argv.push_back("-lpolygeist_kernels");
+    if (LinkAllocator)
+      Argv.push_back("-lpolygeist_allocator");
+  }
 
   const unique_ptr<Compilation> compilation(
       driver->BuildCompilation(Argv.getArguments()));
@@ -395,19 +487,6 @@ int emitBinary(char *Argv0, const char *filename,
   return Res;
 }
 
-#define dump_module(PASS_MANAGER, EXEC)                                        \
-  do {                                                                         \
-    llvm::errs() << "at line" << __LINE__ << "\n";                             \
-    (void)PASS_MANAGER.run(module.get());                                      \
-    module->dump();                                                            \
-    EXEC;                                                                      \
-  } while (0)
-#undef dump_module
-#define dump_module(PASS_MANAGER, EXEC)                                        \
-  do {                                                                         \
-  } while (0)
-
-#include "Lib/clang-mlir.cc"
 int main(int argc, char **argv) {
 
   if (argc >= 1) {
@@ -481,39 +560,107 @@ int main(int argc, char **argv) {
     }
   }
 
-  mlir::DialectRegistry registry;
-  mlir::registerOpenMPDialectTranslation(registry);
-  mlir::registerLLVMDialectTranslation(registry);
+  mlirclang::CompilerOptions options;
+  options.function = cfunction;
+  options.includeDirs = includeDirs;
+  options.defines = defines;
+  options.includes = Includes;
+  options.standard = Standard;
+  options.targetTriple = TargetTripleOpt;
+  options.mcpu = McpuOpt;
+  options.march = MArch;
+  options.resourceDir = ResourceDir;
+  options.sysRoot = SysRoot;
+  options.cudaGPUArch = CUDAGPUArch;
+  options.cudaPath = CUDAPath;
+  options.noCUDAInc = NoCUDAInc;
+  options.noCUDALib = NoCUDALib;
+  options.openMP = FOpenMP;
+  options.verbose = Verbose;
+  options.showAST = ShowAST;
+  options.memRefABI = MemRefABI;
+  options.memRefFullRank = MemRefFullRank;
+  options.cStyleMemRef = CStyleMemRef;
+  options.structABI = CombinedStructABI;
+  options.prefixABI = PrefixABI;
+
+  if (Opt0)
+    options.optLevel = 0;
+  if (Opt1)
+    options.optLevel = 1;
+  if (Opt2)
+    options.optLevel = 2;
+  if (Opt3)
+    options.optLevel = 3;
+  // Disable inlining for -O0
+  options.inlining = !Opt0;
+  options.cudaLower = CudaLower;
+  options.emitCuda = EmitCuda;
+  options.cudaInlineAll = CudaInlineAll;
+  options.useOriginalGPUBlockSize = UseOriginalGPUBlockSize;
+  options.outputIntermediateGPU = OutputIntermediateGPU;
+#if POLYGEIST_ENABLE_CUDA
+  options.nvptxOptLevel = NvptxOptLevel;
+#endif
+  options.scfOpenMP = SCFOpenMP;
+  options.openMPOpt = OpenMPOpt;
+  options.parallelLICM = ParallelLICM;
+  options.innerSerialize = InnerSerialize;
+  options.earlyInnerSerialize = EarlyInnerSerialize;
+  options.raiseToAffine = RaiseToAffine;
+  options.loopInterchange = LoopInterchange;
+  options.loopUnswitch = LoopUnswitch;
+  options.unswitchBudget = UnswitchBudget;
+  options.loopIdiom = LoopIdiom;
+  options.predictiveCommoning = PredictiveCommoning;
+  options.nonTemporalStores = NonTemporalStores;
+  options.llcSize = LLCSize;
+  options.scalarReplacement = ScalarReplacement;
+  options.loopUnroll = LoopUnroll;
+  options.unrollSize = UnrollSize;
+  options.detectReduction = DetectReduction;
+  options.recognizeKernels = RecognizeKernels;
+  options.kernelLibrary = KernelLibrary;
+  options.allocator =
+      PolygeistAllocator == AllocatorKind::HugePage ? "hugepage" : "libc";
+  options.kernelMinWork = KernelMinWork;
+  options.cpuify = ToCPU;
+  options.cpuifyCacheBudget = CPUifyCacheBudget;
+  options.cpuifyReport = CPUifyReport;
+  options.cpuifyRemarks = CPUifyRemarks;
+  options.recognizeCollectives = RecognizeCollectives;
+  options.elideSharedStaging = ElideSharedStaging;
+  options.earlyVerifier = EarlyVerifier;
+  options.canonicalizeIterations = CanonicalizeIterations;
+  options.threads = NumThreads;
+  options.inBoundsGEP = InBoundsGEP;
+
+  if (TuningDB != "") {
+    // Flags given on the command line take precedence over the database.
+    llvm::StringSet<> pinned;
+    auto &registered = cl::getRegisteredOptions();
+    for (StringRef name : mlirclang::getTunableOptionNames()) {
+      auto found = registered.find(name);
+      if (found != registered.end() && found->second->getNumOccurrences())
+        pinned.insert(name);
+    }
+    if (!mlirclang::applyTuningDatabase(TuningDB, files, options, pinned))
+      return 1;
+  }
+
+  mlirclang::EmitKind kind = mlirclang::EmitKind::MLIR;
+  if (EmitOpenMPIR)
+    kind = mlirclang::EmitKind::OpenMPIR;
+  else if (EmitLLVM || !EmitAssembly)
+    kind = mlirclang::EmitKind::LLVMIR;
+  else if (EmitLLVMDialect)
+    kind = mlirclang::EmitKind::LLVMDialect;
+
   polygeist::registerGpuSerializeToCubinPass();
-  MLIRContext context(registry);
-
-  context.disableMultithreading();
-  context.getOrLoadDialect<AffineDialect>();
-  context.getOrLoadDialect<func::FuncDialect>();
-  context.getOrLoadDialect<DLTIDialect>();
-  context.getOrLoadDialect<mlir::scf::SCFDialect>();
-  context.getOrLoadDialect<mlir::async::AsyncDialect>();
-  context.getOrLoadDialect<mlir::LLVM::LLVMDialect>();
-  context.getOrLoadDialect<mlir::NVVM::NVVMDialect>();
-  context.getOrLoadDialect<mlir::gpu::GPUDialect>();
-  context.getOrLoadDialect<mlir::omp::OpenMPDialect>();
-  context.getOrLoadDialect<mlir::math::MathDialect>();
-  context.getOrLoadDialect<mlir::memref::MemRefDialect>();
-  context.getOrLoadDialect<mlir::linalg::LinalgDialect>();
-  context.getOrLoadDialect<mlir::polygeist::PolygeistDialect>();
-
-  LLVM::LLVMFunctionType::attachInterface<MemRefInsider>(context);
-  LLVM::LLVMPointerType::attachInterface<MemRefInsider>(context);
-  LLVM::LLVMArrayType::attachInterface<MemRefInsider>(context);
-  LLVM::LLVMStructType::attachInterface<MemRefInsider>(context);
-  MemRefType::attachInterface<PtrElementModel<MemRefType>>(context);
-  IndexType::attachInterface<PtrElementModel<IndexType>>(context);
-  LLVM::LLVMStructType::attachInterface<PtrElementModel<LLVM::LLVMStructType>>(
-      context);
-  LLVM::LLVMPointerType::attachInterface<
-      PtrElementModel<LLVM::LLVMPointerType>>(context);
-  LLVM::LLVMArrayType::attachInterface<PtrElementModel<LLVM::LLVMArrayType>>(
-      context);
+  std::unique_ptr<llvm::ThreadPool> threadPool;
+  MLIRContext context(MLIRContext::Threading::DISABLED);
+  mlirclang::configureThreading(context, options.threads, threadPool);
+  mlirclang::prepareMLIRContext(context);
 
   mlir::OwningOpRef<mlir::ModuleOp> module(
       mlir::ModuleOp::create(mlir::OpBuilder(&context).getUnknownLoc()));
@@ -522,10 +669,9 @@ int main(int argc, char **argv) {
   llvm::DataLayout DL("");
   llvm::Triple gpuTriple;
   llvm::DataLayout gpuDL("");
-  parseMLIR(argv[0], files, cfunction, includeDirs, defines, module, triple, DL,
-            gpuTriple, gpuDL);
-
-  mlir::PassManager pm(&context);
+  if (!mlirclang::parseMLIR(argv[0], files, options, module, triple, DL,
+                            gpuTriple, gpuDL))
+    return 1;
 
   OpPrintingFlags flags;
   if (PrintDebugInfo)
@@ -537,461 +683,28 @@ int main(int argc, char **argv) {
     llvm::errs() << "</immediate: mlir>\n";
   }
 
-  int optLevel = 0;
-  if (Opt0)
-    optLevel = 0;
-  if (Opt1)
-    optLevel = 1;
-  if (Opt2)
-    optLevel = 2;
-  if (Opt3)
-    optLevel = 3;
-
-#if !POLYGEIST_ENABLE_CUDA
-  if (EmitCuda) {
-    llvm::errs() << "error: no CUDA support, aborting\n";
-    return 1;
-  }
-#endif
-
-  auto convertGepInBounds = [](llvm::Module &llvmModule) {
-    for (auto &F : llvmModule) {
-      for (auto &BB : F) {
-        for (auto &I : BB) {
-          if (auto g = dyn_cast<GetElementPtrInst>(&I))
-            g->setIsInBounds(true);
-        }
-      }
+  // The pass appends to the report, start it afresh for this compilation.
+  if (!CPUifyReport.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream report(CPUifyReport, EC);
+    if (EC) {
+      llvm::errs() << "cannot open " << CPUifyReport << ": " << EC.message()
+                   << "\n";
+      return 1;
     }
-  };
+  }
 
-  int unrollSize = 32;
   bool LinkOMP = FOpenMP;
-  pm.enableVerifier(EarlyVerifier);
-  mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
-  GreedyRewriteConfig canonicalizerConfig;
-  canonicalizerConfig.maxIterations = CanonicalizeIterations;
-  if (true) {
-    optPM.addPass(mlir::createCSEPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    optPM.addPass(polygeist::createMem2RegPass());
-    optPM.addPass(mlir::createCSEPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    optPM.addPass(polygeist::createMem2RegPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    optPM.addPass(polygeist::createRemoveTrivialUsePass());
-    optPM.addPass(polygeist::createMem2RegPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    optPM.addPass(polygeist::createLoopRestructurePass());
-    optPM.addPass(polygeist::replaceAffineCFGPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    if (ScalarReplacement)
-      optPM.addPass(mlir::createAffineScalarReplacementPass());
-    if (ParallelLICM)
-      optPM.addPass(polygeist::createParallelLICMPass());
-    else
-      optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    optPM.addPass(polygeist::createCanonicalizeForPass());
-    optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-    if (RaiseToAffine) {
-      optPM.addPass(polygeist::createCanonicalizeForPass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      if (ParallelLICM)
-        optPM.addPass(polygeist::createParallelLICMPass());
-      else
-        optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
-      optPM.addPass(polygeist::createRaiseSCFToAffinePass());
-      optPM.addPass(polygeist::replaceAffineCFGPass());
-      if (ScalarReplacement)
-        optPM.addPass(mlir::createAffineScalarReplacementPass());
-    }
-    if (mlir::failed(pm.run(module.get()))) {
-      module->dump();
-      return 4;
-    }
-    if (mlir::failed(mlir::verify(module.get()))) {
-      module->dump();
-      return 5;
-    }
-
-#define optPM optPM2
-#define pm pm2
-    {
-      mlir::PassManager pm(&context);
-      mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
-
-      if (DetectReduction)
-        optPM.addPass(polygeist::detectReductionPass());
-
-      // Disable inlining for -O0
-      if (!Opt0) {
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM.addPass(mlir::createCSEPass());
-        // Affine must be lowered to enable inlining
-        if (RaiseToAffine)
-          optPM.addPass(mlir::createLowerAffinePass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        pm.addPass(mlir::createInlinerPass());
-        mlir::OpPassManager &optPM2 = pm.nest<mlir::func::FuncOp>();
-        optPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM2.addPass(mlir::createCSEPass());
-        optPM2.addPass(polygeist::createMem2RegPass());
-        optPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM2.addPass(mlir::createCSEPass());
-        optPM2.addPass(polygeist::createCanonicalizeForPass());
-        if (RaiseToAffine) {
-          optPM2.addPass(polygeist::createRaiseSCFToAffinePass());
-        }
-        optPM2.addPass(polygeist::replaceAffineCFGPass());
-        optPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM2.addPass(mlir::createCSEPass());
-        if (ParallelLICM)
-          optPM2.addPass(polygeist::createParallelLICMPass());
-        else
-          optPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
-        optPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      }
-      if (mlir::failed(pm.run(module.get()))) {
-        module->dump();
-        return 6;
-      }
-    }
-
-    if (CudaLower) {
-      mlir::PassManager pm(&context);
-      mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
-      optPM.addPass(mlir::createLowerAffinePass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-#if POLYGEIST_ENABLE_CUDA
-      pm.addPass(
-          polygeist::createParallelLowerPass(/* wrapParallelOps */ EmitCuda));
-      if (!EmitCuda)
-        pm.addPass(polygeist::createCudaRTLowerPass());
-#else
-      pm.addPass(polygeist::createParallelLowerPass());
-      pm.addPass(polygeist::createCudaRTLowerPass());
-#endif
-
-      pm.addPass(mlir::createSymbolDCEPass());
-      mlir::OpPassManager &noptPM = pm.nest<mlir::func::FuncOp>();
-      noptPM.addPass(
-          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      noptPM.addPass(polygeist::createMem2RegPass());
-      noptPM.addPass(
-          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      pm.addPass(mlir::createInlinerPass());
-      mlir::OpPassManager &noptPM2 = pm.nest<mlir::func::FuncOp>();
-      noptPM2.addPass(
-          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      noptPM2.addPass(polygeist::createMem2RegPass());
-      noptPM2.addPass(polygeist::createCanonicalizeForPass());
-      noptPM2.addPass(
-          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      noptPM2.addPass(mlir::createCSEPass());
-      if (ParallelLICM)
-        noptPM2.addPass(polygeist::createParallelLICMPass());
-      else
-        noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
-      noptPM2.addPass(
-          mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      if (RaiseToAffine) {
-        noptPM2.addPass(polygeist::createCanonicalizeForPass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ParallelLICM)
-          noptPM2.addPass(polygeist::createParallelLICMPass());
-        else
-          noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
-        noptPM2.addPass(polygeist::createRaiseSCFToAffinePass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        noptPM2.addPass(polygeist::replaceAffineCFGPass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (LoopUnroll)
-          noptPM2.addPass(mlir::createLoopUnrollPass(unrollSize, false, true));
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        noptPM2.addPass(mlir::createCSEPass());
-        noptPM2.addPass(polygeist::createMem2RegPass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ParallelLICM)
-          noptPM2.addPass(polygeist::createParallelLICMPass());
-        else
-          noptPM2.addPass(mlir::createLoopInvariantCodeMotionPass());
-        noptPM2.addPass(polygeist::createRaiseSCFToAffinePass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        noptPM2.addPass(polygeist::replaceAffineCFGPass());
-        noptPM2.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ScalarReplacement)
-          noptPM2.addPass(mlir::createAffineScalarReplacementPass());
-      }
-      if (mlir::failed(pm.run(module.get()))) {
-        module->dump();
-        return 7;
-      }
-    }
-
-    mlir::PassManager pm(&context);
-    mlir::OpPassManager &optPM = pm.nest<mlir::func::FuncOp>();
-    if (CudaLower) {
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      optPM.addPass(mlir::createCSEPass());
-      optPM.addPass(polygeist::createMem2RegPass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      optPM.addPass(mlir::createCSEPass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      optPM.addPass(polygeist::createCanonicalizeForPass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-
-      if (RaiseToAffine) {
-        optPM.addPass(polygeist::createCanonicalizeForPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ParallelLICM)
-          optPM.addPass(polygeist::createParallelLICMPass());
-        else
-          optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
-        optPM.addPass(polygeist::createRaiseSCFToAffinePass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM.addPass(polygeist::replaceAffineCFGPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ScalarReplacement)
-          optPM.addPass(mlir::createAffineScalarReplacementPass());
-      }
-      if (ToCPU == "continuation") {
-        optPM.addPass(polygeist::createBarrierRemovalContinuation());
-        // pm.nest<mlir::FuncOp>().addPass(mlir::createCanonicalizerPass());
-      } else if (ToCPU.size() != 0) {
-        optPM.addPass(polygeist::createCPUifyPass(ToCPU));
-      }
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      optPM.addPass(mlir::createCSEPass());
-      optPM.addPass(polygeist::createMem2RegPass());
-      optPM.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      optPM.addPass(mlir::createCSEPass());
-      if (RaiseToAffine) {
-        optPM.addPass(polygeist::createCanonicalizeForPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ParallelLICM)
-          optPM.addPass(polygeist::createParallelLICMPass());
-        else
-          optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
-        if (EarlyInnerSerialize) {
-          optPM.addPass(mlir::createLowerAffinePass());
-          optPM.addPass(polygeist::createInnerSerializationPass());
-          optPM.addPass(polygeist::createCanonicalizeForPass());
-        }
-        optPM.addPass(polygeist::createRaiseSCFToAffinePass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM.addPass(polygeist::replaceAffineCFGPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (LoopUnroll)
-          optPM.addPass(mlir::createLoopUnrollPass(unrollSize, false, true));
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM.addPass(mlir::createCSEPass());
-        optPM.addPass(polygeist::createMem2RegPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ParallelLICM)
-          optPM.addPass(polygeist::createParallelLICMPass());
-        else
-          optPM.addPass(mlir::createLoopInvariantCodeMotionPass());
-        optPM.addPass(polygeist::createRaiseSCFToAffinePass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        optPM.addPass(polygeist::replaceAffineCFGPass());
-        optPM.addPass(
-            mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-        if (ScalarReplacement)
-          optPM.addPass(mlir::createAffineScalarReplacementPass());
-      }
-    }
-    pm.addPass(mlir::createSymbolDCEPass());
-
-    if (EmitCuda || EmitLLVM || !EmitAssembly || EmitOpenMPIR ||
-        EmitLLVMDialect) {
-      pm.addPass(mlir::createLowerAffinePass());
-      if (InnerSerialize)
-        pm.addPass(polygeist::createInnerSerializationPass());
-
-      if (mlir::failed(pm.run(module.get()))) {
-        module->dump();
-        return 8;
-      }
-    }
-
-#if POLYGEIST_ENABLE_CUDA
-    if (EmitCuda) {
-      if (CudaLower)
-        pm.addPass(polygeist::createConvertParallelToGPUPass1(
-            UseOriginalGPUBlockSize));
-      // We cannot canonicalize here because we have sunk some operations in the
-      // kernel which the canonicalizer would hoist
-
-      // TODO pass in gpuDL, the format is weird
-      pm.addPass(mlir::createGpuKernelOutliningPass());
-      pm.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      // TODO maybe preserve info about which original kernel corresponds to
-      // which outlined kernel, might be useful for calls to
-      // cudaFuncSetCacheConfig e.g.
-      pm.addPass(polygeist::createConvertParallelToGPUPass2());
-      pm.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-
-      if (mlir::failed(pm.run(module.get()))) {
-        module->dump();
-        return 12;
-      }
-    }
-#endif
-
-    if (EmitLLVM || !EmitAssembly || EmitOpenMPIR || EmitLLVMDialect) {
-      mlir::PassManager pm2(&context);
-      if (SCFOpenMP) {
-        pm2.addPass(createConvertSCFToOpenMPPass());
-      } else
-        pm2.addPass(polygeist::createSerializationPass());
-      pm2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      if (OpenMPOpt) {
-        pm2.addPass(polygeist::createOpenMPOptPass());
-        pm2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      }
-      pm.nest<mlir::func::FuncOp>().addPass(polygeist::createMem2RegPass());
-      pm2.addPass(mlir::createCSEPass());
-      pm2.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-      if (mlir::failed(pm2.run(module.get()))) {
-        module->dump();
-        return 9;
-      }
-      if (!EmitOpenMPIR) {
-        module->walk([&](mlir::omp::ParallelOp) { LinkOMP = true; });
-        mlir::PassManager pm3(&context);
-        LowerToLLVMOptions options(&context);
-        options.dataLayout = DL;
-        // invalid for gemm.c init array
-        // options.useBarePtrCallConv = true;
-
-#if POLYGEIST_ENABLE_CUDA
-        if (EmitCuda) {
-          pm3.addPass(polygeist::createConvertPolygeistToLLVMPass(
-              options, CStyleMemRef, /* onlyGpuModules */ true));
-
-          using namespace clang;
-          using namespace clang::driver;
-          using namespace std;
-          IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
-          IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts =
-              new DiagnosticOptions();
-          TextDiagnosticPrinter *DiagBuffer =
-              new TextDiagnosticPrinter(llvm::errs(), &*DiagOpts);
-          DiagnosticsEngine Diags(DiagID, &*DiagOpts, DiagBuffer);
-          const unique_ptr<Driver> driver(
-              new Driver("clang", triple.str(), Diags));
-          PolygeistCudaDetectorArgList argList;
-          CudaInstallationDetector detector(*driver, triple, argList);
-
-          std::string arch = CUDAGPUArch;
-          if (arch == "")
-            arch = "sm_60";
-          std::string libDevicePath = detector.getLibDeviceFile(arch);
-          std::string ptxasPath = std::string(detector.getBinPath()) + "/ptxas";
-
-          // TODO what should the ptx version be?
-          mlir::OpPassManager &gpuPM = pm3.nest<gpu::GPUModuleOp>();
-          gpuPM.addPass(polygeist::createGpuSerializeToCubinPass(
-              gpuTriple.getTriple(), arch, "+ptx74", optLevel, NvptxOptLevel,
-              ptxasPath, libDevicePath, OutputIntermediateGPU));
-        }
-#endif
-
-        pm3.addPass(polygeist::createConvertPolygeistToLLVMPass(
-            options, CStyleMemRef, /* onlyGpuModules */ false));
-        pm3.addPass(mlir::createCanonicalizerPass(canonicalizerConfig, {}, {}));
-
-        if (mlir::failed(pm3.run(module.get()))) {
-          module->dump();
-          return 10;
-        }
-      }
-
-    } else {
-
-      if (mlir::failed(pm.run(module.get()))) {
-        module->dump();
-        return 11;
-      }
-    }
-    if (mlir::failed(mlir::verify(module.get()))) {
-      module->dump();
-      return 5;
-    }
-  }
+  if (int res = mlirclang::runPolygeistPipeline(
+          context, module, options, kind, triple, DL, gpuTriple, LinkOMP))
+    return res;
 
   if (EmitLLVM || !EmitAssembly) {
     llvm::LLVMContext llvmContext;
-    auto llvmModule = mlir::translateModuleToLLVMIR(module.get(), llvmContext);
-    if (!llvmModule) {
-      module->dump();
-      llvm::errs() << "Failed to emit LLVM IR\n";
+    auto llvmModule = mlirclang::translateToLLVMIR(module.get(), llvmContext,
+                                                   options, triple, DL);
+    if (!llvmModule)
       return -1;
-    }
-    if (InBoundsGEP) {
-      convertGepInBounds(*llvmModule);
-    }
-    for (auto &F : *llvmModule) {
-      for (auto AttrName : {"target-cpu", "tune-cpu", "target-features"})
-        if (auto V = module.get()->getAttrOfType<mlir::StringAttr>(
-                (StringRef("polygeist.") + AttrName).str())) {
-          F.addFnAttr(AttrName, V.getValue());
-        }
-    }
-    if (auto F = llvmModule->getFunction("malloc")) {
-      // allocsize
-      for (auto Attr : {llvm::Attribute::InaccessibleMemOnly,
-                        llvm::Attribute::MustProgress, llvm::Attribute::NoFree,
-                        llvm::Attribute::NoUnwind, llvm::Attribute::WillReturn})
-        F->addFnAttr(Attr);
-      F->addRetAttr(llvm::Attribute::NoAlias);
-      F->addRetAttr(llvm::Attribute::NoUndef);
-      SmallVector<llvm::Value *> todo = {F};
-      while (todo.size()) {
-        auto cur = todo.back();
-        todo.pop_back();
-        if (isa<llvm::Function>(cur)) {
-          for (auto u : cur->users())
-            todo.push_back(u);
-          continue;
-        }
-        if (auto CE = dyn_cast<llvm::ConstantExpr>(cur))
-          if (CE->isCast()) {
-            for (auto u : cur->users())
-              todo.push_back(u);
-            continue;
-          }
-        if (auto CI = dyn_cast<llvm::CallInst>(cur)) {
-          CI->addRetAttr(llvm::Attribute::NoAlias);
-          CI->addRetAttr(llvm::Attribute::NoUndef);
-        }
-      }
-    }
-    llvmModule->setDataLayout(DL);
-    llvmModule->setTargetTriple(triple.getTriple());
     if (!EmitAssembly) {
       auto tmpFile =
           llvm::sys::fs::TempFile::create("/tmp/intermediate%%%%%%%.ll");
@@ -0,0 +1,107 @@
+// Rodinia-style backprop: forward pass of the input layer as per-block
+// shared-memory tree reductions, then the weight adjustment.
+
+#include "bench.h"
+
+#ifndef IN
+#define IN (1 << 16)
+#endif
+#ifndef EPOCHS
+#define EPOCHS 10
+#endif
+#define BS 16
+#define HID BS
+
+__global__ void layerforward(const float *input, const float *w,
+                             float *partial) {
+  __shared__ float node[BS];
+  __shared__ float m[BS][BS];
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int row = BS * blockIdx.y + ty + 1;
+  int col = tx + 1;
+  if (tx == 0)
+    node[ty] = input[row];
+  __syncthreads();
+
+  m[ty][tx] = w[row * (HID + 1) + col] * node[ty];
+  __syncthreads();
+
+  for (int i = 1; i < BS; i *= 2) {
+    if (ty % (2 * i) == 0)
+      m[ty][tx] += m[ty + i][tx];
+    __syncthreads();
+  }
+  if (ty == 0)
+    partial[blockIdx.y * HID + tx] = m[0][tx];
+}
+
+__global__ void adjust_weights(const float *delta, const float *input,
+                               float *w, float *oldw) {
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int row = BS * blockIdx.y + ty + 1;
+  int col = tx + 1;
+  int i = row * (HID + 1) + col;
+  float d = 0.3f * delta[col] * input[row] + 0.3f * oldw[i];
+  w[i] += d;
+  oldw[i] = d;
+}
+
+int main() {
+  long wsize = (long)(IN + 1) * (HID + 1);
+  int blocks = IN / BS;
+  float *input = (float *)malloc((IN + 1) * sizeof(float));
+  float *w = (float *)malloc(wsize * sizeof(float));
+  float *partial = (float *)malloc(blocks * HID * sizeof(float));
+  float delta[HID + 1];
+  input[0] = 1.0f;
+  for (int i = 1; i <= IN; i++)
+    input[i] = bench_randf();
+  for (long i = 0; i < wsize; i++)
+    w[i] = bench_randf() * 0.002f - 0.001f;
+
+  float *d_input, *d_w, *d_oldw, *d_partial, *d_delta;
+  cudaMalloc((void **)&d_input, (IN + 1) * sizeof(float));
+  cudaMalloc((void **)&d_w, wsize * sizeof(float));
+  cudaMalloc((void **)&d_oldw, wsize * sizeof(float));
+  cudaMalloc((void **)&d_partial, blocks * HID * sizeof(float));
+  cudaMalloc((void **)&d_delta, (HID + 1) * sizeof(float));
+  cudaMemcpy(d_input, input, (IN + 1) * sizeof(float),
+             cudaMemcpyHostToDevice);
+  cudaMemcpy(d_w, w, wsize * sizeof(float), cudaMemcpyHostToDevice);
+  for (long i = 0; i < wsize; i++)
+    w[i] = 0.0f;
+  cudaMemcpy(d_oldw, w, wsize * sizeof(float), cudaMemcpyHostToDevice);
+
+  double start = bench_now();
+  for (int e = 0; e < EPOCHS; e++) {
+    layerforward<<<dim3(1, blocks), dim3(BS, BS)>>>(d_input, d_w, d_partial);
+    cudaMemcpy(partial, d_partial, blocks * HID * sizeof(float),
+               cudaMemcpyDeviceToHost);
+    delta[0] = 0.0f;
+    for (int j = 0; j < HID; j++) {
+      float sum = 0.0f;
+      for (int b = 0; b < blocks; b++)
+        sum += partial[b * HID + j];
+      float h = 1.0f / (1.0f + expf(-sum));
+      delta[j + 1] = h * (1.0f - h) * (0.5f - h);
+    }
+    cudaMemcpy(d_delta, delta, (HID + 1) * sizeof(float),
+               cudaMemcpyHostToDevice);
+    adjust_weights<<<dim3(1, blocks), dim3(BS, BS)>>>(d_delta, d_input, d_w,
+                                                      d_oldw);
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(w, d_w, wsize * sizeof(float), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_f(w, wsize));
+  cudaFree(d_input);
+  cudaFree(d_w);
+  cudaFree(d_oldw);
+  cudaFree(d_partial);
+  cudaFree(d_delta);
+  free(input);
+  free(w);
+  free(partial);
+  return 0;
+}
@@ -0,0 +1,53 @@
+// OpenMP reference for backprop.cu.
+
+#include "bench.h"
+
+#ifndef IN
+#define IN (1 << 16)
+#endif
+#ifndef EPOCHS
+#define EPOCHS 10
+#endif
+#define HID 16
+
+int main() {
+  long wsize = (long)(IN + 1) * (HID + 1);
+  float *input = (float *)malloc((IN + 1) * sizeof(float));
+  float *w = (float *)malloc(wsize * sizeof(float));
+  float *oldw = (float *)calloc(wsize, sizeof(float));
+  float delta[HID + 1];
+  input[0] = 1.0f;
+  for (int i = 1; i <= IN; i++)
+    input[i] = bench_randf();
+  for (long i = 0; i < wsize; i++)
+    w[i] = bench_randf() * 0.002f - 0.001f;
+
+  double start = bench_now();
+  for (int e = 0; e < EPOCHS; e++) {
+    delta[0] = 0.0f;
+    for (int j = 1; j <= HID; j++) {
+      float sum = 0.0f;
+#pragma omp parallel for reduction(+ : sum)
+      for (int i = 1; i <= IN; i++)
+        sum += w[i * (HID + 1) + j] * input[i];
+      float h = 1.0f / (1.0f + expf(-sum));
+      delta[j] = h * (1.0f - h) * (0.5f - h);
+    }
+#pragma omp parallel for
+    for (int i = 1; i <= IN; i++) {
+      for (int j = 1; j <= HID; j++) {
+        long k = (long)i * (HID + 1) + j;
+        float d = 0.3f * delta[j] * input[i] + 0.3f * oldw[k];
+        w[k] += d;
+        oldw[k] = d;
+      }
+    }
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_f(w, wsize));
+  free(input);
+  free(w);
+  free(oldw);
+  return 0;
+}
@@ -0,0 +1,125 @@
+//===- bench.h - Shared harness for the CUDA-on-CPU benchmarks -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Timing, input generation and result reporting shared by the CUDA kernels and
+// their OpenMP references. Every program prints a `time:` line covering the
+// kernels only and a `checksum:` line that cuda-cpu-bench.py compares against
+// the reference.
+//
+// When BENCH_CUDA_STUBS is defined the CUDA runtime API is declared here, so
+// the kernels build with `-nocudainc` and no CUDA installation; cgeist
+// replaces these calls when it lowers the kernels with `-cuda-lower`.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CUDA_CPU_BENCH_H
+#define CUDA_CPU_BENCH_H
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__CUDA__) && defined(BENCH_CUDA_STUBS)
+#include <stddef.h>
+
+#include "__clang_cuda_builtin_vars.h"
+
+#define __device__ __attribute__((device))
+#define __global__ __attribute__((global))
+#define __host__ __attribute__((host))
+#define __shared__ __attribute__((shared))
+
+struct dim3 {
+  unsigned x, y, z;
+  __host__ __device__ dim3(unsigned x = 1, unsigned y = 1, unsigned z = 1)
+      : x(x), y(y), z(z) {}
+};
+
+typedef struct cudaStream *cudaStream_t;
+typedef enum cudaError { cudaSuccess = 0 } cudaError_t;
+enum cudaMemcpyKind {
+  cudaMemcpyHostToHost = 0,
+  cudaMemcpyHostToDevice = 1,
+  cudaMemcpyDeviceToHost = 2,
+  cudaMemcpyDeviceToDevice = 3,
+};
+
+extern "C" int cudaConfigureCall(dim3 gridSize, dim3 blockSize,
+                                 size_t sharedSize = 0,
+                                 cudaStream_t stream = 0);
+extern "C" int __cudaPushCallConfiguration(dim3 gridSize, dim3 blockSize,
+                                           size_t sharedSize = 0,
+                                           cudaStream_t stream = 0);
+extern "C" cudaError_t cudaLaunchKernel(const void *func, dim3 gridDim,
+                                        dim3 blockDim, void **args,
+                                        size_t sharedMem, cudaStream_t stream);
+extern "C" cudaError_t cudaMalloc(void **devPtr, size_t size);
+extern "C" cudaError_t cudaFree(void *devPtr);
+extern "C" cudaError_t cudaMemcpy(void *dst, const void *src, size_t count,
+                                  cudaMemcpyKind kind);
+extern "C" cudaError_t cudaDeviceSynchronize(void);
+#elif defined(__CUDA__) || defined(__CUDACC__)
+#include <cuda_runtime.h>
+#else
+#define __device__
+#define __global__
+#define __host__
+#define __shared__
+#endif
+
+static inline __host__ __device__ int bench_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+static inline __host__ __device__ int bench_max(int a, int b) {
+  return a > b ? a : b;
+}
+
+static inline double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A fixed linear congruential generator, so the CUDA program and its
+// reference see the same inputs.
+static unsigned bench_seed = 12345u;
+
+static inline float bench_randf(void) {
+  bench_seed = bench_seed * 1103515245u + 12345u;
+  return ((bench_seed >> 8) & 0xffff) / 65536.0f;
+}
+
+static inline int bench_randi(int n) {
+  bench_seed = bench_seed * 1103515245u + 12345u;
+  return (int)((bench_seed >> 8) % (unsigned)n);
+}
+
+// Position-weighted sums, so swapped elements change the checksum.
+static inline double bench_checksum_f(const float *a, long n) {
+  double sum = 0;
+  for (long i = 0; i < n; i++)
+    sum += a[i] * (double)(1 + i % 7);
+  return sum;
+}
+
+static inline double bench_checksum_i(const int *a, long n) {
+  double sum = 0;
+  for (long i = 0; i < n; i++)
+    sum += a[i] * (double)(1 + i % 7);
+  return sum;
+}
+
+static inline void bench_report(double seconds, double checksum) {
+  printf("time: %.6f\n", seconds);
+  printf("checksum: %.9e\n", checksum);
+}
+
+#endif // CUDA_CPU_BENCH_H
@@ -0,0 +1,68 @@
+// Rodinia-style hotspot: explicit thermal simulation of a chip, one stencil
+// step per launch over 16x16 shared-memory tiles.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+#ifndef STEPS
+#define STEPS 20
+#endif
+#define BS 16
+
+__global__ void hotspot(const float *power, const float *tin, float *tout,
+                        int n, float cap, float rx, float ry, float rz,
+                        float amb) {
+  __shared__ float t[BS][BS];
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int x = blockIdx.x * BS + tx, y = blockIdx.y * BS + ty;
+  int i = y * n + x;
+  t[ty][tx] = tin[i];
+  __syncthreads();
+
+  float c = t[ty][tx];
+  float w = tx > 0 ? t[ty][tx - 1] : (x > 0 ? tin[i - 1] : c);
+  float e = tx < BS - 1 ? t[ty][tx + 1] : (x < n - 1 ? tin[i + 1] : c);
+  float no = ty > 0 ? t[ty - 1][tx] : (y > 0 ? tin[i - n] : c);
+  float so = ty < BS - 1 ? t[ty + 1][tx] : (y < n - 1 ? tin[i + n] : c);
+  tout[i] = c + cap * (power[i] + (so + no - 2.0f * c) * ry +
+                       (e + w - 2.0f * c) * rx + (amb - c) * rz);
+}
+
+int main() {
+  long size = (long)N * N;
+  float *power = (float *)malloc(size * sizeof(float));
+  float *temp = (float *)malloc(size * sizeof(float));
+  for (long i = 0; i < size; i++) {
+    power[i] = bench_randf() * 0.5f;
+    temp[i] = 320.0f + bench_randf() * 20.0f;
+  }
+
+  float *d_power, *d_a, *d_b;
+  cudaMalloc((void **)&d_power, size * sizeof(float));
+  cudaMalloc((void **)&d_a, size * sizeof(float));
+  cudaMalloc((void **)&d_b, size * sizeof(float));
+  cudaMemcpy(d_power, power, size * sizeof(float), cudaMemcpyHostToDevice);
+  cudaMemcpy(d_a, temp, size * sizeof(float), cudaMemcpyHostToDevice);
+
+  double start = bench_now();
+  for (int s = 0; s < STEPS; s++) {
+    hotspot<<<dim3(N / BS, N / BS), dim3(BS, BS)>>>(
+        d_power, d_a, d_b, N, 0.5f, 0.1f, 0.1f, 0.0001f, 80.0f);
+    float *tmp = d_a;
+    d_a = d_b;
+    d_b = tmp;
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(temp, d_a, size * sizeof(float), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_f(temp, size));
+  cudaFree(d_power);
+  cudaFree(d_a);
+  cudaFree(d_b);
+  free(power);
+  free(temp);
+  return 0;
+}
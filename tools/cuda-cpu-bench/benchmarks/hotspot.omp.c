@@ -0,0 +1,53 @@
+// OpenMP reference for hotspot.cu.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+#ifndef STEPS
+#define STEPS 20
+#endif
+
+static void hotspot(const float *power, const float *tin, float *tout, int n,
+                    float cap, float rx, float ry, float rz, float amb) {
+#pragma omp parallel for
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      int i = y * n + x;
+      float c = tin[i];
+      float w = x > 0 ? tin[i - 1] : c;
+      float e = x < n - 1 ? tin[i + 1] : c;
+      float no = y > 0 ? tin[i - n] : c;
+      float so = y < n - 1 ? tin[i + n] : c;
+      tout[i] = c + cap * (power[i] + (so + no - 2.0f * c) * ry +
+                           (e + w - 2.0f * c) * rx + (amb - c) * rz);
+    }
+  }
+}
+
+int main() {
+  long size = (long)N * N;
+  float *power = (float *)malloc(size * sizeof(float));
+  float *a = (float *)malloc(size * sizeof(float));
+  float *b = (float *)malloc(size * sizeof(float));
+  for (long i = 0; i < size; i++) {
+    power[i] = bench_randf() * 0.5f;
+    a[i] = 320.0f + bench_randf() * 20.0f;
+  }
+
+  double start = bench_now();
+  for (int s = 0; s < STEPS; s++) {
+    hotspot(power, a, b, N, 0.5f, 0.1f, 0.1f, 0.0001f, 80.0f);
+    float *tmp = a;
+    a = b;
+    b = tmp;
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_f(a, size));
+  free(power);
+  free(a);
+  free(b);
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Rodinia-style LU decomposition without pivoting: for each 16x16 diagonal
+// tile, factor the tile, solve the perimeter tiles and update the trailing
+// matrix, each step with its own kernel.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+#define BS 16
+
+__global__ void lud_diagonal(float *m, int n, int off) {
+  __shared__ float s[BS][BS];
+  int tx = threadIdx.x;
+  for (int i = 0; i < BS; i++)
+    s[i][tx] = m[(off + i) * n + off + tx];
+  __syncthreads();
+
+  for (int i = 0; i < BS - 1; i++) {
+    if (tx > i) {
+      for (int j = 0; j < i; j++)
+        s[tx][i] -= s[tx][j] * s[j][i];
+      s[tx][i] /= s[i][i];
+    }
+    __syncthreads();
+    if (tx > i) {
+      for (int j = 0; j < i + 1; j++)
+        s[i + 1][tx] -= s[i + 1][j] * s[j][tx];
+    }
+    __syncthreads();
+  }
+
+  for (int i = 1; i < BS; i++)
+    m[(off + i) * n + off + tx] = s[i][tx];
+}
+
+__global__ void lud_perimeter(float *m, int n, int off) {
+  __shared__ float dia[BS][BS];
+  __shared__ float row[BS][BS];
+  __shared__ float col[BS][BS];
+  int tx = threadIdx.x;
+  int b = off + (blockIdx.x + 1) * BS;
+
+  if (tx < BS) {
+    int idx = tx;
+    for (int i = 0; i < BS / 2; i++)
+      dia[i][idx] = m[(off + i) * n + off + idx];
+    for (int i = 0; i < BS; i++)
+      row[i][idx] = m[(off + i) * n + b + idx];
+  } else {
+    int idx = tx - BS;
+    for (int i = BS / 2; i < BS; i++)
+      dia[i][idx] = m[(off + i) * n + off + idx];
+    for (int i = 0; i < BS; i++)
+      col[i][idx] = m[(b + i) * n + off + idx];
+  }
+  __syncthreads();
+
+  if (tx < BS) {
+    int idx = tx;
+    for (int i = 1; i < BS; i++)
+      for (int j = 0; j < i; j++)
+        row[i][idx] -= dia[i][j] * row[j][idx];
+  } else {
+    int idx = tx - BS;
+    for (int i = 0; i < BS; i++) {
+      for (int j = 0; j < i; j++)
+        col[idx][i] -= col[idx][j] * dia[j][i];
+      col[idx][i] /= dia[i][i];
+    }
+  }
+  __syncthreads();
+
+  if (tx < BS) {
+    int idx = tx;
+    for (int i = 1; i < BS; i++)
+      m[(off + i) * n + b + idx] = row[i][idx];
+  } else {
+    int idx = tx - BS;
+    for (int i = 0; i < BS; i++)
+      m[(b + i) * n + off + idx] = col[i][idx];
+  }
+}
+
+__global__ void lud_internal(float *m, int n, int off) {
+  __shared__ float prow[BS][BS];
+  __shared__ float pcol[BS][BS];
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int gr = off + (blockIdx.y + 1) * BS + ty;
+  int gc = off + (blockIdx.x + 1) * BS + tx;
+  prow[ty][tx] = m[(off + ty) * n + gc];
+  pcol[ty][tx] = m[gr * n + off + tx];
+  __syncthreads();
+
+  float sum = 0.0f;
+  for (int i = 0; i < BS; i++)
+    sum += pcol[ty][i] * prow[i][tx];
+  m[gr * n + gc] -= sum;
+}
+
+int main() {
+  long size = (long)N * N;
+  float *a = (float *)malloc(size * sizeof(float));
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++)
+      a[(long)i * N + j] = bench_randf() + (i == j ? N : 0.0f);
+
+  float *d_a;
+  cudaMalloc((void **)&d_a, size * sizeof(float));
+  cudaMemcpy(d_a, a, size * sizeof(float), cudaMemcpyHostToDevice);
+
+  double start = bench_now();
+  int off = 0;
+  for (; off < N - BS; off += BS) {
+    int rest = (N - off) / BS - 1;
+    lud_diagonal<<<1, BS>>>(d_a, N, off);
+    lud_perimeter<<<rest, 2 * BS>>>(d_a, N, off);
+    lud_internal<<<dim3(rest, rest), dim3(BS, BS)>>>(d_a, N, off);
+  }
+  lud_diagonal<<<1, BS>>>(d_a, N, off);
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(a, d_a, size * sizeof(float), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_f(a, size));
+  cudaFree(d_a);
+  free(a);
+  return 0;
+}
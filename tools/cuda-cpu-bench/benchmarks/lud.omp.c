@@ -0,0 +1,32 @@
+// OpenMP reference for lud.cu: right-looking LU decomposition without
+// pivoting.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+
+int main() {
+  long size = (long)N * N;
+  float *a = (float *)malloc(size * sizeof(float));
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++)
+      a[(long)i * N + j] = bench_randf() + (i == j ? N : 0.0f);
+
+  double start = bench_now();
+  for (int k = 0; k < N - 1; k++) {
+#pragma omp parallel for
+    for (int i = k + 1; i < N; i++) {
+      float l = a[(long)i * N + k] / a[(long)k * N + k];
+      a[(long)i * N + k] = l;
+      for (int j = k + 1; j < N; j++)
+        a[(long)i * N + j] -= l * a[(long)k * N + j];
+    }
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_f(a, size));
+  free(a);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// Rodinia-style Needleman-Wunsch: 16x16 tiles processed one anti-diagonal of
+// tiles per launch; inside a tile the threads sweep the cell anti-diagonals
+// with a barrier after each.
+
+#include "bench.h"
+
+#ifndef N
+#define N 4096
+#endif
+#ifndef PENALTY
+#define PENALTY 10
+#endif
+#define BS 16
+
+__device__ int max3(int a, int b, int c) {
+  return bench_max(a, bench_max(b, c));
+}
+
+__global__ void nw(const int *ref, int *score, int cols, int penalty,
+                   int diag, int first) {
+  __shared__ int temp[BS + 1][BS + 1];
+  __shared__ int r[BS][BS];
+  int tx = threadIdx.x;
+  int bx = blockIdx.x + first;
+  int by = diag - bx;
+  int base = cols * BS * by + BS * bx;
+
+  for (int ty = 0; ty < BS; ty++)
+    r[ty][tx] = ref[base + cols * (ty + 1) + tx + 1];
+  if (tx == 0)
+    temp[0][0] = score[base];
+  temp[tx + 1][0] = score[base + cols * (tx + 1)];
+  temp[0][tx + 1] = score[base + tx + 1];
+  __syncthreads();
+
+  for (int m = 0; m < BS; m++) {
+    if (tx <= m) {
+      int x = tx + 1, y = m - tx + 1;
+      temp[y][x] = max3(temp[y - 1][x - 1] + r[y - 1][x - 1],
+                        temp[y][x - 1] - penalty, temp[y - 1][x] - penalty);
+    }
+    __syncthreads();
+  }
+  for (int m = BS - 2; m >= 0; m--) {
+    if (tx <= m) {
+      int x = tx + BS - m, y = BS - tx;
+      temp[y][x] = max3(temp[y - 1][x - 1] + r[y - 1][x - 1],
+                        temp[y][x - 1] - penalty, temp[y - 1][x] - penalty);
+    }
+    __syncthreads();
+  }
+
+  for (int ty = 0; ty < BS; ty++)
+    score[base + cols * (ty + 1) + tx + 1] = temp[ty + 1][tx + 1];
+}
+
+int main() {
+  int cols = N + 1;
+  long size = (long)cols * cols;
+  int *ref = (int *)malloc(size * sizeof(int));
+  int *score = (int *)malloc(size * sizeof(int));
+  for (long i = 0; i < size; i++) {
+    ref[i] = bench_randi(21) - 10;
+    score[i] = 0;
+  }
+  for (int i = 0; i < cols; i++) {
+    score[i] = -i * PENALTY;
+    score[(long)i * cols] = -i * PENALTY;
+  }
+
+  int *d_ref, *d_score;
+  cudaMalloc((void **)&d_ref, size * sizeof(int));
+  cudaMalloc((void **)&d_score, size * sizeof(int));
+  cudaMemcpy(d_ref, ref, size * sizeof(int), cudaMemcpyHostToDevice);
+  cudaMemcpy(d_score, score, size * sizeof(int), cudaMemcpyHostToDevice);
+
+  int tiles = N / BS;
+  double start = bench_now();
+  for (int d = 0; d < 2 * tiles - 1; d++) {
+    int first = bench_max(0, d - tiles + 1);
+    int last = bench_min(d, tiles - 1);
+    nw<<<last - first + 1, BS>>>(d_ref, d_score, cols, PENALTY, d, first);
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(score, d_score, size * sizeof(int), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_i(score, size));
+  cudaFree(d_ref);
+  cudaFree(d_score);
+  free(ref);
+  free(score);
+  return 0;
+}
@@ -0,0 +1,52 @@
+// OpenMP reference for nw.cu: the same tile wavefront, one tile per
+// iteration.
+
+#include "bench.h"
+
+#ifndef N
+#define N 4096
+#endif
+#ifndef PENALTY
+#define PENALTY 10
+#endif
+#define BS 16
+
+static int max3(int a, int b, int c) { return bench_max(a, bench_max(b, c)); }
+
+int main() {
+  int cols = N + 1;
+  long size = (long)cols * cols;
+  int *ref = (int *)malloc(size * sizeof(int));
+  int *score = (int *)malloc(size * sizeof(int));
+  for (long i = 0; i < size; i++) {
+    ref[i] = bench_randi(21) - 10;
+    score[i] = 0;
+  }
+  for (int i = 0; i < cols; i++) {
+    score[i] = -i * PENALTY;
+    score[(long)i * cols] = -i * PENALTY;
+  }
+
+  int tiles = N / BS;
+  double start = bench_now();
+  for (int d = 0; d < 2 * tiles - 1; d++) {
+    int first = bench_max(0, d - tiles + 1);
+    int last = bench_min(d, tiles - 1);
+#pragma omp parallel for
+    for (int bx = first; bx <= last; bx++) {
+      int by = d - bx;
+      for (int y = by * BS + 1; y <= (by + 1) * BS; y++)
+        for (int x = bx * BS + 1; x <= (bx + 1) * BS; x++) {
+          long i = (long)y * cols + x;
+          score[i] = max3(score[i - cols - 1] + ref[i], score[i - 1] - PENALTY,
+                          score[i - cols] - PENALTY);
+        }
+    }
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_i(score, size));
+  free(ref);
+  free(score);
+  return 0;
+}
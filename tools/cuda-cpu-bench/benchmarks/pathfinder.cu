@@ -0,0 +1,62 @@
+// Rodinia-style pathfinder: dynamic programming over a grid, one row per
+// launch, with the previous row and its halo staged in shared memory.
+
+#include "bench.h"
+
+#ifndef COLS
+#define COLS (1 << 20)
+#endif
+#ifndef ROWS
+#define ROWS 100
+#endif
+#define BS 256
+
+__global__ void pathfinder(const int *wall, const int *src, int *dst,
+                           int cols, int row) {
+  __shared__ int prev[BS + 2];
+  int tx = threadIdx.x;
+  int x = blockIdx.x * BS + tx;
+  prev[tx + 1] = src[x];
+  if (tx == 0)
+    prev[0] = x > 0 ? src[x - 1] : INT_MAX;
+  if (tx == BS - 1)
+    prev[BS + 1] = x < cols - 1 ? src[x + 1] : INT_MAX;
+  __syncthreads();
+
+  int m = bench_min(prev[tx], bench_min(prev[tx + 1], prev[tx + 2]));
+  dst[x] = wall[(long)row * cols + x] + m;
+}
+
+int main() {
+  long size = (long)ROWS * COLS;
+  int *wall = (int *)malloc(size * sizeof(int));
+  int *result = (int *)malloc(COLS * sizeof(int));
+  for (long i = 0; i < size; i++)
+    wall[i] = bench_randi(10);
+
+  int *d_wall, *d_a, *d_b;
+  cudaMalloc((void **)&d_wall, size * sizeof(int));
+  cudaMalloc((void **)&d_a, COLS * sizeof(int));
+  cudaMalloc((void **)&d_b, COLS * sizeof(int));
+  cudaMemcpy(d_wall, wall, size * sizeof(int), cudaMemcpyHostToDevice);
+  cudaMemcpy(d_a, wall, COLS * sizeof(int), cudaMemcpyHostToDevice);
+
+  double start = bench_now();
+  for (int r = 1; r < ROWS; r++) {
+    pathfinder<<<COLS / BS, BS>>>(d_wall, d_a, d_b, COLS, r);
+    int *tmp = d_a;
+    d_a = d_b;
+    d_b = tmp;
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(result, d_a, COLS * sizeof(int), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_i(result, COLS));
+  cudaFree(d_wall);
+  cudaFree(d_a);
+  cudaFree(d_b);
+  free(wall);
+  free(result);
+  return 0;
+}
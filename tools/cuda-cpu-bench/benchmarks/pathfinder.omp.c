@@ -0,0 +1,44 @@
+// OpenMP reference for pathfinder.cu.
+
+#include "bench.h"
+
+#ifndef COLS
+#define COLS (1 << 20)
+#endif
+#ifndef ROWS
+#define ROWS 100
+#endif
+
+int main() {
+  long size = (long)ROWS * COLS;
+  int *wall = (int *)malloc(size * sizeof(int));
+  int *a = (int *)malloc(COLS * sizeof(int));
+  int *b = (int *)malloc(COLS * sizeof(int));
+  for (long i = 0; i < size; i++)
+    wall[i] = bench_randi(10);
+  for (int x = 0; x < COLS; x++)
+    a[x] = wall[x];
+
+  double start = bench_now();
+  for (int r = 1; r < ROWS; r++) {
+#pragma omp parallel for
+    for (int x = 0; x < COLS; x++) {
+      int m = a[x];
+      if (x > 0)
+        m = bench_min(m, a[x - 1]);
+      if (x < COLS - 1)
+        m = bench_min(m, a[x + 1]);
+      b[x] = wall[(long)r * COLS + x] + m;
+    }
+    int *tmp = a;
+    a = b;
+    b = tmp;
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_i(a, COLS));
+  free(wall);
+  free(a);
+  free(b);
+  return 0;
+}
@@ -0,0 +1,61 @@
+// Shared-memory tree reduction: each block sums 2 * BS elements and the host
+// adds up the per-block partial sums.
+
+#include "bench.h"
+
+#ifndef N
+#define N (1 << 24)
+#endif
+#ifndef REPS
+#define REPS 10
+#endif
+#define BS 256
+
+__global__ void reduce(const float *in, float *partial) {
+  __shared__ float s[BS];
+  int tx = threadIdx.x;
+  long i = (long)blockIdx.x * 2 * BS + tx;
+  s[tx] = in[i] + in[i + BS];
+  __syncthreads();
+
+  for (int stride = BS / 2; stride > 0; stride >>= 1) {
+    if (tx < stride)
+      s[tx] += s[tx + stride];
+    __syncthreads();
+  }
+  if (tx == 0)
+    partial[blockIdx.x] = s[0];
+}
+
+int main() {
+  int blocks = N / (2 * BS);
+  float *in = (float *)malloc(N * sizeof(float));
+  float *partial = (float *)malloc(blocks * sizeof(float));
+  for (long i = 0; i < N; i++)
+    in[i] = bench_randf();
+
+  float *d_in, *d_partial;
+  cudaMalloc((void **)&d_in, N * sizeof(float));
+  cudaMalloc((void **)&d_partial, blocks * sizeof(float));
+  cudaMemcpy(d_in, in, N * sizeof(float), cudaMemcpyHostToDevice);
+
+  double total = 0;
+  double start = bench_now();
+  for (int r = 0; r < REPS; r++) {
+    reduce<<<blocks, BS>>>(d_in, d_partial);
+    cudaMemcpy(partial, d_partial, blocks * sizeof(float),
+               cudaMemcpyDeviceToHost);
+    double sum = 0;
+    for (int b = 0; b < blocks; b++)
+      sum += partial[b];
+    total += sum;
+  }
+  double end = bench_now();
+
+  bench_report(end - start, total);
+  cudaFree(d_in);
+  cudaFree(d_partial);
+  free(in);
+  free(partial);
+  return 0;
+}
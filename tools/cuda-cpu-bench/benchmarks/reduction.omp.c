@@ -0,0 +1,31 @@
+// OpenMP reference for reduction.cu.
+
+#include "bench.h"
+
+#ifndef N
+#define N (1 << 24)
+#endif
+#ifndef REPS
+#define REPS 10
+#endif
+
+int main() {
+  float *in = (float *)malloc(N * sizeof(float));
+  for (long i = 0; i < N; i++)
+    in[i] = bench_randf();
+
+  double total = 0;
+  double start = bench_now();
+  for (int r = 0; r < REPS; r++) {
+    double sum = 0;
+#pragma omp parallel for reduction(+ : sum)
+    for (long i = 0; i < N; i++)
+      sum += in[i];
+    total += sum;
+  }
+  double end = bench_now();
+
+  bench_report(end - start, total);
+  free(in);
+  return 0;
+}
@@ -0,0 +1,76 @@
+// Hillis-Steele inclusive scan within each block, then the scanned block sums
+// are added back by a second kernel.
+
+#include "bench.h"
+
+#ifndef N
+#define N (1 << 22)
+#endif
+#ifndef REPS
+#define REPS 10
+#endif
+#define BS 256
+
+__global__ void scan_blocks(const int *in, int *out, int *sums) {
+  __shared__ int s[BS];
+  int tx = threadIdx.x;
+  long i = (long)blockIdx.x * BS + tx;
+  s[tx] = in[i];
+  __syncthreads();
+
+  for (int off = 1; off < BS; off *= 2) {
+    int t = tx >= off ? s[tx - off] : 0;
+    __syncthreads();
+    s[tx] += t;
+    __syncthreads();
+  }
+  out[i] = s[tx];
+  if (tx == BS - 1)
+    sums[blockIdx.x] = s[tx];
+}
+
+__global__ void add_offsets(int *out, const int *offsets) {
+  long i = (long)blockIdx.x * BS + threadIdx.x;
+  out[i] += offsets[blockIdx.x];
+}
+
+int main() {
+  int blocks = N / BS;
+  int *in = (int *)malloc(N * sizeof(int));
+  int *out = (int *)malloc(N * sizeof(int));
+  int *sums = (int *)malloc(blocks * sizeof(int));
+  for (long i = 0; i < N; i++)
+    in[i] = bench_randi(10);
+
+  int *d_in, *d_out, *d_sums;
+  cudaMalloc((void **)&d_in, N * sizeof(int));
+  cudaMalloc((void **)&d_out, N * sizeof(int));
+  cudaMalloc((void **)&d_sums, blocks * sizeof(int));
+  cudaMemcpy(d_in, in, N * sizeof(int), cudaMemcpyHostToDevice);
+
+  double start = bench_now();
+  for (int r = 0; r < REPS; r++) {
+    scan_blocks<<<blocks, BS>>>(d_in, d_out, d_sums);
+    cudaMemcpy(sums, d_sums, blocks * sizeof(int), cudaMemcpyDeviceToHost);
+    int carry = 0;
+    for (int b = 0; b < blocks; b++) {
+      int s = sums[b];
+      sums[b] = carry;
+      carry += s;
+    }
+    cudaMemcpy(d_sums, sums, blocks * sizeof(int), cudaMemcpyHostToDevice);
+    add_offsets<<<blocks, BS>>>(d_out, d_sums);
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(out, d_out, N * sizeof(int), cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_i(out, N));
+  cudaFree(d_in);
+  cudaFree(d_out);
+  cudaFree(d_sums);
+  free(in);
+  free(out);
+  free(sums);
+  return 0;
+}
@@ -0,0 +1,49 @@
+// OpenMP reference for scan.cu: per-chunk scans, a sequential pass over the
+// chunk sums, then the offsets are added back.
+
+#include "bench.h"
+
+#ifndef N
+#define N (1 << 22)
+#endif
+#ifndef REPS
+#define REPS 10
+#endif
+#define CHUNK 4096
+
+int main() {
+  int chunks = N / CHUNK;
+  int *in = (int *)malloc(N * sizeof(int));
+  int *out = (int *)malloc(N * sizeof(int));
+  int *sums = (int *)malloc(chunks * sizeof(int));
+  for (long i = 0; i < N; i++)
+    in[i] = bench_randi(10);
+
+  double start = bench_now();
+  for (int r = 0; r < REPS; r++) {
+#pragma omp parallel for
+    for (int c = 0; c < chunks; c++) {
+      int acc = 0;
+      for (long i = (long)c * CHUNK; i < (long)(c + 1) * CHUNK; i++)
+        out[i] = acc += in[i];
+      sums[c] = acc;
+    }
+    int carry = 0;
+    for (int c = 0; c < chunks; c++) {
+      int s = sums[c];
+      sums[c] = carry;
+      carry += s;
+    }
+#pragma omp parallel for
+    for (int c = 0; c < chunks; c++)
+      for (long i = (long)c * CHUNK; i < (long)(c + 1) * CHUNK; i++)
+        out[i] += sums[c];
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_i(out, N));
+  free(in);
+  free(out);
+  free(sums);
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Rodinia-style SRAD (speckle reducing anisotropic diffusion): a diffusion
+// coefficient kernel and an update kernel, both over 16x16 shared-memory
+// tiles.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+#ifndef ITER
+#define ITER 10
+#endif
+#define BS 16
+
+__global__ void srad1(const float *J, float *C, float *dN, float *dS,
+                      float *dW, float *dE, int n, float q0sqr) {
+  __shared__ float t[BS][BS];
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int x = blockIdx.x * BS + tx, y = blockIdx.y * BS + ty;
+  int i = y * n + x;
+  t[ty][tx] = J[i];
+  __syncthreads();
+
+  float jc = t[ty][tx];
+  float no = ty > 0 ? t[ty - 1][tx] : (y > 0 ? J[i - n] : jc);
+  float so = ty < BS - 1 ? t[ty + 1][tx] : (y < n - 1 ? J[i + n] : jc);
+  float we = tx > 0 ? t[ty][tx - 1] : (x > 0 ? J[i - 1] : jc);
+  float ea = tx < BS - 1 ? t[ty][tx + 1] : (x < n - 1 ? J[i + 1] : jc);
+  float gn = no - jc, gs = so - jc, gw = we - jc, ge = ea - jc;
+  float g2 = (gn * gn + gs * gs + gw * gw + ge * ge) / (jc * jc);
+  float l = (gn + gs + gw + ge) / jc;
+  float num = 0.5f * g2 - (1.0f / 16.0f) * (l * l);
+  float den = 1.0f + 0.25f * l;
+  float qsqr = num / (den * den);
+  den = (qsqr - q0sqr) / (q0sqr * (1.0f + q0sqr));
+  float c = 1.0f / (1.0f + den);
+  C[i] = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+  dN[i] = gn;
+  dS[i] = gs;
+  dW[i] = gw;
+  dE[i] = ge;
+}
+
+__global__ void srad2(const float *C, const float *dN, const float *dS,
+                      const float *dW, const float *dE, float *J, int n,
+                      float lambda) {
+  __shared__ float c[BS][BS];
+  int tx = threadIdx.x, ty = threadIdx.y;
+  int x = blockIdx.x * BS + tx, y = blockIdx.y * BS + ty;
+  int i = y * n + x;
+  c[ty][tx] = C[i];
+  __syncthreads();
+
+  float cn = c[ty][tx];
+  float cs = ty < BS - 1 ? c[ty + 1][tx] : (y < n - 1 ? C[i + n] : cn);
+  float ce = tx < BS - 1 ? c[ty][tx + 1] : (x < n - 1 ? C[i + 1] : cn);
+  float d = cn * dN[i] + cs * dS[i] + cn * dW[i] + ce * dE[i];
+  J[i] += 0.25f * lambda * d;
+}
+
+int main() {
+  long size = (long)N * N;
+  long bytes = size * sizeof(float);
+  float *J = (float *)malloc(bytes);
+  for (long i = 0; i < size; i++)
+    J[i] = expf(bench_randf());
+
+  float *d_J, *d_C, *d_N, *d_S, *d_W, *d_E;
+  cudaMalloc((void **)&d_J, bytes);
+  cudaMalloc((void **)&d_C, bytes);
+  cudaMalloc((void **)&d_N, bytes);
+  cudaMalloc((void **)&d_S, bytes);
+  cudaMalloc((void **)&d_W, bytes);
+  cudaMalloc((void **)&d_E, bytes);
+  cudaMemcpy(d_J, J, bytes, cudaMemcpyHostToDevice);
+
+  dim3 grid(N / BS, N / BS), block(BS, BS);
+  double start = bench_now();
+  for (int it = 0; it < ITER; it++) {
+    cudaMemcpy(J, d_J, bytes, cudaMemcpyDeviceToHost);
+    double sum = 0, sum2 = 0;
+    for (long i = 0; i < size; i++) {
+      sum += J[i];
+      sum2 += J[i] * J[i];
+    }
+    double mean = sum / size;
+    float q0sqr = (float)((sum2 / size - mean * mean) / (mean * mean));
+    srad1<<<grid, block>>>(d_J, d_C, d_N, d_S, d_W, d_E, N, q0sqr);
+    srad2<<<grid, block>>>(d_C, d_N, d_S, d_W, d_E, d_J, N, 0.5f);
+  }
+  cudaDeviceSynchronize();
+  double end = bench_now();
+
+  cudaMemcpy(J, d_J, bytes, cudaMemcpyDeviceToHost);
+  bench_report(end - start, bench_checksum_f(J, size));
+  cudaFree(d_J);
+  cudaFree(d_C);
+  cudaFree(d_N);
+  cudaFree(d_S);
+  cudaFree(d_W);
+  cudaFree(d_E);
+  free(J);
+  return 0;
+}
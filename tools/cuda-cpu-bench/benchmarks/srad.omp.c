@@ -0,0 +1,81 @@
+// OpenMP reference for srad.cu.
+
+#include "bench.h"
+
+#ifndef N
+#define N 1024
+#endif
+#ifndef ITER
+#define ITER 10
+#endif
+
+int main() {
+  int n = N;
+  long size = (long)N * N;
+  long bytes = size * sizeof(float);
+  float *J = (float *)malloc(bytes);
+  float *C = (float *)malloc(bytes);
+  float *dN = (float *)malloc(bytes);
+  float *dS = (float *)malloc(bytes);
+  float *dW = (float *)malloc(bytes);
+  float *dE = (float *)malloc(bytes);
+  for (long i = 0; i < size; i++)
+    J[i] = expf(bench_randf());
+
+  double start = bench_now();
+  for (int it = 0; it < ITER; it++) {
+    double sum = 0, sum2 = 0;
+    for (long i = 0; i < size; i++) {
+      sum += J[i];
+      sum2 += J[i] * J[i];
+    }
+    double mean = sum / size;
+    float q0sqr = (float)((sum2 / size - mean * mean) / (mean * mean));
+
+#pragma omp parallel for
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        int i = y * n + x;
+        float jc = J[i];
+        float gn = (y > 0 ? J[i - n] : jc) - jc;
+        float gs = (y < n - 1 ? J[i + n] : jc) - jc;
+        float gw = (x > 0 ? J[i - 1] : jc) - jc;
+        float ge = (x < n - 1 ? J[i + 1] : jc) - jc;
+        float g2 = (gn * gn + gs * gs + gw * gw + ge * ge) / (jc * jc);
+        float l = (gn + gs + gw + ge) / jc;
+        float num = 0.5f * g2 - (1.0f / 16.0f) * (l * l);
+        float den = 1.0f + 0.25f * l;
+        float qsqr = num / (den * den);
+        den = (qsqr - q0sqr) / (q0sqr * (1.0f + q0sqr));
+        float c = 1.0f / (1.0f + den);
+        C[i] = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+        dN[i] = gn;
+        dS[i] = gs;
+        dW[i] = gw;
+        dE[i] = ge;
+      }
+    }
+
+#pragma omp parallel for
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        int i = y * n + x;
+        float cn = C[i];
+        float cs = y < n - 1 ? C[i + n] : cn;
+        float ce = x < n - 1 ? C[i + 1] : cn;
+        float d = cn * dN[i] + cs * dS[i] + cn * dW[i] + ce * dE[i];
+        J[i] += 0.25f * 0.5f * d;
+      }
+    }
+  }
+  double end = bench_now();
+
+  bench_report(end - start, bench_checksum_f(J, size));
+  free(J);
+  free(C);
+  free(dN);
+  free(dS);
+  free(dW);
+  free(dE);
+  return 0;
+}
@@ -0,0 +1,329 @@
+#!/usr/bin/env python3
+# ===- cuda-cpu-bench.py - Compare cpuify methods on CUDA benchmarks ---------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===-------------------------------------------------------------------------===#
+"""Compare cpuify methods on CUDA benchmarks.
+
+Builds every CUDA benchmark in benchmarks/ with cgeist `-cuda-lower` once per
+barrier elimination method (`-cpuify=...`), runs it next to the OpenMP
+reference in the same directory and reports, per benchmark and method:
+
+  time     median kernel time over --runs runs, and the speedup over the
+           OpenMP reference
+  rss      peak resident set size of the process
+  buffers  bytes of the buffers the distribute methods allocate to carry
+           values across barriers, as recorded in the `-cpuify-report` of
+           the build. Barriers whose buffers have a dynamic size are counted
+           separately. The other methods do not report their buffers.
+
+Every result is checked against the reference checksum first.
+
+Example:
+  cuda-cpu-bench.py --cgeist build/bin/cgeist --json results.json \
+    --benchmarks hotspot lud --methods distribute continuation
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+CPUIFY_METHODS = [
+    'distribute',
+    'distribute.mincut',
+    'distribute.ifsplit',
+    'distribute.ifhoist',
+    'distribute.mincut.ifsplit',
+    'omp',
+    'continuation',
+]
+
+def read_report(path):
+    """Returns the buffer bytes and the number of barriers with buffers of
+    dynamic size recorded in a cpuify report, one JSON object per function
+    and line."""
+    static, dynamic = 0, 0
+    if not os.path.exists(path):
+        return static, dynamic
+    with open(path) as f:
+        for line in f:
+            if not line.strip():
+                continue
+            function = json.loads(line)
+            for barrier in function['barriers']:
+                if barrier['bytes'] is None:
+                    dynamic += 1
+                else:
+                    static += barrier['bytes']
+    return static, dynamic
+
+
+class Benchmark:
+    def __init__(self, path):
+        self.path = os.path.abspath(path)
+        self.name = os.path.basename(path)[:-len('.cu')]
+        self.reference = os.path.join(os.path.dirname(self.path),
+                                      self.name + '.omp.c')
+
+
+class Runner:
+    def __init__(self, args):
+        self.args = args
+        self.workdir = tempfile.mkdtemp(prefix='cuda-cpu-bench-')
+        self.env = dict(os.environ)
+        if args.threads:
+            self.env['OMP_NUM_THREADS'] = str(args.threads)
+
+    def log(self, msg):
+        if self.args.verbose:
+            print(msg, file=sys.stderr)
+
+    def run(self, cmd):
+        self.log('  $ ' + ' '.join(cmd))
+        try:
+            return subprocess.run(cmd, stdout=subprocess.PIPE,
+                                  stderr=subprocess.PIPE,
+                                  universal_newlines=True,
+                                  timeout=self.args.timeout)
+        except subprocess.TimeoutExpired:
+            print('  timed out after %ss: %s' % (self.args.timeout, cmd[0]),
+                  file=sys.stderr)
+            return subprocess.CompletedProcess(cmd, -1, '', 'timeout')
+
+    def cgeist(self, bench, extra):
+        cmd = [self.args.cgeist, bench.path, '-O3', '--function=*',
+               '--cuda-gpu-arch=sm_60', '-nocudalib', '-nocudainc',
+               '-DBENCH_CUDA_STUBS', '-I' + os.path.dirname(bench.path)]
+        if self.args.resource_dir:
+            cmd.append('-resource-dir=' + self.args.resource_dir)
+        return cmd + extra + self.args.define + self.args.cgeist_flag
+
+    def execute(self, exe):
+        """Runs exe and returns (time, checksum, peak RSS in KiB)."""
+        self.log('  $ ' + exe)
+        with tempfile.TemporaryFile(mode='w+') as out:
+            proc = subprocess.Popen([exe], stdout=out,
+                                    stderr=subprocess.DEVNULL, env=self.env)
+            deadline = time.time() + self.args.timeout
+            while True:
+                pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+                if pid != 0:
+                    break
+                if time.time() > deadline:
+                    proc.kill()
+                    proc.wait()
+                    return None
+                time.sleep(0.01)
+            # Already reaped by wait4; keep Popen from waiting on it again.
+            proc.returncode = os.waitstatus_to_exitcode(status)
+            if proc.returncode != 0:
+                return None
+            out.seek(0)
+            values = {}
+            for line in out:
+                key, _, value = line.partition(':')
+                if value:
+                    values[key.strip()] = value.strip()
+        try:
+            return (float(values['time']), float(values['checksum']),
+                    usage.ru_maxrss)
+        except (KeyError, ValueError):
+            return None
+
+    def measure(self, exe):
+        results = []
+        for _ in range(self.args.runs):
+            result = self.execute(exe)
+            if result is None:
+                return None
+            results.append(result)
+        return {
+            'time': statistics.median(r[0] for r in results),
+            'checksum': results[0][1],
+            'rss': max(r[2] for r in results),
+        }
+
+    def build_reference(self, bench):
+        exe = os.path.join(self.workdir, bench.name + '.ref')
+        cmd = [self.args.cc, '-O3', '-fopenmp', bench.reference, '-o', exe,
+               '-I' + os.path.dirname(bench.path), '-lm'] + self.args.define
+        if self.run(cmd).returncode != 0:
+            return None
+        return exe
+
+    def build(self, bench, method):
+        """Returns the executable and the cpuify report of the build, or
+        None."""
+        tag = '%s.%s' % (bench.name, method)
+        ll = os.path.join(self.workdir, tag + '.ll')
+        exe = os.path.join(self.workdir, tag)
+        report = os.path.join(self.workdir, tag + '.report.json')
+        if os.path.exists(report):
+            os.remove(report)
+        cmd = self.cgeist(bench, ['--cuda-lower', '--cpuify=' + method,
+                                  '--cpuify-report=' + report, '-S',
+                                  '-emit-llvm', '-o', ll])
+        if self.run(cmd).returncode != 0:
+            return None
+        cmd = [self.args.cc, '-O3', '-fopenmp', ll, '-o', exe, '-lm']
+        if self.run(cmd).returncode != 0:
+            return None
+        return exe, report
+
+    def matches(self, checksum, reference):
+        return abs(checksum - reference) <= self.args.rtol * max(
+            abs(reference), 1.0)
+
+    def benchmark(self, bench):
+        print('running %s' % bench.name, file=sys.stderr)
+        records = []
+        ref_exe = self.build_reference(bench)
+        reference = self.measure(ref_exe) if ref_exe else None
+        if reference is None:
+            print('  could not run the OpenMP reference', file=sys.stderr)
+        else:
+            records.append({'benchmark': bench.name, 'method': 'openmp',
+                            'status': 'ok', **reference})
+
+        for method in self.args.methods:
+            record = {'benchmark': bench.name, 'method': method}
+            records.append(record)
+            built = self.build(bench, method)
+            if built is None:
+                record['status'] = 'compile-error'
+                continue
+            exe, report = built
+            if method.startswith('distribute'):
+                record['buffer_bytes'], record['dynamic_buffers'] = \
+                    read_report(report)
+            result = self.measure(exe)
+            if result is None:
+                record['status'] = 'run-error'
+                continue
+            record.update(result)
+            if reference is None:
+                record['status'] = 'unverified'
+            elif not self.matches(result['checksum'], reference['checksum']):
+                record['status'] = 'mismatch'
+            else:
+                record['status'] = 'ok'
+                record['speedup'] = reference['time'] / result['time']
+        return records
+
+
+def print_table(records):
+    header = '%-12s %-28s %-14s %12s %9s %10s %12s' % (
+        'benchmark', 'method', 'status', 'time (s)', 'vs omp', 'rss (MiB)',
+        'buffers (B)')
+    print(header)
+    print('-' * len(header))
+    for r in records:
+        buffers = ''
+        if 'buffer_bytes' in r:
+            buffers = str(r['buffer_bytes'])
+            if r['dynamic_buffers']:
+                buffers += ' +%d?' % r['dynamic_buffers']
+        print('%-12s %-28s %-14s %12s %9s %10s %12s' % (
+            r['benchmark'], r['method'], r['status'],
+            '%.6f' % r['time'] if 'time' in r else '',
+            '%.2fx' % r['speedup'] if 'speedup' in r else '',
+            '%.1f' % (r['rss'] / 1024.0) if 'rss' in r else '', buffers))
+
+
+def find_benchmarks(args):
+    known = sorted(os.path.join(args.benchmark_dir, f)
+                   for f in os.listdir(args.benchmark_dir) if f.endswith('.cu'))
+    if not args.benchmarks:
+        return known
+    found = []
+    for name in args.benchmarks:
+        if os.path.isfile(name):
+            found.append(name)
+            continue
+        matches = [p for p in known if os.path.basename(p) == name + '.cu']
+        if not matches:
+            sys.exit('error: unknown benchmark %s' % name)
+        found += matches
+    return found
+
+
+def default_resource_dir(cc):
+    try:
+        result = subprocess.run([cc, '-print-resource-dir'],
+                                stdout=subprocess.PIPE,
+                                stderr=subprocess.DEVNULL,
+                                universal_newlines=True)
+    except OSError:
+        return ''
+    return result.stdout.strip() if result.returncode == 0 else ''
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cgeist', default=shutil.which('cgeist') or 'cgeist',
+                        help='cgeist binary to benchmark')
+    parser.add_argument('--cc', default='clang',
+                        help='C compiler for linking and the OpenMP '
+                             'references')
+    parser.add_argument('--resource-dir', default=None,
+                        help='clang resource directory for cgeist '
+                             '(default: ask --cc)')
+    parser.add_argument('--benchmark-dir',
+                        default=os.path.join(here, 'benchmarks'))
+    parser.add_argument('--benchmarks', nargs='*', default=[],
+                        help='benchmark names or source files (default: all)')
+    parser.add_argument('--methods', nargs='*', default=CPUIFY_METHODS,
+                        help='cpuify methods to compare (default: all)')
+    parser.add_argument('--runs', type=int, default=5,
+                        help='timed runs per build (median is kept)')
+    parser.add_argument('--threads', type=int, default=0,
+                        help='OMP_NUM_THREADS for every run')
+    parser.add_argument('--rtol', type=float, default=1e-4,
+                        help='relative checksum tolerance against the '
+                             'reference')
+    parser.add_argument('-D', dest='define', action='append', default=[],
+                        type=lambda d: '-D' + d,
+                        help='macro for every build, e.g. -D N=2048')
+    parser.add_argument('--timeout', type=int, default=600)
+    parser.add_argument('--cgeist-flag', action='append', default=[],
+                        help='extra flag passed to every cgeist invocation')
+    parser.add_argument('--json', help='write all results to this file')
+    parser.add_argument('--keep', action='store_true',
+                        help='keep the build directory')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+    args.benchmark_dir = os.path.abspath(args.benchmark_dir)
+    if args.resource_dir is None:
+        args.resource_dir = default_resource_dir(args.cc)
+
+    runner = Runner(args)
+    records = []
+    try:
+        for path in find_benchmarks(args):
+            records += runner.benchmark(Benchmark(path))
+    finally:
+        if not args.keep:
+            shutil.rmtree(runner.workdir, ignore_errors=True)
+
+    print_table(records)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(records, f, indent=2, sort_keys=True)
+            f.write('\n')
+    return 0 if all(r['status'] == 'ok' for r in records) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
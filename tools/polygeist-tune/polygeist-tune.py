@@ -0,0 +1,386 @@
+#!/usr/bin/env python3
+# ===- polygeist-tune.py - Autotune the cgeist pass pipeline -----------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===-------------------------------------------------------------------------===#
+"""Autotune the cgeist pass pipeline.
+
+Searches the cgeist pipeline configuration space per benchmark: every
+candidate is compiled with cgeist, linked with the PolyBench timing harness,
+checked against a reference build and timed. The fastest configuration of
+each benchmark is recorded in a JSON database that cgeist applies with
+`-tuning-db=<file>`.
+
+Example:
+  polygeist-tune.py --cgeist build/bin/cgeist --db tuning.json \
+    --benchmarks gemm 2mm jacobi-2d
+  cgeist gemm.c -tuning-db=tuning.json ...
+"""
+
+import argparse
+import itertools
+import json
+import os
+import random
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+
+# Knobs and the values worth trying, in the order coordinate descent visits
+# them. The first value of each list is the cgeist default.
+SEARCH_SPACE = {
+    'raise-scf-to-affine': [False, True],
+    'loop-interchange': [False, True],
+    'unswitch-loops': [False, True],
+    'loop-idiom': [False, True],
+    'predictive-commoning': [False, True],
+    'nontemporal-stores': [False, True],
+    'scal-rep': [True, False],
+    'parallel-licm': [True, False],
+    'detect-reduction': [False, True],
+    'unroll-loops': [False, True],
+    'unroll-size': [32, 4, 8, 16],
+    'inner-serialize': [False, True],
+    'early-inner-serialize': [False, True],
+    'scf-openmp': [True, False],
+    'openmp-opt': [True, False],
+}
+
+# Barrier elimination strategies, only searched for CUDA sources.
+CPUIFY_SPACE = [
+    'distribute',
+    'distribute.mincut',
+    'distribute.mincut.ifsplit',
+    'continuation',
+]
+
+
+def default_config(cuda):
+    config = {knob: values[0] for knob, values in SEARCH_SPACE.items()}
+    if cuda:
+        config['cpuify'] = CPUIFY_SPACE[0]
+    return config
+
+
+def search_space(cuda):
+    space = dict(SEARCH_SPACE)
+    if cuda:
+        space['cpuify'] = CPUIFY_SPACE
+    return space
+
+
+def is_meaningful(config):
+    # Unroll factors, early serialization, loop interchange, unswitching,
+    # predictive commoning and non-temporal stores only matter when the passes
+    # they depend on run; skip the duplicates.
+    if not config.get('unroll-loops') and config.get('unroll-size') != 32:
+        return False
+    if not config.get('raise-scf-to-affine') and (
+            config.get('unroll-loops') or config.get('early-inner-serialize')
+            or config.get('loop-interchange')
+            or config.get('unswitch-loops')
+            or config.get('predictive-commoning')
+            or config.get('nontemporal-stores')):
+        return False
+    return True
+
+
+def config_flags(config):
+    flags = []
+    for knob, value in sorted(config.items()):
+        if isinstance(value, bool):
+            flags.append('-%s=%d' % (knob, int(value)))
+        else:
+            flags.append('-%s=%s' % (knob, value))
+    return flags
+
+
+def config_key(config):
+    return tuple(sorted(config.items()))
+
+
+class Benchmark:
+    def __init__(self, path, polybench):
+        self.path = os.path.abspath(path)
+        self.name = os.path.splitext(os.path.basename(path))[0]
+        self.polybench = polybench
+        self.cuda = self.path.endswith('.cu')
+
+    def include_dirs(self):
+        return [os.path.dirname(self.path),
+                os.path.join(self.polybench, 'utilities')]
+
+
+class Tuner:
+    def __init__(self, args):
+        self.args = args
+        self.workdir = tempfile.mkdtemp(prefix='polygeist-tune-')
+        self.polybench_c = os.path.join(args.polybench, 'utilities',
+                                        'polybench.c')
+
+    def log(self, msg):
+        if self.args.verbose:
+            print(msg, file=sys.stderr)
+
+    def run(self, cmd, **kwargs):
+        self.log('  $ ' + ' '.join(cmd))
+        try:
+            return subprocess.run(cmd, stdout=subprocess.PIPE,
+                                  stderr=subprocess.PIPE,
+                                  universal_newlines=True,
+                                  timeout=self.args.timeout, **kwargs)
+        except subprocess.TimeoutExpired:
+            # A variant that hangs or runs too long counts as failed.
+            self.log('  timed out after %s s' % self.args.timeout)
+            return subprocess.CompletedProcess(cmd, -1, '', 'timeout')
+
+    def defines(self, dataset, dump):
+        defines = ['-D' + dataset]
+        defines.append('-DPOLYBENCH_DUMP_ARRAYS' if dump else
+                       '-DPOLYBENCH_TIME')
+        return defines
+
+    def build_reference(self, bench):
+        exe = os.path.join(self.workdir, bench.name + '.ref')
+        cmd = [self.args.cc, '-O0', bench.path, self.polybench_c, '-o', exe,
+               '-lm']
+        cmd += ['-I' + d for d in bench.include_dirs()]
+        cmd += self.defines(self.args.verify_dataset, dump=True)
+        if self.run(cmd).returncode != 0:
+            return None
+        result = self.run([exe])
+        return result.stderr if result.returncode == 0 else None
+
+    def build(self, bench, config, dataset, dump):
+        tag = '%s.%x%s' % (bench.name, abs(hash(config_key(config))),
+                           '.dump' if dump else '')
+        ll = os.path.join(self.workdir, tag + '.ll')
+        exe = os.path.join(self.workdir, tag)
+        cmd = [self.args.cgeist, bench.path, '-O3', '-S', '-emit-llvm',
+               '-o', ll]
+        if self.args.function:
+            cmd.append('--function=' + self.args.function)
+        cmd += ['-I' + d for d in bench.include_dirs()]
+        cmd += self.defines(dataset, dump)
+        cmd += config_flags(config) + self.args.cgeist_flag
+        if self.run(cmd).returncode != 0:
+            return None
+        cmd = [self.args.cc, '-O3', '-fopenmp', ll, self.polybench_c, '-o',
+               exe, '-lm', '-I' + os.path.join(self.args.polybench,
+                                               'utilities')]
+        cmd += self.defines(dataset, dump)
+        if self.run(cmd).returncode != 0:
+            return None
+        return exe
+
+    def measure(self, bench, config, reference):
+        if reference is not None:
+            exe = self.build(bench, config, self.args.verify_dataset,
+                             dump=True)
+            if exe is None:
+                return None
+            result = self.run([exe])
+            if result.returncode != 0 or result.stderr != reference:
+                self.log('  output mismatch')
+                return None
+        exe = self.build(bench, config, self.args.dataset, dump=False)
+        if exe is None:
+            return None
+        times = []
+        for _ in range(self.args.runs):
+            result = self.run([exe])
+            if result.returncode != 0:
+                return None
+            try:
+                times.append(float(result.stdout.split()[0]))
+            except (IndexError, ValueError):
+                return None
+        return statistics.median(times)
+
+    def candidates(self, bench):
+        space = search_space(bench.cuda)
+        knobs = list(space)
+        if self.args.strategy == 'exhaustive':
+            for values in itertools.product(*(space[k] for k in knobs)):
+                yield dict(zip(knobs, values))
+        elif self.args.strategy == 'random':
+            rng = random.Random(self.args.seed)
+            yield default_config(bench.cuda)
+            while True:
+                yield {k: rng.choice(space[k]) for k in knobs}
+
+    def tune_greedy(self, bench, evaluate):
+        # Coordinate descent: change one knob at a time, keep improvements,
+        # and sweep again until a full pass brings nothing.
+        space = search_space(bench.cuda)
+        best = default_config(bench.cuda)
+        best_time = evaluate(best)
+        improved = True
+        while improved:
+            improved = False
+            for knob, values in space.items():
+                for value in values:
+                    if value == best[knob]:
+                        continue
+                    candidate = dict(best)
+                    candidate[knob] = value
+                    time = evaluate(candidate)
+                    if time is not None and (best_time is None or
+                                             time < best_time):
+                        best, best_time = candidate, time
+                        improved = True
+        return best, best_time
+
+    def tune(self, bench):
+        print('tuning %s' % bench.name, file=sys.stderr)
+        reference = None
+        if self.args.verify:
+            reference = self.build_reference(bench)
+            if reference is None:
+                print('  could not build reference, skipping verification',
+                      file=sys.stderr)
+
+        seen = {}
+
+        def evaluate(config):
+            key = config_key(config)
+            if key in seen:
+                return seen[key]
+            if len(seen) >= self.args.max_configs or not is_meaningful(
+                    config):
+                return None
+            time = self.measure(bench, config, reference)
+            seen[key] = time
+            print('  %-10s %s' % ('fail' if time is None else '%.6f' % time,
+                                  ' '.join(config_flags(config))),
+                  file=sys.stderr)
+            return time
+
+        if self.args.strategy == 'greedy':
+            best, best_time = self.tune_greedy(bench, evaluate)
+        else:
+            best, best_time = None, None
+            for config in self.candidates(bench):
+                if len(seen) >= self.args.max_configs:
+                    break
+                time = evaluate(config)
+                if time is not None and (best_time is None or
+                                         time < best_time):
+                    best, best_time = config, time
+        if best_time is None:
+            print('  no working configuration', file=sys.stderr)
+            return None
+
+        # Only record the knobs that differ from the defaults so the database
+        # keeps following cgeist's defaults for everything else.
+        defaults = default_config(bench.cuda)
+        entry = {
+            'source': os.path.basename(bench.path),
+            'time': best_time,
+            'options': {k: v for k, v in best.items() if defaults[k] != v},
+        }
+        if bench.cuda:
+            entry['options']['cpuify'] = best['cpuify']
+        if self.args.function:
+            entry['function'] = self.args.function
+        print('  best %.6f %s' % (best_time,
+                                  ' '.join(config_flags(entry['options']))),
+              file=sys.stderr)
+        return entry
+
+
+def find_benchmarks(args):
+    listing = os.path.join(args.polybench, 'utilities', 'benchmark_list')
+    with open(listing) as f:
+        known = [os.path.join(args.polybench, line.strip())
+                 for line in f if line.strip()]
+    if not args.benchmarks:
+        return known
+    found = []
+    for name in args.benchmarks:
+        if os.path.isfile(name):
+            found.append(name)
+            continue
+        matches = [p for p in known
+                   if os.path.splitext(os.path.basename(p))[0] == name]
+        if not matches:
+            sys.exit('error: unknown benchmark %s' % name)
+        found += matches
+    return found
+
+
+def merge_into_db(path, entries):
+    db = {'version': 1, 'entries': []}
+    if os.path.exists(path):
+        with open(path) as f:
+            db = json.load(f)
+    keys = {(e['source'], e.get('function')) for e in entries}
+    db['entries'] = [e for e in db.get('entries', [])
+                     if (e.get('source'), e.get('function')) not in keys]
+    db['entries'] += entries
+    with open(path, 'w') as f:
+        json.dump(db, f, indent=2, sort_keys=True)
+        f.write('\n')
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cgeist', default=shutil.which('cgeist') or 'cgeist',
+                        help='cgeist binary to tune')
+    parser.add_argument('--cc', default='clang',
+                        help='C compiler for the harness and reference build')
+    parser.add_argument('--polybench',
+                        default=os.path.join(here, '..', 'cgeist', 'Test',
+                                             'polybench'),
+                        help='PolyBench/C root directory')
+    parser.add_argument('--benchmarks', nargs='*', default=[],
+                        help='benchmark names or source files (default: all)')
+    parser.add_argument('--function', default='',
+                        help='tune and record for this cgeist -function')
+    parser.add_argument('--db', required=True,
+                        help='tuning database to create or update')
+    parser.add_argument('--strategy', default='greedy',
+                        choices=['greedy', 'random', 'exhaustive'])
+    parser.add_argument('--max-configs', type=int, default=64,
+                        help='configurations to try per benchmark')
+    parser.add_argument('--runs', type=int, default=5,
+                        help='timed runs per configuration (median is kept)')
+    parser.add_argument('--dataset', default='LARGE_DATASET')
+    parser.add_argument('--verify-dataset', default='MINI_DATASET')
+    parser.add_argument('--no-verify', dest='verify', action='store_false',
+                        help='do not compare outputs against a reference')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--timeout', type=int, default=600)
+    parser.add_argument('--cgeist-flag', action='append', default=[],
+                        help='extra flag passed to every cgeist invocation')
+    parser.add_argument('--keep', action='store_true',
+                        help='keep the build directory')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+    args.polybench = os.path.abspath(args.polybench)
+
+    tuner = Tuner(args)
+    try:
+        entries = []
+        for path in find_benchmarks(args):
+            entry = tuner.tune(Benchmark(path, args.polybench))
+            if entry is not None:
+                entries.append(entry)
+                # Save as we go so an interrupted run keeps its results.
+                merge_into_db(args.db, [entry])
+    finally:
+        if not args.keep:
+            shutil.rmtree(tuner.workdir, ignore_errors=True)
+    return 0 if entries else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())